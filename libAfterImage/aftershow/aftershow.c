@@ -619,6 +619,8 @@ HandleOutput (AfterShowContext *ctx, int channel)
  
  If encompasing <window> tag is missing - default client's window is assumed.
  If encompasing <layer> tag is missing - first layer of the window is assumed.
+
+ Top level <shm> and <compose> tags are handled separately - see shmutil.c.
  
 
 */
@@ -654,7 +656,7 @@ HandleXML (AfterShowContext *ctx, int channel)
 		xml_elem_t *container, *tag;
 		xml_elem_t *result = NULL;
 
-		container = tag = client->xml_output_head;
+		container = tag = client->xml_input_head;
 		/* remove tag from the input queue */
 
 		client->xml_input_head = tag->next;
@@ -671,7 +673,11 @@ HandleXML (AfterShowContext *ctx, int channel)
 			memset( &tag_ctx, 0x00, sizeof(tag_ctx));
 			tag_ctx.client = client;
 			
-			if (tag->tag_id != AfterShow_window_ID)
+			if (tag->tag_id == AfterShow_shm_ID)
+				result = aftershow_handle_shm_tag (ctx, client, tag);
+			else if (tag->tag_id == AfterShow_compose_ID)
+				result = aftershow_handle_compose_tag (ctx, client, tag);
+			else if (tag->tag_id != AfterShow_window_ID)
 				result = HandleWindowTag( ctx, &tag_ctx, NULL, tag);
 			else
 				result = HandleWindowTag( ctx, &tag_ctx, tag, tag->child);
@@ -794,6 +800,8 @@ ShutdownClient (AfterShowContext *ctx, int channel)
 		free_xml_buffer_resources (client->xml_output_buf);
 		free (client->xml_output_buf);
 	}
+
+	aftershow_free_client_cache (client);
 	
 	memset( client, 0x00, sizeof(AfterShowClient));		
 }
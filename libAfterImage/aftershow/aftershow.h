@@ -124,8 +124,11 @@ typedef struct AfterShowClient
 	AfterShowMagicPtr 	 default_gui;		/* could be either x or win32 */
 	int 				 default_screen;
 	AfterShowMagicPtr 	 default_window;	/* could be either x or win32 */
-	ASImageManager 		 imman;				/* if NULL - use the shared one */
-	ASFontManager 		 fontman;			/* if NULL - use the shared one */
+	ASImageManager 		*imman;				/* if NULL - use the shared one */
+	ASFontManager 		*fontman;			/* if NULL - use the shared one */
+
+	ASHashTable			*shm_segments;		/* attached SysV shm segments by shmid */
+	ASHashTable			*compositions;		/* cached parsed <compose> tags by id */
 }AfterShowClient;
 
 typedef struct AfterShowContext
@@ -197,6 +200,10 @@ typedef enum
 	AfterShow_screen_ID,	
 	AfterShow_window_ID,
 	AfterShow_geometry_ID,	
+	AfterShow_shm_ID,
+	AfterShow_shmid_ID,
+	AfterShow_op_ID,
+	AfterShow_compose_ID,
 	AfterShow_SUPPORTED_IDS
 
 }SupportedAfterShowXMLTagIDs;
@@ -204,6 +211,13 @@ typedef enum
 void aftershow_add_tags_to_queue( xml_elem_t* tags, xml_elem_t **phead, xml_elem_t **ptail);
 void aftershow_init_vocabulary (Bool free_resources);
 xml_elem_t *aftershow_parse_xml_doc (const char *doc);
+xml_elem_t *aftershow_parse_xml_parm (const char *parm);
+
+/***** from shmutil.c */
+
+xml_elem_t *aftershow_handle_shm_tag (AfterShowContext *ctx, AfterShowClient *client, xml_elem_t *tag);
+xml_elem_t *aftershow_handle_compose_tag (AfterShowContext *ctx, AfterShowClient *client, xml_elem_t *tag);
+void aftershow_free_client_cache (AfterShowClient *client);
 
 
 #endif /* AFTERSHOW_H_INCLUDED */
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2008 Sasha Vasko <sasha at aftercode.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*********************************************************************************
+ * Shared memory image transport and per-client composition cache :
+ *
+ * <shm op="put" id="image_id" shmid="segment" width="w" height="h"/>
+ * 		imports w*h ARGB32 pixels from the segment into the client's image
+ * 		manager under the name image_id;
+ * <shm op="get" id="image_id" shmid="segment"/>
+ * 		exports named image into the segment as ARGB32 pixels;
+ * <shm op="release" shmid="segment"/>
+ * 		detaches from the segment. Segments are otherwise attached once and
+ * 		kept attached until the client disconnects;
+ * <compose id="comp_id" [width="w"] [height="h"] [shmid="segment"]>
+ * 		composition tags
+ * </compose>
+ * 		stores composition tags in the client's cache and renders them;
+ * <compose id="comp_id" [width="w"] [height="h"] [shmid="segment"]/>
+ * 		renders previously cached composition without reparsing it.
+ *
+ * Rendered result is stored in the client's image manager under comp_id,
+ * so it could be fetched with <shm op="get"> or recalled by other
+ * compositions. If shmid is given - result is written straight into the
+ * segment as well.
+ * Only segments owned by the user running the daemon are accepted.
+ *********************************************************************************/
+
+#ifdef _WIN32
+#include "../win32/config.h"
+#else
+#include "../config.h"
+#endif
+
+#undef LOCAL_DEBUG
+
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDARG_H
+#include <stdarg.h>
+#endif
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "../afterbase.h"
+#include "../afterimage.h"
+#include "aftershow.h"
+
+typedef struct AfterShowShmSegment
+{
+	int 	 shmid;
+	void 	*addr;
+	size_t 	 size;
+}AfterShowShmSegment;
+
+typedef struct AfterShowComposition
+{
+	xml_elem_t 	*doc;		/* <compose> tag holding composition as its children */
+	int 		 renders;
+}AfterShowComposition;
+
+static void
+destroy_shm_segment (ASHashableValue value, void *data)
+{
+	AfterShowShmSegment *seg = (AfterShowShmSegment*)data;
+	if (seg)
+	{
+		LOCAL_DEBUG_OUT ("detaching shm segment %d at %p", seg->shmid, seg->addr);
+		shmdt (seg->addr);
+		free (seg);
+	}
+}
+
+static void
+destroy_composition (ASHashableValue value, void *data)
+{
+	AfterShowComposition *comp = (AfterShowComposition*)data;
+	free ((char*)value);
+	if (comp)
+	{
+		if (comp->doc)
+			xml_elem_delete (NULL, comp->doc);
+		free (comp);
+	}
+}
+
+static xml_elem_t *
+make_reply (const char *tag, const char *text, const char *parm_format, ...)
+{
+	xml_elem_t *reply = safecalloc (1, sizeof(xml_elem_t));
+	reply->tag = mystrdup (tag);
+	reply->tag_id = XML_UNKNOWN_ID;
+	if (parm_format)
+	{
+		va_list ap;
+		reply->parm = safemalloc (256);
+		va_start (ap, parm_format);
+		vsnprintf (reply->parm, 256, parm_format, ap);
+		va_end (ap);
+	}
+	if (text)
+	{
+		reply->child = safecalloc (1, sizeof(xml_elem_t));
+		reply->child->tag = mystrdup (XML_CDATA_STR);
+		reply->child->tag_id = XML_CDATA_ID;
+		reply->child->parm = mystrdup (text);
+	}
+	return reply;
+}
+
+static ASVisual *
+get_client_asvisual (AfterShowContext *ctx, AfterShowClient *client)
+{
+#ifndef X_DISPLAY_MISSING
+	if (ctx->gui.x.valid && client->default_screen < ctx->gui.x.screens_num
+		&& ctx->gui.x.screens[client->default_screen].asv)
+		return ctx->gui.x.screens[client->default_screen].asv;
+#endif
+	return get_default_asvisual ();
+}
+
+static ASImageManager *
+get_client_imman (AfterShowClient *client)
+{
+	if (client->imman == NULL)
+		client->imman = create_generic_imageman (NULL);
+	return client->imman;
+}
+
+/* stores image under the name, replacing whatever was stored there before */
+static void
+store_client_image (AfterShowClient *client, ASImage *im, const char *name)
+{
+	ASImageManager *imman = get_client_imman (client);
+	ASImage *old = query_asimage (imman, name);
+
+	if (old != NULL)
+	{
+		forget_asimage (old);
+		destroy_asimage (&old);
+	}
+	if (!store_asimage (imman, im, name))
+		destroy_asimage (&im);
+}
+
+static AfterShowShmSegment *
+get_client_segment (AfterShowClient *client, int shmid, size_t size_needed, const char **error)
+{
+	ASHashData hdata = {0};
+	AfterShowShmSegment *seg = NULL;
+	struct shmid_ds ds;
+
+	if (client->shm_segments == NULL)
+		client->shm_segments = create_ashash (7, NULL, NULL, destroy_shm_segment);
+	else if (get_hash_item (client->shm_segments, AS_HASHABLE(shmid), &hdata.vptr) == ASH_Success)
+		seg = hdata.vptr;
+
+	if (seg == NULL)
+	{
+		void *addr;
+		if (shmid < 0 || shmctl (shmid, IPC_STAT, &ds) != 0)
+		{
+			*error = "invalid shared memory segment";
+			return NULL;
+		}
+		if (ds.shm_perm.uid != geteuid ())
+		{
+			*error = "shared memory segment is not owned by this user";
+			return NULL;
+		}
+		if ((addr = shmat (shmid, NULL, 0)) == (void*)-1)
+		{
+			*error = "failed to attach shared memory segment";
+			return NULL;
+		}
+		seg = safecalloc (1, sizeof(AfterShowShmSegment));
+		seg->shmid = shmid;
+		seg->addr = addr;
+		seg->size = ds.shm_segsz;
+		add_hash_item (client->shm_segments, AS_HASHABLE(shmid), seg);
+		LOCAL_DEBUG_OUT ("attached shm segment %d of %ld bytes at %p", shmid, (long)seg->size, addr);
+	}
+
+	if (seg->size < size_needed)
+	{
+		*error = "shared memory segment is too small";
+		return NULL;
+	}
+	return seg;
+}
+
+/* writes image as ARGB32 pixels into the segment */
+static xml_elem_t *
+export_image_to_shm (AfterShowContext *ctx, AfterShowClient *client, ASImage *im, const char *id, int shmid)
+{
+	size_t size = (size_t)im->width * im->height * sizeof(ARGB32);
+	const char *error = NULL;
+	AfterShowShmSegment *seg = get_client_segment (client, shmid, size, &error);
+	ARGB32 *dst;
+
+	if (seg == NULL)
+		return make_reply ("error", error, "id=\"%s\" shmid=%d size=%lu", id, shmid, (unsigned long)size);
+
+	dst = (ARGB32*)seg->addr;
+	if (get_flags (im->flags, ASIM_PACKED_ARGB32))
+		memcpy (dst, im->alt.argb32, size);
+	else
+	{
+		ASImageDecoder *imdec = start_image_decoding (get_client_asvisual (ctx, client), im, SCL_DO_ALL,
+													  0, 0, im->width, 0, NULL);
+		int x, y;
+		if (imdec == NULL)
+			return make_reply ("error", "failed to decode image", "id=\"%s\"", id);
+		for (y = 0; y < (int)im->height; ++y)
+		{
+			ASScanline *buf = &(imdec->buffer);
+			imdec->decode_image_scanline (imdec);
+			for (x = 0; x < (int)im->width; ++x)
+				dst[x] = MAKE_ARGB32(buf->alpha[x], buf->red[x], buf->green[x], buf->blue[x]);
+			dst += im->width;
+		}
+		stop_image_decoding (&imdec);
+	}
+	return NULL;
+}
+
+xml_elem_t *
+aftershow_handle_shm_tag (AfterShowContext *ctx, AfterShowClient *client, xml_elem_t *tag)
+{
+	xml_elem_t *parm = aftershow_parse_xml_parm (tag->parm);
+	xml_elem_t *ptr, *result = NULL;
+	const char *op = NULL, *id = NULL;
+	int shmid = -1, width = 0, height = 0;
+
+	for (ptr = parm; ptr; ptr = ptr->next)
+		switch (ptr->tag_id)
+		{
+			case AfterShow_op_ID : 		op = ptr->parm; break;
+			case AfterShow_id_ID : 		id = ptr->parm; break;
+			case AfterShow_shmid_ID : 	shmid = atoi (ptr->parm); break;
+			case AfterShow_width_ID : 	width = atoi (ptr->parm); break;
+			case AfterShow_height_ID : 	height = atoi (ptr->parm); break;
+		}
+
+	if (op == NULL)
+		result = make_reply ("error", "shm op is not specified", NULL);
+	else if (mystrcasecmp (op, "release") == 0)
+	{
+		if (client->shm_segments == NULL
+			|| remove_hash_item (client->shm_segments, AS_HASHABLE(shmid), NULL, True) != ASH_Success)
+			result = make_reply ("error", "shared memory segment is not attached", "shmid=%d", shmid);
+		else
+			result = make_reply ("success", NULL, "op=\"release\" shmid=%d", shmid);
+	}else if (id == NULL)
+		result = make_reply ("error", "image id is not specified", NULL);
+	else if (mystrcasecmp (op, "put") == 0)
+	{
+		size_t size = (size_t)width * height * sizeof(ARGB32);
+		const char *error = "invalid image size";
+		AfterShowShmSegment *seg = NULL;
+
+		if (width <= 0 || height <= 0 || width > MAX_IMPORT_IMAGE_SIZE || height > MAX_IMPORT_IMAGE_SIZE
+			|| (seg = get_client_segment (client, shmid, size, &error)) == NULL)
+			result = make_reply ("error", error, "id=\"%s\" shmid=%d size=%lu", id, shmid, (unsigned long)size);
+		else
+		{
+			ASImage *im = create_packed_asimage (width, height);
+			memcpy (im->alt.argb32, seg->addr, size);
+			store_client_image (client, im, id);
+			result = make_reply ("success", NULL, "op=\"put\" id=\"%s\" width=%d height=%d", id, width, height);
+		}
+	}else if (mystrcasecmp (op, "get") == 0)
+	{
+		ASImage *im = client->imman ? query_asimage (client->imman, id) : NULL;
+		if (im == NULL && ctx->imman)
+			im = query_asimage (ctx->imman, id);
+		if (im == NULL)
+			result = make_reply ("error", "no image with such id", "id=\"%s\"", id);
+		else if ((result = export_image_to_shm (ctx, client, im, id, shmid)) == NULL)
+			result = make_reply ("success", NULL, "op=\"get\" id=\"%s\" width=%d height=%d size=%lu",
+								 id, im->width, im->height, (unsigned long)im->width * im->height * sizeof(ARGB32));
+	}else
+		result = make_reply ("error", "unknown shm op", "op=\"%s\"", op);
+
+	xml_elem_delete (NULL, parm);
+	return result;
+}
+
+xml_elem_t *
+aftershow_handle_compose_tag (AfterShowContext *ctx, AfterShowClient *client, xml_elem_t *tag)
+{
+	xml_elem_t *parm = aftershow_parse_xml_parm (tag->parm);
+	xml_elem_t *ptr, *result = NULL;
+	const char *id = NULL;
+	int shmid = -1, width = 0, height = 0;
+	AfterShowComposition *comp = NULL;
+	Bool cached = False;
+
+	for (ptr = parm; ptr; ptr = ptr->next)
+		switch (ptr->tag_id)
+		{
+			case AfterShow_id_ID : 		id = ptr->parm; break;
+			case AfterShow_shmid_ID : 	shmid = atoi (ptr->parm); break;
+			case AfterShow_width_ID : 	width = atoi (ptr->parm); break;
+			case AfterShow_height_ID : 	height = atoi (ptr->parm); break;
+		}
+
+	if (id == NULL)
+		result = make_reply ("error", "composition id is not specified", NULL);
+	else
+	{
+		ASHashData hdata = {0};
+
+		if (client->compositions == NULL)
+			client->compositions = create_ashash (7, string_hash_value, string_compare, destroy_composition);
+
+		if (tag->child)
+		{/* new or updated composition - take over the parsed tags */
+			remove_hash_item (client->compositions, AS_HASHABLE((char*)id), NULL, True);
+			comp = safecalloc (1, sizeof(AfterShowComposition));
+			comp->doc = safecalloc (1, sizeof(xml_elem_t));
+			comp->doc->tag = mystrdup (tag->tag);
+			comp->doc->tag_id = tag->tag_id;
+			comp->doc->child = tag->child;
+			tag->child = NULL;
+			add_hash_item (client->compositions, AS_HASHABLE(mystrdup(id)), comp);
+		}else if (get_hash_item (client->compositions, AS_HASHABLE((char*)id), &hdata.vptr) == ASH_Success)
+		{
+			comp = hdata.vptr;
+			cached = True;
+		}
+
+		if (comp == NULL)
+			result = make_reply ("error", "no cached composition with such id", "id=\"%s\"", id);
+		else
+		{
+			ASImage *im = compose_asimage_xml_from_doc (get_client_asvisual (ctx, client),
+														get_client_imman (client), ctx->fontman,
+														comp->doc, 0, 0, None, NULL, width, height);
+			if (im && im->imageman != NULL)
+			{/* composition returned some stored image as is */
+				ASImage *tmp = clone_asimage (im, SCL_DO_ALL);
+				safe_asimage_destroy (im);
+				im = tmp;
+			}
+			if (im == NULL)
+				result = make_reply ("error", "failed to render composition", "id=\"%s\"", id);
+			else
+			{
+				int im_width = im->width, im_height = im->height;
+				++(comp->renders);
+				store_client_image (client, im, id);
+				if (shmid >= 0 && (im = query_asimage (client->imman, id)) != NULL)
+					result = export_image_to_shm (ctx, client, im, id, shmid);
+				if (result == NULL)
+					result = make_reply ("success", NULL, "id=\"%s\" width=%d height=%d cached=%d renders=%d",
+										 id, im_width, im_height, cached?1:0, comp->renders);
+			}
+		}
+	}
+
+	xml_elem_delete (NULL, parm);
+	return result;
+}
+
+void
+aftershow_free_client_cache (AfterShowClient *client)
+{
+	if (client->compositions)
+		destroy_ashash (&(client->compositions));
+	if (client->shm_segments)
+		destroy_ashash (&(client->shm_segments));
+	if (client->imman)
+	{
+		destroy_image_manager (client->imman, False);
+		client->imman = NULL;
+	}
+}
+
+/*********************************************************************************
+ * The end !!!!
+ ********************************************************************************/
@@ -59,6 +59,10 @@ aftershow_init_vocabulary (Bool free_resources)
 		REGISTER_AFTERSHOW_TAG(screen);
 		REGISTER_AFTERSHOW_TAG(window);
 		REGISTER_AFTERSHOW_TAG(geometry);
+		REGISTER_AFTERSHOW_TAG(shm);
+		REGISTER_AFTERSHOW_TAG(shmid);
+		REGISTER_AFTERSHOW_TAG(op);
+		REGISTER_AFTERSHOW_TAG(compose);
 #undef REGISTER_AFTERSHOW_TAG
 	}
 }
@@ -71,6 +75,14 @@ aftershow_parse_xml_doc (const char *doc)
 	return xml_parse_doc (doc, AfterShowVocabulary);
 }
 
+xml_elem_t *
+aftershow_parse_xml_parm (const char *parm)
+{
+	if (AfterShowVocabulary == NULL)
+		aftershow_init_vocabulary (False);		
+	return xml_parse_parm (parm, AfterShowVocabulary);
+}
+
 
 void 
 aftershow_add_tags_to_queue( xml_elem_t* tags, xml_elem_t **phead, xml_elem_t **ptail)
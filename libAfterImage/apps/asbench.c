@@ -0,0 +1,493 @@
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+#include <sys/resource.h>
+
+/****h* libAfterImage/tutorials/ASBench
+ * NAME
+ * ASBench
+ * SYNOPSIS
+ * libAfterImage microbenchmark suite.
+ * DESCRIPTION
+ * Times hot library operations on fixed synthetic input, and on
+ * rose512.jpg and test.ttf when those can be found in the data
+ * directory. Each operation is repeated until it has run for at least
+ * the requested time, and results are written out as JSON, one record
+ * per operation, with throughput in megapixels per second, number of
+ * scanline buffers, decoders and outputs allocated per run (see
+ * get_image_codec_pool_stats()) and peak resident set size so far.
+ * Results of runs with MMX enabled and disabled, or of different
+ * releases, can then be compared by a script.
+ *
+ * Operations covered: merge_layers() with every standard merging
+ * function, scale_asimage(), tile_asimage(), blur_asimage_gauss(),
+ * make_gradient(), store_data()/fetch_data32(), export and import of
+ * every file format compiled in, draw_text() and, when X display is
+ * available, asimage2ximage().
+ * SOURCE
+ */
+
+#include "../afterbase.h"
+#include "../afterimage.h"
+#include "../asstorage.h"
+
+#define BENCH_WIDTH		512
+#define BENCH_HEIGHT	512
+
+typedef struct ASBenchContext
+{
+	ASVisual *asv ;
+	ASImage  *synthetic ;	/* opaque gradient */
+	ASImage  *overlay ;		/* same with alpha varying across the image */
+	ASImage  *photo ;		/* real input, or synthetic when unavailable */
+	struct ASFont *font ;
+	const char *tmp_dir ;
+	ASStorageID *stored ;
+	int stored_count ;
+}ASBenchContext;
+
+/* each benchmark returns number of pixels processed, or 0 if it could
+ * not be run in this configuration : */
+typedef unsigned long (*as_bench_func)( ASBenchContext *ctx, const char *arg );
+
+typedef struct ASBenchmark
+{
+	const char    *name ;
+	const char    *arg ;
+	as_bench_func  func ;
+}ASBenchmark;
+
+static const char *merge_names[] =
+{ "add", "alphablend", "allanon", "colorize", "darken", "diff", "dissipate",
+  "hue", "lighten", "overlay", "saturate", "screen", "sub", "tint", "value",
+  NULL };
+
+static const struct { const char *ext; ASImageFileTypes type; } bench_formats[] =
+{ { "xpm", ASIT_Xpm }, { "png", ASIT_Png }, { "jpg", ASIT_Jpeg },
+  { "ppm", ASIT_Ppm }, { "bmp", ASIT_Bmp }, { "gif", ASIT_Gif },
+  { "tiff", ASIT_Tiff }, { NULL, ASIT_Unknown } };
+
+static double
+bench_now()
+{
+	struct timeval tv ;
+	gettimeofday( &tv, NULL );
+	return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0 ;
+}
+
+static long
+bench_peak_rss_kb()
+{
+	struct rusage ru ;
+	if( getrusage( RUSAGE_SELF, &ru ) != 0 )
+		return -1;
+	return ru.ru_maxrss ;
+}
+
+static unsigned long
+bench_codec_allocs()
+{
+	ASImCodecPoolStats stats ;
+	get_image_codec_pool_stats( &stats );
+	return stats.scanlines.misses+stats.decoders_allocated+stats.outputs_allocated ;
+}
+
+static ASImage *
+bench_gradient( ASVisual *asv, int width, int height, Bool with_alpha )
+{
+	static ARGB32 colors[3] = { 0xFFFF0000, 0xFF00FF00, 0xFF0000FF };
+	static ARGB32 alpha_colors[3] = { 0x20FF0000, 0xFF00FF00, 0x800000FF };
+	static double offsets[3] = { 0.0, 0.5, 1.0 };
+	ASGradient grad ;
+
+	grad.type = GRADIENT_TopLeft2BottomRight ;
+	grad.npoints = 3 ;
+	grad.color = with_alpha?alpha_colors:colors ;
+	grad.offset = offsets ;
+	return make_gradient( asv, &grad, width, height, SCL_DO_ALL, ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT );
+}
+
+static char *
+bench_tmp_file( ASBenchContext *ctx, const char *ext )
+{
+	char *path = safemalloc( strlen(ctx->tmp_dir)+1+8+strlen(ext)+1 );
+	sprintf( path, "%s/asbench.%s", ctx->tmp_dir, ext );
+	return path;
+}
+
+/* individual benchmarks : ***********************************************/
+static unsigned long
+bench_merge( ASBenchContext *ctx, const char *arg )
+{
+	ASImageLayer layers[2] ;
+	ASImage *res ;
+
+	init_image_layers( &layers[0], 2 );
+	layers[0].im = ctx->synthetic ;
+	layers[0].clip_width = BENCH_WIDTH ;
+	layers[0].clip_height = BENCH_HEIGHT ;
+	layers[1].im = ctx->overlay ;
+	layers[1].clip_width = BENCH_WIDTH ;
+	layers[1].clip_height = BENCH_HEIGHT ;
+	layers[1].merge_scanlines = blend_scanlines_name2func( arg );
+	if( layers[1].merge_scanlines == NULL )
+		return 0;
+	res = merge_layers( ctx->asv, &layers[0], 2, BENCH_WIDTH, BENCH_HEIGHT,
+						ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT );
+	if( res == NULL )
+		return 0;
+	destroy_asimage( &res );
+	return BENCH_WIDTH*BENCH_HEIGHT;
+}
+
+static unsigned long
+bench_scale( ASBenchContext *ctx, const char *arg )
+{
+	int width = 0, height = 0 ;
+	ASImage *res ;
+	if( sscanf( arg, "%dx%d", &width, &height ) != 2 )
+		return 0;
+	res = scale_asimage( ctx->asv, ctx->photo, width, height, ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT );
+	if( res == NULL )
+		return 0;
+	destroy_asimage( &res );
+	return width*height;
+}
+
+static unsigned long
+bench_tile( ASBenchContext *ctx, const char *arg )
+{
+	ASImage *res = tile_asimage( ctx->asv, ctx->photo, 100, 100, 800, 600, 0x7F7F9F7F,
+								 ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT );
+	if( res == NULL )
+		return 0;
+	destroy_asimage( &res );
+	return 800*600;
+}
+
+static unsigned long
+bench_blur( ASBenchContext *ctx, const char *arg )
+{
+	double radius = atof( arg );
+	ASImage *res = blur_asimage_gauss( ctx->asv, ctx->photo, radius, radius, SCL_DO_ALL,
+									   ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT );
+	if( res == NULL )
+		return 0;
+	destroy_asimage( &res );
+	return ctx->photo->width*ctx->photo->height;
+}
+
+static unsigned long
+bench_gradient_make( ASBenchContext *ctx, const char *arg )
+{
+	ASImage *res = bench_gradient( ctx->asv, 640, 480, (arg[0] == 'a') );
+	if( res == NULL )
+		return 0;
+	destroy_asimage( &res );
+	/* otherwise we would be timing the cache : */
+	flush_gradient_cache();
+	return 640*480;
+}
+
+static unsigned long
+bench_store( ASBenchContext *ctx, const char *arg )
+{
+	ASScanline buf ;
+	int y ;
+	prepare_scanline( ctx->photo->width, 0, &buf, False );
+	for( y = 0 ; y < (int)ctx->photo->height ; ++y )
+	{
+		ASStorageID id ;
+		asimage_decode_line( ctx->photo, IC_GREEN, buf.green, y, 0, buf.width );
+		id = store_data( NULL, (CARD8*)buf.green, buf.width*sizeof(CARD32), ASStorage_32BitRLE, 0 );
+		if( id )
+			forget_data( NULL, id );
+	}
+	free_scanline( &buf, True );
+	return ctx->photo->width*ctx->photo->height;
+}
+
+static unsigned long
+bench_fetch( ASBenchContext *ctx, const char *arg )
+{
+	CARD32 *buf = safemalloc( ctx->photo->width*sizeof(CARD32) );
+	int y ;
+	for( y = 0 ; y < ctx->stored_count ; ++y )
+		fetch_data32( NULL, ctx->stored[y], buf, 0, ctx->photo->width, 0, NULL );
+	free( buf );
+	return ctx->photo->width*ctx->stored_count;
+}
+
+static unsigned long
+bench_export( ASBenchContext *ctx, const char *arg )
+{
+	char *path = bench_tmp_file( ctx, arg );
+	unsigned long res = 0 ;
+	int i ;
+	for( i = 0 ; bench_formats[i].ext ; ++i )
+		if( strcmp( bench_formats[i].ext, arg ) == 0 )
+		{
+			unlink( path );			/* some writers append */
+			if( ASImage2file( ctx->photo, NULL, path, bench_formats[i].type, NULL ) )
+				res = ctx->photo->width*ctx->photo->height ;
+			break;
+		}
+	free( path );
+	return res;
+}
+
+static unsigned long
+bench_import( ASBenchContext *ctx, const char *arg )
+{
+	char *path = bench_tmp_file( ctx, arg );
+	unsigned long res = 0 ;
+	ASImage *im = file2ASImage( path, 0xFFFFFFFF, SCREEN_GAMMA, 0, NULL );
+	if( im )
+	{
+		res = im->width*im->height ;
+		destroy_asimage( &im );
+	}
+	free( path );
+	return res;
+}
+
+static unsigned long
+bench_text( ASBenchContext *ctx, const char *arg )
+{
+	ASImage *res ;
+	unsigned long pixels ;
+	if( ctx->font == NULL )
+		return 0;
+	res = draw_text( arg, ctx->font, AST_Plain, 0 );
+	if( res == NULL )
+		return 0;
+	pixels = res->width*res->height ;
+	destroy_asimage( &res );
+	return pixels;
+}
+
+static unsigned long
+bench_ximage( ASBenchContext *ctx, const char *arg )
+{
+#ifndef X_DISPLAY_MISSING
+	XImage *xim ;
+	if( ctx->asv->dpy == NULL )
+		return 0;
+	xim = asimage2ximage( ctx->asv, ctx->photo );
+	if( xim == NULL )
+		return 0;
+	XDestroyImage( xim );
+	ctx->photo->alt.ximage = NULL ;
+	return ctx->photo->width*ctx->photo->height;
+#else
+	return 0;
+#endif
+}
+
+/*************************************************************************/
+static void
+run_benchmark( ASBenchContext *ctx, const char *name, const char *arg,
+			   as_bench_func func, double min_time, FILE *out, Bool *first )
+{
+	unsigned long pixels, total_pixels = 0, iterations = 0 ;
+	unsigned long allocs ;
+	double started, elapsed ;
+
+	/* warm up caches and pools, and see if it can run at all : */
+	if( (pixels = func( ctx, arg )) == 0 )
+	{
+		show_warning( "benchmark %s(%s) is not available - skipped.", name, arg );
+		return;
+	}
+	allocs = bench_codec_allocs();
+	started = bench_now();
+	do
+	{
+		total_pixels += func( ctx, arg );
+		++iterations ;
+		elapsed = bench_now() - started ;
+	}while( elapsed < min_time );
+	allocs = bench_codec_allocs() - allocs ;
+
+	fprintf( out, "%s    {\"name\": \"%s\", \"arg\": \"%s\", \"iterations\": %lu, "
+				  "\"seconds\": %.6f, \"mpix_per_sec\": %.3f, "
+				  "\"codec_allocs_per_run\": %.2f, \"peak_rss_kb\": %ld}",
+			 *first?"":",\n", name, arg, iterations, elapsed,
+			 (elapsed > 0)?(double)total_pixels/(elapsed*1000000.0):0.0,
+			 (double)allocs/(double)iterations, bench_peak_rss_kb() );
+	fflush( out );
+	*first = False ;
+}
+
+void usage()
+{
+	printf( "Usage: asbench [-h] [-t seconds] [-f filter] [-d data_dir] "
+			"[-T tmp_dir] [-m on|off] [-o file]\n");
+	printf( "Where: seconds  - minimum time to run each benchmark (default 0.5).\n");
+	printf( "       filter   - only run benchmarks whose name contains that string.\n");
+	printf( "       data_dir - where to look for rose512.jpg and test.ttf.\n");
+	printf( "       tmp_dir  - where to write files for export/import tests.\n");
+	printf( "       -m       - enable/disable MMX code, where compiled in.\n");
+	printf( "       file     - write JSON results there instead of stdout.\n");
+}
+
+int main(int argc, char* argv[])
+{
+	ASBenchContext ctx ;
+	Display *dpy = NULL;
+	int screen = 0, depth = 0;
+	double min_time = 0.5 ;
+	const char *filter = NULL ;
+	const char *data_dir = "." ;
+	const char *out_file = NULL ;
+	FILE *out = stdout ;
+	ASFontManager *fontman = NULL ;
+	Bool first = True ;
+	int i ;
+	static ASBenchmark benchmarks[] =
+	{
+		{ "scale_asimage", "800x600", bench_scale },
+		{ "scale_asimage", "200x150", bench_scale },
+		{ "tile_asimage", "800x600", bench_tile },
+		{ "blur_asimage_gauss", "5", bench_blur },
+		{ "blur_asimage_gauss", "20", bench_blur },
+		{ "make_gradient", "opaque", bench_gradient_make },
+		{ "make_gradient", "alpha", bench_gradient_make },
+		{ "store_data", "32BitRLE", bench_store },
+		{ "fetch_data32", "32BitRLE", bench_fetch },
+		{ "draw_text", "The quick brown fox jumps over the lazy dog", bench_text },
+		{ "asimage2ximage", "", bench_ximage },
+		{ NULL, NULL, NULL }
+	};
+
+	set_application_name( argv[0] );
+	memset( &ctx, 0x00, sizeof(ctx) );
+
+	for( i = 1 ; i < argc ; i++ )
+	{
+		if( strncmp( argv[i], "-h", 2 ) == 0 )
+		{
+			usage();
+			return 0;
+		}else if( argv[i][0] == '-' && i < argc-1 )
+		{
+			switch( argv[i][1] )
+			{
+				case 't' : min_time = atof( argv[i+1] ); break;
+				case 'f' : filter = argv[i+1]; break;
+				case 'd' : data_dir = argv[i+1]; break;
+				case 'T' : ctx.tmp_dir = argv[i+1]; break;
+				case 'o' : out_file = argv[i+1]; break;
+				case 'm' : asimage_use_mmx = (mystrcasecmp( argv[i+1], "on" ) == 0); break;
+			}
+			++i ;
+		}
+	}
+
+	if( ctx.tmp_dir == NULL )
+		ctx.tmp_dir = getenv( "TMPDIR" );
+	if( ctx.tmp_dir == NULL )
+		ctx.tmp_dir = "/tmp" ;
+
+#ifndef X_DISPLAY_MISSING
+	if( (dpy = XOpenDisplay(NULL)) != NULL )
+	{
+		screen = DefaultScreen(dpy);
+		depth = DefaultDepth( dpy, screen );
+	}
+#endif
+	ctx.asv = create_asvisual( dpy, screen, depth, NULL );
+
+	ctx.synthetic = bench_gradient( ctx.asv, BENCH_WIDTH, BENCH_HEIGHT, False );
+	ctx.overlay = bench_gradient( ctx.asv, BENCH_WIDTH, BENCH_HEIGHT, True );
+	flush_gradient_cache();
+	ctx.photo = file2ASImage( "rose512.jpg", 0xFFFFFFFF, SCREEN_GAMMA, 0, data_dir, NULL );
+	if( ctx.photo == NULL )
+	{
+		show_warning( "rose512.jpg not found in \"%s\" - using synthetic input instead.", data_dir );
+		ctx.photo = clone_asimage( ctx.synthetic, SCL_DO_ALL );
+	}
+	if( (fontman = create_font_manager( dpy, data_dir, NULL )) != NULL )
+		ctx.font = get_asfont( fontman, "test.ttf", 0, 24, ASF_Freetype );
+
+	ctx.stored_count = ctx.photo->height ;
+	ctx.stored = safecalloc( ctx.stored_count, sizeof(ASStorageID) );
+	{
+		ASScanline buf ;
+		prepare_scanline( ctx.photo->width, 0, &buf, False );
+		for( i = 0 ; i < ctx.stored_count ; ++i )
+		{
+			asimage_decode_line( ctx.photo, IC_GREEN, buf.green, i, 0, buf.width );
+			ctx.stored[i] = store_data( NULL, (CARD8*)buf.green, buf.width*sizeof(CARD32), ASStorage_32BitRLE, 0 );
+		}
+		free_scanline( &buf, True );
+	}
+
+	if( out_file && (out = fopen( out_file, "w" )) == NULL )
+	{
+		show_error( "unable to open \"%s\" for writing.", out_file );
+		return 1;
+	}
+	fprintf( out, "{\n  \"mmx\": %s,\n  \"min_time\": %.3f,\n  \"input\": \"%dx%d\",\n  \"results\": [\n",
+			 asimage_use_mmx?"true":"false", min_time, ctx.photo->width, ctx.photo->height );
+
+	for( i = 0 ; merge_names[i] ; ++i )
+		if( filter == NULL || strstr( "merge_layers", filter ) || strstr( merge_names[i], filter ) )
+			run_benchmark( &ctx, "merge_layers", merge_names[i], bench_merge, min_time, out, &first );
+	for( i = 0 ; benchmarks[i].name ; ++i )
+		if( filter == NULL || strstr( benchmarks[i].name, filter ) )
+			run_benchmark( &ctx, benchmarks[i].name, benchmarks[i].arg, benchmarks[i].func, min_time, out, &first );
+	/* exporters first, so that importers have something to read : */
+	for( i = 0 ; bench_formats[i].ext ; ++i )
+	{
+		if( filter == NULL || strstr( "export", filter ) || strstr( bench_formats[i].ext, filter ) )
+			run_benchmark( &ctx, "export", bench_formats[i].ext, bench_export, min_time, out, &first );
+		if( filter == NULL || strstr( "import", filter ) || strstr( bench_formats[i].ext, filter ) )
+			run_benchmark( &ctx, "import", bench_formats[i].ext, bench_import, min_time, out, &first );
+	}
+	fprintf( out, "\n  ],\n  \"peak_rss_kb\": %ld\n}\n", bench_peak_rss_kb() );
+	if( out != stdout )
+		fclose( out );
+
+	for( i = 0 ; bench_formats[i].ext ; ++i )
+	{
+		char *path = bench_tmp_file( &ctx, bench_formats[i].ext );
+		unlink( path );
+		free( path );
+	}
+	for( i = 0 ; i < ctx.stored_count ; ++i )
+		if( ctx.stored[i] )
+			forget_data( NULL, ctx.stored[i] );
+	free( ctx.stored );
+	if( ctx.font )
+		release_font( ctx.font );
+	if( fontman )
+		destroy_font_manager( fontman, False );
+	destroy_asimage( &ctx.photo );
+	destroy_asimage( &ctx.overlay );
+	destroy_asimage( &ctx.synthetic );
+	destroy_asvisual( ctx.asv, False );
+	flush_image_codec_pool();
+#ifndef X_DISPLAY_MISSING
+	if( dpy )
+		XCloseDisplay( dpy );
+#endif
+	return 0;
+}
+/**************/
@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
 # include <time.h>
@@ -74,6 +76,7 @@ int asvisual_empty_XErrorHandler (Display * dpy, XErrorEvent * event);
  * ascompose -f file|-s string [-o file] [-t type] [-V] [-n]
  * ascompose -f file|-s string [-o file] [-t type [-c compression_level]] 
  * 			 [-V] [-r]
+ * ascompose -B jobs_file|- [-j workers] [-t type [-c compression_level]]
  * ascompose [-h]
  * ascompose [-v]
  *
@@ -140,6 +143,17 @@ int asvisual_empty_XErrorHandler (Display * dpy, XErrorEvent * event);
  *                       debug messages.
  *    -i --include file  include file as input prior to processing main 
  * 						 file.
+ *    -B --batch file    batch mode - read stream of <job> tags from the
+ *                       file ( or STDIN if file is '-' ), and render each
+ *                       of them in turn. Visual and font manager are kept
+ *                       across jobs. Each job looks like :
+ *                       <job [id=name] [src=xml_file] [out=file] [type=type]
+ *                            [compress=level] [width=w] [height=h]>
+ *                           optional inline composition
+ *                       </job>
+ *                       One report line per job is printed to STDOUT with
+ *                       job status, size of the result and time it took.
+ *    -j --jobs count    number of worker processes to use in batch mode.
  * PORTABILITY
  * ascompose could be used both with and without X window system. It has
  * been tested on most UNIX flavors on both 32 and 64 bit architecture.
@@ -214,6 +228,11 @@ void usage(void) {
 		"\n"
 		"  -C --clipboard     run ascompose waiting for data being copied into clipboard,\n" 
 		"                     and displaying/processing it, if it is xml.\n"
+		" Batch options : \n"
+		"  -B --batch file    render stream of <job> tags read from file ('-' for STDIN) :\n"
+		"                     <job [id=name] [src=xml_file] [out=file] [type=type] [compress=level]\n"
+		"                          [width=w] [height=h]>[inline xml]</job>\n"
+		"  -j --jobs count    number of worker processes to render jobs with\n"
 		" Examples: \n"
 		" To display image.jpg on root window : \n"
 		"   ascompose -r -s \"<img src=image.jpg/>\""
@@ -252,6 +271,7 @@ static char* default_doc_str = "\
 #endif
 /*******/
 char *load_stdin();	
+int compose_batch( FILE *fp, int workers, const char *save_type, const char *compress );
 
 typedef struct ASComposeWinProps
 {
@@ -301,8 +321,11 @@ int main(int argc, char** argv) {
 	{
 		COMPOSE_Once = 0,
 		COMPOSE_Interactive,
-		COMPOSE_XClipboard
+		COMPOSE_XClipboard,
+		COMPOSE_Batch
 	}compose_type = COMPOSE_Once ;
+	int batch_workers = 1 ;
+	int exit_code = 0 ;
 	Bool endless_loop = False ; 
 	Window main_window = None ;
 	ASComposeWinProps main_window_props ;
@@ -381,6 +404,12 @@ int main(int argc, char** argv) {
             endless_loop = True ;
 		} else if (!strcmp(argv[i], "--dont-clear")) {
             main_window_props.dont_clear = True ;
+		} else if ((!strcmp(argv[i], "--batch") || !strcmp(argv[i], "-B")) && i + 1 < argc) {
+			doc_file = argv[++i];
+            compose_type = COMPOSE_Batch ;
+			display = 0 ;
+		} else if ((!strcmp(argv[i], "--jobs") || !strcmp(argv[i], "-j")) && i + 1 < argc) {
+			batch_workers = atoi( argv[++i] );
 		}
 #ifndef X_DISPLAY_MISSING
 		  else if ((!strcmp(argv[i], "--geometry") || !strcmp(argv[i], "-g")) && i < argc + 1) {
@@ -620,6 +649,21 @@ int main(int argc, char** argv) {
 		}
 		if( fp && fp != stdin ) 
 			fclose( fp );
+	}else if( compose_type == COMPOSE_Batch )
+	{
+		FILE *fp = stdin ;
+		if( strcmp( doc_file, "-") != 0 ) 
+			fp = fopen( doc_file, "rt" );
+		if( fp == NULL ) 
+		{
+			show_error("Unable to open batch file [%s]: %s.\n", doc_file, strerror(errno));
+			exit(1);
+		}
+		if( compose_batch( fp, batch_workers, doc_save_type, doc_compress ) > 0 ) 
+			exit_code = 1 ;
+		if( fp != stdin ) 
+			fclose( fp );
+		doc_file = NULL ; 
 	}
 #ifndef X_DISPLAY_MISSING		  	
 	else if( compose_type == COMPOSE_XClipboard && dpy )
@@ -757,6 +801,8 @@ int main(int argc, char** argv) {
 	LOCAL_DEBUG_OUT( "display Closed%s","");
     build_xpm_colormap( NULL );
 	LOCAL_DEBUG_OUT( "display Closed%s","");
+	flush_gradient_cache();
+	flush_image_codec_pool();
 	flush_default_asstorage();
 	LOCAL_DEBUG_OUT( "display Closed%s","");
 //	destroy_asvisual( asv, False );
@@ -767,7 +813,7 @@ int main(int argc, char** argv) {
 	print_asimage_registry();
 #endif
 
-	return 0;
+	return exit_code;
 }
 
 Window 
@@ -1206,3 +1252,412 @@ char *load_stdin()
 	return complete;
 }	 
 
+/**************************************************************************
+ * Batch mode :
+ *************************************************************************/
+#define BATCH_REPORT_SIZE	1024
+
+typedef struct ASComposeWorker
+{
+	pid_t pid ;
+	int   job_fd, report_fd ;
+	Bool  busy ;
+	char  report[BATCH_REPORT_SIZE] ;
+	int   report_used ;
+}ASComposeWorker;
+
+static double
+batch_elapsed_msec( struct timeval *start )
+{
+	struct timeval now ;
+	gettimeofday( &now, NULL );
+	return (now.tv_sec - start->tv_sec)*1000.0 + (now.tv_usec - start->tv_usec)/1000.0 ;
+}
+
+/* reads next top level tag from the stream. Returns NULL on EOF */
+static char *
+read_batch_job( FILE *fp, ASXmlBuffer *xb )
+{
+	int c ;
+
+	reset_xml_buffer( xb );
+	while( (c = fgetc(fp)) != EOF ) 
+	{
+		char cc = c; 
+		while( xb->state >= 0 && spool_xml_tag( xb, &cc, 1 ) <= 0);
+		if( xb->state == ASXML_Start && xb->tags_count > 0 && xb->level == 0) 
+		{
+			add_xml_buffer_chars( xb, "", 1 );
+			return mystrdup( xb->buffer );
+		}
+		if( xb->state < 0 ) 
+		{
+			xml_elem_t *msg = format_xml_buffer_state( xb );
+			if( msg ) 
+			{
+				xml_print( msg );
+				printf( "\n" );
+				xml_elem_delete( NULL, msg );
+			}
+			/* skip the rest of the line so we could resync with the stream */
+			while( c != '\n' && (c = fgetc(fp)) != EOF );
+			reset_xml_buffer( xb );
+		}
+	}
+	return NULL;
+}
+
+/* images stored with id="..." only make sense within the job that stored
+ * them, so we drop them to keep them from leaking into the next job */
+static void
+release_batch_job_ids( ASImageManager *imman, xml_elem_t *elem )
+{
+	for( ; elem ; elem = elem->next )
+	{
+		if( elem->parm )
+		{
+			xml_elem_t *parm = xml_parse_parm( elem->parm, NULL ), *tmp ;
+			for( tmp = parm ; tmp ; tmp = tmp->next )
+				if( !strcmp( tmp->tag, "id" ) )
+					while( release_asimage_by_name( imman, tmp->parm ) > 0 );
+			if( parm )
+				xml_elem_delete( NULL, parm );
+		}
+		if( elem->child )
+			release_batch_job_ids( imman, elem->child );
+	}
+}
+
+/* renders single job and formats one line report about it.
+ * Returns False if job failed. */
+static Bool
+run_batch_job( const char *job_text, int job_no, ASImageManager *imman, ASFontManager *fontman, 
+			   const char *save_type, const char *compress, char *report )
+{
+	struct timeval start ;
+	xml_elem_t *doc, *job = NULL, *parm = NULL, *tmp ;
+	xml_elem_t *src_doc = NULL, *stored_ids = NULL ;
+	char *id = NULL, *src = NULL, *out = NULL ;
+	const char *error = NULL ;
+	int width = -1, height = -1 ;
+	ASImage *im = NULL ;
+	char default_id[32] ;
+
+	gettimeofday( &start, NULL );
+	sprintf( default_id, "%d", job_no );
+
+	if( (doc = xml_parse_doc( job_text, NULL )) != NULL ) 
+		job = doc->child ;
+	if( job == NULL || job->tag == NULL || strcmp( job->tag, "job" ) != 0 ) 
+		error = "not a <job> tag" ;
+	else
+	{
+		parm = xml_parse_parm( job->parm, NULL );
+		for( tmp = parm ; tmp ; tmp = tmp->next )
+		{
+			if( !strcmp(tmp->tag, "id") ) 			id = tmp->parm ;
+			else if( !strcmp(tmp->tag, "src") ) 		src = tmp->parm ;
+			else if( !strcmp(tmp->tag, "out") ) 		out = tmp->parm ;
+			else if( !strcmp(tmp->tag, "type") ) 		save_type = tmp->parm ;
+			else if( !strcmp(tmp->tag, "compress") ) 	compress = tmp->parm ;
+			else if( !strcmp(tmp->tag, "width") ) 	width = parse_math(tmp->parm, NULL, 0);
+			else if( !strcmp(tmp->tag, "height") ) 	height = parse_math(tmp->parm, NULL, 0);
+		}
+
+		if( src ) 
+		{
+			char *doc_str = load_file( src );
+			if( doc_str == NULL ) 
+				error = "unable to load src file" ;
+			else
+			{
+				char *slash = strrchr( src, '/' );
+				char *path = slash ? mystrndup( src, slash - src ) : NULL ;
+				stored_ids = src_doc = xml_parse_doc( doc_str, NULL );
+				im = compose_asimage_xml_from_doc( asv, imman, fontman, src_doc, ASFLAGS_EVERYTHING, verbose, None, path, width, height );
+				if( path ) 
+					free( path );
+				free( doc_str );
+			}
+		}else if( job->child ) 
+		{
+			im = compose_asimage_xml_from_doc( asv, imman, fontman, job, ASFLAGS_EVERYTHING, verbose, None, NULL, width, height );
+			stored_ids = job->child ;
+		}else
+			error = "job has neither src nor inline xml" ;
+
+		if( error == NULL ) 
+		{
+			if( im == NULL ) 
+				error = "composition produced no image" ;
+			else if( out ) 
+			{
+				if( save_type == NULL && (save_type = strrchr( out, '.' )) != NULL ) 
+					++save_type ;
+				if( save_type == NULL || !save_asimage_to_file( out, im, save_type, compress, NULL, 0, 1 ) ) 
+					error = "save failed" ;
+			}
+		}
+		if( im ) 
+		{
+			width = im->width ;
+			height = im->height ;
+			safe_asimage_destroy( im );
+		}
+		if( stored_ids ) 
+			release_batch_job_ids( imman, stored_ids );
+	}
+
+	if( error ) 
+		snprintf( report, BATCH_REPORT_SIZE, "<job id=\"%s\" status=\"error\" time_ms=\"%.3f\">%s</job>\n", 
+				  id?id:default_id, batch_elapsed_msec( &start ), error );
+	else
+		snprintf( report, BATCH_REPORT_SIZE, "<job id=\"%s\" status=\"success\" width=%d height=%d out=\"%s\" time_ms=\"%.3f\"/>\n", 
+				  id?id:default_id, width, height, out?out:"", batch_elapsed_msec( &start ) );
+	report[BATCH_REPORT_SIZE-2] = '\n' ;
+	report[BATCH_REPORT_SIZE-1] = '\0' ;
+
+	if( parm ) 
+		xml_elem_delete( NULL, parm );
+	if( src_doc ) 
+		xml_elem_delete( NULL, src_doc );
+	if( doc ) 
+		xml_elem_delete( NULL, doc );
+	return (error == NULL);
+}
+
+static void
+batch_worker_died( ASComposeWorker *w, int worker_no, int *alive_count )
+{
+	show_error( "batch worker %d (pid %d) died.", worker_no, w->pid );
+	close( w->job_fd );
+	close( w->report_fd );
+	w->job_fd = w->report_fd = -1 ;
+	--(*alive_count) ;
+}
+
+static Bool
+batch_io( int fd, void *data, int size, Bool write_data )
+{
+	char *ptr = data ;
+	while( size > 0 ) 
+	{
+		int res = write_data ? write( fd, ptr, size ) : read( fd, ptr, size );
+		if( res < 0 && errno == EINTR ) 
+			continue;
+		if( res <= 0 ) 
+			return False;
+		ptr += res ;
+		size -= res ;
+	}
+	return True;
+}
+
+/* worker process loop : jobs come in as length prefixed strings,
+ * report lines go out */
+static void
+batch_worker_loop( int job_fd, int report_fd, ASFontManager *fontman, 
+				   const char *save_type, const char *compress )
+{
+	ASImageManager *imman = create_generic_imageman( NULL );
+	int job_size ;
+	char report[BATCH_REPORT_SIZE] ;
+
+	while( batch_io( job_fd, &job_size, sizeof(job_size), False ) && job_size > 0 ) 
+	{
+		int job_no ;
+		char *job_text = safemalloc( job_size );
+		if( !batch_io( job_fd, &job_no, sizeof(job_no), False ) 
+			|| !batch_io( job_fd, job_text, job_size, False ) ) 
+		{
+			free( job_text );
+			break;
+		}
+		run_batch_job( job_text, job_no, imman, fontman, save_type, compress, report );
+		free( job_text );
+		if( !batch_io( report_fd, report, strlen(report), True ) ) 
+			break;
+	}
+	destroy_image_manager( imman, False );
+}
+
+/* Renders all the jobs from the stream, using workers processes if 
+ * requested. Returns number of failed jobs. */
+int 
+compose_batch( FILE *fp, int workers_num, const char *save_type, const char *compress )
+{
+	ASFontManager  *fontman = create_generic_fontman( asv->dpy, NULL );
+	ASComposeWorker *workers = NULL ;
+	ASXmlBuffer xb ; 
+	struct timeval start ;
+	int jobs_count = 0, failed_count = 0 ;
+	int i ;
+	char *job_text ;
+
+	memset( &xb, 0x00, sizeof(xb));
+	gettimeofday( &start, NULL );
+	fflush( stdout );
+
+	if( workers_num > 1 ) 
+	{
+		workers = safecalloc( workers_num, sizeof(ASComposeWorker));
+		for( i = 0 ; i < workers_num ; ++i ) 
+		{
+			int job_pipe[2], report_pipe[2] ;
+			if( pipe( job_pipe ) != 0 ) 
+				break;
+			if( pipe( report_pipe ) != 0 ) 
+			{
+				close( job_pipe[0] );
+				close( job_pipe[1] );
+				break;
+			}
+			if( (workers[i].pid = fork()) == 0 ) 
+			{
+				int k ;
+				for( k = 0 ; k < i ; ++k ) 
+				{
+					close( workers[k].job_fd );
+					close( workers[k].report_fd );
+				}
+				close( job_pipe[1] );
+				close( report_pipe[0] );
+				batch_worker_loop( job_pipe[0], report_pipe[1], fontman, save_type, compress );
+				destroy_font_manager( fontman, False );
+				_exit(0);
+			}
+			close( job_pipe[0] );
+			close( report_pipe[1] );
+			if( workers[i].pid < 0 ) 
+			{
+				show_system_error( "unable to fork batch worker" );
+				close( job_pipe[1] );
+				close( report_pipe[0] );
+				break;
+			}
+			workers[i].job_fd = job_pipe[1] ;
+			workers[i].report_fd = report_pipe[0] ;
+		}
+		workers_num = i ;
+		/* dead worker should not take us down with it */
+		if( workers_num > 1 ) 
+			signal( SIGPIPE, SIG_IGN );
+	}
+
+	if( workers_num <= 1 ) 
+	{
+		ASImageManager *imman = create_generic_imageman( NULL );
+		char report[BATCH_REPORT_SIZE] ;
+		while( (job_text = read_batch_job( fp, &xb )) != NULL ) 
+		{
+			if( !run_batch_job( job_text, ++jobs_count, imman, fontman, save_type, compress, report ) ) 
+				++failed_count ;
+			fputs( report, stdout );
+			fflush( stdout );
+			free( job_text );
+		}
+		destroy_image_manager( imman, False );
+	}else
+	{
+		Bool eof = False ;
+		int busy_count = 0, alive_count = workers_num ;
+		while( (!eof && alive_count > 0) || busy_count > 0 ) 
+		{
+			fd_set in_fdset ;
+			int max_fd = 0 ;
+
+			/* hand out jobs to idle workers */
+			for( i = 0 ; i < workers_num && !eof ; ++i ) 
+				if( !workers[i].busy && workers[i].job_fd >= 0 ) 
+				{
+					int job_size ;
+					if( (job_text = read_batch_job( fp, &xb )) == NULL ) 
+					{
+						eof = True ;
+						break;
+					}
+					job_size = strlen( job_text ) + 1 ;
+					++jobs_count ;
+					if( batch_io( workers[i].job_fd, &job_size, sizeof(job_size), True ) 
+						&& batch_io( workers[i].job_fd, &jobs_count, sizeof(jobs_count), True ) 
+						&& batch_io( workers[i].job_fd, job_text, job_size, True ) ) 
+					{
+						workers[i].busy = True ;
+						++busy_count ;
+					}else
+					{
+						printf( "<job id=\"%d\" status=\"error\">worker died</job>\n", jobs_count );
+						++failed_count ;
+						batch_worker_died( &workers[i], i, &alive_count );
+					}
+					free( job_text );
+				}
+			if( busy_count == 0 ) 
+				continue;
+
+			FD_ZERO( &in_fdset );
+			for( i = 0 ; i < workers_num ; ++i ) 
+				if( workers[i].busy ) 
+				{
+					FD_SET( workers[i].report_fd, &in_fdset );
+					if( workers[i].report_fd > max_fd ) 
+						max_fd = workers[i].report_fd ;
+				}
+			if( PORTABLE_SELECT( max_fd+1, &in_fdset, NULL, NULL, NULL ) < 0 ) 
+			{
+				if( errno == EINTR ) 
+					continue;
+				show_system_error( "select failed" );
+				break;
+			}
+			for( i = 0 ; i < workers_num ; ++i ) 
+				if( workers[i].busy && FD_ISSET( workers[i].report_fd, &in_fdset ) ) 
+				{
+					ASComposeWorker *w = &workers[i] ;
+					int res = read( w->report_fd, &(w->report[w->report_used]), BATCH_REPORT_SIZE - 1 - w->report_used );
+					if( res > 0 ) 
+						w->report_used += res ;
+					if( res <= 0 || w->report_used >= BATCH_REPORT_SIZE-1 || w->report[w->report_used-1] == '\n' ) 
+					{
+						if( res <= 0 ) 
+						{
+							printf( "<job status=\"error\">worker died</job>\n" );
+							++failed_count ;
+							batch_worker_died( w, i, &alive_count );
+						}else 
+						{
+							w->report[w->report_used] = '\0' ;
+							if( strstr( w->report, "status=\"error\"" ) != NULL ) 
+								++failed_count ;
+							fputs( w->report, stdout );
+							fflush( stdout );
+						}
+						w->report_used = 0 ;
+						w->busy = False ;
+						--busy_count ;
+					}
+				}
+		}
+
+		if( !eof ) 
+			show_error( "all batch workers died - remaining jobs are not processed." );
+		for( i = 0 ; i < workers_num ; ++i ) 
+			if( workers[i].job_fd >= 0 ) 
+			{
+				close( workers[i].job_fd );
+				close( workers[i].report_fd );
+			}
+		for( i = 0 ; i < workers_num ; ++i ) 
+			waitpid( workers[i].pid, NULL, 0 );
+	}
+
+	printf( "<batch jobs=%d failed=%d workers=%d time_ms=\"%.3f\"/>\n", 
+			jobs_count, failed_count, workers_num > 1 ? workers_num : 1, batch_elapsed_msec( &start ) );
+
+	if( xb.buffer )
+		free( xb.buffer );
+	if( workers ) 
+		free( workers );
+	destroy_font_manager( fontman, False );
+	return failed_count;
+}
@@ -83,9 +83,22 @@
 #include "asfont.h"
 #include "asimage.h"
 #include "asvisual.h"
+#include "scanline.h"
 
-#ifdef HAVE_XRENDER
+#if defined(HAVE_XRENDER) && !defined(X_DISPLAY_MISSING)
 #include <X11/extensions/Xrender.h>
+#else
+#undef HAVE_XRENDER
+#endif
+
+/* shared glyph cache relies on mmap() and GCC atomic builtins : */
+#if defined(HAVE_FREETYPE) && !defined(_WIN32) && defined(__GNUC__)
+#define HAVE_GLYPH_CACHE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #endif
 
 #undef MAX_GLYPHS_PER_FONT
@@ -100,11 +113,13 @@
 /*********************************************************************************/
 
 void asfont_destroy (ASHashableValue value, void *data);
+static void close_glyph_cache( struct ASGlyphCache *cache );
 
 ASFontManager *
 create_font_manager( Display *dpy, const char * font_path, ASFontManager *reusable_memory )
 {
 	ASFontManager *fontman = reusable_memory;
+	char *cache_file ;
 	if( fontman == NULL )
 		fontman = safecalloc( 1, sizeof(ASFontManager));
 	else
@@ -124,6 +139,9 @@ LOCAL_DEBUG_OUT( "Freetype library is %p", fontman->ft_library );
 
 	fontman->fonts_hash = create_ashash( 7, string_hash_value, string_compare, asfont_destroy );
 
+	if( (cache_file = getenv( ASFONT_GLYPH_CACHE_ENVVAR )) != NULL && cache_file[0] != '\0' )
+		set_font_manager_glyph_cache( fontman, cache_file, 0 );
+
 	return fontman;
 }
 
@@ -134,6 +152,10 @@ destroy_font_manager( ASFontManager *fontman, Bool reusable )
 	{
 
         destroy_ashash( &(fontman->fonts_hash) );
+		/* glyphs of the fonts destroyed above may point into the cache,
+		 * so it has to go last : */
+		if( fontman->glyph_cache )
+			close_glyph_cache( fontman->glyph_cache );
 
 #ifdef HAVE_FREETYPE
 		FT_Done_FreeType( fontman->ft_library);
@@ -149,6 +171,327 @@ destroy_font_manager( ASFontManager *fontman, Bool reusable )
 	}
 }
 
+/*********************************************************************************/
+/* Shared glyph cache :                                                          */
+/*********************************************************************************/
+/* Glyphs rendered with FreeType get appended to the memory mapped file shared
+ * by all the processes in the session, so that every other process opening
+ * the same font at the same size can use them as is, without rendering.
+ * Records are never modified or removed once published, so readers need no
+ * locking whatsoever. Writers reserve space by atomically advancing "used"
+ * offset, fill the record in, and then publish it by atomically swapping it
+ * in as the head of its hash bucket chain. Once the file is full - it gets
+ * unlinked and replaced with a fresh one, and everybody follows over to it.
+ * Old mapping has to stay around till the end, since our glyphs point into it.
+ */
+struct ASGlyphCache
+{
+	int 	 fd ;
+	size_t	 size ;
+	CARD8 	*data ;		/* mmap()-ed file */
+	char 	*filename ;
+	struct ASGlyphCache *retired ;	/* mappings of the files we've moved away from */
+};
+
+#ifdef HAVE_GLYPH_CACHE
+
+#define GLYPH_CACHE_MAGIC		0xA3A3F0C1
+#define GLYPH_CACHE_VERSION		1
+#define GLYPH_CACHE_BUCKETS		4096
+#define GLYPH_CACHE_MIN_SIZE	(64*1024)
+#define GLYPH_CACHE_MAX_SIZE	0x7FFFFFFF
+
+typedef struct ASGlyphCacheHeader
+{
+	CARD32 			magic, version ;
+	CARD32 			size ;		/* total size of the file */
+	volatile CARD32 used ;		/* offset of the first free byte */
+	volatile CARD32 buckets[GLYPH_CACHE_BUCKETS] ;	/* offsets of chain heads */
+}ASGlyphCacheHeader;
+
+typedef struct ASGlyphCacheRecord
+{
+	CARD32	next ;				/* offset of the next record in the chain */
+	CARD32	hash ;
+	CARD32	uc, font_gid ;
+	CARD32	key_len, pixmap_len ;
+	short 	width, height, lead, step, ascend, descend ;
+	/* followed by key_len bytes of font key and pixmap_len bytes of pixmap */
+}ASGlyphCacheRecord;
+
+#define GLYPH_CACHE_RECORD_SIZE(key_len,pixmap_len) \
+	((sizeof(ASGlyphCacheRecord)+(key_len)+(pixmap_len)+7)&(~7))
+
+static CARD32
+glyph_cache_hash( const char *key, UNICODE_CHAR uc, unsigned int gid )
+{/* FNV-1a */
+	register CARD32 h = 2166136261U ;
+	while( *key )
+	{
+		h ^= (CARD8)*(key++) ;
+		h *= 16777619U ;
+	}
+	h = (h^uc)*16777619U ;
+	return (h^gid)*16777619U ;
+}
+
+static struct ASGlyphCache *
+open_glyph_cache( const char *filename, size_t size )
+{
+	struct ASGlyphCache *cache = NULL ;
+	ASGlyphCacheHeader *hdr ;
+	struct stat st ;
+	void *data = MAP_FAILED ;
+	int fd ;
+
+	if( (fd = open( filename, O_RDWR|O_CREAT, 0600 )) < 0 )
+	{
+		show_warning( "failed to open glyph cache \"%s\" - glyphs will not be shared", filename );
+		return NULL;
+	}
+	/* only one process gets to initialize the file - all others wait here : */
+	flock( fd, LOCK_EX );
+	if( fstat( fd, &st ) == 0 )
+	{
+		if( st.st_size == 0 )
+		{
+			if( size == 0 )
+				size = ASFONT_GLYPH_CACHE_SIZE ;
+			else if( size < GLYPH_CACHE_MIN_SIZE )
+				size = GLYPH_CACHE_MIN_SIZE ;
+			else if( size > GLYPH_CACHE_MAX_SIZE )
+				size = GLYPH_CACHE_MAX_SIZE ;
+			if( ftruncate( fd, size ) != 0 )
+				size = 0 ;
+		}else
+			size = st.st_size ;
+
+		if( size >= GLYPH_CACHE_MIN_SIZE && size <= GLYPH_CACHE_MAX_SIZE )
+			data = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+	}
+	if( data != MAP_FAILED )
+	{
+		hdr = (ASGlyphCacheHeader*)data ;
+		if( hdr->magic == 0 )
+		{	/* brand new file - its all zeroes, so buckets are empty already */
+			hdr->version = GLYPH_CACHE_VERSION ;
+			hdr->size = size ;
+			hdr->used = sizeof(ASGlyphCacheHeader) ;
+			__sync_synchronize();
+			hdr->magic = GLYPH_CACHE_MAGIC ;
+		}
+		if( hdr->magic == GLYPH_CACHE_MAGIC && hdr->version == GLYPH_CACHE_VERSION &&
+			hdr->size == size )
+		{
+			cache = safecalloc( 1, sizeof(struct ASGlyphCache));
+			cache->fd = fd ;
+			cache->size = size ;
+			cache->data = data ;
+			cache->filename = mystrdup( filename );
+		}else
+		{
+			show_warning( "glyph cache \"%s\" is of incompatible format - glyphs will not be shared", filename );
+			munmap( data, size );
+		}
+	}else
+		show_warning( "failed to map glyph cache \"%s\" - glyphs will not be shared", filename );
+
+	flock( fd, LOCK_UN );
+	if( cache == NULL )
+		close( fd );
+	return cache;
+}
+
+/* full file is marked with used == size, so that other processes know
+ * to move over to the fresh one as well : */
+static Bool
+renew_glyph_cache( struct ASGlyphCache *cache )
+{
+	ASGlyphCacheHeader *hdr = (ASGlyphCacheHeader*)cache->data ;
+	struct ASGlyphCache *fresh, *old ;
+	struct stat st, fst ;
+
+	flock( cache->fd, LOCK_EX );
+	hdr->used = cache->size ;
+	/* unless someone has beaten us to it already : */
+	if( stat( cache->filename, &st ) == 0 && fstat( cache->fd, &fst ) == 0 &&
+		st.st_dev == fst.st_dev && st.st_ino == fst.st_ino )
+		unlink( cache->filename );
+	flock( cache->fd, LOCK_UN );
+
+	if( (fresh = open_glyph_cache( cache->filename, cache->size )) == NULL )
+		return False;
+
+	old = safecalloc( 1, sizeof(struct ASGlyphCache));
+	old->fd = cache->fd ;
+	old->size = cache->size ;
+	old->data = cache->data ;
+	old->retired = cache->retired ;
+	cache->retired = old ;
+
+	cache->fd = fresh->fd ;
+	cache->size = fresh->size ;
+	cache->data = fresh->data ;
+	free( fresh->filename );
+	free( fresh );
+	return True;
+}
+
+static Bool
+fetch_cached_glyph( ASFont *font, ASGlyph *asg, unsigned int gid, UNICODE_CHAR uc )
+{
+	struct ASGlyphCache *cache = font->fontman->glyph_cache ;
+	ASGlyphCacheHeader *hdr ;
+	CARD32 hash, offset, key_len ;
+
+	if( cache == NULL || font->glyph_cache_key == NULL )
+		return False;
+
+	hdr = (ASGlyphCacheHeader*)cache->data ;
+	key_len = strlen( font->glyph_cache_key );
+	hash = glyph_cache_hash( font->glyph_cache_key, uc, gid );
+	offset = hdr->buckets[hash%GLYPH_CACHE_BUCKETS] ;
+	while( offset != 0 )
+	{
+		ASGlyphCacheRecord *rec ;
+		size_t pixmap_len ;
+		/* pairs with the barrier implied when record gets published : */
+		__sync_synchronize();
+		if( offset < sizeof(ASGlyphCacheHeader) || offset+sizeof(ASGlyphCacheRecord) > cache->size )
+			break;                             /* corrupted cache */
+		rec = (ASGlyphCacheRecord*)(cache->data+offset);
+		/* widened so that corrupted length can't wrap the bounds check : */
+		pixmap_len = rec->pixmap_len ;
+		if( rec->hash == hash && rec->uc == uc && rec->font_gid == gid &&
+			rec->key_len == key_len && pixmap_len <= cache->size &&
+			offset + GLYPH_CACHE_RECORD_SIZE(key_len,pixmap_len) <= cache->size &&
+			memcmp( rec+1, font->glyph_cache_key, key_len ) == 0 )
+		{
+			asg->pixmap = (CARD8*)(rec+1) + key_len ;
+			asg->pixmap_len = pixmap_len ;
+			asg->font_gid = gid ;
+			asg->width = rec->width ;
+			asg->height = rec->height ;
+			asg->lead = rec->lead ;
+			asg->step = rec->step ;
+			asg->ascend = rec->ascend ;
+			asg->descend = rec->descend ;
+			set_flags( asg->flags, ASG_SharedPixmap );
+			return True;
+		}
+		offset = rec->next ;
+	}
+	/* somebody else has filled it up and moved on - follow them : */
+	if( hdr->used >= cache->size && renew_glyph_cache( cache ) &&
+		((ASGlyphCacheHeader*)cache->data)->used < cache->size )
+		return fetch_cached_glyph( font, asg, gid, uc );
+	return False;
+}
+
+static void
+store_cached_glyph( ASFont *font, ASGlyph *asg, UNICODE_CHAR uc )
+{
+	struct ASGlyphCache *cache = font->fontman->glyph_cache ;
+	ASGlyphCacheHeader *hdr ;
+	ASGlyphCacheRecord *rec ;
+	volatile CARD32 *bucket ;
+	CARD32 hash, offset, head, key_len, pixmap_len, rec_size ;
+	int attempt ;
+
+	if( cache == NULL || font->glyph_cache_key == NULL || asg->pixmap == NULL )
+		return;
+
+	key_len = strlen( font->glyph_cache_key );
+	pixmap_len = asg->pixmap_len ;
+	rec_size = GLYPH_CACHE_RECORD_SIZE(key_len,pixmap_len);
+	/* glyph that won't fit even into an empty file - don't churn over it : */
+	if( sizeof(ASGlyphCacheHeader) + rec_size > cache->size )
+		return;
+	for( attempt = 0 ; ; ++attempt )
+	{
+		hdr = (ASGlyphCacheHeader*)cache->data ;
+		if( hdr->used + rec_size <= cache->size )
+		{
+			offset = __sync_fetch_and_add( &(hdr->used), rec_size );
+			if( offset + rec_size <= cache->size )
+				break;
+		}
+		/* file is full - start over with the fresh one : */
+		if( attempt > 0 || !renew_glyph_cache( cache ) )
+			return;
+	}
+
+	hash = glyph_cache_hash( font->glyph_cache_key, uc, asg->font_gid );
+	rec = (ASGlyphCacheRecord*)(cache->data+offset);
+	rec->hash = hash ;
+	rec->uc = uc ;
+	rec->font_gid = asg->font_gid ;
+	rec->key_len = key_len ;
+	rec->pixmap_len = pixmap_len ;
+	rec->width = asg->width ;
+	rec->height = asg->height ;
+	rec->lead = asg->lead ;
+	rec->step = asg->step ;
+	rec->ascend = asg->ascend ;
+	rec->descend = asg->descend ;
+	memcpy( rec+1, font->glyph_cache_key, key_len );
+	memcpy( (CARD8*)(rec+1)+key_len, asg->pixmap, pixmap_len );
+
+	/* no need to keep private copy of the pixmap any longer : */
+	free( asg->pixmap );
+	asg->pixmap = (CARD8*)(rec+1)+key_len ;
+	set_flags( asg->flags, ASG_SharedPixmap );
+
+	/* publishing it - CAS is a full barrier, so the record is complete
+	 * by the time anyone else can see it : */
+	bucket = &(hdr->buckets[hash%GLYPH_CACHE_BUCKETS]) ;
+	do
+	{
+		head = *bucket ;
+		rec->next = head ;
+	}while( !__sync_bool_compare_and_swap( bucket, head, offset ) );
+}
+#endif /* HAVE_GLYPH_CACHE */
+
+static void
+close_glyph_cache( struct ASGlyphCache *cache )
+{
+	while( cache )
+	{
+		struct ASGlyphCache *next = cache->retired ;
+#ifdef HAVE_GLYPH_CACHE
+		munmap( cache->data, cache->size );
+		close( cache->fd );
+#endif
+		if( cache->filename )
+			free( cache->filename );
+		free( cache );
+		cache = next ;
+	}
+}
+
+Bool
+set_font_manager_glyph_cache( ASFontManager *fontman, const char *filename, size_t size )
+{
+	if( fontman == NULL || filename == NULL )
+		return False;
+	/* glyphs of already open fonts may point into the old cache : */
+	if( fontman->fonts_hash && fontman->fonts_hash->items_num > 0 )
+	{
+		show_warning( "glyph cache can not be changed while fonts are open" );
+		return False;
+	}
+	if( fontman->glyph_cache )
+	{
+		close_glyph_cache( fontman->glyph_cache );
+		fontman->glyph_cache = NULL ;
+	}
+#ifdef HAVE_GLYPH_CACHE
+	fontman->glyph_cache = open_glyph_cache( filename, size );
+#endif
+	return (fontman->glyph_cache != NULL);
+}
+
 #ifdef HAVE_FREETYPE
 static int load_freetype_glyphs( ASFont *font );
 #endif
@@ -226,6 +569,18 @@ LOCAL_DEBUG_OUT( "face found : %p", face );
 					FT_Set_Pixel_Sizes( font->ft_face, size, size );
 					/* but let make our own cell width smaller then height */
 					font->space_size = size*2/3 ;
+#ifdef HAVE_GLYPH_CACHE
+					if( fontman->glyph_cache )
+					{
+						struct stat st ;
+						char *key = safemalloc( strlen(realfilename)+128 );
+						if( stat( realfilename, &st ) != 0 )
+							st.st_mtime = 0 ;
+						sprintf( key, "%s:%ld:%ld:%d:%lX", realfilename, (long)st.st_mtime,
+								 (long)face->face_index, size, (unsigned long)font->flags );
+						font->glyph_cache_key = key ;
+					}
+#endif
 	   				load_freetype_glyphs( font );
 				}
 			}else if( verbose )
@@ -271,7 +626,8 @@ open_X11_font_int( ASFontManager *fontman, const char *font_string, ASFlagType f
 	font->type = ASF_X11 ;
 	font->flags = flags ;
 	load_X11_glyphs( fontman->dpy, font, xfs );
-	XFreeFont( fontman->dpy, xfs );
+	/* we need to keep it around to be able to render glyphs on demand */
+	font->x11_font_info = xfs ;
 #endif /* #ifndef X_DISPLAY_MISSING */
 	return font;
 }
@@ -347,6 +703,8 @@ dup_asfont( ASFont *font )
 	return font;
 }
 
+static void flush_text_run_cache( ASFont *font );
+
 int
 release_font( ASFont *font )
 {
@@ -355,6 +713,9 @@ release_font( ASFont *font )
 	{
 		if( font->magic == MAGIC_ASFONT )
 		{
+			/* images of text drawn by whoever released it are of no use
+			 * to anyone else : */
+			flush_text_run_cache( font );
 			if( --(font->ref_count) < 0 )
 			{
 				ASFontManager *fontman = font->fontman ;
@@ -370,10 +731,11 @@ release_font( ASFont *font )
 static inline void
 free_glyph_data( register ASGlyph *asg )
 {
-    if( asg->pixmap )
+    if( asg->pixmap && !get_flags( asg->flags, ASG_SharedPixmap ) )
         free( asg->pixmap );
 /*fprintf( stderr, "\t\t%p\n", asg->pixmap );*/
     asg->pixmap = NULL ;
+    asg->pixmap_len = 0 ;
 }
 
 static void
@@ -404,6 +766,22 @@ destroy_glyph_range( ASGlyphRange **pgr )
 	}
 }
 
+static void
+destroy_glyph_planes( ASFont *font )
+{
+	int plane, page ;
+	for( plane = 0 ; plane < ASFONT_UNICODE_PLANES ; ++plane )
+		if( font->glyph_planes[plane] )
+		{
+			for( page = 0 ; page < ASFONT_PLANE_PAGES ; ++page )
+				if( font->glyph_planes[plane][page] )
+					free( font->glyph_planes[plane][page] );
+			free( font->glyph_planes[plane] );
+			font->glyph_planes[plane] = NULL ;
+		}
+	font->latin_page = NULL ;
+}
+
 static void
 destroy_font( ASFont *font )
 {
@@ -412,11 +790,23 @@ destroy_font( ASFont *font )
 #ifdef HAVE_FREETYPE
         if( font->type == ASF_Freetype && font->ft_face )
 			FT_Done_Face(font->ft_face);
+#endif
+#ifndef X_DISPLAY_MISSING
+		if( font->x11_font_info && font->fontman && font->fontman->dpy )
+			XFreeFont( font->fontman->dpy, (XFontStruct*)font->x11_font_info );
+#endif
+#ifdef HAVE_XRENDER
+		if( font->xrender_glyphset && font->fontman && font->fontman->dpy )
+			XRenderFreeGlyphSet( font->fontman->dpy, font->xrender_glyphset );
 #endif
         if( font->name )
 			free( font->name );
+		if( font->glyph_cache_key )
+			free( font->glyph_cache_key );
+		flush_text_run_cache( font );
         while( font->codemap )
 			destroy_glyph_range( &(font->codemap) );
+		destroy_glyph_planes( font );
         free_glyph_data( &(font->default_glyph) );
         if( font->locale_glyphs )
 			destroy_ashash( &(font->locale_glyphs) );
@@ -461,7 +851,7 @@ asfont_destroy (ASHashableValue value, void *data)
 static unsigned char *
 compress_glyph_pixmap( unsigned char *src, unsigned char *buffer,
                        unsigned int width, unsigned int height,
-					   int src_step )
+					   int src_step, unsigned int *len_ret )
 {
 	unsigned char *pixmap ;
 	register unsigned char *dst = buffer ;
@@ -511,6 +901,7 @@ compress_glyph_pixmap( unsigned char *src, unsigned char *buffer,
     pixmap  = safemalloc( i/*+(32-(i&0x01F) )*/);
 /*fprintf( stderr, "pixmap alloced %p size %d(%d)", pixmap, i, i+(32-(i&0x01F) )); */
 	memcpy( pixmap, buffer, i );
+	*len_ret = i ;
 
 	return pixmap;
 }
@@ -735,126 +1126,149 @@ LOCAL_DEBUG_OUT( "created glyph range from %lu to %lu", (*r)->min_char, (*r)->ma
 	return first;
 }
 
-void
-load_X11_glyph_range( Display *dpy, ASFont *font, XFontStruct *xfs, size_t char_offset,
-													  unsigned char byte1,
-                                                      unsigned char min_byte2,
-													  unsigned char max_byte2, GC *gc )
+static void
+render_X11_glyph_range( ASFont *font, ASGlyphRange *r )
 {
-	ASGlyphRange  *all, *r ;
-	unsigned long  min_char = (byte1<<8)|min_byte2;
+	Display *dpy = font->fontman->dpy ;
+	XFontStruct *xfs = (XFontStruct*)font->x11_font_info ;
 	unsigned char *buffer, *compressed_buf ;
 	unsigned int   height = xfs->ascent+xfs->descent ;
-	static XGCValues gcv;
+	unsigned char byte1 = (r->min_char>>8)&0x00FF ;
+	unsigned char char_base = r->min_char&0x00FF;
+	int columns = (int)xfs->max_char_or_byte2 - (int)xfs->min_char_or_byte2 + 1 ;
+	XCharStruct *chars ;
+	int len = ((int)r->max_char-(int)r->min_char)+1;
+	register int i ;
+	Pixmap p;
+	XImage *xim;
+	GC gc ;
+	XGCValues gcv;
+	unsigned int total_width = 0 ;
+	int pen_x = 0;
+
+LOCAL_DEBUG_OUT( "rendering glyph range of %lu-%lu", r->min_char, r->max_char );
+	for( i = 0 ; i < len ; i++ )
+		clear_flags( r->glyphs[i].flags, ASG_NotLoaded );
+	if( dpy == NULL )
+		return;
 
+	chars = &(xfs->per_char[((int)byte1-(int)xfs->min_byte1)*columns + (int)char_base - (int)xfs->min_char_or_byte2]);
 	buffer = safemalloc( xfs->max_bounds.width*height*2);
 	compressed_buf = safemalloc( xfs->max_bounds.width*height*4);
-	all = split_X11_glyph_range( min_char, (byte1<<8)|max_byte2, &(xfs->per_char[char_offset]));
-	for( r = all ; r != NULL ; r = r->above )
-	{
-		XCharStruct *chars = &(xfs->per_char[char_offset+r->min_char-min_char]);
-        int len = ((int)r->max_char-(int)r->min_char)+1;
-		unsigned char char_base = r->min_char&0x00FF;
-		register int i ;
-		Pixmap p;
-		XImage *xim;
-		unsigned int total_width = 0 ;
-		int pen_x = 0;
-LOCAL_DEBUG_OUT( "loading glyph range of %lu-%lu", r->min_char, r->max_char );
-		r->glyphs = safecalloc( len, sizeof(ASGlyph) );
-		for( i = 0 ; i < len ; i++ )
-		{
-			int w = chars[i].rbearing - chars[i].lbearing ;
-			r->glyphs[i].lead = chars[i].lbearing ;
-			r->glyphs[i].width = MAX(w,(int)chars[i].width) ;
-			r->glyphs[i].step = chars[i].width;
-			total_width += r->glyphs[i].width ;
-			if( chars[i].lbearing > 0 )
-				total_width += chars[i].lbearing ;
-		}
-		p = XCreatePixmap( dpy, DefaultRootWindow(dpy), total_width, height, 1 );
-		if( *gc == NULL )
-		{
-			gcv.font = xfs->fid;
-			gcv.foreground = 1;
-			*gc = XCreateGC( dpy, p, GCFont|GCForeground, &gcv);
-		}else
-			XSetForeground( dpy, *gc, 1 );
-		XFillRectangle( dpy, p, *gc, 0, 0, total_width, height );
-		XSetForeground( dpy, *gc, 0 );
 
-		for( i = 0 ; i < len ; i++ )
-		{
-			XChar2b test_char ;
-			int offset = MIN(0,(int)chars[i].lbearing);
-
-			test_char.byte1 = byte1 ;
-			test_char.byte2 = char_base+i ;
-			/* we cannot draw string at once since in some fonts charcters may
-			 * overlap each other : */
-			XDrawImageString16( dpy, p, *gc, pen_x-offset, xfs->ascent, &test_char, 1 );
-			pen_x += r->glyphs[i].width ;
-			if( chars[i].lbearing > 0 )
-				pen_x += chars[i].lbearing ;
-		}
-		/*XDrawImageString( dpy, p, *gc, 0, xfs->ascent, test_str_char, len );*/
-		xim = XGetImage( dpy, p, 0, 0, total_width, height, 0xFFFFFFFF, ZPixmap );
-		XFreePixmap( dpy, p );
-		pen_x = 0 ;
-		for( i = 0 ; i < len ; i++ )
+	for( i = 0 ; i < len ; i++ )
+	{
+		int w = chars[i].rbearing - chars[i].lbearing ;
+		r->glyphs[i].lead = chars[i].lbearing ;
+		r->glyphs[i].width = MAX(w,(int)chars[i].width) ;
+		r->glyphs[i].step = chars[i].width;
+		total_width += r->glyphs[i].width ;
+		if( chars[i].lbearing > 0 )
+			total_width += chars[i].lbearing ;
+	}
+	p = XCreatePixmap( dpy, DefaultRootWindow(dpy), total_width, height, 1 );
+	gcv.font = xfs->fid;
+	gcv.foreground = 1;
+	gc = XCreateGC( dpy, p, GCFont|GCForeground, &gcv);
+	XFillRectangle( dpy, p, gc, 0, 0, total_width, height );
+	XSetForeground( dpy, gc, 0 );
+
+	for( i = 0 ; i < len ; i++ )
+	{
+		XChar2b test_char ;
+		int offset = MIN(0,(int)chars[i].lbearing);
+
+		test_char.byte1 = byte1 ;
+		test_char.byte2 = char_base+i ;
+		/* we cannot draw string at once since in some fonts charcters may
+		 * overlap each other : */
+		XDrawImageString16( dpy, p, gc, pen_x-offset, xfs->ascent, &test_char, 1 );
+		pen_x += r->glyphs[i].width ;
+		if( chars[i].lbearing > 0 )
+			pen_x += chars[i].lbearing ;
+	}
+	XFreeGC( dpy, gc );
+	/*XDrawImageString( dpy, p, *gc, 0, xfs->ascent, test_str_char, len );*/
+	xim = XGetImage( dpy, p, 0, 0, total_width, height, 0xFFFFFFFF, ZPixmap );
+	XFreePixmap( dpy, p );
+	pen_x = 0 ;
+	for( i = 0 ; i < len ; i++ )
+	{
+		register int x, y ;
+		int width = r->glyphs[i].width;
+		unsigned char *row = &(buffer[0]);
+
+		if( chars[i].lbearing > 0 )
+			pen_x += chars[i].lbearing ;
+		for( y = 0 ; y < height ; y++ )
 		{
-			register int x, y ;
-			int width = r->glyphs[i].width;
-			unsigned char *row = &(buffer[0]);
-
-			if( chars[i].lbearing > 0 )
-				pen_x += chars[i].lbearing ;
-			for( y = 0 ; y < height ; y++ )
+			for( x = 0 ; x < width ; x++ )
 			{
-				for( x = 0 ; x < width ; x++ )
-				{
-/*					fprintf( stderr, "glyph %d (%c): (%d,%d) 0x%X\n", i, (char)(i+r->min_char), x, y, XGetPixel( xim, pen_x+x, y ));*/
-					/* remember default GC colors are black on white - 0 on 1 - and we need
-					* quite the opposite - 0xFF on 0x00 */
-					row[x] = ( XGetPixel( xim, pen_x+x, y ) != 0 )? 0x00:0xFF;
-				}
-				row += width;
+/*				fprintf( stderr, "glyph %d (%c): (%d,%d) 0x%X\n", i, (char)(i+r->min_char), x, y, XGetPixel( xim, pen_x+x, y ));*/
+				/* remember default GC colors are black on white - 0 on 1 - and we need
+				* quite the opposite - 0xFF on 0x00 */
+				row[x] = ( XGetPixel( xim, pen_x+x, y ) != 0 )? 0x00:0xFF;
 			}
+			row += width;
+		}
 
 #ifdef DO_X11_ANTIALIASING
-			if( height > X11_AA_HEIGHT_THRESHOLD )
-				antialias_glyph( buffer, width, height );
+		if( height > X11_AA_HEIGHT_THRESHOLD )
+			antialias_glyph( buffer, width, height );
 #endif
-			if( get_flags( font->flags, ASF_Monospaced ) )
+		if( get_flags( font->flags, ASF_Monospaced ) )
+		{
+			if( r->glyphs[i].lead > 0 && (int)width + (int)r->glyphs[i].lead > (int)font->space_size )
+				if( r->glyphs[i].lead > (int)font->space_size/8 ) 
+					r->glyphs[i].lead = (int)font->space_size/8 ;
+			if( (int)width + r->glyphs[i].lead > (int)font->space_size )
+			{	
+				r->glyphs[i].width = (int)font->space_size - r->glyphs[i].lead ;
+/*				fprintf(stderr, "lead = %d, space_size = %d, width = %d, to_width = %d\n",
+						r->glyphs[i].lead, font->space_size, width, r->glyphs[i].width ); */
+				scale_down_glyph_width( buffer, width, r->glyphs[i].width, height );
+			}
+			/*else
 			{
-				if( r->glyphs[i].lead > 0 && (int)width + (int)r->glyphs[i].lead > (int)font->space_size )
-					if( r->glyphs[i].lead > (int)font->space_size/8 ) 
-						r->glyphs[i].lead = (int)font->space_size/8 ;
-				if( (int)width + r->glyphs[i].lead > (int)font->space_size )
-				{	
-					r->glyphs[i].width = (int)font->space_size - r->glyphs[i].lead ;
-/*					fprintf(stderr, "lead = %d, space_size = %d, width = %d, to_width = %d\n",
-							r->glyphs[i].lead, font->space_size, width, r->glyphs[i].width ); */
-					scale_down_glyph_width( buffer, width, r->glyphs[i].width, height );
-				}
-				/*else
-				{
-					fprintf(stderr, "lead = %d, space_size = %d, width = %d\n",
-							r->glyphs[i].lead, font->space_size, width );
-				}	 */
-				r->glyphs[i].step = font->space_size ;
-			}	 
-			r->glyphs[i].pixmap = compress_glyph_pixmap( buffer, compressed_buf, r->glyphs[i].width, height, r->glyphs[i].width );
-			r->glyphs[i].height = height ;
-			r->glyphs[i].ascend = xfs->ascent ;
-			r->glyphs[i].descend = xfs->descent ;
+				fprintf(stderr, "lead = %d, space_size = %d, width = %d\n",
+						r->glyphs[i].lead, font->space_size, width );
+			}	 */
+			r->glyphs[i].step = font->space_size ;
+		}	 
+		r->glyphs[i].pixmap = compress_glyph_pixmap( buffer, compressed_buf, r->glyphs[i].width, height, r->glyphs[i].width, &(r->glyphs[i].pixmap_len) );
+		r->glyphs[i].height = height ;
+		r->glyphs[i].ascend = xfs->ascent ;
+		r->glyphs[i].descend = xfs->descent ;
 LOCAL_DEBUG_OUT( "glyph %u(range %lu-%lu) (%c) is %dx%d ascend = %d, lead = %d",  i, r->min_char, r->max_char, (char)(i+r->min_char), r->glyphs[i].width, r->glyphs[i].height, r->glyphs[i].ascend, r->glyphs[i].lead );
-			pen_x += width ;
-		}
-		if( xim )
-			XDestroyImage( xim );
+		pen_x += width ;
+	}
+	if( xim )
+		XDestroyImage( xim );
+	free( buffer ) ;
+	free( compressed_buf ) ;
+}
+
+void
+load_X11_glyph_range( Display *dpy, ASFont *font, XFontStruct *xfs, size_t char_offset,
+													  unsigned char byte1,
+                                                      unsigned char min_byte2,
+													  unsigned char max_byte2 )
+{
+	ASGlyphRange  *all, *r ;
+	unsigned long  min_char = (byte1<<8)|min_byte2;
+
+	/* glyphs themselves will be rendered by render_X11_glyph_range() on
+	 * first use - all we do here is set up the codemap : */
+	all = split_X11_glyph_range( min_char, (byte1<<8)|max_byte2, &(xfs->per_char[char_offset]));
+	for( r = all ; r != NULL ; r = r->above )
+	{
+        int len = ((int)r->max_char-(int)r->min_char)+1;
+		register int i ;
+		r->glyphs = safecalloc( len, sizeof(ASGlyph) );
+		for( i = 0 ; i < len ; i++ )
+			r->glyphs[i].flags = ASG_NotLoaded ;
 	}
-LOCAL_DEBUG_OUT( "done loading glyphs. Attaching set of glyph ranges to the codemap...%s", "" );
+LOCAL_DEBUG_OUT( "Attaching set of glyph ranges to the codemap...%s", "" );
 	if( all != NULL )
 	{
 		if( font->codemap == NULL )
@@ -880,8 +1294,6 @@ LOCAL_DEBUG_OUT( "done loading glyphs. Attaching set of glyph ranges to the code
 				all->below->above = all ;
 		}
 	}
-	free( buffer ) ;
-	free( compressed_buf ) ;
 LOCAL_DEBUG_OUT( "all don%s", "" );
 }
 
@@ -912,7 +1324,7 @@ make_X11_default_glyph( ASFont *font, XFontStruct *xfs )
 	}
 	for( x = 0 ; x < width ; ++x )
 		row[x] = 0xFF;
-	font->default_glyph.pixmap = compress_glyph_pixmap( buf, compressed_buf, width, height, width );
+	font->default_glyph.pixmap = compress_glyph_pixmap( buf, compressed_buf, width, height, width, &(font->default_glyph.pixmap_len) );
 	font->default_glyph.width = width ;
 	font->default_glyph.step = width ;
 	font->default_glyph.height = height ;
@@ -927,7 +1339,6 @@ make_X11_default_glyph( ASFont *font, XFontStruct *xfs )
 static int
 load_X11_glyphs( Display *dpy, ASFont *font, XFontStruct *xfs )
 {
-	GC gc = NULL;
 	font->max_height = xfs->ascent+xfs->descent;
 	font->max_ascend = xfs->ascent;
 	font->max_descend = xfs->descent;
@@ -962,12 +1373,10 @@ load_X11_glyphs( Display *dpy, ASFont *font, XFontStruct *xfs )
 		our_min_char = MAX(our_min_char,min_char);
 		our_max_char = MIN(our_max_char,max_char);
 
-        load_X11_glyph_range( dpy, font, xfs, (int)our_min_char-(int)min_char, byte1, our_min_char&0x00FF, our_max_char&0x00FF, &gc );
+        load_X11_glyph_range( dpy, font, xfs, (int)our_min_char-(int)min_char, byte1, our_min_char&0x00FF, our_max_char&0x00FF );
 	}
 	if( font->default_glyph.pixmap == NULL )
 		make_X11_default_glyph( font, xfs );
-	if( gc )
-		XFreeGC( dpy, gc );
 	return xfs->ascent+xfs->descent;
 }
 #endif /* #ifndef X_DISPLAY_MISSING */
@@ -997,6 +1406,10 @@ load_glyph_freetype( ASFont *font, ASGlyph *asg, int glyph, UNICODE_CHAR uc )
 		return;
 	}
 
+#ifdef HAVE_GLYPH_CACHE
+	if( fetch_cached_glyph( font, asg, glyph, uc ) )
+		return;
+#endif
 	face = font->ft_face;
 	if( FT_Load_Glyph( face, glyph, FT_LOAD_DEFAULT ) )
 		return;
@@ -1085,6 +1498,25 @@ load_glyph_freetype( ASFont *font, ASGlyph *asg, int glyph, UNICODE_CHAR uc )
 			asg->step = font->space_size ;
 		}	 
 
+		asg->ascend  = face->glyph->bitmap_top;
+		asg->descend = bmap->rows - asg->ascend;
+		/* font metrics are fixed once the font is open, so whatever sticks
+		 * out of them due to hinting gets clipped off : */
+		if( font->max_height > 0 )
+		{
+			if( asg->ascend > font->max_ascend )
+			{
+				int skip = MIN(asg->ascend - font->max_ascend, asg->height);
+				src += skip*src_step ;
+				asg->height -= skip ;
+				asg->ascend = font->max_ascend ;
+			}
+			if( asg->descend > font->max_descend )
+			{
+				asg->height -= MIN(asg->descend - font->max_descend, asg->height);
+				asg->descend = font->max_descend ;
+			}
+		}
 		
 		if( glyph_compress_buf_size  < asg->width*asg->height*3 )
 		{
@@ -1093,12 +1525,13 @@ load_glyph_freetype( ASFont *font, ASGlyph *asg, int glyph, UNICODE_CHAR uc )
 		}	 
 	
 		/* we better do some RLE encoding in attempt to preserv memory */
-		asg->pixmap  = compress_glyph_pixmap( src, glyph_compress_buf, asg->width, asg->height, src_step );
-		asg->ascend  = face->glyph->bitmap_top;
-		asg->descend = bmap->rows - asg->ascend;
+		asg->pixmap  = compress_glyph_pixmap( src, glyph_compress_buf, asg->width, asg->height, src_step, &(asg->pixmap_len) );
 		LOCAL_DEBUG_OUT( "glyph %p with FT index %u is %dx%d ascend = %d, lead = %d, bmap_top = %d", 
 							asg, glyph, asg->width, asg->height, asg->ascend, asg->lead, 
 							face->glyph->bitmap_top );
+#ifdef HAVE_GLYPH_CACHE
+		store_cached_glyph( font, asg, uc );
+#endif
 	}
 }
 
@@ -1113,10 +1546,18 @@ LOCAL_DEBUG_CALLER_OUT( "min_char = %lu, max_char = %lu, face = %p", min_char, m
 		while( i <= max_char && FT_Get_Char_Index( face, CHAR2UNICODE(i)) == 0 ) i++ ;
 		if( i <= max_char )
 		{
+			FT_UInt gid ;
 			*r = safecalloc( 1, sizeof(ASGlyphRange));
 			(*r)->min_char = i ;
 			while( i <= max_char && FT_Get_Char_Index( face, CHAR2UNICODE(i)) != 0 ) i++ ;
-			(*r)->max_char = i ;
+			(*r)->max_char = i-1 ;
+			/* glyphs will be rendered on first use : */
+			(*r)->glyphs = safecalloc( i - (*r)->min_char, sizeof(ASGlyph));
+			for( gid = 0 ; gid < i - (*r)->min_char ; ++gid )
+			{
+				(*r)->glyphs[gid].font_gid = FT_Get_Char_Index( face, CHAR2UNICODE((*r)->min_char+gid));
+				(*r)->glyphs[gid].flags = ASG_NotLoaded ;
+			}
 LOCAL_DEBUG_OUT( "created glyph range from %lu to %lu", (*r)->min_char, (*r)->max_char );
 			r = &((*r)->above);
 		}
@@ -1141,100 +1582,70 @@ load_freetype_locale_glyph( ASFont *font, UNICODE_CHAR uc )
 		}else
 		{
 			LOCAL_DEBUG_OUT( "added glyph %p for char %ld to hash font attr(%d,%d,%d) glyph attr (%d,%d)", asg, uc, font->max_ascend, font->max_descend, font->max_height, asg->ascend, asg->descend );
-
-			if( asg->ascend > font->max_ascend )
-				font->max_ascend = asg->ascend ;
-			if( asg->descend > font->max_descend )
-				font->max_descend = asg->descend ;
-			font->max_height = font->max_ascend+font->max_descend ;
-			LOCAL_DEBUG_OUT( "font attr(%d,%d,%d) glyph attr (%d,%d)", font->max_ascend, font->max_descend, font->max_height, asg->ascend, asg->descend );
 		}
 	}else
 		add_hash_item( font->locale_glyphs, AS_HASHABLE(uc), NULL );
 	return asg;
 }
 
-static void
-load_freetype_locale_glyphs( unsigned long min_char, unsigned long max_char, ASFont *font )
-{
-	register unsigned long i = min_char ;
-LOCAL_DEBUG_CALLER_OUT( "min_char = %lu, max_char = %lu, font = %p", min_char, max_char, font );
-	if( font->locale_glyphs == NULL )
-		font->locale_glyphs = create_ashash( 0, NULL, NULL, asglyph_destroy );
-	while( i <= max_char )
-	{
-		load_freetype_locale_glyph( font, CHAR2UNICODE(i));
-		++i;
-	}
-	LOCAL_DEBUG_OUT( "font attr(%d,%d,%d)", font->max_ascend, font->max_descend, font->max_height );
-}
-
-
 static int
 load_freetype_glyphs( ASFont *font )
 {
-	int max_ascend = 0, max_descend = 0;
-	ASGlyphRange *r ;
-
-    /* we preload only codes in range 0x21-0xFF in current charset */
-	/* if draw_unicode_text is used and we need some other glyphs
-	 * we'll just need to add them on demand */
+	FT_Face face = font->ft_face ;
+	FT_Size_Metrics *metrics = &(face->size->metrics) ;
+	long ascender = metrics->ascender, descender = metrics->descender ;
+
+	/* Nothing gets rendered here - glyphs in range 0x21-0x7F are only
+	 * mapped to their indexes, and everything else goes into locale_glyphs
+	 * hash; both get rendered on first use. Text gets laid out before all
+	 * of its glyphs are loaded, so font's ascend/descend have to cover
+	 * every glyph of the face right from the start - hence the bbox. */
 	font->codemap = split_freetype_glyph_range( 0x0021, 0x007F, font->ft_face );
+	font->locale_glyphs = create_ashash( 0, NULL, NULL, asglyph_destroy );
 
 	load_glyph_freetype( font, &(font->default_glyph), 0, 0);/* special no-symbol glyph */
-    load_freetype_locale_glyphs( 0x0080, 0x00FF, font );
-	if( font->codemap == NULL )
-	{
-		font->max_height = font->default_glyph.ascend+font->default_glyph.descend;
-		if( font->max_height <= 0 )
-			font->max_height = 1 ;
-		font->max_ascend = MAX((int)font->default_glyph.ascend,1);
-		font->max_descend = MAX((int)font->default_glyph.descend,1);
-	}else
-	{
-		for( r = font->codemap ; r != NULL ; r = r->above )
-		{
-			long min_char = r->min_char ;
-			long max_char = r->max_char ;
-			long i ;
-			if( max_char < min_char ) 
-			{
-				i = max_char ; 
-				max_char = min_char ; 
-				min_char = i ;	 
-			}	 
-            r->glyphs = safecalloc( (max_char - min_char) + 1, sizeof(ASGlyph));
-			for( i = min_char ; i < max_char ; ++i )
-			{
-				if( i != ' ' && i != '\t' && i!= '\n' )
-				{
-					ASGlyph *asg = &(r->glyphs[i-min_char]);
-					UNICODE_CHAR uc = CHAR2UNICODE(i);
-					load_glyph_freetype( font, asg, FT_Get_Char_Index( font->ft_face, uc), uc);
-/* Not needed ?
- * 					if( asg->lead >= 0 || asg->lead+asg->width > 3 )
- *						font->pen_move_dir = LEFT_TO_RIGHT ;
- */
-					if( asg->ascend > max_ascend )
-						max_ascend = asg->ascend ;
-					if( asg->descend > max_descend )
-						max_descend = asg->descend ;
-				}
-			}
-		}
-		if( (int)font->max_ascend <= max_ascend )
-			font->max_ascend = MAX(max_ascend,1);
-		if( (int)font->max_descend <= max_descend )
-			font->max_descend = MAX(max_descend,1);
-	 	font->max_height = font->max_ascend+font->max_descend;
-	}
 	/* flushing out compression buffer : */
 	load_glyph_freetype(NULL, NULL, 0, 0);
-	return max_ascend+max_descend;
+
+	if( FT_IS_SCALABLE( face ) )
+	{
+		ascender = FT_MulFix( face->bbox.yMax, metrics->y_scale );
+		descender = FT_MulFix( face->bbox.yMin, metrics->y_scale );
+	}
+	font->max_ascend = (ascender+63)>>6 ;
+	font->max_descend = ((-descender)+63)>>6 ;
+	if( font->max_ascend < font->default_glyph.ascend )
+		font->max_ascend = font->default_glyph.ascend ;
+	if( font->max_descend < font->default_glyph.descend )
+		font->max_descend = font->default_glyph.descend ;
+	font->max_ascend = MAX(font->max_ascend,1);
+	font->max_descend = MAX(font->max_descend,1);
+ 	font->max_height = font->max_ascend+font->max_descend;
+	return font->max_height;
 }
 #endif
 
-static inline ASGlyph *get_unicode_glyph( const UNICODE_CHAR uc, ASFont *font )
+static void
+load_pending_glyph( ASFont *font, ASGlyphRange *r, UNICODE_CHAR uc )
+{
+	ASGlyph *asg = &(r->glyphs[uc - r->min_char]);
+#ifndef X_DISPLAY_MISSING
+	if( font->type == ASF_X11 && font->x11_font_info )
+	{/* X11 glyphs are best rendered in bulk to avoid round trips */
+		render_X11_glyph_range( font, r );
+		return;
+	}
+#endif
+	clear_flags( asg->flags, ASG_NotLoaded );
+#ifdef HAVE_FREETYPE
+	if( font->type == ASF_Freetype && font->ft_face )
+	{
+		load_glyph_freetype( font, asg, asg->font_gid, uc );
+	}
+#endif
+}
+
+static ASGlyph *lookup_unicode_glyph( const UNICODE_CHAR uc, ASFont *font )
 {
 	register ASGlyphRange *r;
 	ASGlyph *asg = NULL ;
@@ -1248,15 +1659,21 @@ LOCAL_DEBUG_OUT( "looking for glyph for char %lu (%p) if range (%ld,%ld)", uc, a
 			{
 				asg = &(r->glyphs[uc - r->min_char]);
 LOCAL_DEBUG_OUT( "Found glyph for char %lu (%p)", uc, asg );
+				if( get_flags( asg->flags, ASG_NotLoaded ) )
+					load_pending_glyph( font, r, uc );
 				if( asg->width > 0 && asg->pixmap != NULL )
 					return asg;
 				break;
 			}
 	}
+	asg = NULL ;
+	if( font->locale_glyphs == NULL )
+		return &(font->default_glyph) ;
 	if( get_hash_item( font->locale_glyphs, AS_HASHABLE(uc), &hdata.vptr ) != ASH_Success )
 	{
 #ifdef HAVE_FREETYPE
-		asg = load_freetype_locale_glyph( font, uc );
+		if( font->type == ASF_Freetype )
+			asg = load_freetype_locale_glyph( font, uc );
 LOCAL_DEBUG_OUT( "glyph for char %lu  loaded as %p", uc, asg );
 #endif
 	}else
@@ -1265,6 +1682,45 @@ LOCAL_DEBUG_OUT( "%sFound glyph for char %lu ( %p )", asg?"":"Did not ", uc, asg
 	return asg?asg:&(font->default_glyph) ;
 }
 
+static ASGlyph *
+cache_unicode_glyph( const UNICODE_CHAR uc, ASFont *font )
+{
+	ASGlyph *asg = lookup_unicode_glyph( uc, font );
+	unsigned int plane = uc>>16 ;
+	unsigned int page = (uc>>8)&(ASFONT_PLANE_PAGES-1) ;
+
+	if( plane < ASFONT_UNICODE_PLANES )
+	{
+		ASGlyph ***pages = font->glyph_planes[plane] ;
+		if( pages == NULL )
+			pages = font->glyph_planes[plane] = safecalloc( ASFONT_PLANE_PAGES, sizeof(ASGlyph**));
+		if( pages[page] == NULL )
+		{
+			pages[page] = safecalloc( ASFONT_GLYPH_PAGE_SIZE, sizeof(ASGlyph*));
+			if( plane == 0 && page == 0 )
+				font->latin_page = pages[0] ;
+		}
+		pages[page][uc&(ASFONT_GLYPH_PAGE_SIZE-1)] = asg ;
+	}
+	return asg;
+}
+
+static inline ASGlyph *get_unicode_glyph( const UNICODE_CHAR uc, ASFont *font )
+{
+	register ASGlyph *asg = NULL ;
+	if( uc < ASFONT_GLYPH_PAGE_SIZE )
+	{
+		if( font->latin_page )
+			asg = font->latin_page[uc] ;
+	}else if( (uc>>16) < ASFONT_UNICODE_PLANES )
+	{
+		register ASGlyph ***pages = font->glyph_planes[uc>>16] ;
+		if( pages && pages[(uc>>8)&(ASFONT_PLANE_PAGES-1)] )
+			asg = pages[(uc>>8)&(ASFONT_PLANE_PAGES-1)][uc&(ASFONT_GLYPH_PAGE_SIZE-1)] ;
+	}
+	return asg?asg:cache_unicode_glyph( uc, font );
+}
+
 
 static inline ASGlyph *get_character_glyph( const unsigned char c, ASFont *font )
 {
@@ -1739,11 +2195,14 @@ get_fancy_text_size( const void *src_text, ASFont *font, ASTextAttributes *attr,
 	return get_text_size_internal( src_text, font, &internal_attr, width, height, length, x_positions );
 }
 
+/* pixmap may live in the shared glyph cache, so we never decode past its
+ * recorded length, whatever its contents claim : */
 inline static void
-render_asglyph( CARD8 **scanlines, CARD8 *row,
+render_asglyph( CARD8 **scanlines, CARD8 *row, unsigned int row_len,
                 int start_x, int y, int width, int height,
 				CARD32 ratio )
 {
+	CARD8 *row_end = row + row_len ;
 	int count = -1 ;
 	int max_y = y + height ;
 	register CARD32 data = 0;
@@ -1756,7 +2215,7 @@ render_asglyph( CARD8 **scanlines, CARD8 *row,
 /*fprintf( stderr, "data = %X, count = %d, x = %d, y = %d\n", data, count, x, y );*/
 			if( count < 0 )
 			{
-				data = *(row++);
+				data = (row < row_end)? *(row++) : 0 ;
 				if( (data&0x80) != 0)
 				{
 					data = ((data&0x7F)<<1);
@@ -1779,10 +2238,11 @@ render_asglyph( CARD8 **scanlines, CARD8 *row,
 }
 
 inline static void
-render_asglyph_over( CARD8 **scanlines, CARD8 *row,
+render_asglyph_over( CARD8 **scanlines, CARD8 *row, unsigned int row_len,
                 int start_x, int y, int width, int height,
 				CARD32 value )
 {
+	CARD8 *row_end = row + row_len ;
 	int count = -1 ;
 	int max_y = y + height ;
 	CARD32 anti_data = 0;
@@ -1796,7 +2256,7 @@ render_asglyph_over( CARD8 **scanlines, CARD8 *row,
 /*fprintf( stderr, "data = %X, count = %d, x = %d, y = %d\n", data, count, x, y );*/
 			if( count < 0 )
 			{
-				data = *(row++);
+				data = (row < row_end)? *(row++) : 0 ;
 				if( (data&0x80) != 0)
 				{
 					data = ((data&0x7F)<<1);
@@ -1821,8 +2281,167 @@ render_asglyph_over( CARD8 **scanlines, CARD8 *row,
 
 
 
+/*********************************************************************************/
+/* Rendered text cache :                                                         */
+/*********************************************************************************/
+/* Same labels get drawn over and over again - whenever window gets focused or
+ * background changes - so we keep the images of most recently drawn strings
+ * in a small per-font LRU list and hand out clones of them. Cloned image rows
+ * are reference counted in ASStorage, so that is much cheaper then laying out
+ * and rendering all the glyphs again.
+ */
+typedef struct ASTextRun
+{
+	struct ASTextRun *next ;
+	ASTextAttributes  attr ;		/* tab_stops points to our own copy */
+	int 			  compression, length ;
+	int 			  text_size ;		/* in bytes */
+	char 			 *text ;
+	ASImage 		 *im ;
+}ASTextRun;
+
+static void
+destroy_text_run( ASTextRun *run )
+{
+	if( run->im )
+		destroy_asimage( &(run->im) );
+	if( run->attr.tab_stops )
+		free( run->attr.tab_stops );
+	if( run->text )
+		free( run->text );
+	free( run );
+}
+
+static void
+flush_text_run_cache( ASFont *font )
+{
+	while( font->text_runs )
+	{
+		ASTextRun *run = font->text_runs ;
+		font->text_runs = run->next ;
+		destroy_text_run( run );
+	}
+	font->text_runs_num = 0 ;
+}
+
+/* size in bytes of the text that is going to be drawn : */
+static int
+get_text_run_size( const char *text, ASCharType char_type, int length )
+{
+	register int count = 0, size = 0 ;
+	if( char_type == ASCT_Unicode )
+	{
+		register UNICODE_CHAR *uc_ptr = (UNICODE_CHAR*)text ;
+		while( (length <= 0 || count < length) && uc_ptr[count] != 0 )	++count;
+		return count*sizeof(UNICODE_CHAR);
+	}
+	while( (length <= 0 || count < length) && text[size] != 0 )
+	{
+		size += (char_type == ASCT_UTF8)? UTF8_CHAR_SIZE(text[size]) : 1 ;
+		++count ;
+	}
+	return size;
+}
+
+static Bool
+text_run_matches( ASTextRun *run, const char *text, int text_size, ASTextAttributes *attr, int compression, int length )
+{
+	if( run->text_size != text_size || run->length != length || run->compression != compression )
+		return False;
+	if( run->attr.rendition_flags != attr->rendition_flags || run->attr.type != attr->type ||
+		run->attr.char_type != attr->char_type || run->attr.tab_size != attr->tab_size ||
+		run->attr.origin != attr->origin || run->attr.fore_color != attr->fore_color ||
+		run->attr.width != attr->width || run->attr.tab_stops_num != attr->tab_stops_num )
+		return False;
+	if( attr->tab_stops_num > 0 &&
+		memcmp( run->attr.tab_stops, attr->tab_stops, attr->tab_stops_num*sizeof(unsigned int) ) != 0 )
+		return False;
+	return (memcmp( run->text, text, text_size ) == 0);
+}
+
+static ASImage *
+fetch_text_run( ASFont *font, const char *text, int text_size, ASTextAttributes *attr, int compression, int length )
+{
+	ASTextRun **prun = &(font->text_runs) ;
+	while( *prun )
+	{
+		ASTextRun *run = *prun ;
+		if( text_run_matches( run, text, text_size, attr, compression, length ) )
+		{ /* moving it up front as most recently used : */
+			*prun = run->next ;
+			run->next = font->text_runs ;
+			font->text_runs = run ;
+			return clone_asimage( run->im, SCL_DO_ALL );
+		}
+		prun = &(run->next);
+	}
+	return NULL;
+}
+
+static void
+store_text_run( ASFont *font, const char *text, int text_size, ASTextAttributes *attr, int compression, int length, ASImage *im )
+{
+	ASTextRun *run = safecalloc( 1, sizeof(ASTextRun));
+
+	run->attr = *attr ;
+	run->attr.tab_stops = NULL ;
+	if( attr->tab_stops_num > 0 && attr->tab_stops )
+	{
+		run->attr.tab_stops = safemalloc( attr->tab_stops_num*sizeof(unsigned int));
+		memcpy( run->attr.tab_stops, attr->tab_stops, attr->tab_stops_num*sizeof(unsigned int));
+	}else
+		run->attr.tab_stops_num = 0 ;
+	run->compression = compression ;
+	run->length = length ;
+	run->text_size = text_size ;
+	run->text = safemalloc( text_size+1 );
+	memcpy( run->text, text, text_size );
+	run->im = im ;
+
+	run->next = font->text_runs ;
+	font->text_runs = run ;
+	if( ++(font->text_runs_num) > ASFONT_TEXT_RUN_CACHE_SIZE )
+	{ /* dropping least recently used one : */
+		ASTextRun **ptail = &(font->text_runs) ;
+		while( (*ptail)->next )
+			ptail = &((*ptail)->next);
+		destroy_text_run( *ptail );
+		*ptail = NULL ;
+		--(font->text_runs_num);
+	}
+}
+
+static ASImage *
+render_text_internal( const char *text, ASFont *font, ASTextAttributes *attr, int compression, int length );
+
 static ASImage *
 draw_text_internal( const char *text, ASFont *font, ASTextAttributes *attr, int compression, int length )
+{
+	ASImage *im ;
+	int text_size ;
+
+	if( text == NULL || font == NULL )
+		return NULL;
+	/* the key must be taken before text gets wrapped to attr->width : */
+	text_size = get_text_run_size( text, attr->char_type, length );
+	if( text_size > ASFONT_TEXT_RUN_MAX_BYTES ||
+		(attr->tab_stops_num > 0 && attr->tab_stops == NULL) )
+		return render_text_internal( text, font, attr, compression, length );
+
+	if( (im = fetch_text_run( font, text, text_size, attr, compression, length )) != NULL )
+		return im;
+
+	if( (im = render_text_internal( text, font, attr, compression, length )) != NULL )
+	{
+		ASImage *cached = clone_asimage( im, SCL_DO_ALL );
+		if( cached )
+			store_text_run( font, text, text_size, attr, compression, length, cached );
+	}
+	return im;
+}
+
+static ASImage *
+render_text_internal( const char *text, ASFont *font, ASTextAttributes *attr, int compression, int length )
 {
 	ASGlyphMap map ;
 	CARD8 *memory, *rgb_memory = NULL;
@@ -2000,59 +2619,59 @@ LOCAL_DEBUG_OUT( "line_height is %d, space_size is %d, base_line is %d", line_he
 				switch( attr->type )
 				{
 					case AST_Plain :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_F );
 					    break ;
 					case AST_Embossed :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_F );
-						render_asglyph( scanlines, asg->pixmap, start_x+2, y+2, asg->width, asg->height, alpha_9 );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_C );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+2, y+2, asg->width, asg->height, alpha_9 );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_C );
  					    break ;
 					case AST_Sunken :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_9 );
-						render_asglyph( scanlines, asg->pixmap, start_x+2, y+2, asg->width, asg->height, alpha_F );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_C );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_9 );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+2, y+2, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_C );
 					    break ;
 					case AST_ShadeAbove :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_7 );
-						render_asglyph( scanlines, asg->pixmap, start_x+3, y+3, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_7 );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+3, y+3, asg->width, asg->height, alpha_F );
 					    break ;
 					case AST_ShadeBelow :
-						render_asglyph( scanlines, asg->pixmap, start_x+3, y+3, asg->width, asg->height, alpha_7 );
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+3, y+3, asg->width, asg->height, alpha_7 );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_F );
 					    break ;
 					case AST_EmbossedThick :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_F );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_E );
-						render_asglyph( scanlines, asg->pixmap, start_x+3, y+3, asg->width, asg->height, alpha_7 );
-						render_asglyph( scanlines, asg->pixmap, start_x+2, y+2, asg->width, asg->height, alpha_C );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_E );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+3, y+3, asg->width, asg->height, alpha_7 );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+2, y+2, asg->width, asg->height, alpha_C );
  					    break ;
 					case AST_SunkenThick :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_7 );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_A );
-						render_asglyph( scanlines, asg->pixmap, start_x+3, y+3, asg->width, asg->height, alpha_F );
-						render_asglyph( scanlines, asg->pixmap, start_x+2, y+2, asg->width, asg->height, alpha_C );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_7 );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_A );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+3, y+3, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+2, y+2, asg->width, asg->height, alpha_C );
  					    break ;
 					case AST_OutlineAbove :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_A );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_F );
-						render_asglyph_over( rgb_scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, ARGB32_RED8(attr->fore_color) );
-						render_asglyph_over( &rgb_scanlines[line_height], asg->pixmap, start_x+1, y+1, asg->width, asg->height, ARGB32_GREEN8(attr->fore_color) );
-						render_asglyph_over( &rgb_scanlines[line_height*2], asg->pixmap, start_x+1, y+1, asg->width, asg->height, ARGB32_BLUE8(attr->fore_color) );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_A );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_F );
+						render_asglyph_over( rgb_scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, ARGB32_RED8(attr->fore_color) );
+						render_asglyph_over( &rgb_scanlines[line_height], asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, ARGB32_GREEN8(attr->fore_color) );
+						render_asglyph_over( &rgb_scanlines[line_height*2], asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, ARGB32_BLUE8(attr->fore_color) );
 					    break ;
 					case AST_OutlineBelow :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_F );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_A );
-						render_asglyph_over( rgb_scanlines, asg->pixmap, start_x, y, asg->width, asg->height, ARGB32_RED8(attr->fore_color) );
-						render_asglyph_over( &rgb_scanlines[line_height], asg->pixmap, start_x, y, asg->width, asg->height, ARGB32_GREEN8(attr->fore_color) );
-						render_asglyph_over( &rgb_scanlines[line_height*2], asg->pixmap, start_x, y, asg->width, asg->height, ARGB32_BLUE8(attr->fore_color) );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_A );
+						render_asglyph_over( rgb_scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, ARGB32_RED8(attr->fore_color) );
+						render_asglyph_over( &rgb_scanlines[line_height], asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, ARGB32_GREEN8(attr->fore_color) );
+						render_asglyph_over( &rgb_scanlines[line_height*2], asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, ARGB32_BLUE8(attr->fore_color) );
 					    break ;
 					case AST_OutlineFull :
-						render_asglyph( scanlines, asg->pixmap, start_x, y, asg->width, asg->height, alpha_A );
-						render_asglyph( scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, alpha_F );
-						render_asglyph( scanlines, asg->pixmap, start_x+2, y+2, asg->width, asg->height, alpha_A );
-						render_asglyph_over( rgb_scanlines, asg->pixmap, start_x+1, y+1, asg->width, asg->height, ARGB32_RED8(attr->fore_color) );
-						render_asglyph_over( &rgb_scanlines[line_height], asg->pixmap, start_x+1, y+1, asg->width, asg->height, ARGB32_GREEN8(attr->fore_color) );
-						render_asglyph_over( &rgb_scanlines[line_height*2], asg->pixmap, start_x+1, y+1, asg->width, asg->height, ARGB32_BLUE8(attr->fore_color) );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x, y, asg->width, asg->height, alpha_A );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, alpha_F );
+						render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, start_x+2, y+2, asg->width, asg->height, alpha_A );
+						render_asglyph_over( rgb_scanlines, asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, ARGB32_RED8(attr->fore_color) );
+						render_asglyph_over( &rgb_scanlines[line_height], asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, ARGB32_GREEN8(attr->fore_color) );
+						render_asglyph_over( &rgb_scanlines[line_height*2], asg->pixmap, asg->pixmap_len, start_x+1, y+1, asg->width, asg->height, ARGB32_BLUE8(attr->fore_color) );
 					    break ;
 				  default:
 				        break ;
@@ -2137,6 +2756,7 @@ Bool set_asfont_glyph_spacing( ASFont* font, int x, int y )
 	{
 		font->spacing_x = (x < 0 )? 0: x;
 		font->spacing_y = (y < 0 )? 0: y;
+		flush_text_run_cache( font );
 		return True ;
 	}
 	return False ;
@@ -2179,7 +2799,7 @@ void print_asglyph( FILE* stream, ASFont* font, unsigned long c)
 		k = 0 ;
 		fprintf( stream, "glyph[%lu].pixmap = {", c);
 #if 1
-		for( i = 0 ; i < asg->height*asg->width ; i++ )
+		for( i = 0 ; i < asg->height*asg->width && k < (int)asg->pixmap_len ; i++ )
 		{
 			if( asg->pixmap[k]&0x80 )
 			{
@@ -2206,7 +2826,7 @@ Bool afterimage_uses_xrender(){ return False;}
 	
 void
 draw_text_xrender(  ASVisual *asv, const void *text, ASFont *font, ASTextAttributes *attr, int length,
-					int xrender_op, unsigned long	xrender_src, unsigned long xrender_dst,
+					unsigned long xrender_src, unsigned long xrender_dst,
 					int	xrender_xSrc,  int xrender_ySrc, int xrender_xDst, int xrender_yDst )
 {}
 #else
@@ -2218,100 +2838,120 @@ draw_text_xrender(  ASVisual *asv, const void *text, ASFont *font, ASTextAttribu
 					int	xrender_xSrc,  int xrender_ySrc, int xrender_xDst, int xrender_yDst )
 {
 	ASGlyphMap map;
-	int max_gid = 0 ;
+	XRenderPictFormat *mask_format ;
+	XGlyphElt32 *elts ;
+	unsigned int *gids ;
+	int elts_num = 0 ;
 	int i ;
 	int missing_glyphs = 0 ;
-	int glyphs_bmap_size = 0, max_height = 0 ;
+	int glyphs_bmap_size = 0 ;
+	int space_size, pen_x = 0, pen_y, x = 0, y ;
 
 	if( !get_text_glyph_map( text, font, &map, attr, length) )
 		return;
 	
 	if( map.width == 0 ) 
+	{
+		free_glyph_map( &map, True );
 		return;
+	}
 	/* xrender code starts here : */
+	mask_format = XRenderFindStandardFormat( asv->dpy, PictStandardA8 );
 	/* Step 1: we have to make sure we have a valid GlyphSet */
 	if( font->xrender_glyphset == 0 ) 
-		font->xrender_glyphset = XRenderCreateGlyphSet (asv->dpy, asv->xrender_mask_format);
-	/* Step 2: we have to make sure all the glyphs are in GlyphSet */
+		font->xrender_glyphset = XRenderCreateGlyphSet (asv->dpy, mask_format);
+	/* Step 2: we have to make sure all the glyphs are in GlyphSet - 
+	 * A8 glyph rows are padded to 4 bytes : */
 	for( i = 0 ; map.glyphs[i] != GLYPH_EOT ; ++i ) 
 		if( map.glyphs[i] > MAX_SPECIAL_GLYPH && map.glyphs[i]->xrender_gid == 0 ) 
 		{
-			glyphs_bmap_size += map.glyphs[i]->width * map.glyphs[i]->height ;
-			if( map.glyphs[i]->height > max_height ) 
-				max_height = map.glyphs[i]->height ;
+			ASGlyph *asg = map.glyphs[i];
+			asg->xrender_gid = -1 ; 		/* so that repeated glyphs get added once */
+			glyphs_bmap_size += ((asg->width+3)&~3) * asg->height ;
 			++missing_glyphs;
 		}
 	
 	if( missing_glyphs > 0 ) 
 	{
-		Glyph		*gids;
+		Glyph		*new_gids;
 		XGlyphInfo	*glyphs;
 		char *bitmap, *bmap_ptr ;
-		int	 nbytes_bitmap = 0;
-		CARD8 **scanlines ;
-
-		scanlines = safecalloc(max_height, sizeof(CARD8*));
+		int k = 0 ;
 
-		bmap_ptr = bitmap = safemalloc( glyphs_bmap_size );
+		bmap_ptr = bitmap = safecalloc( glyphs_bmap_size+1, 1 );
 		glyphs = safecalloc( missing_glyphs, sizeof(XGlyphInfo));
-		gids = safecalloc( missing_glyphs, sizeof(Glyph));
+		new_gids = safecalloc( missing_glyphs, sizeof(Glyph));
 		for( i = 0 ; map.glyphs[i] != GLYPH_EOT ; ++i ) 
-			if( map.glyphs[i] > MAX_SPECIAL_GLYPH && map.glyphs[i]->xrender_gid == 0 ) 
+			if( map.glyphs[i] > MAX_SPECIAL_GLYPH && map.glyphs[i]->xrender_gid < 0 ) 
 			{	
 				ASGlyph *asg = map.glyphs[i];
-				int k = asg->height ;  
-				char *ptr = bmap_ptr + asg->width*asg->height ;
-				bmap_ptr = ptr ; 				   
-				while ( --k >= 0 )
+				int stride = (asg->width+3)&~3 ;
+				if( asg->width > 0 && asg->height > 0 ) 
 				{
-					ptr -= asg->width ;	  
-					scanlines[k] = ptr ;
-				}		
-				render_asglyph( scanlines, asg->pixmap,	0, 0, asg->width, asg->height, 0xFF );
-				gids[i] = 
+					CARD8 **scanlines = safemalloc( asg->height*sizeof(CARD8*) );
+					int row ;
+					for( row = 0 ; row < asg->height ; ++row )
+						scanlines[row] = (CARD8*)bmap_ptr + row*stride ;
+					render_asglyph( scanlines, asg->pixmap, asg->pixmap_len, 0, 0, asg->width, asg->height, 0xFF );
+					free( scanlines );
+				}
+				bmap_ptr += stride*asg->height ;
+				glyphs[k].width = asg->width ;
+				glyphs[k].height = asg->height ;
+				glyphs[k].x = -asg->lead ;
+				glyphs[k].y = asg->ascend ;
+				glyphs[k].xOff = asg->step ;
+				glyphs[k].yOff = 0 ;
+				asg->xrender_gid = new_gids[k] = ++(font->xrender_gid_count) ;
+				++k ;
 			}
-		XRenderAddGlyphs( asv->dpy, font->xrender_glyphset, gids, glyphs, missing_glyphs, bitmap, nbytes_bitmap );
-		free( gids );
+		XRenderAddGlyphs( asv->dpy, font->xrender_glyphset, new_gids, glyphs, missing_glyphs, bitmap, bmap_ptr - bitmap );
+		free( new_gids );
 		free( glyphs );
 		free( bitmap );
-		free( scanlines );
 	}
-	/* Step 3: actually rendering text  : */
-	if( max_gid <= 255 ) 
-	{
-		char *string = safemalloc( map->glyphs_num-1 );
-		for( i = 0 ; map.glyphs[i] != GLYPH_EOT ; ++i ) 
-			string[i] = map.glyphs[i]->xrender_gid ;
-		XRenderCompositeString8 ( asv->dpy, PictOpOver, xrender_src, xrender_dst, 
-								  asv->xrender_mask_format,
-			  					  font->xrender_glyphset, 
-								  xrender_xSrc,xrender_ySrc,xrender_xDst,xrender_yDst,
-								  string, i);
-		free( string );
-	}else if( max_gid <= 65000 ) 	
-	{
-		unsigned short *string = safemalloc( sizeof(unsigned short)*(map->glyphs_num-1) );
-		for( i = 0 ; map.glyphs[i] != GLYPH_EOT ; ++i ) 
-			string[i] = map.glyphs[i]->xrender_gid ;
-		XRenderCompositeString16 (asv->dpy, PictOpOver, xrender_src, xrender_dst, 
-								  asv->xrender_mask_format,
-			  					  font->xrender_glyphset, 
-								  xrender_xSrc,xrender_ySrc,xrender_xDst,xrender_yDst,
-								  string, i);
-		free( string );
-	}else
+	/* Step 3: actually rendering text, laid out the same way as get_text_glyph_map()
+	 * measured it - every glyph gets its own element positioned relative to the
+	 * pen position Render left after the previous one : */
+	space_size = font->space_size ;
+	if( !get_flags( font->flags, ASF_Monospaced) )
+		space_size = (space_size>>1)+1 ;
+	space_size += font->spacing_x ;
+	pen_y = y = font->max_ascend ;
+	elts = safecalloc( map.glyphs_num, sizeof(XGlyphElt32) );
+	gids = safecalloc( map.glyphs_num, sizeof(unsigned int) );
+	for( i = 0 ; map.glyphs[i] != GLYPH_EOT ; ++i ) 
 	{
-		unsigned int *string = safemalloc( sizeof(int)*(map->glyphs_num-1) );	
-		for( i = 0 ; map.glyphs[i] != GLYPH_EOT ; ++i ) 
-			string[i] = map.glyphs[i]->xrender_gid ;
-		XRenderCompositeString32 (asv->dpy, PictOpOver, xrender_src, xrender_dst, 
-								  asv->xrender_mask_format,
-			  					  font->xrender_glyphset, 
-								  xrender_xSrc,xrender_ySrc,xrender_xDst,xrender_yDst,
-								  string, i);
-		free( string );
-	}	 
-	
+		ASGlyph *asg = map.glyphs[i] ;
+		if( asg == GLYPH_EOL )
+		{
+			x = 0 ;
+			y += font->max_height + font->spacing_y ;
+		}else if( asg == GLYPH_SPACE )
+			x += space_size ;
+		else if( asg == GLYPH_TAB )
+			x += space_size*attr->tab_size ;
+		else
+		{
+			x += map.x_kerning[i] ;
+			gids[elts_num] = asg->xrender_gid ;
+			elts[elts_num].glyphset = font->xrender_glyphset ;
+			elts[elts_num].chars = &(gids[elts_num]) ;
+			elts[elts_num].nchars = 1 ;
+			elts[elts_num].xOff = x - pen_x ;
+			elts[elts_num].yOff = y - pen_y ;
+			++elts_num ;
+			pen_x = x + asg->step ;
+			pen_y = y ;
+			x += asg->step + font->spacing_x ;
+		}
+	}
+	if( elts_num > 0 )
+		XRenderCompositeText32( asv->dpy, PictOpOver, xrender_src, xrender_dst, mask_format,
+								xrender_xSrc, xrender_ySrc, xrender_xDst, xrender_yDst,
+								elts, elts_num );
+	free( elts );
+	free( gids );
 	/* xrender code ends here : */
 	free_glyph_map( &map, True );	  
 }
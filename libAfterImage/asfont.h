@@ -46,6 +46,7 @@ extern "C" {
  *
  * Functions :
  *          create_font_manager(), destroy_font_manager(),
+ *          set_font_manager_glyph_cache(),
  *          open_freetype_font(), open_X11_font(), get_asfont(),
  *          destroy_font(), print_asfont(), print_asglyph(),
  *          draw_text(),
@@ -120,6 +121,11 @@ typedef struct ASGlyph
 									 */
 	unsigned int font_gid ;		    /* index of the glyph inside the font( TTF only ) */
 	long 		 xrender_gid ;	    /* Used only with XRender  - gid of the glyph in GlyphSet */	    
+	unsigned int pixmap_len ;	    /* size of the RLE encoded pixmap in bytes */
+#define ASG_NotLoaded	(0x01<<0)	/* glyph will be rendered on first use */
+#define ASG_SharedPixmap	(0x01<<1)	/* pixmap lives in the shared glyph
+										 * cache and must not be freed */
+	ASFlagType   flags ;
 }ASGlyph;
 /*************/
 
@@ -205,6 +211,25 @@ typedef struct ASFont
 	unsigned long	xrender_glyphset ;  /* GlyphSet is the actuall datatype, 
 										 * but for easier compilation - 
 										 * we use generic which is the same */ 
+	unsigned long	xrender_gid_count ; /* last gid added to xrender_glyphset */
+	void           *x11_font_info ;     /* XFontStruct of the X11 font kept
+										 * open to render glyphs on demand */
+	/* direct lookup table : Unicode plane -> 256 char page -> glyph,
+	 * filled in as glyphs get looked up for the first time, so that each
+	 * char code only ever goes through codemap/locale_glyphs once : */
+#define ASFONT_GLYPH_PAGE_SIZE		256
+#define ASFONT_PLANE_PAGES			256
+#define ASFONT_UNICODE_PLANES		17
+	struct ASGlyph 	**latin_page ;	/* shortcut to the page for 0x00-0xFF */
+	struct ASGlyph ***glyph_planes[ASFONT_UNICODE_PLANES] ;
+	char           *glyph_cache_key ;  /* identifies font file, face, size and
+										* flags in the shared glyph cache */
+	/* most recently drawn text strings, so that redrawing the same label
+	 * does not require rendering it all over again. MRU order : */
+#define ASFONT_TEXT_RUN_CACHE_SIZE	32
+#define ASFONT_TEXT_RUN_MAX_BYTES	512	/* longer strings are not cached */
+	struct ASTextRun *text_runs ;
+	int               text_runs_num ;
 }ASFont;
 /*************/
 /****s* libAfterImage/ASFontManager
@@ -238,6 +263,12 @@ typedef struct ASFontManager
 #else
 	void       *pad ;
 #endif
+	/* This envvar names the file to be used as glyph cache shared by 
+	 * all the processes in the session. If unset then each process 
+	 * renders its own glyphs : */
+#define ASFONT_GLYPH_CACHE_ENVVAR	"AFTERIMAGE_GLYPH_CACHE"
+#define ASFONT_GLYPH_CACHE_SIZE		(4*1024*1024)
+	struct ASGlyphCache *glyph_cache;
 }ASFontManager;
 /*************/
 
@@ -317,6 +348,9 @@ typedef struct ASTextAttributes
  * needed. It wioll then store copy of font_path and supplied pointer to
  * Display in it. At that time Hash table of loaded fonts is initialized,
  * and if needed FreeType library is initialized as well.
+ * If AFTERIMAGE_GLYPH_CACHE environment variable is set - the file it
+ * names will be attached as shared glyph cache, see
+ * set_font_manager_glyph_cache().
  * ASFontManager object returned by this functions has to be open at all
  * times untill text drawing is no longer needed.
  *********/
@@ -340,6 +374,36 @@ typedef struct ASTextAttributes
 struct ASFontManager *create_font_manager( Display *dpy, const char * font_path, struct ASFontManager *reusable_memory );
 void    destroy_font_manager( struct ASFontManager *fontman, Bool reusable );
 
+/****f* libAfterImage/asfont/set_font_manager_glyph_cache()
+ * NAME
+ * set_font_manager_glyph_cache()
+ * SYNOPSIS
+ * Bool set_font_manager_glyph_cache( ASFontManager *fontman,
+ *                                    const char *filename,
+ *                                    size_t size );
+ * INPUTS
+ * fontman  - pointer to valid ASFontManager object with no fonts open.
+ * filename - file to be memory mapped as glyph cache. Created if it
+ *            does not exist yet.
+ * size     - size of the newly created cache file. 0 selects
+ *            ASFONT_GLYPH_CACHE_SIZE. Size of existing file is
+ *            never changed.
+ * RETURN VALUE
+ * True if cache has been attached, False otherwise.
+ * DESCRIPTION
+ * Attaches glyph cache shared by all the processes using the same file.
+ * Every glyph of FreeType font rendered by any of these processes will
+ * be stored in the cache and reused by all the others opening the same
+ * font file with the same face, size and flags. Cache is append-only
+ * and needs no locking - once it is full the file is unlinked and
+ * replaced with an empty one, which all the processes switch over to.
+ * Mapping of the old file is kept untill the cache is detached, since
+ * glyphs loaded earlier still point into it. Cache can only be attached
+ * before any fonts are opened, and stays attached untill
+ * destroy_font_manager() is called.
+ *********/
+Bool set_font_manager_glyph_cache( struct ASFontManager *fontman, const char *filename, size_t size );
+
 /****f* libAfterImage/asfont/open_freetype_font()
  * NAME
  * open_freetype_font()
@@ -370,8 +434,9 @@ void    destroy_font_manager( struct ASFontManager *fontman, Bool reusable );
  * If file was found function will atempt to read it using FreeType
  * library. If requested face is not available in the font - face 0 will
  * be used.
- * On success all the font's glyphs will be rendered and cached, and
- * needed font geometry info collected.
+ * On success needed font geometry info is collected from the face
+ * bounding box, and does not change afterwards. Glyphs are rendered and
+ * cached on first use, and clipped to that geometry.
  * When FreeType Library is not available that function does nothing.
  *********/
 /****f* libAfterImage/asfont/open_X11_font()
@@ -389,8 +454,9 @@ void    destroy_font_manager( struct ASFontManager *fontman, Bool reusable );
  * font, as well as other relevant info. On failure returns NULL.
  * DESCRIPTION
  * open_X11_font() attempts to load and query font using Xlib calls.
- * On success it goes thgroughthe codemap of the font and renders all
- * the glyphs available. Glyphs then gets transfered to the client's
+ * On success it goes thgroughthe codemap of the font and sets up ranges
+ * of available glyphs. When glyph from the range is first used - all the
+ * glyphs of the range get rendered, transfered to the client's
  * memory and encoded using RLE compression. At this time smoothing
  * filters are applied on glyph pixmaps, if its size exceeds threshold.
  * TODO
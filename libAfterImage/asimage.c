@@ -65,6 +65,7 @@
 #include "scanline.h"
 #include "blender.h"
 #include "asimage.h"
+#include "ximage.h"
 #include "ascmap.h"
 
 static ASVisual __as_dummy_asvisual = {0};
@@ -118,6 +119,10 @@ Bool asimage_use_mmx = True;
 Bool asimage_use_mmx = False;
 #endif
 
+unsigned long asimage_revision_seq = 0 ;
+
+static void forget_asimage_shapes( ASImage *im );
+
 /* *********************   ASImage  ************************************/
 void
 asimage_init (ASImage * im, Bool free_resources)
@@ -127,7 +132,10 @@ asimage_init (ASImage * im, Bool free_resources)
 		if (free_resources)
 		{
 			register int i ;
-			for( i = im->height*4-1 ; i>= 0 ; --i )
+			forget_asimage_shapes( im );
+			if( im->mip )
+				destroy_asimage( &(im->mip) );
+			for( i = im->height*ASIMAGE_ROW_TILES(im)*4-1 ; i>= 0 ; --i )
 				if( im->red[i] != 0 )
 					forget_data( NULL, im->red[i] );
 			if( im->red )
@@ -137,6 +145,8 @@ asimage_init (ASImage * im, Bool free_resources)
 				XDestroyImage( im->alt.ximage );
 			if( im->alt.mask_ximage )
 				XDestroyImage( im->alt.mask_ximage );
+			destroy_asimage_picture( im );
+			forget_asimage_pixmaps( im );
 #endif
 			if( im->alt.argb32 )
 				free( im->alt.argb32 );
@@ -147,6 +157,7 @@ asimage_init (ASImage * im, Bool free_resources)
 		}
 		memset (im, 0x00, sizeof (ASImage));
 		im->magic = MAGIC_ASIMAGE ;
+		TOUCH_ASIMAGE(im);
 		im->back_color = ARGB32_DEFAULT_BACK_COLOR ;
 	}
 }
@@ -165,28 +176,37 @@ flush_asimage_cache( ASImage *im )
 		XDestroyImage( im->alt.mask_ximage );
         im->alt.mask_ximage = NULL ;
     }
+	destroy_asimage_picture( im );
 #endif
 }
 
+static void
+set_asimage_channels( ASImage *im, ASStorageID *rows )
+{
+	int rows_count = im->height*ASIMAGE_ROW_TILES(im) ;
+
+	im->red = rows ;
+	im->green = im->red+rows_count;
+	im->blue = 	im->red+(rows_count*2);
+	im->alpha = im->red+(rows_count*3);
+	im->channels[IC_RED] = im->red ;
+	im->channels[IC_GREEN] = im->green ;
+	im->channels[IC_BLUE] = im->blue ;
+	im->channels[IC_ALPHA] = im->alpha ;
+}
+
 static void
 alloc_asimage_channels ( ASImage *im )
 {
 	/* we want result to be 32bit aligned and padded */
-	im->red = safecalloc (1, sizeof (ASStorageID) * im->height * 4);
-	LOCAL_DEBUG_OUT( "allocated %p for channels of the image %p", im->red, im );
-	if( im->red == NULL )
+	ASStorageID *rows = safecalloc (1, sizeof (ASStorageID) * im->height * ASIMAGE_ROW_TILES(im) * 4);
+	LOCAL_DEBUG_OUT( "allocated %p for channels of the image %p", rows, im );
+	if( rows == NULL )
 	{
 		show_error( "Insufficient memory to create image %dx%d!", im->width, im->height );
 		return ;
 	}
-
-	im->green = im->red+im->height;
-	im->blue = 	im->red+(im->height*2);
-	im->alpha = im->red+(im->height*3);
-	im->channels[IC_RED] = im->red ;
-	im->channels[IC_GREEN] = im->green ;
-	im->channels[IC_BLUE] = im->blue ;
-	im->channels[IC_ALPHA] = im->alpha ;
+	set_asimage_channels( im, rows );
 }
 
 void
@@ -214,7 +234,7 @@ asimage_replace (ASImage *im, ASImage *from)
 			int ref_count = im->ref_count ;
 			ASImageManager *imageman = im->imageman ;
 			char *name = im->name ;
-			ASFlagType  saved_flags = im->flags & (ASIM_NAME_IS_FILENAME|ASIM_NO_COMPRESSION) ;
+			ASFlagType  saved_flags = im->flags & (ASIM_NAME_IS_FILENAME|ASIM_NO_COMPRESSION|ASIM_MIPMAPPED|ASIM_MIP_LANCZOS) ;
 
 			im->name = NULL ; 
 			asimage_init (im, True);
@@ -265,6 +285,32 @@ create_asimage( unsigned int width, unsigned int height, unsigned int compressio
 	return check_created_asimage( im, width, height );
 }
 
+ASImage *
+create_packed_asimage( unsigned int width, unsigned int height )
+{
+	ASImage *im = create_asimage( width, height, 0 );
+	if( im )
+	{
+		im->alt.argb32 = safecalloc( width*height, sizeof(ARGB32) );
+		set_flags( im->flags, ASIM_DATA_NOT_USEFUL|ASIM_PACKED_ARGB32 );
+	}
+	return im;
+}
+
+ASImage *
+create_tiled_asimage( unsigned int width, unsigned int height, unsigned int compression)
+{
+	ASImage *im = safecalloc( 1, sizeof(ASImage) );
+	asimage_init (im, False);
+	im->height = height;
+	im->width = width;
+	set_flags( im->flags, ASIM_TILED );
+	alloc_asimage_channels( im );
+	if( compression == 0 )
+		set_flags( im->flags, ASIM_NO_COMPRESSION );
+	return check_created_asimage( im, width, height );
+}
+
 void
 destroy_asimage( ASImage **im )
 {
@@ -295,7 +341,7 @@ void print_asimage_func (ASHashableValue value)
     ASImage *im = (ASImage*)value ;
     if( im && im->magic == MAGIC_ASIMAGE )
     {
-        unsigned int k;
+        unsigned int k, slots_num = im->height*ASIMAGE_ROW_TILES(im) ;
         unsigned int red_mem = 0, green_mem = 0, blue_mem = 0, alpha_mem = 0;
         unsigned int red_count = 0, green_count = 0, blue_count = 0, alpha_count = 0;
 		ASStorageSlot slot ;
@@ -321,7 +367,8 @@ void print_asimage_func (ASHashableValue value)
         fprintf( stderr,"\tASImage[%p].name = \"%s\";\n", im, im->name );
         fprintf( stderr,"\tASImage[%p].flags = 0x%lX;\n", im, im->flags );
 
-        for( k = 0 ; k < im->height ; k++ )
+        /* tiled images have several slots per row : */
+        for( k = 0 ; k < slots_num ; k++ )
     	{
 			if( im->red[k] ) 
 				if( query_storage_slot(NULL, im->red[k], &slot ) )
@@ -349,10 +396,10 @@ void print_asimage_func (ASHashableValue value)
 				}
         }
 
-        fprintf( stderr,"\tASImage[%p].uncompressed_size = %d;\n", im, im->width*red_count +
+        fprintf( stderr,"\tASImage[%p].uncompressed_size = %d;\n", im, (im->width*red_count +
                                                                     im->width*green_count +
                                                                     im->width*blue_count +
-                                                                    im->width*alpha_count );
+                                                                    im->width*alpha_count)/ASIMAGE_ROW_TILES(im) );
         fprintf( stderr,"\tASImage[%p].compressed_size = %d;\n",   im, red_mem + green_mem +blue_mem + alpha_mem );
         fprintf( stderr,"\t\tASImage[%p].channel[red].lines_count = %d;\n", im, red_count );
         fprintf( stderr,"\t\tASImage[%p].channel[red].memory_used = %d;\n", im, red_mem );
@@ -798,6 +845,94 @@ destroy_image_layers( register ASImageLayer *l, int count, Bool reusable )
 /* **********************************************************************/
 /*  Compression/decompression 										   */
 /* **********************************************************************/
+/* packed ARGB32 images keep no channel rows, so we have to pick 
+ * channel values out of/into packed pixels : */
+static void
+set_packed_channel_line( ASImage *im, ColorPart color, CARD32 *data, int step, unsigned int y )
+{
+	register ARGB32 *row = im->alt.argb32 + y*im->width ;
+	register ARGB32 mask = ~MAKE_ARGB32_CHAN8(0xFF,color) ;
+	register int x, i = 0 ;
+	for( x = 0 ; x < (int)im->width ; ++x, i += step )
+		row[x] = (row[x]&mask)|MAKE_ARGB32_CHAN8(data[i],color);
+}
+
+static int
+get_packed_channel_line( ASImage *im, ColorPart color, CARD32 *to_buf, unsigned int y, unsigned int skip, unsigned int out_width )
+{
+	register ARGB32 *row = im->alt.argb32 + y*im->width + skip ;
+	register int x, count ;
+	if( skip >= im->width )
+		return 0;
+	count = MIN(out_width, im->width-skip);
+	for( x = 0 ; x < count ; ++x )
+		to_buf[x] = ARGB32_CHAN8(row[x],color);
+	return count;
+}
+
+/* tiled images keep rows as series of independently stored pieces, so we 
+ * only need to touch those overlapping requested span : */
+static void
+forget_row_tiles( ASStorageID *tiles, int count )
+{
+	register int t ;
+	for( t = 0 ; t < count ; ++t )
+		if( tiles[t] )
+		{
+			forget_data( NULL, tiles[t] );
+			tiles[t] = 0 ;
+		}
+}
+
+static void
+store_row_tiles( ASStorageID *tiles, CARD32 *data, unsigned int width, ASFlagType flags )
+{
+	unsigned int x ;
+	for( x = 0 ; x < width ; x += ASIMAGE_TILE_WIDTH, ++tiles )
+	{
+		int tile_width = (width-x < ASIMAGE_TILE_WIDTH)? width-x : ASIMAGE_TILE_WIDTH ;
+		if( *tiles )
+			forget_data( NULL, *tiles );
+		*tiles = store_data( NULL, (CARD8*)(data+x), tile_width*4, flags, 0);
+	}
+}
+
+static int
+get_tiled_channel_line( ASImage *im, ColorPart color, CARD32 *to_buf, unsigned int y, int skip, unsigned int out_width )
+{
+	int width = im->width ;
+	ASStorageID *tiles = &(im->channels[color][y*ASIMAGE_ROW_TILES(im)]) ;
+	CARD32 fill = ARGB32_CHAN8(im->back_color,color);
+	Bool has_data = False ;
+	int x, count = 0 ;
+
+	/* same as with plain rows data repeats itself past the right edge : */
+	x = skip%width ;
+	if( x < 0 )
+		x += width ;
+	while( count < (int)out_width )
+	{
+		int tile = x/ASIMAGE_TILE_WIDTH ;
+		int tile_x = x - tile*ASIMAGE_TILE_WIDTH ;
+		int len = MIN(width-x,ASIMAGE_TILE_WIDTH-tile_x) ;
+		int fetched = 0 ;
+
+		if( len > (int)out_width - count )
+			len = out_width - count ;
+		if( tiles[tile] )
+		{
+			fetched = fetch_data32( NULL, tiles[tile], to_buf+count, tile_x, len, 0, NULL);
+			has_data = True ;
+		}
+		while( fetched < len )
+			to_buf[count+(fetched++)] = fill ;
+		count += len ;
+		if( (x += len) >= width )
+			x = 0 ;
+	}
+	return has_data?count:0;
+}
+
 size_t
 asimage_add_line_mono (ASImage * im, ColorPart color, CARD8 value, unsigned int y)
 {
@@ -806,9 +941,29 @@ asimage_add_line_mono (ASImage * im, ColorPart color, CARD8 value, unsigned int
 	if (y >= im->height)
 		return 0;
 	
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{
+		CARD32 chan_data = value ;
+		set_packed_channel_line( im, color, &chan_data, 0, y );
+		TOUCH_ASIMAGE(im);
+		return im->width;
+	}
+	if( get_flags( im->flags, ASIM_TILED ) )
+	{
+		int tiles_count = ASIMAGE_ROW_TILES(im) ;
+		ASStorageID *tiles = &(im->channels[color][y*tiles_count]) ;
+		register int t ;
+		forget_row_tiles( tiles, tiles_count );
+		tiles[0] = store_data( NULL, &value, 1, 0, 0);
+		for( t = 1 ; t < tiles_count ; ++t )
+			tiles[t] = dup_data( NULL, tiles[0] );
+		TOUCH_ASIMAGE(im);
+		return im->width;
+	}
 	if( im->channels[color][y] ) 
 		forget_data( NULL, im->channels[color][y] ); 
 	im->channels[color][y] = store_data( NULL, &value, 1, 0, 0);
+	TOUCH_ASIMAGE(im);
 	return im->width;
 }
 
@@ -819,9 +974,23 @@ asimage_add_line (ASImage * im, ColorPart color, register CARD32 * data, unsigne
 		return 0;
 	if (y >= im->height)
 		return 0;
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{
+		set_packed_channel_line( im, color, data, 1, y );
+		TOUCH_ASIMAGE(im);
+		return im->width;
+	}
+	if( get_flags( im->flags, ASIM_TILED ) )
+	{
+		store_row_tiles( &(im->channels[color][y*ASIMAGE_ROW_TILES(im)]), data, im->width, 
+						 ASStorage_RLEDiffCompress|ASStorage_32Bit );
+		TOUCH_ASIMAGE(im);
+		return im->width;
+	}
 	if( im->channels[color][y] ) 
 		forget_data( NULL, im->channels[color][y] ); 
 	im->channels[color][y] = store_data( NULL, (CARD8*)data, im->width*4, ASStorage_RLEDiffCompress|ASStorage_32Bit, 0);
+	TOUCH_ASIMAGE(im);
 	return im->width;
 }
 
@@ -832,6 +1001,26 @@ asimage_add_line_bgra (ASImage * im, register CARD32 * data, unsigned int y)
 		return 0;
 	if (y >= im->height)
 		return 0;
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{
+		memcpy( im->alt.argb32+y*im->width, data, im->width*sizeof(ARGB32) );
+		TOUCH_ASIMAGE(im);
+		return im->width;
+	}
+	if( get_flags( im->flags, ASIM_TILED ) )
+	{
+		int offset = y*ASIMAGE_ROW_TILES(im) ;
+		store_row_tiles( &(im->channels[IC_ALPHA][offset]), data, im->width, 
+						 ASStorage_24BitShift|ASStorage_Masked|ASStorage_RLEDiffCompress|ASStorage_32Bit );
+		store_row_tiles( &(im->channels[IC_RED][offset]), data, im->width, 
+						 ASStorage_16BitShift|ASStorage_Masked|ASStorage_RLEDiffCompress|ASStorage_32Bit );
+		store_row_tiles( &(im->channels[IC_GREEN][offset]), data, im->width, 
+						 ASStorage_8BitShift|ASStorage_Masked|ASStorage_RLEDiffCompress|ASStorage_32Bit );
+		store_row_tiles( &(im->channels[IC_BLUE][offset]), data, im->width, 
+						 ASStorage_Masked|ASStorage_RLEDiffCompress|ASStorage_32Bit );
+		TOUCH_ASIMAGE(im);
+		return im->width;
+	}
 	if( im->channels[IC_ALPHA][y] ) 
 		forget_data( NULL, im->channels[IC_ALPHA][y] ); 
 	im->channels[IC_ALPHA][y] = store_data( NULL, (CARD8*)data, im->width*4, 
@@ -852,6 +1041,7 @@ asimage_add_line_bgra (ASImage * im, register CARD32 * data, unsigned int y)
 	im->channels[IC_BLUE][y] = store_data( NULL, (CARD8*)data, im->width*4, 
 	                                        ASStorage_Masked|
 											ASStorage_RLEDiffCompress|ASStorage_32Bit, 0);
+	TOUCH_ASIMAGE(im);
 	return im->width;
 }
 
@@ -863,6 +1053,15 @@ asimage_print_line (ASImage * im, ColorPart color, unsigned int y, unsigned long
 	if (y >= im->height)
 		return 0;
 	
+	if( get_flags( im->flags, ASIM_TILED ) )
+	{
+		int tiles_count = ASIMAGE_ROW_TILES(im) ;
+		unsigned int total = 0 ;
+		register int t ;
+		for( t = 0 ; t < tiles_count ; ++t )
+			total += print_storage_slot(NULL, im->channels[color][y*tiles_count+t]);
+		return total;
+	}
 	return print_storage_slot(NULL, im->channels[color][y]);
 }
 
@@ -896,6 +1095,10 @@ asimage_decode_line (ASImage * im, ColorPart color, CARD32 * to_buf, unsigned in
 	/* that thing below is supposedly highly optimized : */
 LOCAL_DEBUG_CALLER_OUT( "im->width = %d, color = %d, y = %d, skip = %d, out_width = %d", im->width, color, y, skip, out_width );
 
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+		return get_packed_channel_line( im, color, to_buf, y, skip, out_width );
+	if( get_flags( im->flags, ASIM_TILED ) )
+		return get_tiled_channel_line( im, color, to_buf, y, skip, out_width );
 	if( id )
 	{
 		i = fetch_data32( NULL, id, to_buf, skip, out_width, 0, NULL);
@@ -914,6 +1117,147 @@ LOCAL_DEBUG_CALLER_OUT( "im->width = %d, color = %d, y = %d, skip = %d, out_widt
 	return 0;
 }
 
+/* when either image is packed, or rows of two images are split into tiles
+ * differently, there is nothing to share between them, so we have to 
+ * actually copy channel values line by line : */
+static void
+copy_decoded_channel_lines( ASImage *dst, int channel_dst, unsigned int offset_dst,
+						   ASImage *src, int channel_src, unsigned int offset_src,
+						   unsigned int nlines )
+{
+	CARD32 *buf = safemalloc( dst->width*sizeof(CARD32) );
+	CARD32 fill = ARGB32_CHAN8(src->back_color,channel_src);
+	unsigned int i ;
+	for( i = 0 ; i < nlines ; ++i )
+	{
+		int count = asimage_decode_line( src, channel_src, buf, offset_src+i, 0, dst->width );
+		while( count < (int)dst->width )
+			buf[count++] = fill ;
+		asimage_add_line( dst, channel_dst, buf, offset_dst+i );
+	}
+	free( buf );
+	TOUCH_ASIMAGE(dst);
+}
+
+static Bool
+asimage_rows_shareable( ASImage *dst, ASImage *src )
+{
+	if( get_flags( dst->flags|src->flags, ASIM_PACKED_ARGB32 ) )
+		return False;
+	if( get_flags( dst->flags|src->flags, ASIM_TILED ) )
+		return ( get_flags( dst->flags&src->flags, ASIM_TILED ) && dst->width == src->width );
+	return True;
+}
+
+Bool
+pack_asimage( ASImage *im )
+{
+	ARGB32 *argb ;
+	CARD32 *buf ;
+	unsigned int y ;
+	int chan, i ;
+
+	if( im == NULL || im->width == 0 || im->height == 0 )
+		return False;
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+		return True;
+	if( get_flags( im->flags, ASIM_DATA_NOT_USEFUL ) && im->alt.argb32 )
+	{	/* channel rows were never written - alt.argb32 is all there is */
+		set_flags( im->flags, ASIM_PACKED_ARGB32 );
+		return True;
+	}
+
+	argb = safemalloc( im->width*im->height*sizeof(ARGB32) );
+	buf = safemalloc( im->width*sizeof(CARD32) );
+	for( y = 0 ; y < im->height ; ++y )
+	{
+		register ARGB32 *row = argb+y*im->width ;
+		for( i = 0 ; i < (int)im->width ; ++i )
+			row[i] = 0 ;
+		for( chan = 0 ; chan < IC_NUM_CHANNELS ; ++chan )
+		{
+			CARD32 fill = ARGB32_CHAN8(im->back_color,chan);
+			int count = asimage_decode_line( im, chan, buf, y, 0, im->width );
+			while( count < (int)im->width )
+				buf[count++] = fill ;
+			for( i = 0 ; i < (int)im->width ; ++i )
+				row[i] |= MAKE_ARGB32_CHAN8(buf[i],chan);
+		}
+	}
+	free( buf );
+
+	for( i = 0 ; i < (int)im->height*ASIMAGE_ROW_TILES(im)*IC_NUM_CHANNELS ; ++i )
+		if( im->red[i] )
+		{
+			forget_data( NULL, im->red[i] );
+			im->red[i] = 0 ;
+		}
+	if( get_flags( im->flags, ASIM_TILED ) )
+	{	/* channel rows are not used by packed images, but could be written 
+		 * by move_asimage_channel() and such later */
+		clear_flags( im->flags, ASIM_TILED );
+		free( im->red );
+		alloc_asimage_channels( im );
+	}
+	if( im->alt.argb32 )
+		free( im->alt.argb32 );
+	im->alt.argb32 = argb ;
+	set_flags( im->flags, ASIM_DATA_NOT_USEFUL|ASIM_PACKED_ARGB32 );
+	TOUCH_ASIMAGE(im);
+	return True;
+}
+
+Bool
+tile_asimage_rows( ASImage *im )
+{
+	ASImage layout ;
+	ASStorageID *tiles, *old_rows ;
+	CARD32 *buf ;
+	int tiles_count, old_count ;
+	unsigned int y ;
+	int chan, i ;
+
+	if( im == NULL || im->width == 0 || im->height == 0 )
+		return False;
+	if( get_flags( im->flags, ASIM_TILED ) )
+		return True;
+
+	/* new rows must be laid out exactly as alloc_asimage_channels() would : */
+	layout.width = im->width ;
+	layout.height = im->height ;
+	layout.flags = ASIM_TILED ;
+	tiles_count = ASIMAGE_ROW_TILES(&layout) ;
+	tiles = safecalloc( im->height*tiles_count*IC_NUM_CHANNELS, sizeof(ASStorageID) );
+	set_asimage_channels( &layout, tiles );
+	buf = safemalloc( im->width*sizeof(CARD32) );
+	for( chan = 0 ; chan < IC_NUM_CHANNELS ; ++chan )
+	{
+		ASStorageID *chan_tiles = layout.channels[chan] ;
+		for( y = 0 ; y < im->height ; ++y )	/* missing rows stay missing */
+			if( asimage_decode_line( im, chan, buf, y, 0, im->width ) >= (int)im->width )
+				store_row_tiles( chan_tiles+y*tiles_count, buf, im->width, 
+								 ASStorage_RLEDiffCompress|ASStorage_32Bit );
+	}
+	free( buf );
+
+	old_rows = im->red ;
+	old_count = im->height*IC_NUM_CHANNELS ;
+	for( i = 0 ; i < old_count ; ++i )
+		if( old_rows[i] )
+			forget_data( NULL, old_rows[i] );
+	free( old_rows );
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{
+		free( im->alt.argb32 );
+		im->alt.argb32 = NULL ;
+		clear_flags( im->flags, ASIM_DATA_NOT_USEFUL|ASIM_PACKED_ARGB32 );
+	}
+	set_flags( im->flags, ASIM_TILED );
+	set_asimage_channels( im, tiles );
+	TOUCH_ASIMAGE(im);
+	return True;
+}
+
 void
 move_asimage_channel( ASImage *dst, int channel_dst, ASImage *src, int channel_src )
 {
@@ -923,13 +1267,28 @@ move_asimage_channel( ASImage *dst, int channel_dst, ASImage *src, int channel_s
 		register int i = MIN(dst->height, src->height);
 		register ASStorageID *dst_rows = dst->channels[channel_dst] ;
 		register ASStorageID *src_rows = src->channels[channel_src] ;
-		while( --i >= 0 )
+		if( !asimage_rows_shareable( dst, src ) )
 		{
-			if( dst_rows[i] )
-				forget_data( NULL, dst_rows[i] );
-			dst_rows[i] = src_rows[i] ;
-			src_rows[i] = 0 ;
+			int src_tiles = ASIMAGE_ROW_TILES(src) ;
+			copy_decoded_channel_lines( dst, channel_dst, 0, src, channel_src, 0, i );
+			while( --i >= 0 )
+				if( get_flags( src->flags, ASIM_PACKED_ARGB32 ) )
+					asimage_add_line_mono( src, channel_src, ARGB32_CHAN8(src->back_color,channel_src), i );
+				else
+					forget_row_tiles( &(src_rows[i*src_tiles]), src_tiles );
+		}else
+		{
+			i *= ASIMAGE_ROW_TILES(src) ;
+			while( --i >= 0 )
+			{
+				if( dst_rows[i] )
+					forget_data( NULL, dst_rows[i] );
+				dst_rows[i] = src_rows[i] ;
+				src_rows[i] = 0 ;
+			}
 		}
+		TOUCH_ASIMAGE(dst);
+		TOUCH_ASIMAGE(src);
 	}
 }
 
@@ -944,12 +1303,19 @@ copy_asimage_channel( ASImage *dst, int channel_dst, ASImage *src, int channel_s
 		register ASStorageID *dst_rows = dst->channels[channel_dst] ;
 		register ASStorageID *src_rows = src->channels[channel_src] ;
 		LOCAL_DEBUG_OUT( "src = %p, dst = %p, dst->width = %d, src->width = %d", src, dst, dst->width, src->width );
+		if( !asimage_rows_shareable( dst, src ) )
+		{
+			copy_decoded_channel_lines( dst, channel_dst, 0, src, channel_src, 0, i );
+			return;
+		}
+		i *= ASIMAGE_ROW_TILES(src) ;
 		while( --i >= 0 )
 		{
 			if( dst_rows[i] )
 				forget_data( NULL, dst_rows[i] );
 			dst_rows[i] = dup_data( NULL, src_rows[i] );
 		}
+		TOUCH_ASIMAGE(dst);
 	}
 }
 
@@ -969,19 +1335,24 @@ copy_asimage_lines( ASImage *dst, unsigned int offset_dst,
 			nlines = dst->height - offset_dst ;
 
 		for( chan = 0 ; chan < IC_NUM_CHANNELS ; ++chan )
-			if( get_flags( filter, 0x01<<chan ) )
+			if( get_flags( filter, 0x01<<chan ) && !asimage_rows_shareable( dst, src ) )
+				copy_decoded_channel_lines( dst, chan, offset_dst, src, chan, offset_src, nlines );
+			else if( get_flags( filter, 0x01<<chan ) )
 			{
 				register int i = -1;
-				register ASStorageID *dst_rows = &(dst->channels[chan][offset_dst]) ;
-				register ASStorageID *src_rows = &(src->channels[chan][offset_src]) ;
+				int tiles_count = ASIMAGE_ROW_TILES(src) ;
+				register ASStorageID *dst_rows = &(dst->channels[chan][offset_dst*tiles_count]) ;
+				register ASStorageID *src_rows = &(src->channels[chan][offset_src*tiles_count]) ;
+				int count = nlines*tiles_count ;
 LOCAL_DEBUG_OUT( "copying %d lines of channel %d...", nlines, chan );
-				while( ++i < (int)nlines )
+				while( ++i < count )
 				{
 					if( dst_rows[i] )
 						forget_data( NULL, dst_rows[i] );
 					dst_rows[i] = dup_data( NULL, src_rows[i] );
 				}
 			}
+		TOUCH_ASIMAGE(dst);
 	}
 }
 
@@ -1006,11 +1377,22 @@ get_asimage_chanmask( ASImage *im)
     ASFlagType mask = 0 ;
 	int color ;
 
-	if( !AS_ASSERT(im) )
+	if( !AS_ASSERT(im) && get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{	/* color is always stored - alpha only counts if it is not opaque */
+		register ARGB32 *data = im->alt.argb32 ;
+		register int i = im->width*im->height ;
+		mask = SCL_DO_COLOR ;
+		while( --i >= 0 )
+			if( (data[i]&0xFF000000) != 0xFF000000 )
+			{
+				set_flags( mask, SCL_DO_ALPHA );
+				break;
+			}
+	}else if( !AS_ASSERT(im) )
 		for( color = 0; color < IC_NUM_CHANNELS ; color++ )
 		{
 			register ASStorageID *chan = im->channels[color];
-			register int y, height = im->height ;
+			register int y, height = im->height*ASIMAGE_ROW_TILES(im) ;
 			for( y = 0 ; y < height ; y++ )
 				if( chan[y] )
 				{
@@ -1069,26 +1451,145 @@ check_asimage_alpha (ASVisual *asv, ASImage *im )
 	return recomended_depth;
 }
 
-static Bool 
-check_line_empty (ASImage *im, CARD32 *buf, int line, int *left_return, int *right_return, int threshold)
+/* ********************************************************************************/
+/* Shape helpers - work on stored rows directly, without decoding them :          */
+/* ********************************************************************************/
+/* Fills runs with pairs of first and last x of spans of values at or above
+ * threshold. Returns number of values in runs, or -1 if row has no data at
+ * all. runs must have room for (width+1)*2 values. */
+static int
+get_asimage_row_runs( ASImage *im, int channel, unsigned int y, unsigned int threshold, unsigned int *runs, CARD32 *buf )
 {
-	int count = asimage_decode_line (im, IC_ALPHA, buf, line, 0, im->width);
-	*left_return = 0 ; 
-	*right_return = im->width-1;
-	int i;
+	int width = im->width ;
+	int count = 0 ;
 
-	if (count < (int)im->width) 
-		return (ARGB32_ALPHA8(im->back_color) <= threshold);
-		
-	for (i = 0 ; i < im->width ; ++i)
-		if ((int)buf[i] <= threshold)		(*left_return)++;
-		else				break;
-		
-	for (i = (int)im->width-1 ; i > *left_return ; --i)
-		if ((int)buf[i] <= threshold)		(*right_return)--;
-		else				break;
-		
-	return (*left_return >= (int)im->width-1);
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{
+		int x, start = -1 ;
+		get_packed_channel_line( im, channel, buf, y, 0, width );
+		for( x = 0 ; x < width ; ++x )
+			if( buf[x] >= threshold )
+			{
+				if( start < 0 )
+					start = x ;
+			}else if( start >= 0 )
+			{
+				runs[count++] = start ;
+				runs[count++] = x-1 ;
+				start = -1 ;
+			}
+		if( start >= 0 )
+		{
+			runs[count++] = start ;
+			runs[count++] = width-1 ;
+		}
+	}else if( get_flags( im->flags, ASIM_TILED ) )
+	{	/* tiles get thresholded separately and then stitched together : */
+		int tiles_count = ASIMAGE_ROW_TILES(im) ;
+		ASStorageID *tiles = &(im->channels[channel][y*tiles_count]) ;
+		Bool back_on = ( ARGB32_CHAN8(im->back_color,channel) >= threshold );
+		Bool has_data = False ;
+		int t, x ;
+		for( t = 0, x = 0 ; t < tiles_count ; ++t, x += ASIMAGE_TILE_WIDTH )
+		{
+			int tile_width = (width-x < ASIMAGE_TILE_WIDTH)? width-x : ASIMAGE_TILE_WIDTH ;
+			int k, tile_count = 0 ;
+			unsigned int *tile_runs = runs+count ;
+
+			if( tiles[t] )
+			{
+				tile_count = threshold_stored_data( NULL, tiles[t], tile_runs, tile_width, threshold );
+				has_data = True ;
+			}else if( back_on )
+			{
+				tile_runs[0] = 0 ;
+				tile_runs[1] = tile_width-1 ;
+				tile_count = 2 ;
+			}
+			if( tile_count <= 0 )
+				continue;
+			for( k = 0 ; k < tile_count ; ++k )
+				tile_runs[k] += x ;
+			if( count > 0 && runs[count-1]+1 == tile_runs[0] )
+			{	/* run continues from the previous tile */
+				runs[count-1] = tile_runs[1] ;
+				for( k = 2 ; k < tile_count ; ++k )
+					runs[count+k-2] = tile_runs[k] ;
+				tile_count -= 2 ;
+			}
+			count += tile_count ;
+		}
+		if( !has_data )
+			return -1;
+	}else
+	{
+		if( im->channels[channel][y] == 0 )
+			return -1;
+		count = threshold_stored_data( NULL, im->channels[channel][y], runs, width, threshold );
+	}
+	return count;
+}
+
+/* Shapes of the same image tend to be requested over and over, so we keep
+ * few recent results around. Revision of the image changes every time it is
+ * modified and is never reused, so it is all we need to validate them : */
+#define ASIMAGE_SHAPE_CACHE_SIZE	8
+
+typedef struct ASImageShapeCacheItem
+{
+	ASImage      *im ;
+	unsigned long revision ;
+	int           channel ;			/* -1 for closure */
+	unsigned int  threshold ;
+	int           closure[4] ;
+	XRectangle   *rects ;
+	unsigned int  rects_count ;
+}ASImageShapeCacheItem;
+
+static ASImageShapeCacheItem asimage_shape_cache[ASIMAGE_SHAPE_CACHE_SIZE];
+static int asimage_shape_cache_next = 0 ;
+
+static ASImageShapeCacheItem *
+find_asimage_shape( ASImage *im, int channel, unsigned int threshold )
+{
+	int i ;
+	for( i = 0 ; i < ASIMAGE_SHAPE_CACHE_SIZE ; ++i )
+	{
+		ASImageShapeCacheItem *item = &(asimage_shape_cache[i]) ;
+		if( item->im == im && item->revision == im->revision &&
+			item->channel == channel && item->threshold == threshold )
+			return item;
+	}
+	return NULL;
+}
+
+static ASImageShapeCacheItem *
+add_asimage_shape( ASImage *im, int channel, unsigned int threshold )
+{
+	ASImageShapeCacheItem *item = &(asimage_shape_cache[asimage_shape_cache_next]) ;
+	if( ++asimage_shape_cache_next >= ASIMAGE_SHAPE_CACHE_SIZE )
+		asimage_shape_cache_next = 0 ;
+	if( item->rects )
+		free( item->rects );
+	memset( item, 0x00, sizeof(ASImageShapeCacheItem));
+	item->im = im ;
+	item->revision = im->revision ;
+	item->channel = channel ;
+	item->threshold = threshold ;
+	return item;
+}
+
+static void
+forget_asimage_shapes( ASImage *im )
+{
+	int i ;
+	for( i = 0 ; i < ASIMAGE_SHAPE_CACHE_SIZE ; ++i )
+		if( asimage_shape_cache[i].im == im )
+		{
+			if( asimage_shape_cache[i].rects )
+				free( asimage_shape_cache[i].rects );
+			memset( &(asimage_shape_cache[i]), 0x00, sizeof(ASImageShapeCacheItem));
+		}
 }
 
 void
@@ -1096,37 +1597,57 @@ get_asimage_closure (ASImage *im, int *left_return, int *top_return, int *right_
 {
 	int left = 0, top = 0;
 	int right = 0, bottom = 0;
-	
-	int left_tmp, right_tmp;
 
 	if (im != NULL) {
-		unsigned int            i;
-		ASScanline     buf;
-		bottom = im->height-1;
-		right = im->width-1;
-		
-		prepare_scanline (im->width, 0, &buf, 0);
-		buf.flags = SCL_DO_ALPHA ;
-/* top */
-		for (; top < im->height; ++top)
-			if (!check_line_empty (im, buf.alpha, top, &left_tmp, &right_tmp, threshold))
-				break;
-/* bottom */
-		for (; bottom > top; --bottom)
-			if (!check_line_empty (im, buf.alpha, bottom, &left_tmp, &right_tmp, threshold))
-				break;
-
-/* sides */
-		if (bottom < top && (left_return != NULL || right_return != NULL)) {
+		ASImageShapeCacheItem *cached = find_asimage_shape (im, -1, threshold);
+		if (cached == NULL) {
+			/* pixel is part of the image if its alpha is above threshold : */
+			unsigned int *runs = safemalloc ((im->width+1)*2*sizeof(unsigned int));
+			CARD32 *buf = get_flags (im->flags, ASIM_PACKED_ARGB32)? safemalloc (im->width*sizeof(CARD32)) : NULL;
+			Bool back_empty = (ARGB32_ALPHA8(im->back_color) <= threshold);
+			unsigned int y;
+			int row_left, row_right;
+
+			top = im->height;
+			bottom = im->height-1;
 			left = im->width-1;
 			right = 0;
-			for (i = top ; i <= bottom ; ++i) {
-				check_line_empty (im, buf.alpha, bottom, &left_tmp, &right_tmp, threshold);
-				if (left_tmp < left) left = left_tmp;
-				if (right_tmp > right) right = right_tmp;
+			for (y = 0; y < im->height; ++y) {
+				int count = get_asimage_row_runs (im, IC_ALPHA, y, threshold+1, runs, buf);
+				if (count < 0) {
+					if (back_empty)
+						continue;
+					row_left = 0;
+					row_right = im->width-1;
+				} else if (count == 0)
+					continue;
+				else {
+					row_left = runs[0];
+					row_right = runs[count-1];
+				}
+				if (top > (int)y)
+					top = y;
+				bottom = y;
+				if (row_left < left) left = row_left;
+				if (row_right > right) right = row_right;
+			}
+			if (top >= (int)im->height) {
+				left = 0;
+				right = im->width-1;
 			}
+			if (buf)
+				free (buf);
+			free (runs);
+			cached = add_asimage_shape (im, -1, threshold);
+			cached->closure[0] = left;
+			cached->closure[1] = top;
+			cached->closure[2] = right;
+			cached->closure[3] = bottom;
 		}
-		free_scanline(&buf, True);
+		left = cached->closure[0];
+		top = cached->closure[1];
+		right = cached->closure[2];
+		bottom = cached->closure[3];
 	}
 	if (left_return)	
 		*left_return = left;
@@ -1168,6 +1689,7 @@ vectorize_asimage( ASImage *im, unsigned int max_colors, unsigned int dither,
 	ASVectorPalette* pal ;
 	double *vec ;
 	ASColormap cmap;
+	int *res ;
     unsigned int r, g, b, v;
 	unsigned int x, y, j ;
 
@@ -1178,25 +1700,8 @@ vectorize_asimage( ASImage *im, unsigned int max_colors, unsigned int dither,
 	/* contributed by Valeriy Onuchin from Root project at cern.ch */   
 
  	dither = dither > 7 ? 7 : dither;
-	{
- 		int *res = colormap_asimage(im, &cmap, max_colors, dither, opaque_threshold);
- 
-    	for ( y = 0; y < im->height; y++) 
-		{
-       		for ( x = 0; x < im->width; x++) 
-			{
-          		int i = y*im->width + x;
-          		g = INDEX_SHIFT_GREEN(cmap.entries[res[i]].green);
-          		b = INDEX_SHIFT_BLUE(cmap.entries[res[i]].blue);
-          		r = INDEX_SHIFT_RED(cmap.entries[res[i]].red);
-          		v = MAKE_INDEXED_COLOR24(r,g,b);
-		        v = (v>>12)&0x0FFF;
-          		vec[(im->height - y - 1)*im->width + x] = ((double)v)/0x0FFF;
-       		}
-    	}
-	
-		free (res);
-	}
+	res = colormap_asimage(im, &cmap, max_colors, dither, opaque_threshold);
+
     pal = safecalloc( 1, sizeof(ASVectorPalette));
 
 	pal->npoints = cmap.count ;	
@@ -1220,6 +1725,19 @@ vectorize_asimage( ASImage *im, unsigned int max_colors, unsigned int dither,
        pal->channels[IC_BLUE][j] = cmap.entries[j].blue<<QUANT_ERR_BITS;
        pal->channels[IC_ALPHA][j] = 0xFFFF;
     }
+
+	/* value of every pixel is that of its palette entry, so we simply look it
+	 * up instead of recomputing it for each pixel. Double data goes from
+	 * bottom to top : */
+	for ( y = 0; y < im->height; y++) 
+	{
+		register int *src = res + y*im->width ;
+		register double *dst = vec + (im->height - y - 1)*im->width ;
+		register double *points = pal->points ;
+		for ( x = 0; x < im->width; x++) 
+			dst[x] = points[src[x]] ;
+	}
+	free (res);
  
     destroy_colormap(&cmap, True);
 
@@ -1238,14 +1756,33 @@ clone_asimage( ASImage *src, ASFlagType filter )
 	if( !AS_ASSERT(src) )
 	{
 		int chan ;
-		dst = create_asimage(src->width, src->height, 100);
+		if( get_flags( src->flags, ASIM_PACKED_ARGB32 ) )
+		{
+			dst = create_packed_asimage(src->width, src->height);
+			dst->back_color = src->back_color ;
+			if( (filter&SCL_DO_ALL) == SCL_DO_ALL )
+				memcpy( dst->alt.argb32, src->alt.argb32, src->width*src->height*sizeof(ARGB32) );
+			else
+			{	/* channels filtered out read back as back_color, as with planar clones */
+				register int i = src->width*src->height ;
+				while( --i >= 0 )
+					dst->alt.argb32[i] = src->back_color ;
+				copy_asimage_lines( dst, 0, src, 0, src->height, filter );
+			}
+			SHOW_TIME("", started);
+			return dst;
+		}
+		if( get_flags( src->flags, ASIM_TILED ) )
+			dst = create_tiled_asimage(src->width, src->height, 100);
+		else
+			dst = create_asimage(src->width, src->height, 100);
 		if( get_flags( src->flags, ASIM_DATA_NOT_USEFUL ) )
 			set_flags( dst->flags, ASIM_DATA_NOT_USEFUL );
 		dst->back_color = src->back_color ;
 		for( chan = 0 ; chan < IC_NUM_CHANNELS;  chan++ )
 			if( get_flags( filter, 0x01<<chan) )
 			{
-				register int i = dst->height;
+				register int i = dst->height*ASIMAGE_ROW_TILES(dst);
 				register ASStorageID *dst_rows = dst->channels[chan] ;
 				register ASStorageID *src_rows = src->channels[chan] ;
 				while( --i >= 0 )
@@ -1265,13 +1802,26 @@ get_asimage_channel_rects( ASImage *src, int channel, unsigned int threshold, un
 {
 	XRectangle *rects = NULL ;
 	int rects_count = 0, rects_allocated = 0 ;
+	ASImageShapeCacheItem *cached ;
 
 	START_TIME(started);
 
-	if( !AS_ASSERT(src) && channel < IC_NUM_CHANNELS )
+	if( src && channel >= 0 && channel < IC_NUM_CHANNELS && 
+		(cached = find_asimage_shape( src, channel, threshold )) != NULL )
+	{
+		if( cached->rects_count > 0 )
+		{
+			rects = safemalloc( cached->rects_count*sizeof(XRectangle));
+			memcpy( rects, cached->rects, cached->rects_count*sizeof(XRectangle));
+		}
+		if( rects_count_ret )
+			*rects_count_ret = cached->rects_count ;
+		return rects;
+	}
+	if( !AS_ASSERT(src) && channel >= 0 && channel < IC_NUM_CHANNELS )
 	{
 		int i = src->height;
-		ASStorageID  *src_rows = src->channels[channel] ;
+		CARD32 *buf = get_flags( src->flags, ASIM_PACKED_ARGB32 )? safemalloc( src->width*sizeof(CARD32) ) : NULL ;
 		unsigned int *height = safemalloc( (src->width+1)*2 * sizeof(unsigned int) );
 		unsigned int *prev_runs = NULL ;
 		int prev_runs_count = 0 ;
@@ -1296,14 +1846,16 @@ get_asimage_channel_rects( ASImage *src, int channel, unsigned int threshold, un
 #endif
 			if( i >= 0 )
 			{
-				if( src_rows[i] )
-				{
-					runs_count = threshold_stored_data(NULL, src_rows[i], runs, src->width, threshold);
-				}else if( count_empty )
+				runs_count = get_asimage_row_runs( src, channel, i, threshold, runs, buf );
+				if( runs_count < 0 )
 				{
-					runs_count = 2 ;
-					runs[0] = 0 ;
-					runs[1] = src->width ;
+					runs_count = 0 ;
+					if( count_empty )
+					{
+						runs_count = 2 ;
+						runs[0] = 0 ;
+						runs[1] = src->width ;
+					}
 				}
 			}
 #ifdef DEBUG_RECTS
@@ -1485,9 +2037,10 @@ get_asimage_channel_rects( ASImage *src, int channel, unsigned int threshold, un
 			}else if( runs_count > 0 )
 			{
 				int k = runs_count;
+				unsigned int *tmp = prev_runs ;
 				prev_runs_count = runs_count ;
 				prev_runs = runs ;
-				runs = safemalloc( (src->width+1)*2 * sizeof(unsigned int) );
+				runs = tmp?tmp:safemalloc( (src->width+1)*2 * sizeof(unsigned int) );
 				while( --k >= 0 )
 					height[k] = 1 ;
 			}
@@ -1498,6 +2051,16 @@ get_asimage_channel_rects( ASImage *src, int channel, unsigned int threshold, un
 		free( tmp_runs );
 		free( tmp_height );
 		free( height );
+		if( buf )
+			free( buf );
+
+		cached = add_asimage_shape( src, channel, threshold );
+		cached->rects_count = rects_count ;
+		if( rects_count > 0 )
+		{
+			cached->rects = safemalloc( rects_count*sizeof(XRectangle));
+			memcpy( cached->rects, rects, rects_count*sizeof(XRectangle));
+		}
 	}
 	SHOW_TIME("", started);
 
@@ -159,6 +159,8 @@ typedef struct ASImage
 									 * in conjunction with
 									 * ASScientificPalette to produce
 									 * actuall ARGB data */
+	struct ASImagePicture *picture; /* server side ARGB32 copy of the image
+									 * used by asimage2drawable_xrender() */
   }alt;
 
   struct ASImageManager *imageman;  /* if not null - then image could be
@@ -183,12 +185,42 @@ typedef struct ASImage
 #define ASIM_RGB_IS_BITMAP		(0x01<<5) 
 #define ASIM_XIMAGE_NOT_USEFUL	(0x01<<6)
 #define ASIM_NAME_IS_FILENAME	(0x01<<7)
+#define ASIM_PACKED_ARGB32		(0x01<<8) /* Image data is kept uncompressed
+										   * in alt.argb32 only - no channel
+										   * rows. See create_packed_asimage()
+										   */
+#define ASIM_TILED				(0x01<<9) /* Channel rows are split into 
+										   * tiles compressed independently.
+										   * See create_tiled_asimage()
+										   */
+#define ASIM_MIPMAPPED			(0x01<<10) /* Keep chain of half resolution
+										   * copies to start downscaling
+										   * from. See get_asimage_mip()
+										   */
+#define ASIM_MIP_LANCZOS		(0x01<<11) /* Build mip levels with Lanczos
+										   * prefilter instead of box one */
 
   ASFlagType			 flags ;    /* combination of the above flags */
+
+  unsigned long          revision ; /* changes every time image data is
+									 * modified, so that copies of it
+									 * kept elsewhere could be validated */
+  struct ASImage        *mip ;      /* half resolution copy of the image,
+									 * built on demand if ASIM_MIPMAPPED
+									 * is set */
+  unsigned long          mip_revision ; /* revision of the image mip was
+  									 * built from */
   
 } ASImage;
 /*******/
 
+/* width of the tile in images with ASIM_TILED flag set, and number of 
+ * tiles each row is split into. Tile n of the channel row y is kept at 
+ * channels[chan][y*ASIMAGE_ROW_TILES(im)+n] : */
+#define ASIMAGE_TILE_WIDTH		256
+#define ASIMAGE_ROW_TILES(im)	(get_flags((im)->flags,ASIM_TILED)? \
+								 ((im)->width+ASIMAGE_TILE_WIDTH-1)/ASIMAGE_TILE_WIDTH:1)
+
 /****d* libAfterImage/LIMITS
  * NAME
  * MAX_IMPORT_IMAGE_SIZE	effectively limits size of the allowed
@@ -447,6 +479,10 @@ typedef struct ASGradient
 
 extern Bool asimage_use_mmx ;
 
+/* every modification of image data gets unique revision number : */
+extern unsigned long asimage_revision_seq ;
+#define TOUCH_ASIMAGE(im)	((im)->revision = ++asimage_revision_seq)
+
 /****f* libAfterImage/asimage/asimage_init()
  * NAME 
  * asimage_init() frees datamembers of the supplied ASImage structure, and
@@ -506,6 +542,63 @@ extern Bool asimage_use_mmx ;
  * Pointer to newly allocated and initialized ASImage structure on
  * Success. NULL in case of any kind of error - that should never happen.
  *********/
+/****f* libAfterImage/asimage/create_packed_asimage()
+ * NAME
+ * create_packed_asimage() creates ASImage that keeps its pixels as 
+ * uncompressed packed ARGB32 array.
+ * NAME
+ * pack_asimage() converts existing ASImage into packed ARGB32 storage.
+ * SYNOPSIS
+ * ASImage *create_packed_asimage( unsigned int width, unsigned int height );
+ * Bool     pack_asimage( ASImage *im );
+ * INPUTS
+ * width       - desired image width
+ * height      - desired image height
+ * im          - image to be converted.
+ * RETURN VALUE
+ * create_packed_asimage() returns pointer to the new ASImage with all 
+ * pixels set to 0. pack_asimage() returns True on success.
+ * DESCRIPTION
+ * Packed images have ASIM_PACKED_ARGB32 flag set and keep pixels in 
+ * im->alt.argb32, with no compression and no per-channel rows. 
+ * Decoding reads pixels straight from that array, and output into such 
+ * an image with ASA_ASImage format writes packed pixels directly, so 
+ * neither planar RLE encoding nor decompression takes place. That is 
+ * meant for small images that get redrawn a lot - buttons, icons, 
+ * glyphs - where codec overhead outweighs memory savings. Results of 
+ * transformations requested with ASA_ARGB32 out_format are packed 
+ * images as well.
+ *********/
+/****f* libAfterImage/asimage/create_tiled_asimage()
+ * NAME
+ * create_tiled_asimage() creates ASImage that keeps each row of its 
+ * channels as a number of independently compressed tiles.
+ * NAME
+ * tile_asimage_rows() converts existing ASImage into tiled storage.
+ * SYNOPSIS
+ * ASImage *create_tiled_asimage( unsigned int width, unsigned int height,
+ *                                unsigned int compression );
+ * Bool     tile_asimage_rows( ASImage *im );
+ * INPUTS
+ * width       - desired image width
+ * height      - desired image height
+ * compression - compression level in new ASImage( see asimage_start()
+ *               for more ).
+ * im          - image to be converted.
+ * RETURN VALUE
+ * create_tiled_asimage() returns pointer to the newly allocated ASImage.
+ * tile_asimage_rows() returns True on success.
+ * DESCRIPTION
+ * Tiled images have ASIM_TILED flag set, and every row of every channel
+ * is stored as ASIMAGE_TILE_WIDTH pixels wide pieces. Rows are already
+ * stored independently, so it takes splitting them horizontally to get 
+ * 2D tiles. Decoding a rectangle out of such image only decompresses 
+ * tiles it overlaps, instead of entire rows. That is meant for huge
+ * images, such as backgrounds spanning several screens, that mostly get 
+ * cropped - for transparency, thumbnails and such. Images wider than 
+ * AS_IMPORT_TILED_MIN_WIDTH get converted into tiled storage as they 
+ * are loaded from files.
+ *********/
 /****f* libAfterImage/asimage/clone_asimage()
  * NAME 
  * clone_asimage()
@@ -556,6 +649,10 @@ void asimage_init (ASImage * im, Bool free_resources);
 void flush_asimage_cache( ASImage *im );
 void asimage_start (ASImage * im, unsigned int width, unsigned int height, unsigned int compression);
 ASImage *create_asimage( unsigned int width, unsigned int height, unsigned int compression);
+ASImage *create_packed_asimage( unsigned int width, unsigned int height );
+Bool pack_asimage( ASImage *im );
+ASImage *create_tiled_asimage( unsigned int width, unsigned int height, unsigned int compression);
+Bool tile_asimage_rows( ASImage *im );
 ASImage *create_static_asimage( unsigned int width, unsigned int height, unsigned int compression);
 ASImage *clone_asimage( ASImage *src, ASFlagType filter );
 void destroy_asimage( ASImage **im );
@@ -100,7 +100,7 @@ static char* cdata_str = XML_CDATA_STR;
  * 	gradient  - render multipoint gradient.
  * 	mirror    - create mirror copy of an image.
  * 	blur      - perform gaussian blur on an image.
- * 	rotate    - rotate/flip image in 90 degree increments.
+ * 	rotate    - rotate image by arbitrary angle.
  * 	scale     - scale an image to arbitrary size.
  * 	slice     - enlarge image to arbitrary size leaving corners unchanged.
  * 	crop      - crop an image to arbitrary size.
@@ -1770,17 +1770,23 @@ handle_asxml_tag_mirror( ASImageXMLState *state, xml_elem_t* doc, xml_elem_t* pa
 
 /****** libAfterImage/asimagexml/rotate
  * NAME
- * rotate - rotate an image in 90 degree increments (flip).
+ * rotate - rotate an image by arbitrary angle.
  * SYNOPSIS
  *  <rotate id="new_id" angle="degrees"
  * 			width="pixels" height="pixels" refid="refid">
   * ATTRIBUTES
  * id       Optional. Image will be given this name for future reference.
- * angle    Required.  Given in degrees.  Possible values are currently
- *          "90", "180", and "270".  Rotates the image through the given
- *          angle.
- * width    Optional.  The result will have this width.
- * height   Optional.  The result will have this height.
+ * angle    Required.  Given in degrees.  Rotates the image
+ *          counterclockwise through the given angle. Multiples of 90
+ *          ( "90", "180", and "270" ) are performed without any
+ *          quality loss; any other angle produces image with
+ *          antialiased transparent edges.
+ * width    Optional.  The result will have this width. For arbitrary
+ *          angles defaults to the width of the bounding box of the
+ *          rotated image.
+ * height   Optional.  The result will have this height. For arbitrary
+ *          angles defaults to the height of the bounding box of the
+ *          rotated image.
  * refid    Optional.  An image ID defined with the "id" parameter for
  *          any previously created image.  If set, percentages in "width"
  *          and "height" will be derived from the width and height of the
@@ -1795,33 +1801,45 @@ handle_asxml_tag_rotate( ASImageXMLState *state, xml_elem_t* doc, xml_elem_t* pa
 	ASImage *result = NULL ;
 	xml_elem_t* ptr ;
 	double angle = 0;
-	int dir = 0;
+	int dir = 0, right_angles ;
+	Bool has_width = False, has_height = False ;
 	LOCAL_DEBUG_OUT("doc = %p, parm = %p, imtmp = %p, width = %d, height = %d", doc, parm, imtmp, width, height );
 	for (ptr = parm ; ptr ; ptr = ptr->next)
+	{
 		if (!strcmp(ptr->tag, "angle")) angle = strtod(ptr->parm, NULL);
+		else if (!strcmp(ptr->tag, "width")) has_width = True;
+		else if (!strcmp(ptr->tag, "height")) has_height = True;
+	}
 
-	angle = fmod(angle, 2 * PI);
-	if (angle > 2 * PI * 7 / 8 || angle < 2 * PI * 1 / 8)
-		dir = 0;
-	else if (angle < 2 * PI * 3 / 8)
-		dir = FLIP_VERTICAL;
-	else if (angle < 2 * PI * 5 / 8)
-		dir = FLIP_UPSIDEDOWN;
-	else
-		dir = FLIP_VERTICAL | FLIP_UPSIDEDOWN;
-	if (dir)
+	angle = fmod(angle, 360.);
+	if( angle < 0 )
+		angle += 360. ;
+	right_angles = (int)floor(angle/90.+0.5);
+	if( fabs(angle - right_angles*90.) < 0.001 )
 	{
-		if( get_flags(dir, FLIP_VERTICAL))
+		if( right_angles == 1 )
+			dir = FLIP_VERTICAL;
+		else if( right_angles == 2 )
+			dir = FLIP_UPSIDEDOWN;
+		else if( right_angles == 3 )
+			dir = FLIP_VERTICAL | FLIP_UPSIDEDOWN;
+		if (dir)
 		{
-			int tmp = width ;
-			width = height ;
-			height = tmp ;
-		}
-		result = flip_asimage(state->asv, imtmp, 0, 0, width, height, dir, ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT);
-		if( state->verbose > 1 )
-			show_progress("Rotating image [%f degrees].", angle);
-	} else
-		result = imtmp;
+			if( get_flags(dir, FLIP_VERTICAL))
+			{
+				int tmp = width ;
+				width = height ;
+				height = tmp ;
+			}
+			result = flip_asimage(state->asv, imtmp, 0, 0, width, height, dir, ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT);
+		} else
+			result = imtmp;
+	}else /* let rotate_asimage() calculate bounding box unless size was requested */
+		result = rotate_asimage(state->asv, imtmp, angle,
+								has_width?width:0, has_height?height:0,
+								ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT);
+	if( result != imtmp && state->verbose > 1 )
+		show_progress("Rotating image [%f degrees].", angle);
 
 	return result;
 }
@@ -1576,9 +1576,6 @@ typedef struct
 {
 	int offset ; 
 	void *buffer ;
-	
-	unsigned int threshold ;
-	int start, end, runs_count ;
 }ASStorageDstBuffer;
 
 typedef void (*data_cpy_func_type)(ASStorageDstBuffer *, void *, size_t);
@@ -1600,64 +1597,6 @@ static void card8_card32_cpy( ASStorageDstBuffer *dst, void *src, size_t size)
 		dst32[i] = src8[i] ;
 }	 
 
-static void 
-card8_threshold( ASStorageDstBuffer *dst, void *src, size_t size)
-{
-	CARD8 *src8 = src ;
-	unsigned int *runs = (unsigned int*)(dst->buffer) ;
-	int runs_count = dst->runs_count ;
-	unsigned int threshold = dst->threshold ;
-	int start = dst->start, end = dst->end;
-	int i = 0;
-
-#ifdef DEBUG_THRESHOLD	  
-	fprintf( stderr, "card8_threshold:enter: start = %d, end = %d, runs_count = %d, size = %d\n", 
-			 start, end, runs_count, size );
-#endif
-
-	while( i < (int)size ) 
-	{
-		if( end < start ) 
-		{
-			while( i < (int)size && src8[i] < threshold ) 
-				++i ;
-			start = i ;
-		}	 
-#ifdef DEBUG_THRESHOLD	  
-		fprintf( stderr, "card8_threshold:1: start = %d, end = %d, i = %d\n", start, end, i );
-#endif
-		
-		if( i < (int)size ) 
-		{	
-			while( i < (int)size && src8[i] >= threshold ) 
-				++i ;
-			end = i-1 ;
-		}
-#ifdef DEBUG_THRESHOLD	  
-		fprintf( stderr, "card8_threshold:2: start = %d, end = %d, i = %d\n", start, end, i );
-#endif
-		
-		if( start >= 0 && end >= start )
-		{
-			runs[runs_count] = start ;
-			++runs_count;
-			runs[runs_count] = end ;
-			++runs_count ;
-#ifdef DEBUG_THRESHOLD	  
-			fprintf( stderr, "card8_threshold:3: runs_count = %d\n", runs_count );
-#endif
-			end = -1 ;
-		}
-	}
-#ifdef DEBUG_THRESHOLD	  
-	fprintf( stderr, "card8_threshold:exit: start = %d, end = %d, runs_count = %d, size = %d\n", 
-			 start, end, runs_count, size );
-#endif
-	dst->runs_count = runs_count ;
-	dst->start = start ; 
-	dst->end = end ;
-}	 
-
 static int  
 fetch_data_int( ASStorage *storage, ASStorageID id, ASStorageDstBuffer *buffer, int offset, int buf_size, CARD8 bitmap_value, 
 		  		data_cpy_func_type cpy_func, int *original_size)
@@ -1897,39 +1836,180 @@ fetch_data32(ASStorage *storage, ASStorageID id, CARD32 *buffer, int offset, int
 	return 0 ;	
 }
 
+/* Thresholding is done directly on compressed data, so that long runs of 
+ * the same value ( fully transparent or opaque areas of the alpha channel )
+ * cost as much as a single value, and nothing gets written into 
+ * decompression buffer : */
+typedef struct ASThresholdState
+{
+	unsigned int *runs ;
+	int runs_count ;
+	int run_start ;			/* -1 when not inside of the run */
+	int x, max_x ;
+	unsigned int threshold ;
+}ASThresholdState;
+
+static inline void
+threshold_span( ASThresholdState *st, unsigned int value, int len )
+{
+	if( len <= 0 || st->x >= st->max_x )
+		return;
+	if( value >= st->threshold )
+	{
+		if( st->run_start < 0 )
+			st->run_start = st->x ;
+	}else if( st->run_start >= 0 )
+	{
+		st->runs[st->runs_count++] = st->run_start ;
+		st->runs[st->runs_count++] = st->x-1 ;
+		st->run_start = -1 ;
+	}
+	st->x += len ;
+}
+
+static void
+threshold_rlediff_data( ASThresholdState *st, CARD8 *data, int size )
+{
+	int in_bytes = 1 ;
+	CARD8 last_val = data[0] ;
+
+	threshold_span( st, last_val, 1 );
+	while( in_bytes < size && st->x < st->max_x )
+	{
+		CARD8 c = data[in_bytes++] ;
+		int count ;
+
+		if( (c & RLE_ZERO_MASK) == 0 )
+		{
+			threshold_span( st, last_val, (int)c+1 );
+			continue;
+		}
+		if( (c & RLE_NOZERO_SHORT_MASK ) == RLE_NOZERO_SHORT_SIG )
+		{
+			count = (c & RLE_NOZERO_SHORT_LENGTH)+1 ;
+			while( --count >= 0 )
+			{
+				CARD8 mod = ((data[in_bytes]>>4)&0x07)+1;
+				last_val = (data[in_bytes]&0x80)?last_val - mod : last_val + mod ;
+				threshold_span( st, last_val, 1 );
+				if( --count >= 0 )
+				{
+					mod = (data[in_bytes]&0x07)+1;
+					last_val = (data[in_bytes]&0x08)?last_val - mod : last_val + mod ;
+					threshold_span( st, last_val, 1 );
+				}
+				++in_bytes ;
+			}
+			continue;
+		}
+		count = (c & RLE_NOZERO_LONG_LENGTH)+1 ;
+		if( (c & RLE_NOZERO_LONG_MASK ) == RLE_NOZERO_LONG1_SIG )
+		{
+			while( count > 0 )
+			{
+				int k ;
+				for( k = 6 ; k >= 0 && --count >= 0 ; k -= 2 )
+				{
+					CARD8 mod = ((data[in_bytes]>>k)&0x01)+1;
+					last_val = ((data[in_bytes]>>(k+1))&0x01)?last_val - mod : last_val + mod ;
+					threshold_span( st, last_val, 1 );
+				}
+				++in_bytes ;
+			}
+		}else if( (c & RLE_NOZERO_LONG_MASK ) == RLE_NOZERO_LONG2_SIG )
+		{
+			while( --count >= 0 )
+			{
+				CARD8 mod = (data[in_bytes]&0x7F)+8;
+				last_val = (data[in_bytes]&0x80)?last_val - mod : last_val + mod ;
+				threshold_span( st, last_val, 1 );
+				++in_bytes ;
+			}
+		}else
+		{
+			Bool sign = ((c & RLE_NOZERO_LONG_MASK ) == RLE_9BIT_NEG_SIG);
+			while( --count >= 0 )
+			{
+				CARD8 mod = data[in_bytes];
+				last_val = sign? last_val - mod : last_val + mod ;
+				sign = !sign ;
+				threshold_span( st, last_val, 1 );
+				++in_bytes ;
+			}
+		}
+	}
+}
+
+static void
+threshold_slot_data( ASThresholdState *st, ASStorageSlot *slot, CARD8 bitmap_value )
+{
+	CARD8 *data = ASStorage_Data(slot) ;
+	int i ;
+
+	if( !get_flags( slot->flags, ASStorage_RLEDiffCompress ) )
+	{
+		for( i = 0 ; i < slot->uncompressed_size && st->x < st->max_x ; ++i )
+			threshold_span( st, data[i], 1 );
+	}else if( get_flags( slot->flags, ASStorage_Bitmap ) )
+	{	/* runs alternate between 0 and bitmap_value, starting with 0 : */
+		CARD8 curr_val = 0 ;
+		for( i = 0 ; i < (int)slot->size && st->x < st->max_x ; ++i )
+		{
+			threshold_span( st, curr_val, data[i] );
+			curr_val = (curr_val == bitmap_value)? 0 : bitmap_value ;
+		}
+	}else
+		threshold_rlediff_data( st, data, slot->size );
+}
+
 int  
 threshold_stored_data(ASStorage *storage, ASStorageID id, unsigned int *runs, int width, unsigned int threshold)
 {
+	ASStorageSlot *slot ;
+	ASThresholdState st ;
+	CARD8 bitmap_value = (CARD8)threshold ;
+
 	if( storage == NULL ) 
 		storage = get_default_asstorage();
-	
-	if( storage != NULL && id != 0 )
-	{
-		ASStorageDstBuffer buf ; 
-		int dumm = 0 ;
-		buf.offset = 0 ; 
-		buf.buffer = runs ;
+	if( storage == NULL || id == 0 || width <= 0 )
+		return 0;
 
-		buf.threshold = threshold ; 
-		buf.start = 0 ;
-		buf.end = -1 ;
-		buf.runs_count = 0 ;
+	while( (slot = find_storage_slot( find_storage_block( storage, id ), id )) != NULL &&
+		   get_flags( slot->flags, ASStorage_Reference) )
+	{
+		ASStorageID target_id = 0;
+		memcpy( &target_id, ASStorage_Data(slot), sizeof( ASStorageID ));
+		if( target_id == 0 || target_id == id )
+			return 0;
+		id = target_id ;
+	}
+	if( slot == NULL || slot->uncompressed_size <= 0 )
+		return 0;
 #ifdef DEBUG_THRESHOLD	  
-		fprintf( stderr, "threshold_stored_data: id = 0x%lX, width = %d, threshold = %d\n", id, width, threshold );
+	fprintf( stderr, "threshold_stored_data: id = 0x%lX, width = %d, threshold = %d\n", id, width, threshold );
 #endif
-		if( fetch_data_int( storage, id, &buf, 0, width, (CARD8)threshold, card8_threshold, &dumm) > 0 ) 
-		{
-			if( buf.start >= 0 && buf.end >= buf.start )
-			{
-				runs[buf.runs_count] = buf.start ;
-				++buf.runs_count;
-				runs[buf.runs_count] = buf.end ;
-				++buf.runs_count ;
-			}	 
-			return buf.runs_count;
-		}
+	/* same bitmap value as we'd get decompressing with threshold as bitmap value: */
+	if( bitmap_value == 0 ) 
+		bitmap_value = AS_STORAGE_DEFAULT_BMAP_VALUE ;
+
+	st.runs = runs ;
+	st.runs_count = 0 ;
+	st.run_start = -1 ;
+	st.x = 0 ;
+	st.max_x = width ;
+	st.threshold = threshold ;
+	/* short data is repeated to fill the width, unless it is not tileable : */
+	do
+	{
+		threshold_slot_data( &st, slot, bitmap_value );
+	}while( st.x < width && !get_flags( slot->flags, ASStorage_NotTileable ) );
+
+	if( st.run_start >= 0 )
+	{
+		runs[st.runs_count++] = st.run_start ;
+		runs[st.runs_count++] = MIN(st.x,width)-1 ;
 	}
-	return 0 ;	
+	return st.runs_count;
 }
 
 
@@ -42,6 +42,12 @@
 #endif
 #include "asvisual.h"
 #include "scanline.h"
+#include "asimage.h"
+#include "ximage.h"
+
+#ifdef HAVE_MMX
+#include <mmintrin.h>
+#endif
 
 #if defined(XSHMIMAGE) && !defined(X_DISPLAY_MISSING)
 # include <sys/ipc.h>
@@ -400,6 +406,7 @@ destroy_asvisual( ASVisual *asv, Bool reusable )
 #endif
 		if( asv->scratch_window )
 			XDestroyWindow( asv->dpy, asv->scratch_window );
+		destroy_asvisual_pixmap_cache( asv );
 
 #endif /*ifndef X_DISPLAY_MISSING */
 		if( !reusable )
@@ -1206,8 +1213,11 @@ void remove_shm_area( ASShmArea *area, Bool free_resources )
 
 }
 
+static void destroy_shm_upload_slots();
+
 void flush_shm_cache( )
 {
+	destroy_shm_upload_slots();
 	if( xshmimage_images )
 		destroy_ashash( &xshmimage_images );
 	if( xshmimage_segments )
@@ -1286,8 +1296,12 @@ destroy_xshmimage_segment(ASHashableValue value, void *data)
 	}
 }
 
+static Bool complete_shm_upload_slot( ShmSeg shmseg );
+
 Bool destroy_xshm_segment( ShmSeg shmseg )
 {
+	if( complete_shm_upload_slot( shmseg ) )
+		return True ;
 	if( xshmimage_segments )
 	{
 		if(remove_hash_item( xshmimage_segments, AS_HASHABLE(shmseg), NULL, True ) == ASH_Success)
@@ -1468,6 +1482,158 @@ XImage *ASGetXImage( ASVisual *asv, Drawable d,
 		xim = XGetImage( asv->dpy, d, x, y, width, height, plane_mask, ZPixmap );
 	return xim ;
 }
+
+/* Pipelined uploads : large images are sent to the server in bands of rows
+ * through a small ring of segments that stay attached between calls. While
+ * the server is still copying from one segment the next band is encoded into
+ * the other one, and a segment is only reused once its ShmCompletion arrives,
+ * so encoding overlaps with the server side copy instead of following it. */
+#define ASSHM_UPLOAD_SLOTS	2
+
+typedef struct ASShmUploadSlot
+{
+	Display 		*dpy ;                   /* display segment is attached to */
+	Visual 			*visual ;                /* ximage was created for */
+	int 			 completion_type ;
+	XShmSegmentInfo  segment ;
+	XImage 			*ximage ;
+	Bool 			 attached ;
+	Bool 			 pending ;               /* waiting for ShmCompletion */
+	unsigned long 	 request ;               /* serial of the XShmPutImage */
+}ASShmUploadSlot;
+
+static ASShmUploadSlot shm_upload_slots[ASSHM_UPLOAD_SLOTS] ;
+static int shm_upload_next_slot = 0 ;
+
+static Bool
+complete_shm_upload_slot( ShmSeg shmseg )
+{
+	int i ;
+	for( i = 0 ; i < ASSHM_UPLOAD_SLOTS ; ++i )
+		if( shm_upload_slots[i].attached && shm_upload_slots[i].segment.shmseg == shmseg )
+		{
+			LOCAL_DEBUG_OUT( "XSHMIMAGE> UPLOAD : slot %d completed", i );
+			shm_upload_slots[i].pending = False ;
+			return True;
+		}
+	return False;
+}
+
+static Bool
+is_shm_upload_completion( Display *dpy, XEvent *event, XPointer arg )
+{
+	ASShmUploadSlot *slot = (ASShmUploadSlot*)arg ;
+	return ( event->type == slot->completion_type &&
+			 ((XShmCompletionEvent*)event)->shmseg == slot->segment.shmseg );
+}
+
+static void
+wait_shm_upload_slot( ASShmUploadSlot *slot )
+{
+	/* the application's event loop may have already passed completion to
+	 * destroy_xshm_segment(), otherwise we pull it off the queue ourselves.
+	 * It could also have been pulled off and dropped by the application
+	 * without telling us, so we can't block waiting for it - instead if the
+	 * server may still be working on our request we make a round trip, after
+	 * which the segment is free whether or not completion ever shows up : */
+	if( slot->pending )
+	{
+		XEvent event ;
+		if( !XCheckIfEvent( slot->dpy, &event, is_shm_upload_completion, (XPointer)slot ) )
+			if( (long)(LastKnownRequestProcessed( slot->dpy ) - slot->request) < 0 )
+			{
+				XSync( slot->dpy, False );
+				XCheckIfEvent( slot->dpy, &event, is_shm_upload_completion, (XPointer)slot );
+			}
+		slot->pending = False ;
+	}
+}
+
+static void
+release_shm_upload_slot( ASShmUploadSlot *slot )
+{
+	if( slot->attached )
+	{
+		wait_shm_upload_slot( slot );
+		XShmDetach( slot->dpy, &(slot->segment) );
+		really_destroy_shm_area( slot->segment.shmaddr, slot->segment.shmid );
+	}
+	if( slot->ximage )
+		XFree( slot->ximage );
+	memset( slot, 0x00, sizeof(ASShmUploadSlot) );
+}
+
+static void
+destroy_shm_upload_slots()
+{
+	int i ;
+	for( i = 0 ; i < ASSHM_UPLOAD_SLOTS ; ++i )
+		release_shm_upload_slot( &(shm_upload_slots[i]) );
+	shm_upload_next_slot = 0 ;
+}
+
+XImage *
+get_shm_upload_ximage( ASVisual *asv, unsigned int width, unsigned int height )
+{
+	ASShmUploadSlot *slot ;
+	XImage *xim ;
+	int rows ;
+
+	if( asv == NULL || !_as_use_shm_images || width == 0 || height == 0 )
+		return NULL;
+
+	slot = &(shm_upload_slots[shm_upload_next_slot]);
+	/* slot may have been last used with some other display : */
+	if( slot->dpy != NULL && slot->dpy != asv->dpy )
+		release_shm_upload_slot( slot );
+	wait_shm_upload_slot( slot );
+	if( !slot->attached )
+	{
+		slot->segment.shmaddr = get_shm_area( ASSHM_UPLOAD_BAND_SIZE, &(slot->segment.shmid) );
+		if( slot->segment.shmid == -1 )
+			return NULL;
+		slot->segment.readOnly = False ;
+		XShmAttach( asv->dpy, &(slot->segment) );
+		slot->dpy = asv->dpy ;
+		slot->completion_type = XShmGetEventBase( asv->dpy ) + ShmCompletion ;
+		slot->attached = True ;
+	}
+
+	xim = slot->ximage ;
+	if( xim == NULL || xim->width != (int)width ||
+		slot->visual != asv->visual_info.visual || xim->depth != (int)asv->visual_info.depth )
+	{
+		if( xim )
+			XFree( xim );
+		slot->ximage = xim = XShmCreateImage( asv->dpy, asv->visual_info.visual, asv->visual_info.depth,
+			                                  ZPixmap, slot->segment.shmaddr, &(slot->segment), width, 1 );
+		slot->visual = asv->visual_info.visual ;
+		if( xim == NULL )
+			return NULL;
+	}
+	rows = ASSHM_UPLOAD_BAND_SIZE/xim->bytes_per_line ;
+	if( rows <= 0 )
+		return NULL;                           /* single row won't fit - let caller use regular upload */
+	xim->height = MIN((int)height,rows);
+	return xim;
+}
+
+Bool
+put_shm_upload_ximage( ASVisual *asv, XImage *xim, Drawable d, GC gc, int dest_x, int dest_y )
+{
+	ASShmUploadSlot *slot = &(shm_upload_slots[shm_upload_next_slot]);
+
+	if( asv == NULL || xim == NULL || xim != slot->ximage || slot->dpy != asv->dpy )
+		return False;
+	slot->request = NextRequest( asv->dpy );
+	if( !XShmPutImage( asv->dpy, d, gc, xim, 0, 0, dest_x, dest_y, xim->width, xim->height, True ) )
+		return False;
+	/* server has to start copying this band while we encode the next one : */
+	XFlush( asv->dpy );
+	slot->pending = True ;
+	shm_upload_next_slot = (shm_upload_next_slot+1)%ASSHM_UPLOAD_SLOTS ;
+	return True;
+}
 #else
 
 Bool enable_shmem_images (){return False; }
@@ -1487,6 +1653,9 @@ Bool ASPutXImage( ASVisual *asv, Drawable d, GC gc, XImage *xim,
 #endif
 }
 
+XImage *get_shm_upload_ximage( ASVisual *asv, unsigned int width, unsigned int height ) {return NULL ;}
+Bool put_shm_upload_ximage( ASVisual *asv, XImage *xim, Drawable d, GC gc, int dest_x, int dest_y ) {return False ;}
+
 XImage * ASGetXImage( ASVisual *asv, Drawable d,
                   int x, int y, unsigned int width, unsigned int height,
 				  unsigned long plane_mask )
@@ -1790,6 +1959,148 @@ void pixel2color15rgb(ASVisual *asv, unsigned long pixel, CARD32 *red, CARD32 *g
 void pixel2color15bgr(ASVisual *asv, unsigned long pixel, CARD32 *red, CARD32 *green, CARD32 *blue)
 {}
 
+/* Pack/unpack kernels shared by the 32/16/15bpp converters below. Pixels are
+ * independent of each other here, so the MMX versions handle 2 (32bpp) or
+ * 4 (16/15bpp) pixels at a time and leave the remainder to the scalar loop.
+ * Shift counts are given for the pixel layout : s1 is the shift of c1,
+ * s2 of c2, etc. */
+static inline void
+pack_argb32_row( CARD32 *dst, CARD32 *c1, CARD32 *c2, CARD32 *c3, CARD32 *c4,
+				 int s1, int s2, int s3, int s4, int len )
+{
+	register int i = 0 ;
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 2 )
+	{
+		__m64 *vdst = (__m64*)dst ;
+		__m64 *v1 = (__m64*)c1, *v2 = (__m64*)c2, *v3 = (__m64*)c3, *v4 = (__m64*)c4 ;
+		int vlen = len>>1 ;
+		do
+		{
+			vdst[i] = _mm_or_si64( _mm_or_si64( _mm_slli_pi32( v1[i], s1 ), _mm_slli_pi32( v2[i], s2 ) ),
+								   _mm_or_si64( _mm_slli_pi32( v3[i], s3 ), _mm_slli_pi32( v4[i], s4 ) ) );
+		}while( ++i < vlen );
+		_mm_empty();
+		i = vlen<<1 ;
+	}
+#endif
+	for( ; i < len ; ++i )
+		dst[i] = (c1[i]<<s1)|(c2[i]<<s2)|(c3[i]<<s3)|(c4[i]<<s4);
+}
+
+static inline void
+unpack_argb32_row( CARD32 *src, CARD32 *c1, CARD32 *c2, CARD32 *c3, CARD32 *c4,
+				   int s1, int s2, int s3, int s4, int len )
+{
+	register int i = 0 ;
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 2 )
+	{
+		__m64 *vsrc = (__m64*)src ;
+		__m64 *v1 = (__m64*)c1, *v2 = (__m64*)c2, *v3 = (__m64*)c3, *v4 = (__m64*)c4 ;
+		__m64 mask = _mm_set1_pi32( 0x000000FF );
+		int vlen = len>>1 ;
+		do
+		{
+			register __m64 v = vsrc[i] ;
+			v1[i] = _mm_and_si64( _mm_srli_pi32( v, s1 ), mask );
+			v2[i] = _mm_and_si64( _mm_srli_pi32( v, s2 ), mask );
+			v3[i] = _mm_and_si64( _mm_srli_pi32( v, s3 ), mask );
+			v4[i] = _mm_and_si64( _mm_srli_pi32( v, s4 ), mask );
+		}while( ++i < vlen );
+		_mm_empty();
+		i = vlen<<1 ;
+	}
+#endif
+	for( ; i < len ; ++i )
+	{
+		c1[i] = (src[i]>>s1)&0x0ff;
+		c2[i] = (src[i]>>s2)&0x0ff;
+		c3[i] = (src[i]>>s3)&0x0ff;
+		c4[i] = (src[i]>>s4)&0x0ff;
+	}
+}
+
+#ifdef HAVE_MMX
+/* widens 4 16bit values into 2 pairs of 32bit channel values : */
+#define MMX_STORE_16TO32(dst,v,zero) \
+	do{ (dst)[0] = _mm_unpacklo_pi16((v),(zero)); (dst)[1] = _mm_unpackhi_pi16((v),(zero)); }while(0)
+#endif
+
+/* returns number of pixels converted, remaining pixels are left for the
+ * scalar loop of the caller : */
+static inline int
+unpack_565_row( CARD16 *src, CARD32 *r, CARD32 *g, CARD32 *b, Bool swapped, int len )
+{
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 4 )
+	{
+		register int i = 0 ;
+		__m64 *vsrc = (__m64*)src ;
+		__m64 zero = _mm_setzero_si64();
+		int vlen = len>>2 ;
+		do
+		{
+			register __m64 v = vsrc[i], vr, vg, vb ;
+			if( swapped )
+			{
+				vr = _mm_and_si64( v, _mm_set1_pi16( 0x00F8 ) );
+				vg = _mm_or_si64( _mm_slli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x0007 ) ), 5 ),
+								  _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( (short)0xE000 ) ), 11 ) );
+				vb = _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x1F00 ) ), 5 );
+			}else
+			{
+				vr = _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( (short)0xF800 ) ), 8 );
+				vg = _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x07E0 ) ), 3 );
+				vb = _mm_slli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x001F ) ), 3 );
+			}
+			MMX_STORE_16TO32( (__m64*)&r[i<<2], vr, zero );
+			MMX_STORE_16TO32( (__m64*)&g[i<<2], vg, zero );
+			MMX_STORE_16TO32( (__m64*)&b[i<<2], vb, zero );
+		}while( ++i < vlen );
+		_mm_empty();
+		return vlen<<2 ;
+	}
+#endif
+	return 0;
+}
+
+static inline int
+unpack_555_row( CARD16 *src, CARD32 *r, CARD32 *g, CARD32 *b, Bool swapped, int len )
+{
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 4 )
+	{
+		register int i = 0 ;
+		__m64 *vsrc = (__m64*)src ;
+		__m64 zero = _mm_setzero_si64();
+		int vlen = len>>2 ;
+		do
+		{
+			register __m64 v = vsrc[i], vr, vg, vb ;
+			if( swapped )
+			{
+				vr = _mm_slli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x007C ) ), 1 );
+				vg = _mm_or_si64( _mm_slli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x0003 ) ), 6 ),
+								  _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( (short)0xE000 ) ), 10 ) );
+				vb = _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x1F00 ) ), 5 );
+			}else
+			{
+				vr = _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x7C00 ) ), 7 );
+				vg = _mm_srli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x03E0 ) ), 2 );
+				vb = _mm_slli_pi16( _mm_and_si64( v, _mm_set1_pi16( 0x001F ) ), 3 );
+			}
+			MMX_STORE_16TO32( (__m64*)&r[i<<2], vr, zero );
+			MMX_STORE_16TO32( (__m64*)&g[i<<2], vg, zero );
+			MMX_STORE_16TO32( (__m64*)&b[i<<2], vb, zero );
+		}while( ++i < vlen );
+		_mm_empty();
+		return vlen<<2 ;
+	}
+#endif
+	return 0;
+}
+
 void ximage2scanline32(ASVisual *asv, XImage *xim, ASScanline *sl, int y,  register unsigned char *xim_data )
 {
 	register CARD32 *r = sl->xc1+sl->offset_x, *g = sl->xc2+sl->offset_x, *b = sl->xc3+sl->offset_x;
@@ -1797,87 +2108,75 @@ void ximage2scanline32(ASVisual *asv, XImage *xim, ASScanline *sl, int y,  regis
 	int i = MIN((unsigned int)(xim->width),sl->width-sl->offset_x);
 	register CARD32 *src = (CARD32*)xim_data ;
 /*	src += sl->offset_x; */
-/*fprintf( stderr, "%d: ", y);*/
 
 #ifdef WORDS_BIGENDIAN
 	if( !asv->msb_first )
 #else
 	if( asv->msb_first )
 #endif
-	{
-		while (--i >= 0)
-		{
-			b[i] = (src[i]>>24)&0x0ff;
-			g[i] = (src[i]>>16)&0x0ff;
-			r[i] = (src[i]>>8)&0x0ff;
-			a[i] = src[i]&0x0ff;
-/*			fprintf( stderr, "[%d->%8.8X %8.8X %8.8X %8.8X = %8.8X]", i, r[i], g[i], b[i], a[i], src[i]);*/
-		}
-	}else
-	{
-		while (--i >= 0)
-		{
-			a[i] = (src[i]>>24)&0x0ff;
-			r[i] = (src[i]>>16)&0x0ff;
-			g[i] = (src[i]>>8)&0x0ff;
-			b[i] =  src[i]&0x0ff;
-		}
-	}
-/*fprintf( stderr, "\n");*/
+		unpack_argb32_row( src, b, g, r, a, 24, 16, 8, 0, i );
+	else
+		unpack_argb32_row( src, a, r, g, b, 24, 16, 8, 0, i );
 }
 
 void ximage2scanline16( ASVisual *asv, XImage *xim, ASScanline *sl, int y,  register unsigned char *xim_data )
 {
-	register int i = MIN((unsigned int)(xim->width),sl->width-sl->offset_x)-1;
+	int len = MIN((unsigned int)(xim->width),sl->width-sl->offset_x);
+	register int i ;
 	register CARD16 *src = (CARD16*)xim_data ;
     register CARD32 *r = sl->xc1+sl->offset_x, *g = sl->xc2+sl->offset_x, *b = sl->xc3+sl->offset_x;
 #ifdef WORDS_BIGENDIAN
-	if( !asv->msb_first )
+	Bool swapped = !asv->msb_first ;
 #else
-	if( asv->msb_first )
+	Bool swapped = asv->msb_first ;
 #endif
-		do
+	i = unpack_565_row( src, r, g, b, swapped, len );
+	if( swapped )
+		for( ; i < len ; ++i )
 		{
 #define ENCODE_MSBF_565(r,gh3,gl3,b)	(((gh3)&0x0007)|((gl3)&0xE000)|((r)&0x00F8)|((b)&0x1F00))
 			r[i] =  (src[i]&0x00F8);
 			g[i] = ((src[i]&0x0007)<<5)|((src[i]&0xE000)>>11);
 			b[i] =  (src[i]&0x1F00)>>5;
-		}while( --i >= 0);
+		}
 	else
-		do
+		for( ; i < len ; ++i )
 		{
 #define ENCODE_LSBF_565(r,g,b) (((g)&0x07E0)|((r)&0xF800)|((b)&0x001F))
 			r[i] =  (src[i]&0xF800)>>8;
 			g[i] =  (src[i]&0x07E0)>>3;
 			b[i] =  (src[i]&0x001F)<<3;
-		}while( --i >= 0);
+		}
 
 }
 void ximage2scanline15( ASVisual *asv, XImage *xim, ASScanline *sl, int y,  register unsigned char *xim_data )
 {
-	register int i = MIN((unsigned int)(xim->width),sl->width-sl->offset_x)-1;
+	int len = MIN((unsigned int)(xim->width),sl->width-sl->offset_x);
+	register int i ;
 	register CARD16 *src = (CARD16*)xim_data ;
     register CARD32 *r = sl->xc1+sl->offset_x, *g = sl->xc2+sl->offset_x, *b = sl->xc3+sl->offset_x;
 #ifdef WORDS_BIGENDIAN
-	if( !asv->msb_first )
+	Bool swapped = !asv->msb_first ;
 #else
-	if( asv->msb_first )
+	Bool swapped = asv->msb_first ;
 #endif
-		do
+	i = unpack_555_row( src, r, g, b, swapped, len );
+	if( swapped )
+		for( ; i < len ; ++i )
 		{
 #define ENCODE_MSBF_555(r,gh2,gl3,b)	(((gh2)&0x0003)|((gl3)&0xE000)|((r)&0x007C)|((b)&0x1F00))
 			r[i] =  (src[i]&0x007C)<<1;
 			g[i] = ((src[i]&0x0003)<<6)|((src[i]&0xE000)>>10);
 			b[i] =  (src[i]&0x1F00)>>5;
-		}while( --i >= 0);
+		}
 	else
-		do
+		for( ; i < len ; ++i )
 		{
 #define ENCODE_LSBF_555(r,g,b) (((g)&0x03E0)|((r)&0x7C00)|((b)&0x001F))
 			r[i] =  (src[i]&0x7C00)>>7;
 			g[i] =  (src[i]&0x03E0)>>2;
 			b[i] =  (src[i]&0x001F)<<3;
-		}while( --i >= 0);
+		}
 }
 
 #ifndef X_DISPLAY_MISSING
@@ -1992,20 +2291,14 @@ void scanline2ximage32( ASVisual *asv, XImage *xim, ASScanline *sl, int y,  regi
 	register int i = MIN((unsigned int)(xim->width),sl->width-sl->offset_x);
 	register CARD32 *src = (CARD32*)xim_data;
 /*	src += sl->offset_x ; */
-/*fprintf( stderr, "%d: ", y);*/
 #ifdef WORDS_BIGENDIAN
 	if( !asv->msb_first )
 #else
 	if( asv->msb_first )
 #endif
-		while( --i >= 0)
-		{
-			src[i] = (b[i]<<24)|(g[i]<<16)|(r[i]<<8)|a[i];
-/*			fprintf( stderr, "[%d->%8.8X %8.8X %8.8X %8.8X = %8.8X]", i, r[i], g[i], b[i], a[i], src[i]);  */
-		}
+		pack_argb32_row( src, b, g, r, a, 24, 16, 8, 0, i );
 	else
-		while( --i >= 0) src[i] = (a[i]<<24)|(r[i]<<16)|(g[i]<<8)|b[i];
-/*fprintf( stderr, "\n");*/
+		pack_argb32_row( src, a, r, g, b, 24, 16, 8, 0, i );
 #ifdef DEBUG_SL2XIMAGE
 	i = MIN((unsigned int)(xim->width),sl->width-sl->offset_x);
 	src = (CARD32*)xim_data;
@@ -271,6 +271,11 @@ typedef struct ASVisual
 
 	Window scratch_window;
 
+	/* server side Pixmaps of the images drawn with
+	 * asimage2drawable_cached(), budgeted to this many bytes : */
+#define ASVISUAL_PIXMAP_CACHE_SIZE	(4*1024*1024)
+	struct ASPixmapCache *pixmap_cache ;
+
 #ifndef X_DISPLAY_MISSING
 #define ARGB2PIXEL(asv,argb,pixel) 		   \
 	(asv)->color2pixel_func((asv),(argb),(pixel))
@@ -653,6 +658,7 @@ XImage* create_visual_scratch_ximage( ASVisual *asv,
 							  unsigned int depth );
 
 #define ASSHM_SAVED_MAX	(256*1024)
+#define ASSHM_UPLOAD_BAND_SIZE	(256*1024)
 
 #ifdef XSHMIMAGE
 Bool destroy_xshm_segment( unsigned long );
@@ -671,6 +677,14 @@ XImage * ASGetXImage( ASVisual *asv, Drawable d,
                   int x, int y, unsigned int width, unsigned int height,
 				  unsigned long plane_mask );
 
+/* Band-wise SHM uploads : get_shm_upload_ximage() returns an XImage of the
+ * requested width backed by the next free upload segment (waiting for the
+ * server to finish with it if necessary), with height reduced to what fits
+ * into ASSHM_UPLOAD_BAND_SIZE. Once filled it is sent with
+ * put_shm_upload_ximage(). Returns NULL when shared memory is unavailable. */
+XImage *get_shm_upload_ximage( ASVisual *asv, unsigned int width, unsigned int height );
+Bool put_shm_upload_ximage( ASVisual *asv, XImage *xim, Drawable d, GC gc, int dest_x, int dest_y );
+
 
 #ifdef __cplusplus
 }
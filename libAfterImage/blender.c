@@ -22,6 +22,12 @@
 #include "config.h"
 #endif
 
+#ifdef _WIN32
+#define ULong64_t unsigned __int64
+#else
+#define ULong64_t unsigned long long
+#endif
+
 /*#define LOCAL_DEBUG*/
 
 #ifdef HAVE_MMX
@@ -108,24 +114,27 @@ rgb2saturation( CARD32 red, CARD32 green, CARD32 blue )
 #define HUE16_BLUE			   	(HUE16_RANGE*HUE_BLUE_TO_MAGENTA)
 #define HUE16_MAGENTA		 	(HUE16_RANGE*HUE_MAGENTA_TO_RED)
 
+#define HUE16_DIV(diff,delta)	(((diff) * (HUE16_RANGE)) / (delta))
 #define MAKE_HUE16(hue,red,green,blue,min_val,max_val,delta) \
+	MAKE_HUE16_DIV(hue,red,green,blue,min_val,max_val,delta,HUE16_DIV)
+#define MAKE_HUE16_DIV(hue,red,green,blue,min_val,max_val,delta,DIV) \
 	do{	if( (red) == (max_val) ){ /* 300 to 60 degrees segment */ \
 			if( (blue) <= (green) ){  /* 0-60 degrees segment*/    \
-				(hue) = HUE16_RED    + (((green) - (blue)) * (HUE16_RANGE)) / (delta) ;\
+				(hue) = HUE16_RED    + DIV((green)-(blue),delta) ;\
 				if( (hue) == 0 ) (hue) = MIN_HUE16 ; \
 			}else {	               /* 300-0 degrees segment*/ \
-				(hue) = HUE16_MAGENTA+ (((red)   - (blue)) * (HUE16_RANGE)) / (delta) ; \
+				(hue) = HUE16_MAGENTA+ DIV((red)-(blue),delta) ; \
 				if( (hue) == 0 ) (hue) = MAX_HUE16 ;                                 \
 			}                                                                   \
 		}else if( (green) == (max_val) ){ /* 60 to 180 degrees segment */           \
 			if( (blue) >= (red) )    /* 120-180 degrees segment*/                   \
-				(hue) = HUE16_GREEN  + (((blue)-(red) ) * (HUE16_RANGE)) / (delta) ;    \
+				(hue) = HUE16_GREEN  + DIV((blue)-(red),delta) ;    \
 			else                 /* 60-120 degrees segment */                   \
-				(hue) = HUE16_YELLOW + (((green)-(red)) * (HUE16_RANGE)) / (delta) ;    \
+				(hue) = HUE16_YELLOW + DIV((green)-(red),delta) ;    \
 		}else if( (red) >= (green) )     /* 240 to 300 degrees segment */           \
-			(hue)     = HUE16_BLUE   + (((red) -(green))* (HUE16_RANGE)) / (delta) ;    \
+			(hue)     = HUE16_BLUE   + DIV((red)-(green),delta) ;    \
 		else                        /* 180 to 240 degrees segment */            \
-			(hue)     = HUE16_CYAN   + (((blue)-(green))* (HUE16_RANGE)) / (delta) ;    \
+			(hue)     = HUE16_CYAN   + DIV((blue)-(green),delta) ;    \
 	}while(0)
 #define INTERPRET_HUE16(hue,delta,max_val,red,green,blue)      \
 	do{	int range = (hue)/HUE16_RANGE ;                                  \
@@ -234,6 +243,88 @@ hsv2rgb (CARD32 hue, CARD32 saturation, CARD32 value, CARD32 *red, CARD32 *green
 	}
 }
 
+/* Whole scanline RGB->HSV translation. Most of the time our data comes
+ * from 8bit images, in which case both divisions in rgb2hsv() have 8bit
+ * divisors and can be replaced with multiplication by reciprocal from
+ * the lookup table. For N*d < 2^32 (which holds for both hue and
+ * saturation numerators) (N*(2^32/d+1))>>32 == N/d exactly : */
+static CARD32 hsv_recip_lut[256] ;
+static Bool   hsv_recip_lut_ready = False ;
+
+#define LUT_DIV8(num,d8)		((CARD32)((((ULong64_t)(num))*hsv_recip_lut[(d8)])>>32))
+#define HUE16_DIV_LUT(diff,delta)	LUT_DIV8(((diff)>>8)*(HUE16_RANGE),(delta)>>8)
+
+static void
+init_hsv_recip_lut()
+{
+	register int i ;
+	hsv_recip_lut[0] = 0 ;
+	for( i = 1 ; i < 256 ; ++i )
+		hsv_recip_lut[i] = (CARD32)((((ULong64_t)1)<<32)/i) + 1 ;
+	hsv_recip_lut_ready = True ;
+}
+
+void
+rgb2hsv_scanline( CARD32 *red, CARD32 *green, CARD32 *blue,
+				  CARD32 *hue, CARD32 *saturation, CARD32 *value, int len )
+{
+	register int i ;
+
+	if( !hsv_recip_lut_ready )
+		init_hsv_recip_lut();
+
+	for( i = 0 ; i < len ; ++i )
+	{
+		int r = red[i], g = green[i], b = blue[i] ;
+		int max_val, min_val, h = 0 ;
+		if( r > g )
+		{
+			max_val = MAX(r,b);
+			min_val = MIN(g,b);
+		}else
+		{
+			max_val = MAX(g,b);
+			min_val = MIN(r,b);
+		}
+		value[i] = max_val ;
+		if( max_val == min_val )
+			saturation[i] = 0 ;
+		else
+		{
+			int delta = max_val-min_val ;
+			if( ((r|g|b)&0xFFFF00FF) == 0 )
+			{
+				saturation[i] = LUT_DIV8( (delta>>8)<<16, max_val>>8 );
+				MAKE_HUE16_DIV(h,r,g,b,min_val,max_val,delta,HUE16_DIV_LUT);
+			}else
+			{
+				saturation[i] = (max_val>1)?(delta<<15)/(max_val>>1): 0;
+				MAKE_HUE16(h,r,g,b,min_val,max_val,delta);
+			}
+		}
+		hue[i] = h ;
+	}
+}
+
+void
+hsv2rgb_scanline( CARD32 *hue, CARD32 *saturation, CARD32 *value, CARD32 *mask,
+				  CARD32 *red, CARD32 *green, CARD32 *blue, int len )
+{
+	register int i ;
+	for( i = 0 ; i < len ; ++i )
+		if( mask == NULL || mask[i] )
+		{
+			CARD32 h = hue[i], s = saturation[i], v = value[i] ;
+			if( s == 0 || h == 0 )
+				blue[i] = green[i] = red[i] = v ;
+			else
+			{
+				int delta = ((s*(v>>1))>>15) ;
+				INTERPRET_HUE16(h,delta,v,red[i],green[i],blue[i]);
+			}
+		}
+}
+
 CARD32                                         /* returns luminance */
 rgb2luminance (CARD32 red, CARD32 green, CARD32 blue )
 {
@@ -580,59 +671,84 @@ overlay_scanlines( ASScanline *bottom, ASScanline *top, int offset )
 		}
 }
 
+/* HSV blending functions translate both scanlines into HSV a chunk at a
+ * time, so that rgb2hsv_scanline() could use its lookup tables : */
+#define HSV_BLEND_CHUNK		64
+
 void
 hue_scanlines( ASScanline *bottom, ASScanline *top, int offset )
 {
+	CARD32 th[HSV_BLEND_CHUNK], ts[HSV_BLEND_CHUNK], tv[HSV_BLEND_CHUNK] ;
+	CARD32 bh[HSV_BLEND_CHUNK], bs[HSV_BLEND_CHUNK], bv[HSV_BLEND_CHUNK] ;
+	int start, k, len ;
 	BLEND_SCANLINES_HEADER
-	while( ++i < max_i )
-		if( ta[i] )
+	for( start = 0 ; start < max_i ; start += HSV_BLEND_CHUNK )
+	{
+		len = MIN(max_i-start,HSV_BLEND_CHUNK);
+		rgb2hsv_scanline( tr+start, tg+start, tb+start, th, ts, tv, len );
+		rgb2hsv_scanline( br+start, bg+start, bb+start, bh, bs, bv, len );
+		for( k = 0 ; k < len ; ++k )
 		{
-			CARD32 hue = rgb2hue( tr[i], tg[i], tb[i]);
-			if( hue > 0 )
+			i = start+k ;
+			if( ta[i] )
 			{
-				CARD32 saturation = rgb2saturation( br[i], bg[i], bb[i]);
-				CARD32 value = rgb2value( br[i], bg[i], bb[i]);;
-
-				hsv2rgb(hue, saturation, value, &br[i], &bg[i], &bb[i]);
+				if( th[k] > 0 )
+					hsv2rgb(th[k], bs[k], bv[k], &br[i], &bg[i], &bb[i]);
+				if( ta[i] < ba[i] )
+					ba[i] = ta[i] ;
 			}
-			if( ta[i] < ba[i] )
-				ba[i] = ta[i] ;
 		}
+	}
 }
 
 void
 saturate_scanlines( ASScanline *bottom, ASScanline *top, int offset )
 {
+	CARD32 th[HSV_BLEND_CHUNK], ts[HSV_BLEND_CHUNK], tv[HSV_BLEND_CHUNK] ;
+	CARD32 bh[HSV_BLEND_CHUNK], bs[HSV_BLEND_CHUNK], bv[HSV_BLEND_CHUNK] ;
+	int start, k, len ;
 	BLEND_SCANLINES_HEADER
-	while( ++i < max_i )
-		if( ta[i] )
+	for( start = 0 ; start < max_i ; start += HSV_BLEND_CHUNK )
+	{
+		len = MIN(max_i-start,HSV_BLEND_CHUNK);
+		rgb2hsv_scanline( tr+start, tg+start, tb+start, th, ts, tv, len );
+		rgb2hsv_scanline( br+start, bg+start, bb+start, bh, bs, bv, len );
+		for( k = 0 ; k < len ; ++k )
 		{
-			CARD32 saturation, value;
-			CARD32 hue = rgb2hsv( br[i], bg[i], bb[i], &saturation, &value);
-
-			saturation = rgb2saturation( tr[i], tg[i], tb[i]);
-			hsv2rgb(hue, saturation, value, &br[i], &bg[i], &bb[i]);
-			if( ta[i] < ba[i] )
-				ba[i] = ta[i] ;
+			i = start+k ;
+			if( ta[i] )
+			{
+				hsv2rgb(bh[k], ts[k], bv[k], &br[i], &bg[i], &bb[i]);
+				if( ta[i] < ba[i] )
+					ba[i] = ta[i] ;
+			}
 		}
+	}
 }
 
 void
 value_scanlines( ASScanline *bottom, ASScanline *top, int offset )
 {
+	CARD32 th[HSV_BLEND_CHUNK], ts[HSV_BLEND_CHUNK], tv[HSV_BLEND_CHUNK] ;
+	CARD32 bh[HSV_BLEND_CHUNK], bs[HSV_BLEND_CHUNK], bv[HSV_BLEND_CHUNK] ;
+	int start, k, len ;
 	BLEND_SCANLINES_HEADER
-	while( ++i < max_i )
-		if( ta[i] )
+	for( start = 0 ; start < max_i ; start += HSV_BLEND_CHUNK )
+	{
+		len = MIN(max_i-start,HSV_BLEND_CHUNK);
+		rgb2hsv_scanline( tr+start, tg+start, tb+start, th, ts, tv, len );
+		rgb2hsv_scanline( br+start, bg+start, bb+start, bh, bs, bv, len );
+		for( k = 0 ; k < len ; ++k )
 		{
-			CARD32 saturation, value;
-			CARD32 hue = rgb2hsv( br[i], bg[i], bb[i], &saturation, &value);
-
-			value = rgb2value( tr[i], tg[i], tb[i]);
-			hsv2rgb(hue, saturation, value, &br[i], &bg[i], &bb[i]);
-
-			if( ta[i] < ba[i] )
-				ba[i] = ta[i] ;
+			i = start+k ;
+			if( ta[i] )
+			{
+				hsv2rgb(bh[k], bs[k], tv[k], &br[i], &bg[i], &bb[i]);
+				if( ta[i] < ba[i] )
+					ba[i] = ta[i] ;
+			}
 		}
+	}
 }
 
 void
@@ -136,6 +136,25 @@ CARD32 rgb2luminance (CARD32 red, CARD32 green, CARD32 blue );
  ****************/
 CARD32 rgb2hsv( CARD32 red, CARD32 green, CARD32 blue, CARD32 *saturation, CARD32 *value );
 CARD32 rgb2hls (CARD32 red, CARD32 green, CARD32 blue, CARD32 *luminance, CARD32 *saturation );
+/****f* libAfterImage/rgb2hsv_scanline()
+ * NAME
+ * rgb2hsv_scanline()
+ * SYNOPSIS
+ * void rgb2hsv_scanline( CARD32 *red, CARD32 *green, CARD32 *blue,
+ *                        CARD32 *hue, CARD32 *saturation, CARD32 *value,
+ *                        int len );
+ * INPUTS
+ * red, green, blue - arrays of len RGB color channel values
+ * hue, saturation, value - arrays of len elements to receive HSV
+ *                          coordinates.
+ * DESCRIPTION
+ * Translates whole array of RGB colors into HSV colorspace at once, with
+ * exactly the same results as calling rgb2hsv() for each element. Colors
+ * with 8bit precision (the most common case) are translated using lookup
+ * tables instead of divisions.
+ ****************/
+void rgb2hsv_scanline( CARD32 *red, CARD32 *green, CARD32 *blue,
+					   CARD32 *hue, CARD32 *saturation, CARD32 *value, int len );
 /****f* libAfterImage/hsv2rgb()
  * NAME
  * hsv2rgb()
@@ -160,6 +179,24 @@ CARD32 rgb2hls (CARD32 red, CARD32 green, CARD32 blue, CARD32 *luminance, CARD32
  ****************/
 void hsv2rgb (CARD32 hue, CARD32 saturation, CARD32 value, CARD32 *red, CARD32 *green, CARD32 *blue);
 void hls2rgb (CARD32 hue, CARD32 luminance, CARD32 saturation, CARD32 *red, CARD32 *green, CARD32 *blue);
+/****f* libAfterImage/hsv2rgb_scanline()
+ * NAME
+ * hsv2rgb_scanline()
+ * SYNOPSIS
+ * void hsv2rgb_scanline( CARD32 *hue, CARD32 *saturation, CARD32 *value,
+ *                        CARD32 *mask,
+ *                        CARD32 *red, CARD32 *green, CARD32 *blue, int len );
+ * INPUTS
+ * hue, saturation, value - arrays of len HSV color coordinates
+ * mask       - optional array of len elements; only pixels with non-zero
+ *              mask will be translated. NULL means translate everything.
+ * red, green, blue - arrays of len elements to receive RGB values.
+ * DESCRIPTION
+ * Reverse of rgb2hsv_scanline() - translates whole array of HSV colors
+ * back into RGB, same as calling hsv2rgb() for each element.
+ ****************/
+void hsv2rgb_scanline( CARD32 *hue, CARD32 *saturation, CARD32 *value, CARD32 *mask,
+					   CARD32 *red, CARD32 *green, CARD32 *blue, int len );
 
 /* scanline blending 													 */
 /****f* libAfterImage/merge_scanline
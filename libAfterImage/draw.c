@@ -37,6 +37,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #ifdef _WIN32
 # include "win32/afterbase.h"
 #else
@@ -46,6 +47,10 @@
 #include "asimage.h"
 #include "draw.h"
 
+#ifdef HAVE_MMX
+#include <mmintrin.h>
+#endif
+
 
 #define CTX_SELECT_CANVAS(ctx)	(get_flags((ctx)->flags, ASDrawCTX_UsingScratch)?(ctx)->scratch_canvas:(ctx)->canvas)
 
@@ -94,10 +99,143 @@ ASDrawTool StandardBrushes[AS_DRAW_BRUSHES] =
 /* auxilary functions : 											 */
 /*********************************************************************************/
 
+/* span kernels - every one of these processes whole run of pixels in one go.
+ * Alpha canvas values never exceed 255, so signed MMX compares are safe. */
+static inline void
+max_span_value( CARD32 *dst, CARD32 value, int len )
+{
+	int i = 0 ;
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 4 )
+	{
+		__m64 *vdst = (__m64*)dst ;
+		__m64  v = _mm_set1_pi32( (int)value );
+		int    vlen = len>>1 ;
+		for( ; i < vlen ; ++i )
+		{
+			__m64 d = vdst[i] ;
+			__m64 mask = _mm_cmpgt_pi32( d, v );       /* pcmpgtd */
+			vdst[i] = _mm_or_si64( _mm_and_si64( mask, d ), _mm_andnot_si64( mask, v ) );
+		}
+		_mm_empty();
+		i = vlen<<1 ;
+	}
+#endif
+	for( ; i < len ; ++i )
+		if( dst[i] < value )
+			dst[i] = value ;
+}
+
+static inline void
+max_span( CARD32 *dst, CARD32 *src, int len )
+{
+	int i = 0 ;
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 4 )
+	{
+		__m64 *vdst = (__m64*)dst ;
+		__m64 *vsrc = (__m64*)src ;
+		int    vlen = len>>1 ;
+		for( ; i < vlen ; ++i )
+		{
+			__m64 d = vdst[i], s = vsrc[i] ;
+			__m64 mask = _mm_cmpgt_pi32( d, s );
+			vdst[i] = _mm_or_si64( _mm_and_si64( mask, d ), _mm_andnot_si64( mask, s ) );
+		}
+		_mm_empty();
+		i = vlen<<1 ;
+	}
+#endif
+	for( ; i < len ; ++i )
+		if( dst[i] < src[i] )
+			dst[i] = src[i] ;
+}
+
+static inline void alpha_blend_point_argb32( CARD32 *dst, CARD32 value, CARD32 ratio)
+{
+	CARD32 ta = (ARGB32_ALPHA8(value)*ratio)/255;
+
+	if (ta >= 255)
+		*dst = value|0xFF000000;
+	else
+	{
+		CARD32 aa = 255-ta; /* must be 256 or we ! */
+		CARD32 orig = *dst;
+		CARD32 res = orig&0xFF000000; //((orig&0xFF000000)>>8)*aa + (ta<<24);
+		if (res < (ta<<24))
+			res = (ta<<24);
+		/* red and blue */
+		res |= (((orig&0x00FF00FF)*aa + (value&0x00FF00FF)*ta)>>8)&0x00FF00FF;
+		/* green */
+		res |= (((orig&0x0000FF00)*aa + (value&0x0000FF00)*ta)>>8)&0x0000FF00;
+		*dst = res;
+	}
+}
+
+/* same as alpha_blend_point_argb32() applied to len pixels of the same color */
+static inline void
+alpha_blend_span_argb32( CARD32 *dst, CARD32 value, CARD32 ratio, int len )
+{
+	CARD32 ta = (ARGB32_ALPHA8(value)*ratio)/255;
+	int i = 0 ;
+
+	if( ta >= 255 )
+	{
+		value |= 0xFF000000 ;
+		for( ; i < len ; ++i )
+			dst[i] = value ;
+		return;
+	}
+#ifdef HAVE_MMX
+	if( asimage_use_mmx && len >= 4 )
+	{
+		__m64 *vdst = (__m64*)dst ;
+		__m64  zero = _mm_setzero_si64();
+		/* color premultiplied by its alpha, in 16bit lanes : */
+		__m64  vterm = _mm_mullo_pi16( _mm_unpacklo_pi8( _mm_cvtsi32_si64( (int)value ), zero ), _mm_set1_pi16( (short)ta ) );
+		__m64  vaa = _mm_set1_pi16( (short)(255-ta) );
+		__m64  alpha_lane = _mm_set_pi16( -1, 0, 0, 0 );
+		__m64  valpha = _mm_set_pi16( (short)ta, 0, 0, 0 );
+		int    vlen = len>>1 ;
+		for( ; i < vlen ; ++i )
+		{
+			__m64 d = vdst[i] ;
+			__m64 lo = _mm_unpacklo_pi8( d, zero );
+			__m64 hi = _mm_unpackhi_pi8( d, zero );
+			__m64 lo_res = _mm_srli_pi16( _mm_add_pi16( _mm_mullo_pi16( lo, vaa ), vterm ), 8 );
+			__m64 hi_res = _mm_srli_pi16( _mm_add_pi16( _mm_mullo_pi16( hi, vaa ), vterm ), 8 );
+			/* alpha is the greater of the two, rather then blended : */
+			__m64 lo_mask = _mm_cmpgt_pi16( lo, valpha );
+			__m64 hi_mask = _mm_cmpgt_pi16( hi, valpha );
+			__m64 lo_a = _mm_or_si64( _mm_and_si64( lo_mask, lo ), _mm_andnot_si64( lo_mask, valpha ) );
+			__m64 hi_a = _mm_or_si64( _mm_and_si64( hi_mask, hi ), _mm_andnot_si64( hi_mask, valpha ) );
+			lo_res = _mm_or_si64( _mm_andnot_si64( alpha_lane, lo_res ), _mm_and_si64( alpha_lane, lo_a ) );
+			hi_res = _mm_or_si64( _mm_andnot_si64( alpha_lane, hi_res ), _mm_and_si64( alpha_lane, hi_a ) );
+			vdst[i] = _mm_packs_pu16( lo_res, hi_res );
+		}
+		_mm_empty();
+		i = vlen<<1 ;
+	}
+#endif
+	for( ; i < len ; ++i )
+		alpha_blend_point_argb32( dst+i, value, ratio );
+}
+
+static inline void
+alpha_blend_span_argb32_var( CARD32 *dst, CARD32 *src, int len )
+{
+	int i ;
+	for( i = 0 ; i < len ; ++i )
+		alpha_blend_point_argb32( dst+i, src[i], 255 );
+}
+
+#define CTX_MARK_DIRTY(ctx,y_from,y_to) \
+	do{ if( (ctx)->dirty_rows && !get_flags((ctx)->flags, ASDrawCTX_UsingScratch) ) \
+			memset( (ctx)->dirty_rows+(y_from), 0x01, (y_to)-(y_from)+1 ); }while(0)
+
 static void
 apply_tool_2D( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio )
 {
-
 /*fprintf( stderr, "(%d,%d)- ratio = %u (0x%X)\n", curr_x, curr_y, ratio, ratio);		*/
 	if( ratio  !=  0 ) 
 	{	
@@ -138,19 +276,13 @@ apply_tool_2D( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio )
 		if( corner_y + th > ch ) 
 			ah = ch - corner_y;
 
+		CTX_MARK_DIRTY(ctx, max(corner_y,0), max(corner_y,0)+ah-1);
+
 		if( ratio == 255 ) 
 		{
 			for( y = 0 ; y < ah ; ++y ) 
 			{	
-				for( x = 0 ; x < aw ; ++x ) 
-				{
-					if( dst[x] < src[x] ) 
-						dst[x] = src[x] ;
-					/*
-					register CARD32 t = (CARD32)dst[x] + (CARD32)src[x] ;
-					dst[x] = t > 255? 255 : t ;
-			 		*/
-				}
+				max_span( dst, src, aw );
 				src += tw ; 
 				dst += cw ; 
 			}
@@ -184,35 +316,13 @@ apply_tool_2D( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio )
 			{	
 				src += tw ; 
 				dst += cw ; 
-				for( x = 1 ; x < aw-1 ; ++x ) 
-					if( dst[x] < src[x] ) 
-						dst[x] = src[x] ;
+				if( aw > 2 )
+					max_span( dst+1, src+1, aw-2 );
 			}
 		}
 	}
 }	   
 
-static inline void alpha_blend_point_argb32( CARD32 *dst, CARD32 value, CARD32 ratio)
-{
-	CARD32 ta = (ARGB32_ALPHA8(value)*ratio)/255;
-
-	if (ta >= 255)
-		*dst = value|0xFF000000;
-	else
-	{
-		CARD32 aa = 255-ta; /* must be 256 or we ! */
-		CARD32 orig = *dst;
-		CARD32 res = orig&0xFF000000; //((orig&0xFF000000)>>8)*aa + (ta<<24);
-		if (res < (ta<<24))
-			res = (ta<<24);
-		/* red and blue */
-		res |= (((orig&0x00FF00FF)*aa + (value&0x00FF00FF)*ta)>>8)&0x00FF00FF;
-		/* green */
-		res |= (((orig&0x0000FF00)*aa + (value&0x0000FF00)*ta)>>8)&0x0000FF00;
-		*dst = res;
-	}
-}
-
 static void
 apply_tool_2D_colored( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio )
 {
@@ -255,6 +365,8 @@ apply_tool_2D_colored( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio
 		if( corner_y + th > ch ) 
 			ah = ch - corner_y;
 
+		CTX_MARK_DIRTY(ctx, max(corner_y,0), max(corner_y,0)+ah-1);
+
 		/* ratio, implementing anti-aliasing should be applyed to the outer layer of 
 		   the tool only ! */		
 		{
@@ -313,8 +425,8 @@ apply_tool_2D_colored( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio
 				{	
 					src += tw ; 
 					dst += cw ; 
-					for( x = 1 ; x < aw-1 ; ++x ) 
-						alpha_blend_point_argb32( dst+x, src[x], 255);
+					if( aw > 2 )
+						alpha_blend_span_argb32_var( dst+1, src+1, aw-2 );
 				}
 			}
 		}
@@ -331,6 +443,7 @@ apply_tool_point( ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio )
 		CARD32 value = (ctx->tool->matrix[0]*ratio)/255 ;
 		CARD32 *dst = CTX_SELECT_CANVAS(ctx) ;
 		dst += curr_y * cw ; 
+		CTX_MARK_DIRTY(ctx, curr_y, curr_y);
 
 		if( dst[curr_x] < value ) 
 			dst[curr_x] = value ;
@@ -347,6 +460,7 @@ apply_tool_point_colored(ASDrawContext *ctx, int curr_x, int curr_y, CARD32 rati
 	{
 		CARD32 *dst = CTX_SELECT_CANVAS(ctx);
 		dst += curr_y * cw + curr_x;
+		CTX_MARK_DIRTY(ctx, curr_y, curr_y);
 		if (get_flags(ctx->flags, ASDrawCTX_UsingScratch))
 		{
 			CARD32 value = (ARGB32_ALPHA8(ctx->tool->matrix[0])*ratio)/255 ;
@@ -373,12 +487,8 @@ fill_hline_notile( ASDrawContext *ctx, int x_from, int y, int x_to, CARD32 ratio
 		if( x2 >= cw ) 
 			x2 = cw - 1 ; 
 
-		while( x1 <= x2 ) 
-		{
-			if( dst[x1] < value ) 
-				dst[x1] = value ;
-			++x1 ;
-		}
+		CTX_MARK_DIRTY(ctx, y, y);
+		max_span_value( dst+x1, value, x2-x1+1 );
 	}
 }
 
@@ -396,21 +506,11 @@ fill_hline_notile_colored(ASDrawContext *ctx, int x_from, int y, int x_to, CARD3
 		if( x2 >= cw ) 
 			x2 = cw - 1 ; 
 
+		CTX_MARK_DIRTY(ctx, y, y);
 		if (get_flags(ctx->flags, ASDrawCTX_UsingScratch))
-		{
-			while( x1 <= x2 ) 
-			{
-				CARD32 value = (ARGB32_ALPHA8(ctx->tool->matrix[0])*ratio)/255 ;
-				if( dst[x1] < value ) 
-					dst[x1] = value ;
-				++x1 ;
-			}
-		}else
-			while( x1 <= x2 ) 
-			{
-				alpha_blend_point_argb32( dst+x1, value, ratio);
-				++x1 ;
-			}
+			max_span_value( dst+x1, (ARGB32_ALPHA8(value)*ratio)/255, x2-x1+1 );
+		else
+			alpha_blend_span_argb32( dst+x1, value, ratio, x2-x1+1 );
 	}
 }
 
@@ -663,6 +763,336 @@ render_supersampled_pixel( ASDrawContext *ctx, int xs, int ys )
 	}
 }	
 
+/*********************************************************************************/
+/* path outline and scanline polygon rasterizer :                                */
+/*********************************************************************************/
+/* While path is being drawn - its outline gets recorded as a list of edges in
+ * 24.8 fixed point, with the center of the pixel at .5 - that matches how
+ * render_supersampled_pixel() places points. To fill the path, edges are walked
+ * one scanline at a time, and for every cell crossed by an edge we accumulate
+ * signed height of the edge's piece inside the cell (cover) and twice the area
+ * to the left of it (area), same as FreeType's "grays" rasterizer does.
+ * Running sum of covers then yields exact coverage of each pixel weighted by
+ * winding number, that gets converted into alpha using non-zero or even-odd
+ * rule. Runs of cells with no edges in them all have the same coverage and
+ * are filled as a whole using fill_hline_func.
+ */
+typedef struct ASDrawEdge
+{
+	int x0, y0, x1, y1 ;	/* y0 < y1 always */
+	int dir ;				/* +1 if edge goes down, -1 if up */
+}ASDrawEdge;
+
+typedef struct ASDrawRaster
+{
+	int 	width ;
+	int    *cover, *area ;
+	int 	left_cover ;		/* cover of the cells left of the canvas */
+	int 	min_x, max_x ;		/* cells touched in current scanline */
+}ASDrawRaster;
+
+static void
+ctx_add_edge( ASDrawContext *ctx, int x0, int y0, int x1, int y1 )
+{
+	ASDrawEdge *e ;
+	if( y0 == y1 )
+		return;                                /* contributes nothing */
+	if( ctx->edges_num >= ctx->edges_allocated )
+	{
+		ctx->edges_allocated += 2048/sizeof(ASDrawEdge);
+		ctx->edges = realloc( ctx->edges, ctx->edges_allocated*sizeof(ASDrawEdge));
+	}
+	e = &(ctx->edges[ctx->edges_num++]);
+	if( y0 < y1 )
+	{
+		e->x0 = x0 ; e->y0 = y0 ; e->x1 = x1 ; e->y1 = y1 ; e->dir = 1 ;
+	}else
+	{
+		e->x0 = x1 ; e->y0 = y1 ; e->x1 = x0 ; e->y1 = y0 ; e->dir = -1 ;
+	}
+}
+
+static void
+ctx_path_close( ASDrawContext *ctx )
+{
+	if( get_flags( ctx->flags, ASDrawCTX_PathStarted ) )
+	{
+		clear_flags( ctx->flags, ASDrawCTX_PathStarted );
+		ctx_add_edge( ctx, ctx->path_last_x, ctx->path_last_y, ctx->path_start_x, ctx->path_start_y );
+	}
+}
+
+static void
+ctx_path_add_line( ASDrawContext *ctx, int x0, int y0, int x1, int y1 )
+{
+	if( !get_flags( ctx->flags, ASDrawCTX_PathStarted ) ||
+		x0 != ctx->path_last_x || y0 != ctx->path_last_y )
+	{	/* pen was moved - that starts new subpath */
+		ctx_path_close( ctx );
+		ctx->path_start_x = x0 ;
+		ctx->path_start_y = y0 ;
+		set_flags( ctx->flags, ASDrawCTX_PathStarted );
+	}
+	ctx_add_edge( ctx, x0, y0, x1, y1 );
+	ctx->path_last_x = x1 ;
+	ctx->path_last_y = y1 ;
+}
+
+#define CTX_PATH_COORD(c)	(((c)<<8)+0x80)
+
+static void
+ctx_path_add_bezier( ASDrawContext *ctx, int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3 )
+{
+	/* number of segments is based on the length of control polygon : */
+	double len = sqrt( (double)(x1-x0)*(x1-x0) + (double)(y1-y0)*(y1-y0) ) +
+				 sqrt( (double)(x2-x1)*(x2-x1) + (double)(y2-y1)*(y2-y1) ) +
+				 sqrt( (double)(x3-x2)*(x3-x2) + (double)(y3-y2)*(y3-y2) ) ;
+	int n = 4 + (int)sqrt( len/256. )*2, i ;
+	int last_x = x0+0x80, last_y = y0+0x80 ;
+	if( n > 256 )
+		n = 256 ;
+	for( i = 1 ; i <= n ; ++i )
+	{
+		double t = (double)i/(double)n, nt = 1. - t ;
+		double a = nt*nt*nt, b = 3.*nt*nt*t, c = 3.*nt*t*t, d = t*t*t ;
+		int x = (int)floor( a*x0 + b*x1 + c*x2 + d*x3 + 0.5 ) + 0x80 ;
+		int y = (int)floor( a*y0 + b*y1 + c*y2 + d*y3 + 0.5 ) + 0x80 ;
+		ctx_path_add_line( ctx, last_x, last_y, x, y );
+		last_x = x ;
+		last_y = y ;
+	}
+}
+
+/* ellips centered at x,y and rotated counterclockwise by angle degrees : */
+static void
+ctx_path_add_ellips( ASDrawContext *ctx, int x, int y, int rx, int ry, int angle )
+{
+	double a = (double)angle*3.14159265358979323846/180. ;
+	double ca = cos(a), sa = sin(a) ;
+	double cx = CTX_PATH_COORD(x), cy = CTX_PATH_COORD(y) ;
+	double frx = (double)rx*256., fry = (double)ry*256. ;
+	/* enough segments to keep chord error well under a tenth of a pixel : */
+	int n = 8 + 8*(int)sqrt( (double)max(rx,ry) ), i ;
+	double step, cs, ss, u = 1., v = 0. ;
+	int first_x, first_y, last_x, last_y ;
+
+	if( n > 4096 )
+		n = 4096 ;
+	step = 2.*3.14159265358979323846/(double)n ;
+	cs = cos(step) ;
+	ss = sin(step) ;
+	first_x = last_x = (int)floor( cx + frx*ca + 0.5 );
+	first_y = last_y = (int)floor( cy - frx*sa + 0.5 );
+	for( i = 1 ; i < n ; ++i )
+	{
+		double t = u*cs - v*ss ;
+		int px, py ;
+		v = u*ss + v*cs ;
+		u = t ;
+		px = (int)floor( cx + frx*u*ca - fry*v*sa + 0.5 );
+		py = (int)floor( cy - frx*u*sa - fry*v*ca + 0.5 );
+		ctx_path_add_line( ctx, last_x, last_y, px, py );
+		last_x = px ;
+		last_y = py ;
+	}
+	ctx_path_add_line( ctx, last_x, last_y, first_x, first_y );
+}
+
+static inline void
+raster_add_cell( ASDrawRaster *r, int cx, int fx0, int fx1, int dy )
+{
+	if( cx < 0 )
+		r->left_cover += dy ;
+	else if( cx < r->width )
+	{
+		r->cover[cx] += dy ;
+		r->area[cx] += (fx0+fx1)*dy ;
+		if( cx < r->min_x ) r->min_x = cx ;
+		if( cx > r->max_x ) r->max_x = cx ;
+	}
+}
+
+/* piece of the edge confined to single scanline - y is relative to its top : */
+static void
+raster_add_line( ASDrawRaster *r, int xa, int ya, int xb, int yb )
+{
+	int max_x = r->width<<8 ;
+	int dy = yb - ya ;
+	int cxa, cxb ;
+
+	if( dy == 0 )
+		return;
+	if( xa <= 0 && xb <= 0 )
+	{
+		r->left_cover += dy ;
+		return;
+	}
+	if( xa >= max_x && xb >= max_x )
+		return;
+	/* splitting at the canvas edges so we don't have to walk
+	 * through cells we don't care about : */
+	if( (xa < 0) != (xb < 0) )
+	{
+		int ym = ya + (int)(((Long64_t)(0-xa)*dy)/(xb-xa)) ;
+		raster_add_line( r, xa, ya, 0, ym );
+		raster_add_line( r, 0, ym, xb, yb );
+		return;
+	}
+	if( (xa > max_x) != (xb > max_x) )
+	{
+		int ym = ya + (int)(((Long64_t)(max_x-xa)*dy)/(xb-xa)) ;
+		raster_add_line( r, xa, ya, max_x, ym );
+		raster_add_line( r, max_x, ym, xb, yb );
+		return;
+	}
+
+	cxa = xa>>8 ;
+	cxb = xb>>8 ;
+	if( cxa == cxb )
+		raster_add_cell( r, cxa, xa-(cxa<<8), xb-(cxa<<8), dy );
+	else
+	{
+		int step = (xb > xa)? 1 : -1 ;
+		int cx = cxa, px = xa, py = ya ;
+		Long64_t ddx = xb - xa ;
+		while( cx != cxb )
+		{
+			int bx = (step > 0)? (cx+1)<<8 : cx<<8 ;
+			int by = ya + (int)(((Long64_t)(bx-xa)*dy)/ddx) ;
+			raster_add_cell( r, cx, px-(cx<<8), bx-(cx<<8), by-py );
+			px = bx ;
+			py = by ;
+			cx += step ;
+		}
+		raster_add_cell( r, cx, px-(cx<<8), xb-(cx<<8), yb-py );
+	}
+}
+
+static inline CARD32
+raster_coverage( int v, Bool even_odd )
+{
+	if( v < 0 )
+		v = -v ;
+	if( even_odd )
+	{
+		v &= 0x1FF ;
+		if( v > 256 )
+			v = 512 - v ;
+	}
+	return (v > 255)? 255 : v ;
+}
+
+static void
+raster_flush_row( ASDrawContext *ctx, ASDrawRaster *r, int y, Bool even_odd )
+{
+	int sum = r->left_cover ;
+	int x = (sum == 0)? r->min_x : 0 ;
+	int width = r->width ;
+
+	while( x < width )
+	{
+		CARD32 v ;
+		if( x > r->max_x )
+		{	/* nothing but the running cover from here on */
+			if( (v = raster_coverage( sum, even_odd )) > 0 )
+				CTX_FILL_HLINE(ctx,x,y,width-1,v);
+			break;
+		}
+		if( r->cover[x] != 0 || r->area[x] != 0 )
+		{
+			v = raster_coverage( (((sum+r->cover[x])<<9) - r->area[x]) >> 9, even_odd );
+			if( v > 0 )
+				CTX_FILL_HLINE(ctx,x,y,x,v);
+			sum += r->cover[x] ;
+			r->cover[x] = r->area[x] = 0 ;
+			++x ;
+		}else
+		{
+			int x_from = x ;
+			while( x < r->max_x && r->cover[x+1] == 0 && r->area[x+1] == 0 ) ++x ;
+			if( (v = raster_coverage( sum, even_odd )) > 0 )
+				CTX_FILL_HLINE(ctx,x_from,y,x,v);
+			++x ;
+		}
+	}
+	r->left_cover = 0 ;
+	r->min_x = width ;
+	r->max_x = -1 ;
+}
+
+static int
+compare_edges_top( const void *e1, const void *e2 )
+{
+	return ((ASDrawEdge*)e1)->y0 - ((ASDrawEdge*)e2)->y0 ;
+}
+
+static void
+ctx_fill_path( ASDrawContext *ctx, ASDrawEdge *edges, int edges_num )
+{
+	ASDrawRaster r ;
+	Bool even_odd = get_flags( ctx->flags, ASDrawCTX_EvenOddFill );
+	int *active ;
+	int active_num = 0, next = 0 ;
+	int y, y_end, i, max_y = 0 ;
+
+	if( edges_num <= 0 )
+		return;
+	qsort( edges, edges_num, sizeof(ASDrawEdge), compare_edges_top );
+	for( i = 0 ; i < edges_num ; ++i )
+		if( edges[i].y1 > max_y )
+			max_y = edges[i].y1 ;
+
+	y = edges[0].y0>>8 ;
+	if( y < 0 )
+		y = 0 ;
+	y_end = (max_y-1)>>8 ;
+	if( y_end >= ctx->canvas_height )
+		y_end = ctx->canvas_height-1 ;
+	if( y > y_end )
+		return;
+
+	r.width = ctx->canvas_width ;
+	r.cover = safecalloc( r.width, sizeof(int));
+	r.area = safecalloc( r.width, sizeof(int));
+	r.left_cover = 0 ;
+	r.min_x = r.width ;
+	r.max_x = -1 ;
+	active = safemalloc( edges_num*sizeof(int));
+
+	for( ; y <= y_end ; ++y )
+	{
+		int top = y<<8, bottom = top+256 ;
+		while( next < edges_num && edges[next].y0 < bottom )
+		{
+			if( edges[next].y1 > top )
+				active[active_num++] = next ;
+			++next ;
+		}
+		for( i = 0 ; i < active_num ; ++i )
+		{
+			ASDrawEdge *e = &(edges[active[i]]) ;
+			int ya, yb, xa, xb ;
+			if( e->y1 <= top )
+			{	/* done with this one */
+				active[i--] = active[--active_num] ;
+				continue;
+			}
+			ya = max( e->y0, top );
+			yb = min( e->y1, bottom );
+			xa = e->x0 + (int)(((Long64_t)(ya - e->y0)*(e->x1 - e->x0))/(e->y1 - e->y0));
+			xb = e->x0 + (int)(((Long64_t)(yb - e->y0)*(e->x1 - e->x0))/(e->y1 - e->y0));
+			if( e->dir > 0 )
+				raster_add_line( &r, xa, ya-top, xb, yb-top );
+			else
+				raster_add_line( &r, xb, yb-top, xa, ya-top );
+		}
+		raster_flush_row( ctx, &r, y, even_odd );
+	}
+	free( active );
+	free( r.cover );
+	free( r.area );
+}
+
 typedef struct ASCubicBezier
 {
 	int x0, y0;
@@ -679,6 +1109,9 @@ ctx_draw_bezier( ASDrawContext *ctx, int x0, int y0, int x1, int y1, int x2, int
 	
 	ASCubicBezier *bstack = NULL ;
 	int bstack_size = 0, bstack_used = 0 ;
+
+	if( get_flags( ctx->flags, ASDrawCTX_UsingScratch ) )
+		ctx_path_add_bezier( ctx, x0, y0, x1, y1, x2, y2, x3, y3 );
 	
 #define ADD_CubicBezier(X0,Y0,X1,Y1,X2,Y2,X3,Y3)	\
 	do{ \
@@ -907,6 +1340,8 @@ create_asdraw_context( unsigned int width, unsigned int height )
 	ctx->canvas_width = width == 0 ? 1 : width ; 
 	ctx->canvas_height = height == 0 ? 1 : height ;
 	ctx->canvas = safecalloc(  ctx->canvas_width*ctx->canvas_height, sizeof(CARD32));
+	ctx->dirty_rows = safecalloc(  ctx->canvas_height, 1);
+	ctx->encoded_rows = safecalloc(  ctx->canvas_height, sizeof(ASStorageID));
 
 	asim_set_brush( ctx, 0 ); 
 	ctx->fill_hline_func = fill_hline_notile ;
@@ -923,6 +1358,18 @@ destroy_asdraw_context( ASDrawContext *ctx )
 			free( ctx->canvas );	 
 		if( ctx->scratch_canvas ) 
 			free( ctx->scratch_canvas );	 
+		if( ctx->edges ) 
+			free( ctx->edges );	 
+		if( ctx->dirty_rows ) 
+			free( ctx->dirty_rows );	 
+		if( ctx->encoded_rows ) 
+		{
+			int y ;
+			for( y = 0 ; y < ctx->canvas_height ; ++y ) 
+				if( ctx->encoded_rows[y] ) 
+					forget_data( NULL, ctx->encoded_rows[y] );
+			free( ctx->encoded_rows );	 
+		}
 		free( ctx );
 	}	 
 }	   
@@ -1001,6 +1448,8 @@ asim_start_path( ASDrawContext *ctx )
 	}else
 		ctx->scratch_canvas	 = safecalloc(  ctx->canvas_width*ctx->canvas_height, sizeof(CARD32));
 	set_flags( ctx->flags, ASDrawCTX_UsingScratch );
+	clear_flags( ctx->flags, ASDrawCTX_PathStarted );
+	ctx->edges_num = 0 ;
 	return True;
 }
 
@@ -1016,26 +1465,38 @@ asim_apply_path( ASDrawContext *ctx, int start_x, int start_y, Bool fill, int fi
 	LOCAL_DEBUG_CALLER_OUT( "start_x = %d, start_y = %d, fill = %d, fill_start_x = %d, fill_start_y = %d",
 							start_x, start_y, fill, fill_start_x, fill_start_y );
 
-	/* TODO : contour tracing functionality : */
+	ctx_path_close( ctx );
 	if( fill ) 
-		asim_flood_fill( ctx, fill_start_x, fill_start_y, 0, fill_threshold==0?CTX_DEFAULT_FILL_THRESHOLD:fill_threshold );	
+	{	/* flood fill is only needed if nothing recorded the outline : */
+		if( ctx->edges_num > 0 )
+			ctx_fill_path( ctx, ctx->edges, ctx->edges_num );
+		else
+			asim_flood_fill( ctx, fill_start_x, fill_start_y, 0, fill_threshold==0?CTX_DEFAULT_FILL_THRESHOLD:fill_threshold );	
+	}
+	ctx->edges_num = 0 ;
 
 	clear_flags( ctx->flags, ASDrawCTX_UsingScratch );	 
 
-	/* actually applying scratch : */
+	/* actually applying scratch - only to the rows path has touched : */
 	{
-		int i = ctx->canvas_width*ctx->canvas_height ;
-		if (get_flags (ctx->flags, ASDrawCTX_CanvasIsARGB))
-		{
-			CARD32 argb = ctx->tool->matrix[ctx->tool->center_y*ctx->tool->width + ctx->tool->center_x];
-			while (--i >= 0)
-				if (ctx->scratch_canvas[i])
-					alpha_blend_point_argb32( ctx->canvas + i, argb, ctx->scratch_canvas[i]);
-		}else
+		int cw = ctx->canvas_width ;
+		int x, y ;
+		CARD32 argb = ctx->tool->matrix[ctx->tool->center_y*ctx->tool->width + ctx->tool->center_x];
+		for( y = 0 ; y < ctx->canvas_height ; ++y ) 
 		{
-			while( --i >= 0 ) 
-				if( ctx->canvas[i] < ctx->scratch_canvas[i] )
-					ctx->canvas[i] = ctx->scratch_canvas[i] ;
+			CARD32 *canvas = ctx->canvas + y*cw ;
+			CARD32 *scratch = ctx->scratch_canvas + y*cw ;
+			for( x = 0 ; x < cw && scratch[x] == 0 ; ++x );
+			if( x >= cw ) 
+				continue;
+			CTX_MARK_DIRTY(ctx, y, y);
+			if (get_flags (ctx->flags, ASDrawCTX_CanvasIsARGB))
+			{
+				for( ; x < cw ; ++x )
+					if (scratch[x])
+						alpha_blend_point_argb32( canvas + x, argb, scratch[x]);
+			}else
+				max_span( canvas+x, scratch+x, cw-x );
 		}
 	}		
 	return True;
@@ -1053,7 +1514,37 @@ apply_asdraw_context( ASImage *im, ASDrawContext *ctx, ASFlagType filter )
 	height = im->height ;
 	if( width != ctx->canvas_width || height != ctx->canvas_height )
 		return False;
+	TOUCH_ASIMAGE(im);
+
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32|ASIM_TILED ) )
+	{	/* no whole storage rows to share - write canvas through the image */
+		for( chan = 0 ; chan < IC_NUM_CHANNELS;  chan++ )
+			if( get_flags( filter, 0x01<<chan) )
+			{
+				int y;
+				for( y = 0 ; y < height ; ++y )
+					asimage_add_line( im, chan, ctx->canvas+y*width, y );
+			}
+		return True;
+	}
 	
+	if( ctx->encoded_rows ) 
+	{	/* only rows changed since last time need encoding - the rest we 
+		 * already have and can simply share with the image : */
+		int y;
+		register CARD32 *canvas_row = ctx->canvas ; 
+		for( y = 0 ; y < height ; ++y )
+		{	
+			if( ctx->encoded_rows[y] == 0 || ctx->dirty_rows[y] ) 
+			{
+				if( ctx->encoded_rows[y] ) 
+					forget_data( NULL, ctx->encoded_rows[y] ); 
+				ctx->encoded_rows[y] = store_data( NULL, (CARD8*)canvas_row, width*sizeof(CARD32), ASStorage_32Bit|ASStorage_RLEDiffCompress, 0);
+				ctx->dirty_rows[y] = 0 ;
+			}
+			canvas_row += width ; 
+		}
+	}
 	for( chan = 0 ; chan < IC_NUM_CHANNELS;  chan++ )
 		if( get_flags( filter, 0x01<<chan) )
 		{
@@ -1073,7 +1564,10 @@ apply_asdraw_context( ASImage *im, ASDrawContext *ctx, ASFlagType filter )
 #endif
 				if( rows[y] ) 
 					forget_data( NULL, rows[y] ); 
-				rows[y] = store_data( NULL, (CARD8*)canvas_row, width*sizeof(CARD32), ASStorage_32Bit|ASStorage_RLEDiffCompress, 0);
+				if( ctx->encoded_rows ) 
+					rows[y] = dup_data( NULL, ctx->encoded_rows[y] );
+				else
+					rows[y] = store_data( NULL, (CARD8*)canvas_row, width*sizeof(CARD32), ASStorage_32Bit|ASStorage_RLEDiffCompress, 0);
 				canvas_row += width ; 
 			}
 		}
@@ -1099,6 +1593,9 @@ asim_line_to_generic( ASDrawContext *ctx, int dst_x, int dst_y, void (*func)(ASD
 		int cw = ctx->canvas_width ; 
 		int ch = ctx->canvas_height ; 
 		
+		if( get_flags( ctx->flags, ASDrawCTX_UsingScratch ) )
+			ctx_path_add_line( ctx, CTX_PATH_COORD(from_x), CTX_PATH_COORD(from_y), 
+									CTX_PATH_COORD(to_x), CTX_PATH_COORD(to_y) );
 		asim_move_to( ctx, dst_x, dst_y );	 				   
 
 		if( to_y == from_y ) 
@@ -1266,7 +1763,7 @@ asim_straight_ellips( ASDrawContext *ctx, int x, int y, int rx, int ry, Bool fil
 		x - rx  < ctx->canvas_width && y - ry < ctx->canvas_height ) 
 	{	 
 		int max_y = ry ; 
-		int orig_x = x, orig_y = y, orig_rx = rx ; 
+		int orig_x = x, orig_y = y, orig_rx = rx, orig_ry = ry ; 
 #ifdef HAVE_LONG_LONG						   
 		Long64_t rx2 = rx*rx, ry2 = ry * ry, d ; 
 #else
@@ -1344,6 +1841,8 @@ asim_straight_ellips( ASDrawContext *ctx, int x, int y, int rx, int ry, Bool fil
 					max_ty -= (long)d;
 				}while( ++y1 <= max_y ); 
 			}
+			if( fill ) 
+				ctx_path_add_ellips( ctx, orig_x, orig_y, orig_rx, orig_ry, 0 );
 		}		
 		asim_apply_path( ctx, orig_x+orig_rx, orig_y, fill, orig_x, orig_y, CTX_ELLIPS_FILL_THRESHOLD );
 	}		
@@ -1367,14 +1866,14 @@ asim_ellips( ASDrawContext *ctx, int x, int y, int rx, int ry, int angle, Bool f
 	
 	if( angle == 0 || angle ==180  || rx == ry ) 
 	{	
-		asim_straight_ellips( ctx, x, y, rx, ry, False );
+		asim_straight_ellips( ctx, x, y, rx, ry, fill );
 		if( angle == 180 ) 
 			asim_move_to( ctx, x-rx, y );
 		return;
 	}
 	if( angle == 90 || angle == 270 ) 
 	{	
-		asim_straight_ellips( ctx, x, y, ry, rx, False );
+		asim_straight_ellips( ctx, x, y, ry, rx, fill );
 		asim_move_to( ctx, x, y + (angle == 90?-rx:rx) );
 		return;
 	}
@@ -1432,11 +1931,13 @@ void
 asim_ellips2( ASDrawContext *ctx, int x, int y, int rx, int ry, int angle, Bool fill ) 
 {
 	Bool direction = 1 ;
+	int orig_angle ;
 
 	while( angle >= 360 ) 
 		angle -= 360 ;
 	while( angle < 0 ) 
 		angle += 360 ;
+	orig_angle = angle ;
 	
 	if( angle == 0 || angle ==180  || rx == ry ) 
 	{	
@@ -1488,7 +1989,12 @@ asim_ellips2( ASDrawContext *ctx, int x, int y, int rx, int ry, int angle, Bool
 		double A2 = 2.*A ;
 		double BB; 
 		double CC = C*(double)((line<<1)-1);
+		Bool path_started = False ;
 
+		/* outline gets drawn into scratch canvas, so that fill could be 
+		 * rasterized from the exact ellips before being applied at once : */
+		if( fill ) 
+			path_started = asim_start_path( ctx );
 
 		xt = (int)((A-CC)/A2)  ;
 		y1 = line*direction ;
@@ -1675,17 +2181,17 @@ asim_ellips2( ASDrawContext *ctx, int x, int y, int rx, int ry, int angle, Bool
 #ifdef DEBUG_ELLIPS					 
 			fprintf( stderr, "dx1 = %d, x1 = %d, dx2 = %d, x2 = %d\n", dx1, x1, dx2, x2 ); 
 #endif
-			if( fill ) 
-			{	
-				CTX_FILL_HLINE(ctx,x+(x1-2),y-y1,x+x2-1,255);
-				CTX_FILL_HLINE(ctx,x-x2-1,y+y1,x-(x1-2),255);
-			}
-			
 			CC -= 2.*C ;
 			BB -= B*(double)((line-1)<<1) ;
 			y1 -= direction ;
 			--line ; 
 		}	 
+		if( fill ) 
+		{
+			ctx_path_add_ellips( ctx, x, y, rx, ry, orig_angle );
+			if( path_started ) 
+				asim_apply_path( ctx, x, y, True, x, y, 0 );
+		}
 	}		
 }	 
 
@@ -14,6 +14,9 @@ typedef struct ASDrawContext
 #define ASDrawCTX_UsingScratch	(0x01<<0)	
 #define ASDrawCTX_CanvasIsARGB	(0x01<<1)
 #define ASDrawCTX_ToolIsARGB	(0x01<<2)
+#define ASDrawCTX_EvenOddFill	(0x01<<3)	/* otherwise paths are filled 
+											 * using non-zero winding rule */
+#define ASDrawCTX_PathStarted	(0x01<<4)
 	ASFlagType flags ;
 
 	ASDrawTool *tool ;
@@ -26,6 +29,18 @@ typedef struct ASDrawContext
 
 	void (*apply_tool_func)( struct ASDrawContext *ctx, int curr_x, int curr_y, CARD32 ratio );
 	void (*fill_hline_func)( struct ASDrawContext *ctx, int x_from, int y, int x_to, CARD32 ratio );
+
+	/* outline of the current path in 24.8 fixed point, used to fill it : */
+	struct ASDrawEdge *edges ;
+	int edges_num, edges_allocated ;
+	int path_start_x, path_start_y ;
+	int path_last_x, path_last_y ;
+
+	/* rows of the canvas changed since it was last applied to ASImage,
+	 * and encoded copies of all the rows as of that time, so that 
+	 * apply_asdraw_context() only needs to encode rows that changed : */
+	CARD8 		*dirty_rows ;
+	ASStorageID *encoded_rows ;
 }ASDrawContext;
 
 #define AS_DRAW_BRUSHES	3
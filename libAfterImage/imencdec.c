@@ -150,22 +150,125 @@ Bool create_image_argb32( ASVisual *asv, ASImage *im, ASAltImFormats format )
 {
 	if( im->alt.argb32 == NULL )
 		im->alt.argb32 = safemalloc( im->width*im->height*sizeof(ARGB32) );
+	/* nothing else holds the pixels of such image - treat it as packed */
+	if( get_flags( im->flags, ASIM_DATA_NOT_USEFUL ) )
+		set_flags( im->flags, ASIM_PACKED_ARGB32 );
 	return True;
 }
 
+/*************************************************************************/
+/* Decoders and outputs get created and destroyed several times per every
+ * transformation - we keep few released ones around for reuse : */
+#define ASIM_CODEC_POOL_SIZE	8
+
+static ASImageDecoder *decoder_pool[ASIM_CODEC_POOL_SIZE];
+static int             decoder_pool_count = 0;
+static ASImageOutput  *output_pool[ASIM_CODEC_POOL_SIZE];
+static int             output_pool_count = 0;
+static ASImCodecPoolStats codec_pool_stats;
+
+static ASImageDecoder *
+alloc_image_decoder()
+{
+	ASImageDecoder *imdec ;
+	if( decoder_pool_count > 0 )
+	{
+		ASBevelRampCache ramps ;
+		imdec = decoder_pool[--decoder_pool_count] ;
+		ramps = imdec->bevel_ramps ;
+		memset( imdec, 0x00, sizeof(ASImageDecoder) );
+		imdec->bevel_ramps = ramps ;
+		++codec_pool_stats.decoders_reused ;
+	}else
+	{
+		imdec = safecalloc( 1, sizeof(ASImageDecoder));
+		++codec_pool_stats.decoders_allocated ;
+	}
+	return imdec;
+}
+
+static void
+release_image_decoder( ASImageDecoder *imdec )
+{
+	if( decoder_pool_count < ASIM_CODEC_POOL_SIZE )
+		decoder_pool[decoder_pool_count++] = imdec ;
+	else
+	{
+		if( imdec->bevel_ramps.left )
+			free( imdec->bevel_ramps.left );
+		free( imdec );
+	}
+}
+
+static ASImageOutput *
+alloc_image_output()
+{
+	ASImageOutput *imout ;
+	if( output_pool_count > 0 )
+	{
+		imout = output_pool[--output_pool_count] ;
+		memset( imout, 0x00, sizeof(ASImageOutput) );
+		++codec_pool_stats.outputs_reused ;
+	}else
+	{
+		imout = safecalloc( 1, sizeof(ASImageOutput));
+		++codec_pool_stats.outputs_allocated ;
+	}
+	return imout;
+}
+
+static void
+release_image_output( ASImageOutput *imout )
+{
+	if( output_pool_count < ASIM_CODEC_POOL_SIZE )
+		output_pool[output_pool_count++] = imout ;
+	else
+		free( imout );
+}
+
+void
+flush_image_codec_pool()
+{
+	while( decoder_pool_count > 0 )
+	{
+		ASImageDecoder *imdec = decoder_pool[--decoder_pool_count] ;
+		if( imdec->bevel_ramps.left )
+			free( imdec->bevel_ramps.left );
+		free( imdec );
+	}
+	while( output_pool_count > 0 )
+		free( output_pool[--output_pool_count] );
+	flush_scanline_pool();
+}
+
+void
+get_image_codec_pool_stats( ASImCodecPoolStats *stats )
+{
+	if( stats )
+	{
+		*stats = codec_pool_stats ;
+		get_scanline_pool_stats( &(stats->scanlines) );
+	}
+}
+
 /*************************************************************************/
 /* low level routines ****************************************************/
 static void
 asimage_dup_line (ASImage * im, ColorPart color, unsigned int y1, unsigned int y2, unsigned int length)
 {
-	ASStorageID *part = im->channels[color];
-	if (part[y2] != 0)
-	{	
-		forget_data(NULL, part[y2]);
-		part[y2] = 0 ;
+	int t, tiles_count = ASIMAGE_ROW_TILES(im) ;
+	ASStorageID *src = im->channels[color]+y1*tiles_count;
+	ASStorageID *part = im->channels[color]+y2*tiles_count;
+	for( t = 0 ; t < tiles_count ; ++t )
+	{
+		if (part[t] != 0)
+		{	
+			forget_data(NULL, part[t]);
+			part[t] = 0 ;
+		}
+		if( src[t] )
+		 	part[t] = dup_data(NULL, src[t] );
 	}
-	if( part[y1] )
-	 	part[y2] = dup_data(NULL, part[y1] );
 }
 
 void
@@ -173,23 +276,30 @@ asimage_erase_line( ASImage * im, ColorPart color, unsigned int y )
 {
 	if( !AS_ASSERT(im) )
 	{
-		ASStorageID *part = im->channels[color];
+		int t, tiles_count = ASIMAGE_ROW_TILES(im) ;
+		ASStorageID *part ;
+		TOUCH_ASIMAGE(im);
 		if( color < IC_NUM_CHANNELS )
 		{
-			if( part[y] )
-			{
-				forget_data( NULL, part[y] );
-				part[y] = 0;
-			}
+			part = im->channels[color]+y*tiles_count;
+			for( t = 0 ; t < tiles_count ; ++t )
+				if( part[t] )
+				{
+					forget_data( NULL, part[t] );
+					part[t] = 0;
+				}
 		}else
 		{
 			int c ;
 			for( c = 0 ; c < IC_NUM_CHANNELS ; c++ )
 			{
-				part = im->channels[c];
-				if( part[y] )
-					forget_data( NULL, part[y] );
-				part[y] = 0;
+				part = im->channels[c]+y*tiles_count;
+				for( t = 0 ; t < tiles_count ; ++t )
+				{
+					if( part[t] )
+						forget_data( NULL, part[t] );
+					part[t] = 0;
+				}
 			}
 		}
 	}
@@ -338,7 +448,7 @@ start_image_decoding( ASVisual *asv,ASImage *im, ASFlagType filter,
 
 	}
 
-	imdec = safecalloc( 1, sizeof(ASImageDecoder));
+	imdec = alloc_image_decoder();
 	imdec->asv = asv ;
 	imdec->im = im ;
 	imdec->filter = filter ;
@@ -489,7 +599,7 @@ stop_image_decoding( ASImageDecoder **pimdec )
 				free( (*pimdec)->xim_buffer );
 			}
 
-			free( *pimdec );
+			release_image_decoder( *pimdec );
 			*pimdec = NULL;
 		}
 }
@@ -516,13 +626,20 @@ start_image_output( ASVisual *asv, ASImage *im, ASAltImFormats format,
 
 	if( format < 0 || format == ASA_Vector || format >= ASA_Formats)
 		return NULL;
+	if( format == ASA_ASImage && get_flags( im->flags, ASIM_PACKED_ARGB32 ) )
+	{	/* packed images keep their pixels in alt.argb32 - write there directly */
+		TOUCH_ASIMAGE(im);
+		format = ASA_ARGB32 ;
+	}
 	if( asimage_format_handlers[format].check_create_asim_format )
 		if( !asimage_format_handlers[format].check_create_asim_format(asv, im, format) )
 			return NULL;
 
-	imout = safecalloc( 1, sizeof(ASImageOutput));
+	imout = alloc_image_output();
 	imout->asv = asv;
 	imout->im = im ;
+	if( format == ASA_ASImage )
+		TOUCH_ASIMAGE(im);
 
 	imout->out_format = format ;
 	imout->encode_image_scanline = asimage_format_handlers[format].encode_image_scanline;
@@ -606,7 +723,7 @@ stop_image_output( ASImageOutput **pimout )
 				imout->output_image_scanline( imout, NULL, 1);
 			free_scanline(&(imout->buffer[0]), True);
 			free_scanline(&(imout->buffer[1]), True);
-			free( imout );
+			release_image_output( imout );
 			*pimout = NULL;
 		}
 	}
@@ -752,7 +869,9 @@ decode_asscanline_native( ASImageDecoder *imdec, unsigned int skip, int y )
 		if( get_flags(imdec->filter, 0x01<<i) )
 		{
 			register CARD32 *chan = scl->channels[i]+skip;
-			if( imdec->im )
+			if( imdec->im && get_flags( imdec->im->flags, ASIM_TILED ) )
+				count = asimage_decode_line( imdec->im, i, chan, y, imdec->offset_x, width );
+			else if( imdec->im )
 				count = fetch_data32( NULL, imdec->im->channels[i][y], chan, imdec->offset_x, width, 0, NULL);
 			else
 				count = 0 ;
@@ -976,41 +1095,121 @@ draw_solid_bevel_line( register ASScanline *scl, int alt_left, int hi_end, int l
 			}
 		}
 }
+/* weights of the fading inline do not depend on the line, only on x - 
+ * so we compute them once per bevel geometry : */
+static ASBevelRampCache *
+get_bevel_ramps( ASImageDecoder *imdec, int left_margin, int right_margin )
+{
+	ASBevelRampCache *ramps = &(imdec->bevel_ramps);
+	ASImageBevel *bevel = imdec->bevel ;
+	int width = imdec->buffer.width ;
+	CARD32 ha_bevel = ARGB32_ALPHA8(bevel->hi_color);
+	CARD32 ha_shade = ARGB32_ALPHA8(bevel->lo_color);
+
+	if( ramps->left == NULL || ramps->width != width ||
+		ramps->bevel_left != imdec->bevel_left || ramps->bevel_right != imdec->bevel_right ||
+		ramps->left_inline != (int)bevel->left_inline || ramps->right_inline != (int)bevel->right_inline ||
+		ramps->hi_alpha != ha_bevel || ramps->lo_alpha != ha_shade )
+	{
+	    CARD32 hda_bevel = (ha_bevel<<8)/(bevel->left_inline+1) ;
+    	CARD32 hda_shade = (ha_shade<<8)/(bevel->right_inline+1);
+		int i, end ;
+
+		if( ramps->allocated < width )
+		{
+			if( ramps->left )
+				free( ramps->left );
+			ramps->left = safemalloc( width*2*sizeof(CARD32) );
+			ramps->allocated = width ;
+		}
+		ramps->right = ramps->left + ramps->allocated ;
+		ramps->width = width ;
+		ramps->bevel_left = imdec->bevel_left ;
+		ramps->bevel_right = imdec->bevel_right ;
+		ramps->left_inline = bevel->left_inline ;
+		ramps->right_inline = bevel->right_inline ;
+		ramps->hi_alpha = ha_bevel ;
+		ramps->lo_alpha = ha_shade ;
+
+		end = MIN(width, imdec->bevel_left+(int)bevel->left_inline);
+		for( i = left_margin ; i < end ; ++i )
+			ramps->left[i] = (hda_bevel*(imdec->bevel_left+(int)bevel->left_inline-i))>>8 ;
+		for( i = MAX(left_margin, imdec->bevel_right-(int)bevel->right_inline) ; i < right_margin ; ++i )
+			ramps->right[i] = (hda_shade*(i-imdec->bevel_right+(int)bevel->right_inline))>>8 ;
+	}
+	return ramps;
+}
+
+/* Blending kernels - plain forward loops over independent pixels, so that
+ * compiler could vectorize them : */
 static inline void
+blend_bevel_ramp( register CARD32 *chan, register const CARD32 *ramp, CARD32 chan_col, int from, int to )
+{
+	register int i ;
+	for( i = from ; i < to ; ++i )
+		chan[i] = (chan[i]*(255-ramp[i])+chan_col*ramp[i])>>8 ;
+}
+
+static inline void
+blend_bevel_const( register CARD32 *chan, CARD32 ca, CARD32 chan_col, int from, int to )
+{
+	register int i ;
+	for( i = from ; i < to ; ++i )
+		chan[i] = (chan[i]*ca+chan_col)>>8 ;
+}
+
+static void
 draw_fading_bevel_sides( ASImageDecoder *imdec,
 					     int left_margin, int left_delta,
 					     int right_delta, int right_margin )
 {
 	register ASScanline *scl = &(imdec->buffer);
 	ASImageBevel *bevel = imdec->bevel ;
-	CARD32 ha_bevel = ARGB32_ALPHA8(bevel->hi_color);
-	CARD32 ha_shade = ARGB32_ALPHA8(bevel->lo_color);
-    CARD32 hda_bevel = (ha_bevel<<8)/(bevel->left_inline+1) ;
-    CARD32 hda_shade = (ha_shade<<8)/(bevel->right_inline+1);
+	int left_end = imdec->bevel_left+(int)bevel->left_inline-left_delta ;
+	int right_start = imdec->bevel_right + right_delta - (int)bevel->right_inline + 1 ;
 	int channel ;
 
-	for( channel = 0 ; channel < ARGB32_CHANNELS ; ++channel )
-		if( get_flags(scl->flags, (0x01<<channel)) )
-		{
-			CARD32 chan_col = ARGB32_CHAN8(bevel->hi_color,channel)<<scl->shift ;
-			register CARD32 ca = hda_bevel*(left_delta+1) ;
-			register int i = MIN((int)scl->width, imdec->bevel_left+(int)bevel->left_inline-left_delta);
-			CARD32 *chan_img_start = scl->channels[channel] ;
-
-			while( --i >= left_margin )
+	if( left_end <= (int)scl->width && right_start > left_margin )
+	{
+		ASBevelRampCache *ramps = get_bevel_ramps( imdec, left_margin, right_margin );
+		for( channel = 0 ; channel < ARGB32_CHANNELS ; ++channel )
+			if( get_flags(scl->flags, (0x01<<channel)) )
 			{
-				chan_img_start[i] = (chan_img_start[i]*(255-(ca>>8))+chan_col*(ca>>8))>>8 ;
-				ca += hda_bevel ;
+				blend_bevel_ramp( scl->channels[channel], ramps->left, 
+								  ARGB32_CHAN8(bevel->hi_color,channel)<<scl->shift, left_margin, left_end );
+				blend_bevel_ramp( scl->channels[channel], ramps->right, 
+								  ARGB32_CHAN8(bevel->lo_color,channel)<<scl->shift, right_start, right_margin );
 			}
-			ca = hda_shade*(right_delta+1) ;
-			i =  MAX( left_margin, imdec->bevel_right + right_delta - (int)bevel->right_inline);
-			chan_col = ARGB32_CHAN8(bevel->lo_color,channel)<<scl->shift ;
-			while( ++i < right_margin )
+	}else
+	{/* bevel is clipped by the scanline - fade starts off the ramp */
+		CARD32 ha_bevel = ARGB32_ALPHA8(bevel->hi_color);
+		CARD32 ha_shade = ARGB32_ALPHA8(bevel->lo_color);
+	    CARD32 hda_bevel = (ha_bevel<<8)/(bevel->left_inline+1) ;
+    	CARD32 hda_shade = (ha_shade<<8)/(bevel->right_inline+1);
+
+		for( channel = 0 ; channel < ARGB32_CHANNELS ; ++channel )
+			if( get_flags(scl->flags, (0x01<<channel)) )
 			{
-				chan_img_start[i] = (chan_img_start[i]*(255-(ca>>8))+chan_col*(ca>>8))>>8 ;
-				ca += hda_shade ;
+				CARD32 chan_col = ARGB32_CHAN8(bevel->hi_color,channel)<<scl->shift ;
+				register CARD32 ca = hda_bevel*(left_delta+1) ;
+				register int i = MIN((int)scl->width, left_end);
+				CARD32 *chan_img_start = scl->channels[channel] ;
+
+				while( --i >= left_margin )
+				{
+					chan_img_start[i] = (chan_img_start[i]*(255-(ca>>8))+chan_col*(ca>>8))>>8 ;
+					ca += hda_bevel ;
+				}
+				ca = hda_shade*(right_delta+1) ;
+				i =  MAX( left_margin, right_start-1 );
+				chan_col = ARGB32_CHAN8(bevel->lo_color,channel)<<scl->shift ;
+				while( ++i < right_margin )
+				{
+					chan_img_start[i] = (chan_img_start[i]*(255-(ca>>8))+chan_col*(ca>>8))>>8 ;
+					ca += hda_shade ;
+				}
 			}
-		}
+	}
 }
 
 static inline void
@@ -1022,24 +1221,17 @@ draw_transp_bevel_sides( ASImageDecoder *imdec,
 	ASImageBevel *bevel = imdec->bevel ;
 	CARD32 ha_bevel = ARGB32_ALPHA8(bevel->hi_color)>>1;
 	CARD32 ha_shade = ARGB32_ALPHA8(bevel->lo_color)>>1;
+	int left_end = imdec->bevel_left+(int)bevel->left_inline-left_delta ;
+	int right_start = MAX( left_margin, imdec->bevel_right + right_delta - (int)bevel->right_inline) + 1 ;
 	int channel ;
 
 	for( channel = 0 ; channel < ARGB32_CHANNELS ; ++channel )
 		if( get_flags(scl->flags, (0x01<<channel)) )
 		{
-			CARD32 chan_col = (ARGB32_CHAN8(bevel->hi_color,channel)<<scl->shift)*ha_bevel ;
-			register CARD32 ca = 255-ha_bevel ;
-			register int i = imdec->bevel_left+(int)bevel->left_inline-left_delta;
-			CARD32 *chan_img_start = scl->channels[channel] ;
-
-			while( --i >= left_margin )
-				chan_img_start[i] = (chan_img_start[i]*ca+chan_col)>>8 ;
-
-			ca = 255-ha_shade ;
-			i =  MAX( left_margin, imdec->bevel_right + right_delta - (int)bevel->right_inline);
-			chan_col = (ARGB32_CHAN8(bevel->lo_color,channel)<<scl->shift)*ha_shade ;
-			while( ++i < right_margin )
-				chan_img_start[i] = (chan_img_start[i]*ca+chan_col)>>8 ;
+			blend_bevel_const( scl->channels[channel], 255-ha_bevel, 
+							   (ARGB32_CHAN8(bevel->hi_color,channel)<<scl->shift)*ha_bevel, left_margin, left_end );
+			blend_bevel_const( scl->channels[channel], 255-ha_shade, 
+							   (ARGB32_CHAN8(bevel->lo_color,channel)<<scl->shift)*ha_shade, right_start, right_margin );
 		}
 }
 
@@ -1082,8 +1274,7 @@ draw_transp_bevel_line ( ASImageDecoder *imdec,
 					if( end_i >= 0 ) 
 						chan_img_start[end_i] = (chan_img_start[end_i]*rev_ca + ARGB32_CHAN8(right_color,channel)*(ca>>8))>>8 ;
 				}
-				while( ++i < end_i )
-					chan_img_start[i] = (chan_img_start[i]*rev_ca+chan_col)>>8;
+				blend_bevel_const( chan_img_start, rev_ca, chan_col, i+1, end_i );
 			}
 	}
 }
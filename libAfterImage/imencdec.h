@@ -41,6 +41,9 @@ extern "C" {
  *          start_image_output(), set_image_output_back_color(),
  *          toggle_image_output_direction(), stop_image_output()
  *
+ *   Pools :
+ *          flush_image_codec_pool(), get_image_codec_pool_stats()
+ *
  * Other libAfterImage modules :
  *          ascmap.h asfont.h asimage.h asvisual.h blender.h export.h
  *          import.h transform.h ximage.h
@@ -138,6 +141,18 @@ typedef void (*decode_asscanline_func)( struct ASImageDecoder *imdec,
 typedef void (*decode_image_scanline_func)
 				(struct ASImageDecoder *imdec);
 
+/* fade weights of the bevel's inline, precomputed for particular bevel 
+ * geometry. Kept with the decoder when it is pooled, so redraws of the 
+ * same bevel don't have to recompute it : */
+typedef struct ASBevelRampCache
+{
+	CARD32 *left, *right ;		/* weights (0-255) indexed by x */
+	int     allocated ;
+	int     width, bevel_left, bevel_right ;
+	int     left_inline, right_inline ;
+	CARD32  hi_alpha, lo_alpha ;
+}ASBevelRampCache;
+
 typedef struct ASImageDecoder
 {
 	struct ASVisual *asv;
@@ -167,6 +182,7 @@ typedef struct ASImageDecoder
 	/* internal data : */
 	unsigned short    bevel_h_addon, bevel_v_addon ;
 	int 			  next_line ;
+	ASBevelRampCache  bevel_ramps ;
 
     struct ASScanline   *xim_buffer; /* matches the size of the 
 							   * original XImage */
@@ -496,6 +512,38 @@ void set_image_output_back_color( ASImageOutput *imout, ARGB32 back_color );
 void toggle_image_output_direction( ASImageOutput *imout );
 void stop_image_output( ASImageOutput **pimout );
 
+/****s* libAfterImage/ASImCodecPoolStats
+ * NAME
+ * ASImCodecPoolStats - counters describing reuse of decoders and outputs.
+ * DESCRIPTION
+ * stop_image_decoding() and stop_image_output() keep a few released 
+ * objects around, so that following start_image_decoding() and 
+ * start_image_output() could recycle them instead of allocating. 
+ * Scanline buffers are pooled separately - see ASScanlinePoolStats.
+ * SOURCE
+ */
+typedef struct ASImCodecPoolStats
+{
+	unsigned long decoders_reused, decoders_allocated ;
+	unsigned long outputs_reused, outputs_allocated ;
+	ASScanlinePoolStats scanlines ;
+}ASImCodecPoolStats;
+/*******************/
+/****f* libAfterImage/asimage/flush_image_codec_pool()
+ * NAME
+ * flush_image_codec_pool() - frees all pooled decoders, outputs and 
+ * scanline buffers.
+ * NAME
+ * get_image_codec_pool_stats() - retrieves pool usage counters.
+ * SYNOPSIS
+ * void flush_image_codec_pool();
+ * void get_image_codec_pool_stats( ASImCodecPoolStats *stats );
+ * DESCRIPTION
+ * Should be called on shutdown, along with flush_default_asstorage().
+ *********/
+void flush_image_codec_pool();
+void get_image_codec_pool_stats( ASImCodecPoolStats *stats );
+
 #ifdef __cplusplus
 }
 #endif
@@ -267,6 +267,11 @@ file2ASImage_extra( const char *file, ASImageImportParams *iparams )
 			if( g_var != NULL )
 				iparams->gamma = atof(g_var);
 			im = as_image_file_loaders[file_type](realfilename, iparams);
+			/* huge images mostly get cropped, and that is cheaper 
+			 * when only touched tiles need decompressing : */
+			if( im != NULL && im->width > ASIMAGE_TILE_WIDTH && 
+				(get_flags(iparams->flags, AS_IMPORT_TILED) || im->width >= AS_IMPORT_TILED_MIN_WIDTH) )
+				tile_asimage_rows( im );
 		}else
 			show_error( "Support for the format of image file \"%s\" has not been implemented yet.", realfilename );
 		/* returned image must not be tracked by any ImageManager yet !!! */
@@ -117,6 +117,10 @@ typedef struct ASImageListEntry
 #define AS_IMPORT_SCALED_V		(0x01<<4)      /* if unset - then tile */
 #define AS_IMPORT_SCALED_BOTH	(AS_IMPORT_SCALED_H|AS_IMPORT_SCALED_V)
 #define AS_IMPORT_FAST			(0x01<<5)      /* can sacrifice quality for speed */
+#define AS_IMPORT_TILED			(0x01<<6)      /* store rows as tiles - see tile_asimage_rows() */
+
+/* images that wide get tiled storage even without AS_IMPORT_TILED : */
+#define AS_IMPORT_TILED_MIN_WIDTH	4096
 
 #define AS_IMPORT_SKIP_COMPRESSED			(0x01<<15)
 #define AS_IMPORT_IGNORE_IF_MISSING		(0x01<<16)
@@ -231,6 +231,12 @@ scale_pixmap (ASVisual *asv, Pixmap src, int src_w, int src_h, int width, int he
 	if (src != None)
     {
 		ASImage *src_im ;
+		if( check_xrender_support( asv ) )
+		{
+			trg = CREATE_TRG_PIXMAP (asv, width, height);
+			copytint_drawable_xrender( asv, src, trg, 0, 0, src_w, src_h, width, height, 0, 0, tint );
+			return trg;
+		}
 		src_im = pixmap2ximage(asv, src, 0, 0, src_w, src_h, AllPlanes, 0 );
 		if( src_im ) 
 		{
@@ -284,7 +290,7 @@ copyshade_drawable_area( ASVisual *asv, Drawable src, Pixmap trg,
 	if( tint == TINT_LEAVE_SAME || asv == NULL )
 	{
 		XCopyArea (dpy, src, trg, gc, x, y, w, h, trg_x, trg_y);
-	}else
+	}else if( !copytint_drawable_xrender( asv, src, trg, x, y, w, h, w, h, trg_x, trg_y, tint ) )
 	{
 		ASImage *src_im = pixmap2ximage( asv, src, x, y, w, h, AllPlanes, 0 );
 		if( src_im )
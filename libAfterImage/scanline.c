@@ -43,6 +43,95 @@
 
 
 /* ********************* ASScanline ************************************/
+/* Scanline buffers are recycled through a pool of size classes, since
+ * every transformation allocates several of them and frees them right
+ * away. Class k holds buffers for widths up to ASSCL_POOL_MIN_WIDTH<<k,
+ * wider scanlines bypass the pool. Each buffer is preceded by 8 bytes
+ * of header that record its class so free_scanline() knows where it
+ * goes back to. */
+#define ASSCL_POOL_MIN_WIDTH	32
+#define ASSCL_POOL_CLASSES		9	/* up to 8192 pixels wide */
+#define ASSCL_POOL_DEPTH		8	/* buffers kept per class */
+#define ASSCL_HEADER_SIZE		2	/* in CARD32s */
+
+static CARD32 *scl_pool[ASSCL_POOL_CLASSES][ASSCL_POOL_DEPTH];
+static int     scl_pool_count[ASSCL_POOL_CLASSES];
+static ASScanlinePoolStats scl_pool_stats;
+
+static inline size_t
+scl_buffer_size( size_t aligned_width )
+{
+	return ((aligned_width*4)+16)*sizeof(CARD32)+8;
+}
+
+static CARD32 *
+alloc_scanline_buffer( size_t aligned_width )
+{
+	int k = 0 ;
+	size_t class_width = ASSCL_POOL_MIN_WIDTH ;
+	CARD32 *block ;
+
+	while( class_width < aligned_width && k < ASSCL_POOL_CLASSES )
+	{
+		class_width <<= 1 ;
+		++k ;
+	}
+	if( k < ASSCL_POOL_CLASSES && scl_pool_count[k] > 0 )
+	{
+		block = scl_pool[k][--scl_pool_count[k]] ;
+		memset( block+ASSCL_HEADER_SIZE, 0x00, scl_buffer_size(class_width) );
+		++scl_pool_stats.hits ;
+		--scl_pool_stats.cached_buffers ;
+		scl_pool_stats.cached_bytes -= scl_buffer_size(class_width);
+		return block+ASSCL_HEADER_SIZE;
+	}
+	if( k >= ASSCL_POOL_CLASSES )
+		class_width = aligned_width ;
+	block = safecalloc( 1, scl_buffer_size(class_width)+ASSCL_HEADER_SIZE*sizeof(CARD32) );
+	if( block == NULL )
+		return NULL;
+	block[0] = k ;
+	++scl_pool_stats.misses ;
+	return block+ASSCL_HEADER_SIZE;
+}
+
+static void
+release_scanline_buffer( CARD32 *buffer )
+{
+	CARD32 *block = buffer-ASSCL_HEADER_SIZE ;
+	int k = block[0] ;
+
+	if( k < ASSCL_POOL_CLASSES && scl_pool_count[k] < ASSCL_POOL_DEPTH )
+	{
+		scl_pool[k][scl_pool_count[k]++] = block ;
+		++scl_pool_stats.released ;
+		++scl_pool_stats.cached_buffers ;
+		scl_pool_stats.cached_bytes += scl_buffer_size(ASSCL_POOL_MIN_WIDTH<<k);
+	}else
+	{
+		++scl_pool_stats.discarded ;
+		free( block );
+	}
+}
+
+void
+flush_scanline_pool()
+{
+	int k ;
+	for( k = 0 ; k < ASSCL_POOL_CLASSES ; ++k )
+		while( scl_pool_count[k] > 0 )
+			free( scl_pool[k][--scl_pool_count[k]] );
+	scl_pool_stats.cached_buffers = 0 ;
+	scl_pool_stats.cached_bytes = 0 ;
+}
+
+void
+get_scanline_pool_stats( ASScanlinePoolStats *stats )
+{
+	if( stats )
+		*stats = scl_pool_stats ;
+}
+
 ASScanline*
 prepare_scanline( unsigned int width, unsigned int shift, ASScanline *reusable_memory, Bool BGR_mode  )
 {
@@ -61,7 +150,7 @@ prepare_scanline( unsigned int width, unsigned int shift, ASScanline *reusable_m
 	/* we want to align data by 8 byte boundary (double)
 	 * to allow for code with less ifs and easier MMX/3Dnow utilization :*/
 	aligned_width = width + (width&0x00000001);
-	sl->buffer = ptr = safecalloc (1, ((aligned_width*4)+16)*sizeof(CARD32)+8);
+	sl->buffer = ptr = alloc_scanline_buffer( aligned_width );
 	if (ptr == NULL)
 	{
 		if (sl != reusable_memory)
@@ -97,7 +186,7 @@ free_scanline( ASScanline *sl, Bool reusable )
 	if( sl )
 	{
 		if( sl->buffer )
-			free( sl->buffer );
+			release_scanline_buffer( sl->buffer );
 		if( !reusable )
 			free( sl );
 	}
@@ -19,7 +19,8 @@ extern "C" {
  *
  * Functions :
  *   ASScanline handling:
- *  	    prepare_scanline(), free_scanline()
+ *  	    prepare_scanline(), free_scanline(), flush_scanline_pool(),
+ *  	    get_scanline_pool_stats()
  *
  * Other libAfterImage modules :
  *          asvisual.h imencdec.h asimage.h blender.h
@@ -142,9 +143,43 @@ typedef void (*ASIMStripLoader)(ASScanline *scl, CARD8 *data, int data_size);
  * If reusable is false then object itself in not freed. That is usable
  * for declaring ASScanline on stack.
  *********/
+/****s* libAfterImage/ASScanlinePoolStats
+ * NAME
+ * ASScanlinePoolStats - counters describing reuse of scanline buffers.
+ * DESCRIPTION
+ * Buffers released by free_scanline() are kept in a pool of size
+ * classes, and handed out again by prepare_scanline(). hits counts
+ * buffers taken from the pool, misses - buffers that had to be
+ * allocated, released - buffers returned into the pool, discarded -
+ * buffers freed since pool was full or scanline too wide.
+ * SOURCE
+ */
+typedef struct ASScanlinePoolStats
+{
+	unsigned long hits, misses ;
+	unsigned long released, discarded ;
+	unsigned long cached_buffers ;
+	size_t        cached_bytes ;
+}ASScanlinePoolStats;
+/*******************/
+/****f* libAfterImage/flush_scanline_pool()
+ * NAME
+ * flush_scanline_pool() - frees all scanline buffers held in the pool.
+ * NAME
+ * get_scanline_pool_stats() - retrieves pool usage counters.
+ * SYNOPSIS
+ * void flush_scanline_pool();
+ * void get_scanline_pool_stats( ASScanlinePoolStats *stats );
+ * DESCRIPTION
+ * Pool memory is bounded, but flush_scanline_pool() should still be 
+ * called on shutdown, along with flush_default_asstorage(), to make 
+ * memory auditing happy.
+ *********/
 ASScanline* prepare_scanline( unsigned int width, unsigned int shift,
 	                          ASScanline *reusable_memory, Bool BGR_mode);
 void       free_scanline( ASScanline *sl, Bool reusable );
+void       flush_scanline_pool();
+void       get_scanline_pool_stats( ASScanlinePoolStats *stats );
 
 /* Scanline strips */
 void destroy_asim_strip (ASIMStrip **pstrip);
@@ -485,6 +485,49 @@ make_component_gradient16( register CARD32 *data, CARD16 from, CARD16 to, CARD8
 	}
 }
 
+#ifdef HAVE_MMX
+/* Same stepping as make_component_gradient16(), only done for all 4 channels
+ * at once - the error carry is serial along the row, but channels are
+ * independent, so we keep RG and BA pairs in two MMX registers : */
+static inline void
+make_argb_gradient16_mmx( CARD32 **channels, int offset, ARGB32 from, ARGB32 to, ARGB32 seed, int len )
+{
+	CARD32 *r = channels[IC_RED]+offset, *g = channels[IC_GREEN]+offset ;
+	CARD32 *b = channels[IC_BLUE]+offset, *a = channels[IC_ALPHA]+offset ;
+	long curr[IC_NUM_CHANNELS], incr[IC_NUM_CHANNELS] ;
+	__m64 vcurr_rg, vcurr_ba, vincr_rg, vincr_ba, vmask, v ;
+	register int i ;
+	int color ;
+
+	for( color = 0 ; color < IC_NUM_CHANNELS ; ++color )
+	{
+		long from16 = ((long)ARGB32_CHAN8(from,color))<<8 ;
+		long seed16 = ((long)ARGB32_CHAN8(seed,color))<<8 ;
+		incr[color] = ((((long)ARGB32_CHAN8(to,color))<<16)-(from16<<8))/len ;
+		curr[color] = from16<<8 ;
+		if( incr[color] != 0 )
+			curr[color] += (seed16 > incr[color])?incr[color]:seed16 ;
+	}
+	vcurr_rg = _mm_set_pi32( (int)curr[IC_GREEN], (int)curr[IC_RED] );
+	vcurr_ba = _mm_set_pi32( (int)curr[IC_ALPHA], (int)curr[IC_BLUE] );
+	vincr_rg = _mm_set_pi32( (int)incr[IC_GREEN], (int)incr[IC_RED] );
+	vincr_ba = _mm_set_pi32( (int)incr[IC_ALPHA], (int)incr[IC_BLUE] );
+	vmask = _mm_set1_pi32( 0x00FF );
+	for( i = 0 ; i < len ; ++i )
+	{
+		v = _mm_srai_pi32( vcurr_rg, 8 );
+		r[i] = _mm_cvtsi64_si32( v );
+		g[i] = _mm_cvtsi64_si32( _mm_srli_si64( v, 32 ) );
+		v = _mm_srai_pi32( vcurr_ba, 8 );
+		b[i] = _mm_cvtsi64_si32( v );
+		a[i] = _mm_cvtsi64_si32( _mm_srli_si64( v, 32 ) );
+		vcurr_rg = _mm_add_pi32( vcurr_rg, _mm_add_pi32( _mm_srli_pi32( _mm_and_si64( vcurr_rg, vmask ), 1 ), vincr_rg ) );
+		vcurr_ba = _mm_add_pi32( vcurr_ba, _mm_add_pi32( _mm_srli_pi32( _mm_and_si64( vcurr_ba, vmask ), 1 ), vincr_ba ) );
+	}
+	_mm_empty();
+}
+#endif
+
 
 static inline void
 copytintpad_scanline( ASScanline *src, ASScanline *dst, int offset, ARGB32 tint )
@@ -610,6 +653,11 @@ make_gradient_scanline( ASScanline *scl, ASGradient *grad, ASFlagType filter, AR
 			if( step > 0 )
 			{
 				int color ;
+#ifdef HAVE_MMX
+				if( asimage_use_mmx && (filter&SCL_DO_ALL) == SCL_DO_ALL )
+					make_argb_gradient16_mmx( scl->channels, offset, last_color, grad->color[new_idx], seed, step );
+				else
+#endif
 				for( color = 0 ; color < IC_NUM_CHANNELS ; ++color )
 					if( get_flags( filter, 0x01<<color ) )
 					{
@@ -854,6 +902,135 @@ scale_image_up_dumb( ASImageDecoder *imdec, ASImageOutput *imout, int h_ratio, i
 }
 
 
+/* *******************************************************************/
+/* Mip chain - half resolution copies of the image, each built from  */
+/* the previous one, so that downscaling could start from the level  */
+/* closest to the requested size instead of the full image :         */
+/* *******************************************************************/
+/* weights of source pixels at distances of 0.5, 1.5, ... from the center of
+ * the destination pixel, on each side, in 1/256 : */
+static int mip_box_weights[1] = { 128 };
+static int mip_lanczos_weights[4] = { 111, 30, -11, -2 };	/* Lanczos2 */
+
+static void
+mip_filter_line( CARD32 *src, int src_width, int *dst, int dst_width, int *weights, int taps )
+{
+	int x ;
+	for( x = 0 ; x < dst_width ; ++x )
+	{
+		int k, sum = 0 ;
+		int left = x+x, right = x+x+1 ;
+		for( k = 0 ; k < taps ; ++k, --left, ++right )
+			sum += weights[k]*((int)src[MAX(left,0)] + (int)src[MIN(right,src_width-1)]);
+		dst[x] = sum ;
+	}
+}
+
+static ASImage *
+make_asimage_mip( ASImage *src )
+{
+	ASVisual *asv = &__transform_fake_asv ;
+	int width = (src->width+1)/2, height = (src->height+1)/2 ;
+	int *weights = mip_box_weights ;
+	int taps = sizeof(mip_box_weights)/sizeof(int) ;
+	int ring_size, *rows, *row_flags ;
+	int c, y, next_row = 0 ;
+	ASImageDecoder *imdec ;
+	ASImageOutput  *imout ;
+	ASImage *dst ;
+	ASScanline out ;
+
+	if( get_flags( src->flags, ASIM_MIP_LANCZOS ) )
+	{
+		weights = mip_lanczos_weights ;
+		taps = sizeof(mip_lanczos_weights)/sizeof(int) ;
+	}
+	if( (imdec = start_image_decoding(asv, src, SCL_DO_ALL, 0, 0, src->width, src->height, NULL)) == NULL )
+		return NULL;
+
+	dst = create_asimage( width, height, 100 );
+	dst->back_color = src->back_color ;
+	set_flags( dst->flags, get_flags( src->flags, ASIM_MIPMAPPED|ASIM_MIP_LANCZOS ) );
+	if((imout = start_image_output( asv, dst, ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT)) == NULL )
+	{
+		destroy_asimage( &dst );
+		stop_image_decoding( &imdec );
+		return NULL;
+	}
+	/* source rows needed for destination row y are 2y-taps+1 ... 2y+taps,
+	 * so we keep that many of them, already filtered horizontally : */
+	ring_size = taps*2 ;
+	rows = safemalloc( ring_size*IC_NUM_CHANNELS*width*sizeof(int) );
+	row_flags = safecalloc( ring_size, sizeof(int) );
+	prepare_scanline( width, 0, &out, asv->BGR_mode );
+
+	for( y = 0 ; y < height ; ++y )
+	{
+		int last_row = MIN(y+y+taps, (int)src->height-1) ;
+		int k ;
+		while( next_row <= last_row )
+		{
+			int slot = next_row%ring_size ;
+			imdec->decode_image_scanline( imdec );
+			row_flags[slot] = imdec->buffer.flags ;
+			for( c = 0 ; c < IC_NUM_CHANNELS ; ++c )
+				mip_filter_line( imdec->buffer.channels[c], src->width,
+								 rows+(slot*IC_NUM_CHANNELS+c)*width, width, weights, taps );
+			++next_row ;
+		}
+		out.flags = 0 ;
+		for( k = 0 ; k < taps ; ++k )
+			out.flags |= row_flags[MAX(y+y-k,0)%ring_size]|row_flags[MIN(y+y+1+k,last_row)%ring_size] ;
+		out.back_color = imdec->buffer.back_color ;
+		for( c = 0 ; c < IC_NUM_CHANNELS ; ++c )
+		{
+			CARD32 *dst_chan = out.channels[c] ;
+			int x ;
+			for( x = 0 ; x < width ; ++x )
+			{
+				int sum = 0 ;
+				for( k = 0 ; k < taps ; ++k )
+					sum += weights[k]*(rows[(((MAX(y+y-k,0))%ring_size)*IC_NUM_CHANNELS+c)*width+x] +
+									   rows[(((MIN(y+y+1+k,last_row))%ring_size)*IC_NUM_CHANNELS+c)*width+x]);
+				sum = (sum+32768)>>16 ;
+				dst_chan[x] = (sum < 0)? 0 : ((sum > 255)? 255 : sum) ;
+			}
+		}
+		imout->output_image_scanline( imout, &out, 1 );
+	}
+	free_scanline( &out, True );
+	free( row_flags );
+	free( rows );
+	stop_image_output( &imout );
+	stop_image_decoding( &imdec );
+	return dst;
+}
+
+ASImage *
+get_asimage_mip( ASImage *im, unsigned int min_width, unsigned int min_height )
+{
+	if( min_width == 0 )
+		min_width = 1 ;
+	if( min_height == 0 )
+		min_height = 1 ;
+	while( im && get_flags( im->flags, ASIM_MIPMAPPED ) &&
+		   (im->width+1)/2 >= min_width && (im->height+1)/2 >= min_height &&
+		   im->width > 1 && im->height > 1 )
+	{
+		if( im->mip != NULL && im->mip_revision != im->revision )
+			destroy_asimage( &(im->mip) );
+		if( im->mip == NULL )
+		{
+			if( (im->mip = make_asimage_mip( im )) == NULL )
+				break;
+			im->mip_revision = im->revision ;
+		}
+		im = im->mip ;
+	}
+	return im;
+}
+
+
 static inline ASImage *
 create_destination_image( unsigned int width, unsigned int height, ASAltImFormats format, 
 						  unsigned int compression, ARGB32 back_color )
@@ -888,6 +1065,9 @@ scale_asimage( ASVisual *asv, ASImage *src, int to_width, int to_height,
 	
 	if( !check_scale_parameters(src,src->width, src->height,&to_width,&to_height) )
 		return NULL;
+	/* final pass needs at least 2:1 ratio for its bins to do any averaging :*/
+	if( to_width < (int)src->width && to_height < (int)src->height )
+		src = get_asimage_mip( src, to_width*2, to_height*2 );
 	if( (imdec = start_image_decoding(asv, src, SCL_DO_ALL, 0, 0, 0, 0, NULL)) == NULL )
 		return NULL;
 
@@ -968,6 +1148,19 @@ scale_asimage2( ASVisual *asv, ASImage *src,
 		clip_height = src->height ;
 	if( !check_scale_parameters(src, clip_width, clip_height, &to_width, &to_height) )
 		return NULL;
+	if( get_flags( src->flags, ASIM_MIPMAPPED ) && to_width < clip_width && to_height < clip_height )
+	{ /* clip rectangle gets mapped onto the mip level proportionally : */
+		ASImage *mip = get_asimage_mip( src, (to_width*2*src->width+clip_width-1)/clip_width,
+											 (to_height*2*src->height+clip_height-1)/clip_height );
+		if( mip != src )
+		{
+			clip_x = clip_x*(int)mip->width/(int)src->width ;
+			clip_y = clip_y*(int)mip->height/(int)src->height ;
+			clip_width = (clip_width*mip->width+src->width-1)/src->width ;
+			clip_height = (clip_height*mip->height+src->height-1)/src->height ;
+			src = mip ;
+		}
+	}
 	if( (imdec = start_image_decoding(asv, src, SCL_DO_ALL, clip_x, clip_y, clip_width, clip_height, NULL)) == NULL )
 		return NULL;
 
@@ -1241,6 +1434,236 @@ LOCAL_DEBUG_OUT( "min_y = %d, max_y = %d", min_y, max_y );
 	return dst;
 }
 
+/* Incremental recomposition : only layers overlapping the rectangle get
+ * decoded, and only for the part of them that falls into it. Background and
+ * bevelled layers are decoded in full width, so that bevel stays intact : */
+static void
+splice_asimage_rect( ASImage *dst, ASImage *src, int dst_x, int dst_y )
+{
+	int y ;
+
+	if( get_flags( dst->flags, ASIM_PACKED_ARGB32 ) )
+	{
+		for( y = 0 ; y < (int)src->height ; ++y )
+			memcpy( dst->alt.argb32+(dst_y+y)*dst->width+dst_x, src->alt.argb32+y*src->width,
+					src->width*sizeof(ARGB32) );
+		TOUCH_ASIMAGE(dst);
+	}else
+	{
+		CARD32 *row = safemalloc( dst->width*sizeof(CARD32) );
+		int color ;
+		for( y = 0 ; y < (int)src->height ; ++y )
+			for( color = 0 ; color < IC_NUM_CHANNELS ; ++color )
+			{
+				int x = asimage_decode_line( dst, color, row, dst_y+y, 0, dst->width );
+				CARD32 fill = ARGB32_CHAN8(dst->back_color,color) ;
+				while( x < (int)dst->width )
+					row[x++] = fill ;
+				asimage_decode_line( src, color, row+dst_x, y, 0, src->width );
+				asimage_add_line( dst, color, row, dst_y+y );
+			}
+		free( row );
+	}
+	flush_asimage_cache( dst );
+}
+
+static Bool
+merge_layers_rect( ASVisual *asv, ASImage *dst, ASImageLayer *layers, int count,
+				   int rect_x, int rect_y, int rect_width, int rect_height, int quality )
+{
+	ASImage *tmp ;
+	ASImageDecoder **imdecs ;
+	ASImageOutput  *imout ;
+	ASImageLayer *pcurr = layers;
+	ASScanline dst_line ;
+	int *offsets ;
+	int i, y, first_y ;
+	int min_y = dst->height, max_y = 0 ;
+	int bg_tint = (layers[0].tint==0)?0x7F7F7F7F:layers[0].tint ;
+	int bg_bottom = 0 ;
+
+	if( rect_x < 0 )
+	{
+		rect_width += rect_x ;
+		rect_x = 0 ;
+	}
+	if( rect_y < 0 )
+	{
+		rect_height += rect_y ;
+		rect_y = 0 ;
+	}
+	if( rect_x+rect_width > (int)dst->width )
+		rect_width = (int)dst->width-rect_x ;
+	if( rect_y+rect_height > (int)dst->height )
+		rect_height = (int)dst->height-rect_y ;
+	if( rect_width <= 0 || rect_height <= 0 )
+		return True;
+
+	imdecs = safecalloc( count, sizeof(ASImageDecoder*));
+	offsets = safecalloc( count, sizeof(int));
+	for( i = 0 ; i < count ; i++ )
+	{
+		/* same layers as in merge_layers() are taken into account : */
+		if( (pcurr->im != NULL || pcurr->solid_color != 0 || i == 0) &&
+			pcurr->dst_x < (int)dst->width && pcurr->dst_x+(int)pcurr->clip_width > 0 )
+		{
+			int layer_bottom = pcurr->dst_y+pcurr->clip_height ;
+			if( i == 0 || pcurr->bevel != NULL )
+			{
+				imdecs[i] = start_image_decoding(asv, pcurr->im, SCL_DO_ALL,
+												 pcurr->clip_x, pcurr->clip_y,
+												 pcurr->clip_width, pcurr->clip_height,
+												 pcurr->bevel);
+				if( imdecs[i] && pcurr->bevel_width != 0 && pcurr->bevel_height != 0 )
+					set_decoder_bevel_geom( imdecs[i],
+											pcurr->bevel_x, pcurr->bevel_y,
+											pcurr->bevel_width, pcurr->bevel_height );
+				offsets[i] = pcurr->dst_x-rect_x ;
+				if( imdecs[i] )
+					layer_bottom += imdecs[i]->bevel_v_addon ;
+			}else
+			{
+				int x0 = MAX(pcurr->dst_x,rect_x) ;
+				int x1 = MIN(pcurr->dst_x+(int)pcurr->clip_width,rect_x+rect_width) ;
+				if( x0 < x1 && pcurr->dst_y < rect_y+rect_height && layer_bottom > rect_y )
+					imdecs[i] = start_image_decoding(asv, pcurr->im, SCL_DO_ALL,
+													 pcurr->clip_x+(x0-pcurr->dst_x), pcurr->clip_y,
+													 x1-x0, pcurr->clip_height, NULL);
+				offsets[i] = x0-rect_x ;
+			}
+			if( imdecs[i] )
+			{
+				if( pcurr->tint == 0 && i != 0 )
+					set_decoder_shift( imdecs[i], 8 );
+				if( pcurr->im == NULL )
+					set_decoder_back_color( imdecs[i], pcurr->solid_color );
+			}
+			if( pcurr->dst_y < min_y )
+				min_y = pcurr->dst_y;
+			if( layer_bottom > max_y )
+				max_y = layer_bottom;
+			if( i == 0 )
+				bg_bottom = layer_bottom ;
+		}
+		if( pcurr->next == pcurr )
+			break;
+		else
+			pcurr = (pcurr->next!=NULL)?pcurr->next:pcurr+1 ;
+	}
+	if( i < count )
+		count = i+1 ;
+
+	if( max_y > (int)dst->height )
+		max_y = dst->height ;
+	/* merge_layers() tiles rows past the bottom of the lowest layer, which
+	 * we can't do here - let the caller merge everything again instead : */
+	if( imdecs[0] == NULL || (max_y < (int)dst->height && rect_y+rect_height > max_y) )
+	{
+		for( i = 0 ; i < count ; i++ )
+			if( imdecs[i] )
+				stop_image_decoding( &(imdecs[i]) );
+		free( imdecs );
+		free( offsets );
+		return False;
+	}
+
+	tmp = create_packed_asimage( rect_width, rect_height );
+	tmp->back_color = dst->back_color ;
+	if( (imout = start_image_output( asv, tmp, ASA_ASImage, QUANT_ERR_BITS, quality)) == NULL )
+	{
+		for( i = 0 ; i < count ; i++ )
+			if( imdecs[i] )
+				stop_image_decoding( &(imdecs[i]) );
+		free( imdecs );
+		free( offsets );
+		destroy_asimage( &tmp );
+		return False;
+	}
+
+	prepare_scanline( rect_width, QUANT_ERR_BITS, &dst_line, asv->BGR_mode );
+	dst_line.back_color = imdecs[0]->back_color ;
+	first_y = MAX(rect_y,min_y) ;
+	pcurr = layers ;
+	for( i = 0 ; i < count ; ++i )
+	{
+		if( imdecs[i] && pcurr->dst_y < first_y )	/* decoders count lines from offset_y */
+			imdecs[i]->next_line = imdecs[i]->offset_y + (first_y - pcurr->dst_y) ;
+		pcurr = (pcurr->next!=NULL)?pcurr->next:pcurr+1 ;
+	}
+	for( y = rect_y ; y < rect_y+rect_height ; ++y )
+	{
+		if( y < min_y )
+		{
+			dst_line.flags = 0 ;
+			imout->output_image_scanline( imout, &dst_line, 1);
+			continue;
+		}
+		if( layers[0].dst_y <= y && bg_bottom > y )
+			imdecs[0]->decode_image_scanline( imdecs[0] );
+		else
+		{
+			imdecs[0]->buffer.back_color = imdecs[0]->back_color ;
+			imdecs[0]->buffer.flags = 0 ;
+		}
+		copytintpad_scanline( &(imdecs[0]->buffer), &dst_line, offsets[0], bg_tint );
+		pcurr = layers[0].next?layers[0].next:&(layers[1]) ;
+		for( i = 1 ; i < count ; i++ )
+		{
+			if( imdecs[i] && pcurr->dst_y <= y &&
+				pcurr->dst_y+(int)pcurr->clip_height+(int)imdecs[i]->bevel_v_addon > y )
+			{
+				register ASScanline *b = &(imdecs[i]->buffer);
+				CARD32 tint = pcurr->tint ;
+				imdecs[i]->decode_image_scanline( imdecs[i] );
+				if( tint != 0 )
+				{
+					tint_component_mod( b->red,   (CARD16)(ARGB32_RED8(tint)<<1),   b->width );
+					tint_component_mod( b->green, (CARD16)(ARGB32_GREEN8(tint)<<1), b->width );
+					tint_component_mod( b->blue,  (CARD16)(ARGB32_BLUE8(tint)<<1),  b->width );
+					tint_component_mod( b->alpha, (CARD16)(ARGB32_ALPHA8(tint)<<1), b->width );
+				}
+				pcurr->merge_scanlines( &dst_line, b, offsets[i] );
+			}
+			pcurr = (pcurr->next!=NULL)?pcurr->next:pcurr+1 ;
+		}
+		imout->output_image_scanline( imout, &dst_line, 1);
+	}
+	stop_image_output( &imout );
+	splice_asimage_rect( dst, tmp, rect_x, rect_y );
+
+	for( i = 0 ; i < count ; i++ )
+		if( imdecs[i] != NULL )
+			stop_image_decoding( &(imdecs[i]) );
+	free( imdecs );
+	free( offsets );
+	free_scanline( &dst_line, True );
+	destroy_asimage( &tmp );
+	return True;
+}
+
+Bool
+merge_layers_rects( ASVisual *asv, ASImage *dst,
+					ASImageLayer *layers, int count,
+					XRectangle *rects, int rects_count, int quality )
+{
+	int i ;
+	START_TIME(started);
+
+	if( dst == NULL || layers == NULL || count <= 0 || (rects == NULL && rects_count > 0) )
+		return False;
+	/* previous result must be there for us to update : */
+	if( get_flags( dst->flags, ASIM_DATA_NOT_USEFUL ) && !get_flags( dst->flags, ASIM_PACKED_ARGB32 ) )
+		return False;
+	if( asv == NULL ) 	asv = &__transform_fake_asv ;
+
+	for( i = 0 ; i < rects_count ; ++i )
+		if( !merge_layers_rect( asv, dst, layers, count,
+								rects[i].x, rects[i].y, rects[i].width, rects[i].height, quality ) )
+			return False;
+	SHOW_TIME("", started);
+	return True;
+}
+
 /* **************************************************************************************/
 /* GRADIENT drawing : 																   */
 /* **************************************************************************************/
@@ -1260,9 +1683,18 @@ make_gradient_top2bottom( ASImageOutput *imout, ASScanline *dither_lines, int di
 	int y, height = imout->im->height, width = imout->im->width ;
 	int line ;
 	ASScanline result;
-	CARD32 chan_data[MAX_GRADIENT_DITHER_LINES] = {0,0,0,0};
+	CARD32 chan_data[IC_NUM_CHANNELS][MAX_GRADIENT_DITHER_LINES] ;
+	CARD32 prev_data[IC_NUM_CHANNELS][MAX_GRADIENT_DITHER_LINES] ;
+	ASFlagType prev_flags = 0 ;
+	ARGB32 prev_back_color = 0 ;
+	/* rows of ASImage output only depend on the input row unless we do
+	 * vertical error diffusion, so identical rows can share storage : */
+	Bool can_share = ( imout->out_format == ASA_ASImage &&
+					   imout->quality != ASIMAGE_QUALITY_TOP &&
+					   imout->bottom_to_top == 1 && imout->tiling_step == 0 );
 LOCAL_DEBUG_CALLER_OUT( "width = %d, height = %d, filetr = 0x%lX, dither_count = %d\n", width, height, filter, dither_lines_num );
 	prepare_scanline( width, QUANT_ERR_BITS, &result, imout->asv->BGR_mode );
+	memset( chan_data, 0x00, sizeof(chan_data) );
 	for( y = 0 ; y < height ; y++ )
 	{
 		int color ;
@@ -1274,6 +1706,7 @@ LOCAL_DEBUG_CALLER_OUT( "width = %d, height = %d, filetr = 0x%lX, dither_count =
 			if( get_flags( filter, 0x01<<color ) )
 			{
 				Bool dithered = False ;
+				CARD32 *cd = &(chan_data[color][0]) ;
 				for( line = 0 ; line < dither_lines_num ; line++ )
 				{
 					/* we want to do error diffusion here since in other places it only works
@@ -1285,9 +1718,9 @@ LOCAL_DEBUG_CALLER_OUT( "width = %d, height = %d, filetr = 0x%lX, dither_count =
 						if( (c&0xFFFF0000) != 0 )
 							c = ( c&0x7F000000 )?0:0x0000FF00;
 					}
-					chan_data[line] = c ;
+					cd[line] = c ;
 
-					if( chan_data[line] != chan_data[0] )
+					if( cd[line] != cd[0] )
 						dithered = True;
 				}
 				LOCAL_DEBUG_OUT( "channel: %d. Dithered ? %d", color, dithered );
@@ -1295,24 +1728,39 @@ LOCAL_DEBUG_CALLER_OUT( "width = %d, height = %d, filetr = 0x%lX, dither_count =
 				if( !dithered )
 				{
 					result.back_color = (result.back_color&(~MAKE_ARGB32_CHAN8(0xFF,color)))|
-										MAKE_ARGB32_CHAN16(chan_data[0],color);
+										MAKE_ARGB32_CHAN16(cd[0],color);
 					LOCAL_DEBUG_OUT( "back_color = %8.8lX", result.back_color);
 				}else
+					set_flags(result.flags, 0x01<<color);
+			}
+
+		if( can_share && y > 0 && result.flags == prev_flags &&
+			result.back_color == prev_back_color &&
+			memcmp( chan_data, prev_data, sizeof(chan_data) ) == 0 )
+		{
+			copy_asimage_lines( imout->im, imout->next_line, imout->im, imout->next_line-1, 1, SCL_DO_ALL );
+			++(imout->next_line);
+			continue;
+		}
+
+		for( color = 0 ; color < IC_NUM_CHANNELS ; color++ )
+			if( get_flags( result.flags, 0x01<<color ) )
+			{
+				register CARD32  *dst = result.channels[color] ;
+				for( line = 0 ; line  < dither_lines_num ; line++ )
 				{
-					register CARD32  *dst = result.channels[color] ;
-					for( line = 0 ; line  < dither_lines_num ; line++ )
+					register int x ;
+					register CARD32 d = chan_data[color][line] ;
+					for( x = line ; x < width ; x+=dither_lines_num )
 					{
-						register int x ;
-						register CARD32 d = chan_data[line] ;
-						for( x = line ; x < width ; x+=dither_lines_num )
-						{
-							dst[x] = d ;
-						}
+						dst[x] = d ;
 					}
-					set_flags(result.flags, 0x01<<color);
 				}
 			}
 		imout->output_image_scanline( imout, &result, 1);
+		prev_flags = result.flags ;
+		prev_back_color = result.back_color ;
+		memcpy( prev_data, chan_data, sizeof(chan_data) );
 	}
 	free_scanline( &result, True );
 }
@@ -1456,6 +1904,106 @@ get_best_grad_back_color( ASGradient *grad )
 	return back_color;
 }
 
+/* small LRU cache of rendered gradients - the same gradient of the same
+ * size tends to be requested over and over again by look's MyStyles : */
+#define MAX_GRADIENT_CACHE_ITEMS	16
+
+typedef struct ASGradientCacheItem
+{
+	int 		type, npoints ;
+	ARGB32 	   *color ;
+	double 	   *offset ;
+	int 		width, height ;
+	ASFlagType 	filter ;
+	unsigned int compression ;
+	int 		quality ;
+	Bool 		BGR_mode ;
+	ASImage    *im ;
+}ASGradientCacheItem;
+
+static ASGradientCacheItem gradient_cache[MAX_GRADIENT_CACHE_ITEMS] ;
+static int gradient_cache_used = 0 ;
+
+static void
+free_gradient_cache_item( ASGradientCacheItem *item )
+{
+	if( item->im )
+		destroy_asimage( &(item->im) );
+	if( item->color )
+		free( item->color );
+	if( item->offset )
+		free( item->offset );
+	memset( item, 0x00, sizeof(ASGradientCacheItem) );
+}
+
+void
+flush_gradient_cache()
+{
+	while( gradient_cache_used > 0 )
+		free_gradient_cache_item( &(gradient_cache[--gradient_cache_used]) );
+}
+
+static ASImage *
+dup_gradient_image( ASImage *src, unsigned int compression )
+{
+	ASImage *dst = create_destination_image( src->width, src->height, ASA_ASImage, compression, src->back_color );
+	if( dst )
+		copy_asimage_lines( dst, 0, src, 0, src->height, SCL_DO_ALL );
+	return dst;
+}
+
+static ASGradientCacheItem *
+find_cached_gradient( ASVisual *asv, ASGradient *grad, int width, int height, ASFlagType filter,
+					  unsigned int compression, int quality )
+{
+	int i ;
+	for( i = 0 ; i < gradient_cache_used ; ++i )
+	{
+		ASGradientCacheItem *item = &(gradient_cache[i]);
+		if( item->type == grad->type && item->npoints == grad->npoints &&
+			item->width == width && item->height == height && item->filter == filter &&
+			item->compression == compression && item->quality == quality &&
+			item->BGR_mode == asv->BGR_mode &&
+			memcmp( item->color, grad->color, grad->npoints*sizeof(ARGB32) ) == 0 &&
+			memcmp( item->offset, grad->offset, grad->npoints*sizeof(double) ) == 0 )
+		{
+			if( i > 0 )
+			{/* moving it to the front of the list : */
+				ASGradientCacheItem tmp = *item ;
+				memmove( &(gradient_cache[1]), &(gradient_cache[0]), i*sizeof(ASGradientCacheItem) );
+				gradient_cache[0] = tmp ;
+			}
+			return &(gradient_cache[0]);
+		}
+	}
+	return NULL;
+}
+
+static void
+cache_gradient( ASVisual *asv, ASGradient *grad, int width, int height, ASFlagType filter,
+				unsigned int compression, int quality, ASImage *im )
+{
+	ASGradientCacheItem *item ;
+	if( gradient_cache_used >= MAX_GRADIENT_CACHE_ITEMS )
+		free_gradient_cache_item( &(gradient_cache[--gradient_cache_used]) );
+	memmove( &(gradient_cache[1]), &(gradient_cache[0]), gradient_cache_used*sizeof(ASGradientCacheItem) );
+	++gradient_cache_used ;
+	item = &(gradient_cache[0]);
+	item->type = grad->type ;
+	item->npoints = grad->npoints ;
+	item->color = safemalloc( grad->npoints*sizeof(ARGB32) );
+	memcpy( item->color, grad->color, grad->npoints*sizeof(ARGB32) );
+	item->offset = safemalloc( grad->npoints*sizeof(double) );
+	memcpy( item->offset, grad->offset, grad->npoints*sizeof(double) );
+	item->width = width ;
+	item->height = height ;
+	item->filter = filter ;
+	item->compression = compression ;
+	item->quality = quality ;
+	item->BGR_mode = asv->BGR_mode ;
+	item->im = dup_gradient_image( im, compression );
+}
+
 ASImage*
 make_gradient( ASVisual *asv, ASGradient *grad,
                int width, int height, ASFlagType filter,
@@ -1476,6 +2024,17 @@ LOCAL_DEBUG_CALLER_OUT( "type = 0x%X, width=%d, height = %d, filter = 0x%lX", gr
  	if( height == 0 )
 		height = 2;
 
+	if( out_format == ASA_ASImage && grad->npoints > 0 )
+	{
+		ASGradientCacheItem *cached = find_cached_gradient( asv, grad, width, height, filter, compression_out, quality );
+		if( cached )
+		{
+			im = dup_gradient_image( cached->im, compression_out );
+			SHOW_TIME("", started);
+			return im;
+		}
+	}
+
 	im = create_destination_image( width, height, out_format, compression_out, get_best_grad_back_color( grad ) );
 
 	if( get_flags(grad->type,GRADIENT_TYPE_ORIENTATION) )
@@ -1525,6 +2084,8 @@ LOCAL_DEBUG_CALLER_OUT( "type = 0x%X, width=%d, height = %d, filter = 0x%lX", gr
 		for( line = 0 ; line < dither_lines ; line++ )
 			free_scanline( &(lines[line]), True );
 		free( lines );
+		if( out_format == ASA_ASImage && grad->npoints > 0 )
+			cache_gradient( asv, grad, width, height, filter, compression_out, quality, im );
 	}
 	SHOW_TIME("", started);
 	return im;
@@ -1709,6 +2270,248 @@ LOCAL_DEBUG_OUT("miroring actually...%s", "");
 	return dst;
 }
 
+/* ***************************************************************************/
+/* Arbitrary angle rotation													*/
+/* ***************************************************************************/
+/* Source is unpacked into ARGB32 buffer with 1 pixel wide border around it.
+ * Border pixels replicate colors of the nearest edge pixel, but are fully
+ * transparent, so that bilinear interpolation produces antialiased alpha
+ * edge without any bounds checking in the inner loop. */
+static CARD32 *
+decode_rotation_source( ASVisual *asv, ASImage *src, int *pstride )
+{
+	ASImageDecoder *imdec ;
+	CARD32 *buf ;
+	int stride = src->width+2 ;
+	int x, y ;
+
+	if( (imdec = start_image_decoding(asv, src, SCL_DO_ALL, 0, 0, src->width, src->height, NULL)) == NULL )
+		return NULL;
+
+	buf = safemalloc( stride*(src->height+2)*sizeof(CARD32));
+	for( y = 1 ; y <= (int)src->height ; ++y )
+	{
+		register CARD32 *row = &(buf[y*stride]);
+		CARD32 *a = imdec->buffer.alpha ;
+		CARD32 *r = imdec->buffer.red ;
+		CARD32 *g = imdec->buffer.green ;
+		CARD32 *b = imdec->buffer.blue;
+
+		imdec->decode_image_scanline( imdec );
+		for( x = 0 ; x < (int)src->width ; ++x )
+			row[x+1] = MAKE_ARGB32( a[x],r[x],g[x],b[x] );
+		row[0] = row[1]&0x00FFFFFF ;
+		row[stride-1] = row[stride-2]&0x00FFFFFF ;
+	}
+	stop_image_decoding( &imdec );
+
+	for( x = 0 ; x < stride ; ++x )
+	{
+		buf[x] = buf[stride+x]&0x00FFFFFF ;
+		buf[(src->height+1)*stride+x] = buf[src->height*stride+x]&0x00FFFFFF ;
+	}
+	*pstride = stride ;
+	return buf;
+}
+
+/* interpolates between 2 ARGB32 values processing 2 channels at a time,
+ * weight is in 0-256 range */
+#define LERP_ARGB32(p,q,w) \
+	(((((p)&0x00FF00FF)*(256-(w))+((q)&0x00FF00FF)*(w))>>8)&0x00FF00FF)| \
+	 (((((p)>>8)&0x00FF00FF)*(256-(w))+(((q)>>8)&0x00FF00FF)*(w))&0xFF00FF00)
+
+/* finds range of destination pixels [*pstart, *pend) of the line for which
+ * coordinate start+x*step falls within (low, high) */
+static inline void
+clip_rotation_span( double start, double step, double low, double high, int *pstart, int *pend )
+{
+	if( step > 0.000001 )
+	{
+		double from = (low - start)/step, to = (high - start)/step ;
+		if( from > (double)*pstart ) *pstart = (from >= (double)*pend)? *pend : (int)from + 1 ;
+		if( to < (double)*pend ) *pend = (to <= (double)*pstart)? *pstart : (int)ceil(to) ;
+	}else if( step < -0.000001 )
+	{
+		double from = (high - start)/step, to = (low - start)/step ;
+		if( from > (double)*pstart ) *pstart = (from >= (double)*pend)? *pend : (int)from + 1 ;
+		if( to < (double)*pend ) *pend = (to <= (double)*pstart)? *pstart : (int)ceil(to) ;
+	}else if( start <= low || start >= high )
+		*pend = *pstart ;
+}
+
+ASImage *
+rotate_asimage( ASVisual *asv, ASImage *src, double angle,
+				int to_width, int to_height,
+				ASAltImFormats out_format,
+				unsigned int compression_out, int quality )
+{
+	ASImage *dst = NULL ;
+	ASImageOutput  *imout ;
+	double rad, cos_a, sin_a, fw, fh ;
+	int right_angles ;
+	START_TIME(started);
+
+LOCAL_DEBUG_CALLER_OUT( "angle = %f, to_width = %d, to_height = %d", angle, to_width, to_height );
+	if( src == NULL )
+		return NULL ;
+	if( asv == NULL ) 	asv = &__transform_fake_asv ;
+
+	angle = fmod( angle, 360.0 );
+	if( angle < 0 )
+		angle += 360.0 ;
+	rad = angle*3.14159265358979323846/180.0 ;
+	cos_a = cos(rad);
+	sin_a = sin(rad);
+	/* bounding box of the rotated image - small epsilon prevents
+	 * rounding errors from adding extra row/column */
+	fw = fabs((double)src->width*cos_a)+fabs((double)src->height*sin_a);
+	fh = fabs((double)src->width*sin_a)+fabs((double)src->height*cos_a);
+	if( to_width <= 0 )
+		to_width = (int)ceil(fw - 0.001);
+	if( to_height <= 0 )
+		to_height = (int)ceil(fh - 0.001);
+	if( to_width <= 0 ) to_width = 1 ;
+	if( to_height <= 0 ) to_height = 1 ;
+
+	/* multiples of 90 degrees are handled by lossless flipping code : */
+	right_angles = (int)floor(angle/90.0+0.5);
+	if( fabs( angle - right_angles*90.0 ) < 0.001 )
+	{
+		static int right_angle_flips[4] = { 0, FLIP_VERTICAL, FLIP_UPSIDEDOWN, FLIP_VERTICAL|FLIP_UPSIDEDOWN };
+		int flip = right_angle_flips[right_angles&0x03] ;
+		int natural_width = get_flags(flip, FLIP_VERTICAL)? src->height : src->width ;
+		int natural_height = get_flags(flip, FLIP_VERTICAL)? src->width : src->height ;
+
+		if( to_width == natural_width && to_height == natural_height )
+		{
+			if( flip == 0 )
+				return tile_asimage( asv, src, 0, 0, to_width, to_height, TINT_LEAVE_SAME, out_format, compression_out, quality );
+			return flip_asimage( asv, src, 0, 0, to_width, to_height, flip, out_format, compression_out, quality );
+		}
+	}
+
+	dst = create_destination_image( to_width, to_height, out_format, compression_out, src->back_color);
+
+	if((imout = start_image_output( asv, dst, out_format, 0, quality)) == NULL )
+	{
+        destroy_asimage( &dst );
+    }else
+	{
+		ASScanline result ;
+		CARD32 *buf ;
+		int stride = 0 ;
+
+		prepare_scanline( to_width, 0, &result, asv->BGR_mode );
+		result.flags = SCL_DO_ALL ;
+		result.back_color = src->back_color ;
+		if( (buf = decode_rotation_source( asv, src, &stride )) != NULL )
+		{
+			/* Destination pixel centers are mapped back onto the source
+			 * ( rotation is counterclockwise ) :
+			 * sx = dx*cos - dy*sin + src_cx ; sy = dx*sin + dy*cos + src_cy
+			 * We then step along destination line in fixed point, skipping
+			 * pixels that fall completely outside of the source. */
+			double src_cx = (double)src->width*0.5 - 0.5 ;
+			double src_cy = (double)src->height*0.5 - 0.5 ;
+			double dst_cx = (double)to_width*0.5 - 0.5 ;
+			double dst_cy = (double)to_height*0.5 - 0.5 ;
+			int max_size = max(src->width,src->height)+2 ;
+			int fp_bits = 16, fp_one, fp_frac_mask, step_x, step_y ;
+			Bool interpolate = (quality != ASIMAGE_QUALITY_POOR);
+			int x, y ;
+
+			while( fp_bits > 8 && max_size > (0x3FFFFFFF>>fp_bits) )
+				--fp_bits ;
+			fp_one = 0x01<<fp_bits ;
+			fp_frac_mask = fp_one - 1 ;
+			step_x = (int)floor(cos_a*fp_one+0.5);
+			step_y = (int)floor(sin_a*fp_one+0.5);
+
+			for( y = 0 ; y < to_height ; ++y )
+			{
+				double dy = (double)y - dst_cy ;
+				/* coordinates are offset by 1 to account for the border : */
+				double sx0 = -dst_cx*cos_a - dy*sin_a + src_cx + 1.0 ;
+				double sy0 = -dst_cx*sin_a + dy*cos_a + src_cy + 1.0 ;
+				int start = 0, end = to_width ;
+
+				if( interpolate )
+				{
+					clip_rotation_span( sx0, cos_a, 0.0, (double)src->width+1.0, &start, &end );
+					clip_rotation_span( sy0, sin_a, 0.0, (double)src->height+1.0, &start, &end );
+				}else
+				{
+					clip_rotation_span( sx0, cos_a, 0.5, (double)src->width+0.5, &start, &end );
+					clip_rotation_span( sy0, sin_a, 0.5, (double)src->height+0.5, &start, &end );
+				}
+				for( x = 0 ; x < start ; ++x )
+					result.alpha[x] = 0 ;
+				for( x = end ; x < to_width ; ++x )
+					result.alpha[x] = 0 ;
+
+				if( start < end )
+				{
+					register int sx = (int)floor((sx0 + start*cos_a)*fp_one + 0.5);
+					register int sy = (int)floor((sy0 + start*sin_a)*fp_one + 0.5);
+					if( interpolate )
+					{
+						for( x = start ; x < end ; ++x )
+						{
+							int ix = sx>>fp_bits, iy = sy>>fp_bits ;
+							int wx = (sx&fp_frac_mask)>>(fp_bits-8) ;
+							int wy = (sy&fp_frac_mask)>>(fp_bits-8) ;
+							CARD32 *p, c1, c2, c ;
+							/* precision loss at the very edge of the span
+							 * may push us by one pixel outside : */
+							if( ix < 0 ) { ix = 0 ; wx = 0 ; }
+							else if( ix > (int)src->width ) { ix = src->width ; wx = 256 ; }
+							if( iy < 0 ) { iy = 0 ; wy = 0 ; }
+							else if( iy > (int)src->height ) { iy = src->height ; wy = 256 ; }
+							p = &(buf[iy*stride+ix]);
+							c1 = LERP_ARGB32(p[0],p[1],wx);
+							c2 = LERP_ARGB32(p[stride],p[stride+1],wx);
+							c = LERP_ARGB32(c1,c2,wy);
+							result.alpha[x] = ARGB32_ALPHA8(c);
+							result.red  [x] = ARGB32_RED8(c);
+							result.green[x] = ARGB32_GREEN8(c);
+							result.blue [x] = ARGB32_BLUE8(c);
+							sx += step_x ;
+							sy += step_y ;
+						}
+					}else
+					{
+						sx += fp_one>>1 ;
+						sy += fp_one>>1 ;
+						for( x = start ; x < end ; ++x )
+						{
+							int ix = sx>>fp_bits, iy = sy>>fp_bits ;
+							CARD32 c ;
+							if( ix < 1 ) ix = 1 ;
+							else if( ix > (int)src->width ) ix = src->width ;
+							if( iy < 1 ) iy = 1 ;
+							else if( iy > (int)src->height ) iy = src->height ;
+							c = buf[iy*stride+ix] ;
+							result.alpha[x] = ARGB32_ALPHA8(c);
+							result.red  [x] = ARGB32_RED8(c);
+							result.green[x] = ARGB32_GREEN8(c);
+							result.blue [x] = ARGB32_BLUE8(c);
+							sx += step_x ;
+							sy += step_y ;
+						}
+					}
+				}
+				imout->output_image_scanline( imout, &result, 1);
+			}
+			free( buf );
+		}
+		free_scanline( &result, True );
+		stop_image_output( &imout );
+	}
+	SHOW_TIME("", started);
+	return dst;
+}
+#undef LERP_ARGB32
+
 ASImage *
 pad_asimage(  ASVisual *asv, ASImage *src,
 		      int dst_x, int dst_y,
@@ -1907,6 +2710,97 @@ Bool fill_asimage( ASVisual *asv, ASImage *im,
 /* ********************************************************************************/
 /* Vector -> ASImage functions :                                                  */
 /* ********************************************************************************/
+/* Precomputed interpolation table for ASVectorPalette. Value range of the
+ * palette is split into equal bins, each remembering the first palette segment
+ * it overlaps, so that locating a segment takes a multiply and a short scan
+ * regardless of how far the value is from the previous one. */
+#define VECTOR_LUT_BINS_PER_POINT	4
+#define VECTOR_LUT_MAX_BINS			4096
+
+typedef struct ASVectorSegment
+{
+	double start ;
+	double slopes[IC_NUM_CHANNELS] ;	/* channel increment per unit of the value */
+	int    bases[IC_NUM_CHANNELS] ;		/* channel value at the start of segment */
+}ASVectorSegment;
+
+typedef struct ASVectorPaletteLUT
+{
+	ASVectorSegment *segs ;
+	int      last_seg ;
+	double   lo, scale ;
+	int      max_bin ;
+	int     *bins ;
+}ASVectorPaletteLUT;
+
+static Bool
+make_vector_palette_lut( ASVectorPalette *palette, ASVectorPaletteLUT *lut )
+{
+	double *points = palette->points ;
+	int nsegs = (int)palette->npoints - 1 ;
+	int chan, seg, bin, nbins ;
+	double range ;
+
+	if( points == NULL || nsegs < 1 )
+		return False;
+	/* extra segment holds the end of the range and stops forward scans : */
+	lut->segs = safecalloc( nsegs+1, sizeof(ASVectorSegment));
+	lut->last_seg = nsegs-1 ;
+	for( seg = 0 ; seg <= nsegs ; ++seg )
+		lut->segs[seg].start = points[seg] ;
+	for( chan = 0 ; chan < IC_NUM_CHANNELS ; ++chan )
+	{
+		CARD16 *pc = palette->channels[chan] ;
+		if( pc != NULL )
+			for( seg = 0 ; seg < nsegs ; ++seg )
+			{
+				lut->segs[seg].bases[chan] = pc[seg] ;
+				if( points[seg+1] == points[seg] )
+					lut->segs[seg].slopes[chan] = 1 ;
+				else
+					lut->segs[seg].slopes[chan] = (double)(pc[seg+1] - pc[seg])/
+												  (points[seg+1]-points[seg]);
+			}
+	}
+
+	nbins = palette->npoints*VECTOR_LUT_BINS_PER_POINT ;
+	if( nbins > VECTOR_LUT_MAX_BINS )
+		nbins = VECTOR_LUT_MAX_BINS ;
+	lut->lo = points[0] ;
+	range = points[nsegs] - points[0] ;
+	lut->scale = ( range > 0 )? (double)nbins/range : 0. ;
+	lut->max_bin = nbins-1 ;
+	lut->bins = safemalloc( nbins*sizeof(int));
+	for( seg = 0, bin = 0 ; bin < nbins ; ++bin )
+	{
+		double start = lut->lo + (double)bin*range/nbins ;
+		while( seg < lut->last_seg && points[seg+1] <= start )
+			++seg ;
+		lut->bins[bin] = seg ;
+	}
+	return True;
+}
+
+static inline int
+lookup_vector_segment( ASVectorPaletteLUT *lut, double v )
+{
+	ASVectorSegment *segs = lut->segs ;
+	double fbin = (v - lut->lo)*lut->scale ;
+	register int seg ;
+
+	if( fbin >= 0 && fbin <= (double)lut->max_bin )
+	{
+		seg = lut->bins[(int)fbin] ;
+		/* rounding may place value just below the start of its bin : */
+		while( seg > 0 && segs[seg].start > v )
+			--seg ;
+		while( seg < lut->last_seg && segs[seg+1].start <= v )
+			++seg ;
+	}else /* outside of the palette - extrapolate from the closest segment */
+		seg = ( fbin > 0 )? lut->last_seg : 0 ;
+	return seg;
+}
+
 Bool
 colorize_asimage_vector( ASVisual *asv, ASImage *im,
 						 ASVectorPalette *palette,
@@ -1915,10 +2809,9 @@ colorize_asimage_vector( ASVisual *asv, ASImage *im,
 {
 	ASImageOutput  *imout = NULL ;
 	ASScanline buf ;
-	int x, y, curr_point, last_point ;
+	ASVectorPaletteLUT lut ;
+	int x, y, chan, width ;
     register double *vector ;
-	double *points ;
-	double *multipliers[IC_NUM_CHANNELS] ;
 	START_TIME(started);
 
 	if( im == NULL || palette == NULL || out_format == ASA_Vector )
@@ -1927,90 +2820,57 @@ colorize_asimage_vector( ASVisual *asv, ASImage *im,
 	if( im->alt.vector == NULL )
 		return False;
 	vector = im->alt.vector ;
+	width = im->width ;
 
 	if( asv == NULL ) 	asv = &__transform_fake_asv ;
 
+	if( !make_vector_palette_lut( palette, &lut ) )
+		return False;
+
 	if((imout = start_image_output( asv, im, out_format, QUANT_ERR_BITS, quality)) == NULL )
+	{
+		free( lut.bins );
+		free( lut.segs );
 		return False;
+	}
 	/* as per ROOT ppl request double data goes from bottom to top,
 	 * instead of from top to bottom : */
 	if( !get_flags( im->flags, ASIM_VECTOR_TOP2BOTTOM) )
 		toggle_image_output_direction(imout);
 
-	prepare_scanline( im->width, QUANT_ERR_BITS, &buf, asv->BGR_mode );
-	curr_point = palette->npoints/2 ;
-	points = palette->points ;
-	last_point = palette->npoints-1 ;
+	prepare_scanline( width, QUANT_ERR_BITS, &buf, asv->BGR_mode );
 	buf.flags = 0 ;
-	for( y = 0 ; y < IC_NUM_CHANNELS ; ++y )
-	{
-		if( palette->channels[y] )
-		{
-			multipliers[y] = safemalloc( last_point*sizeof(double));
-			for( x = 0 ; x < last_point ; ++x )
-			{
-				if (points[x+1] == points[x])
-      				multipliers[y][x] = 1;
-				else
-					multipliers[y][x] = (double)(palette->channels[y][x+1] - palette->channels[y][x])/
-				                 	        (points[x+1]-points[x]);
-/*				fprintf( stderr, "%e-%e/%e-%e=%e ", (double)palette->channels[y][x+1], (double)palette->channels[y][x],
-				                 	        points[x+1], points[x], multipliers[y][x] );
- */
-			}
-/*			fputc( '\n', stderr ); */
-			set_flags(buf.flags, (0x01<<y));
-		}else
-			multipliers[y] = NULL ;
-	}
+	for( chan = 0 ; chan < IC_NUM_CHANNELS ; ++chan )
+		if( palette->channels[chan] )
+			set_flags(buf.flags, (0x01<<chan));
+
 	for( y = 0 ; y < (int)im->height ; ++y )
 	{
-		for( x = 0 ; x < (int)im->width ;)
+		register CARD32 *a = buf.alpha, *r = buf.red, *g = buf.green, *b = buf.blue ;
+		ASVectorSegment *seg = &(lut.segs[lookup_vector_segment( &lut, vector[0] )]);
+
+		/* every row starts from the table lookup, so rows do not depend on
+		 * each other; missing channels have zero slope and base, so all four
+		 * are computed unconditionally : */
+		for( x = 0 ; x < width ; ++x )
 		{
-			register int i = IC_NUM_CHANNELS ;
+			register double v = vector[x] ;
 			double d ;
-
-			if( points[curr_point] > vector[x] )
-			{
-				while( --curr_point >= 0 )
-					if( points[curr_point] < vector[x] )
-						break;
-				if( curr_point < 0 )
-					++curr_point ;
-			}else
-			{
-				while( points[curr_point+1] < vector[x] )
-					if( ++curr_point >= last_point )
-					{
-						curr_point = last_point-1 ;
-						break;
-					}
-			}
-			d = vector[x]-points[curr_point];
-
-			while( --i >= 0 )
-				if( multipliers[i] )
-				{/* the following calculation is the most expensive part of the algorithm : */
-					buf.channels[i][x] = (int)(d*multipliers[i][curr_point])+palette->channels[i][curr_point] ;
-				}
-
-			while( ++x < (int)im->width )
-				if( vector[x] == vector[x-1] )
-				{
-					buf.red[x] = buf.red[x-1] ;
-					buf.green[x] = buf.green[x-1] ;
-					buf.blue[x] = buf.blue[x-1] ;
-					buf.alpha[x] = buf.alpha[x-1] ;
-				}else
-					break;
+			/* neighbouring values tend to stay within the same segment : */
+			if( v < seg->start || v >= seg[1].start )
+				seg = &(lut.segs[lookup_vector_segment( &lut, v )]);
+			d = v - seg->start ;
+			/* the following calculation is the most expensive part of the algorithm : */
+			a[x] = (int)(d*seg->slopes[IC_ALPHA])+seg->bases[IC_ALPHA] ;
+			r[x] = (int)(d*seg->slopes[IC_RED])+seg->bases[IC_RED] ;
+			g[x] = (int)(d*seg->slopes[IC_GREEN])+seg->bases[IC_GREEN] ;
+			b[x] = (int)(d*seg->slopes[IC_BLUE])+seg->bases[IC_BLUE] ;
 		}
-
 		imout->output_image_scanline( imout, &buf, 1);
-		vector += im->width ;
+		vector += width ;
 	}
-	for( y = 0 ; y < IC_NUM_CHANNELS ; ++y )
-		if( multipliers[y] )
-			free(multipliers[y]);
+	free( lut.bins );
+	free( lut.segs );
 
 	stop_image_output( &imout );
 	free_scanline( &buf, True );
@@ -2704,6 +3564,83 @@ static void calc_gauss_int(int radius, GAUSS_COEFF_TYPE* gauss, GAUSS_COEFF_TYPE
 /***********************************************************************
  * Hue,saturation and lightness adjustments.
  **********************************************************************/
+typedef struct ASHSVAdjustment
+{
+	CARD32 from_hue1, to_hue1, from_hue2, to_hue2 ;
+	Bool   any_hue ;
+	int    hue_offset, saturation_offset, value_offset ;
+}ASHSVAdjustment;
+
+/* applies offsets to the whole line of HSV values, and sets affected[x]
+ * to all ones for every pixel that falls into affected hue range : */
+static inline void
+adjust_hsv_values( CARD32 *hue, CARD32 *saturation, CARD32 *value, CARD32 *affected,
+				   ASHSVAdjustment *adj, int len )
+{
+	register int x = 0 ;
+#ifdef HAVE_MMX
+	if( asimage_use_mmx )
+	{
+		__m64 *vh = (__m64*)hue, *vs = (__m64*)saturation, *vv = (__m64*)value, *va = (__m64*)affected ;
+		__m64 zero = _mm_setzero_si64();
+		__m64 from1 = _mm_set1_pi32( (int)adj->from_hue1-1 ), to1 = _mm_set1_pi32( (int)adj->to_hue1+1 );
+		__m64 from2 = _mm_set1_pi32( (int)adj->from_hue2-1 ), to2 = _mm_set1_pi32( (int)adj->to_hue2+1 );
+		__m64 any_hue = _mm_set1_pi32( adj->any_hue?-1:0 );
+		__m64 hue_offset = _mm_set1_pi32( adj->hue_offset );
+		__m64 saturation_offset = _mm_set1_pi32( adj->saturation_offset );
+		__m64 value_offset = _mm_set1_pi32( adj->value_offset );
+		__m64 max_hue = _mm_set1_pi32( MAX_HUE16 ), min_hue = _mm_set1_pi32( MIN_HUE16 );
+		__m64 max_val = _mm_set1_pi32( 0x00FFFF );
+		int i, max_i = len>>1 ;
+		for( i = 0 ; i < max_i ; ++i )
+		{
+			__m64 h = vh[i], s, v, m ;
+			/* affected = (h != 0) && ( any_hue || h in [from1,to1] || h in [from2,to2] ) : */
+			m = _mm_or_si64( _mm_and_si64( _mm_cmpgt_pi32( h, from1 ), _mm_cmpgt_pi32( to1, h ) ),
+							 _mm_and_si64( _mm_cmpgt_pi32( h, from2 ), _mm_cmpgt_pi32( to2, h ) ) );
+			m = _mm_andnot_si64( _mm_cmpeq_pi32( h, zero ), _mm_or_si64( m, any_hue ) );
+			va[i] = m ;
+			/* hue rotation with wrapping around : */
+			h = _mm_add_pi32( h, hue_offset );
+			h = _mm_sub_pi32( h, _mm_and_si64( _mm_cmpgt_pi32( h, max_hue ), max_hue ) );
+			h = _mm_or_si64( h, _mm_and_si64( _mm_cmpeq_pi32( h, zero ), min_hue ) );
+			h = _mm_add_pi32( h, _mm_and_si64( _mm_cmpgt_pi32( zero, h ), max_hue ) );
+			vh[i] = h ;
+			/* saturation and value are clipped to 0-0xFFFF : */
+			s = _mm_add_pi32( vs[i], saturation_offset );
+			s = _mm_andnot_si64( _mm_cmpgt_pi32( zero, s ), s );
+			m = _mm_cmpgt_pi32( s, max_val );
+			vs[i] = _mm_or_si64( _mm_andnot_si64( m, s ), _mm_and_si64( m, max_val ) );
+			v = _mm_add_pi32( vv[i], value_offset );
+			v = _mm_andnot_si64( _mm_cmpgt_pi32( zero, v ), v );
+			m = _mm_cmpgt_pi32( v, max_val );
+			vv[i] = _mm_or_si64( _mm_andnot_si64( m, v ), _mm_and_si64( m, max_val ) );
+		}
+		_mm_empty();
+		x = max_i<<1 ;
+	}
+#endif
+	for( ; x < len ; ++x )
+	{
+		long h = hue[x], s, v ;
+		affected[x] = ( h != 0 && ( adj->any_hue ||
+						(h >= (long)adj->from_hue1 && h <= (long)adj->to_hue1 ) ||
+						(h >= (long)adj->from_hue2 && h <= (long)adj->to_hue2 ) ) )?0xFFFFFFFF:0 ;
+		h += adj->hue_offset ;
+		if( h > MAX_HUE16 )
+			h -= MAX_HUE16 ;
+		else if( h == 0 )
+			h =  MIN_HUE16 ;
+		else if( h < 0 )
+			h += MAX_HUE16 ;
+		hue[x] = h ;
+		s = (long)saturation[x] + adj->saturation_offset ;
+		saturation[x] = (s < 0)?0:((s > 0x00FFFF)?0x00FFFF:s);
+		v = (long)value[x] + adj->value_offset ;
+		value[x] = (v < 0)?0:((v > 0x00FFFF)?0x00FFFF:v);
+	}
+}
+
 ASImage*
 adjust_asimage_hsv( ASVisual *asv, ASImage *src,
 				    int offset_x, int offset_y,
@@ -2733,34 +3670,40 @@ LOCAL_DEBUG_CALLER_OUT( "offset_x = %d, offset_y = %d, to_width = %d, to_height
         destroy_asimage( &dst );
     }else
 	{
-	    CARD32 from_hue1 = 0, from_hue2 = 0, to_hue1 = 0, to_hue2 = 0 ;
+		ASHSVAdjustment adj ;
 		int y, max_y = to_height;
 		Bool do_greyscale = False ; 
+		int width = imdec->buffer.width ;
+		CARD32 *hsv_buf = safemalloc( (((width+1)&(~1))*4)*sizeof(CARD32) );
+		CARD32 *hue = hsv_buf, *saturation = hue+((width+1)&(~1)) ;
+		CARD32 *value = saturation+((width+1)&(~1)), *affected = value+((width+1)&(~1)) ;
 
+		memset( &adj, 0x00, sizeof(adj) );
 		affected_hue = normalize_degrees_val( affected_hue );
 		affected_radius = normalize_degrees_val( affected_radius );
 		if( value_offset != 0 )
 			do_greyscale = (affected_hue+affected_radius >= 360 || affected_hue-affected_radius <= 0 );
 		if( affected_hue > affected_radius )
 		{
-			from_hue1 = degrees2hue16(affected_hue-affected_radius);
+			adj.from_hue1 = degrees2hue16(affected_hue-affected_radius);
 			if( affected_hue+affected_radius >= 360 )
 			{
-				to_hue1 = MAX_HUE16 ;
-				from_hue2 = MIN_HUE16 ;
-				to_hue2 = degrees2hue16(affected_hue+affected_radius-360);
+				adj.to_hue1 = MAX_HUE16 ;
+				adj.from_hue2 = MIN_HUE16 ;
+				adj.to_hue2 = degrees2hue16(affected_hue+affected_radius-360);
 			}else
-				to_hue1 = degrees2hue16(affected_hue+affected_radius);
+				adj.to_hue1 = degrees2hue16(affected_hue+affected_radius);
 		}else
 		{
-			from_hue1 = degrees2hue16(affected_hue+360-affected_radius);
-			to_hue1 = MAX_HUE16 ;
-			from_hue2 = MIN_HUE16 ;
-			to_hue2 = degrees2hue16(affected_hue+affected_radius);
+			adj.from_hue1 = degrees2hue16(affected_hue+360-affected_radius);
+			adj.to_hue1 = MAX_HUE16 ;
+			adj.from_hue2 = MIN_HUE16 ;
+			adj.to_hue2 = degrees2hue16(affected_hue+affected_radius);
 		}
-		hue_offset = degrees2hue16(hue_offset);
-		saturation_offset = (saturation_offset<<16) / 100;
-		value_offset = (value_offset<<16)/100 ;
+		adj.any_hue = ( affected_radius >= 180 );
+		adj.hue_offset = degrees2hue16(hue_offset);
+		adj.saturation_offset = (saturation_offset<<16) / 100;
+		adj.value_offset = (value_offset<<16)/100 ;
 LOCAL_DEBUG_OUT("adjusting actually...%s", "");
 		if( to_height > src->height )
 		{
@@ -2769,55 +3712,27 @@ LOCAL_DEBUG_OUT("adjusting actually...%s", "");
 		}
 		for( y = 0 ; y < max_y ; y++  )
 		{
-			register int x = imdec->buffer.width;
+			register int x ;
 			CARD32 *r = imdec->buffer.red;
 			CARD32 *g = imdec->buffer.green;
 			CARD32 *b = imdec->buffer.blue ;
-			long h, s, v ;
 			imdec->decode_image_scanline( imdec );
-			while( --x >= 0 )
-			{
-				if( (h = rgb2hue( r[x], g[x], b[x] )) != 0 )
-				{
-#ifdef DEBUG_HSV_ADJUSTMENT
-					fprintf( stderr, "IN  %d: rgb = #%4.4lX.%4.4lX.%4.4lX hue = %ld(%d)        range is (%ld - %ld, %ld - %ld), dh = %d\n", __LINE__, r[x], g[x], b[x], h, ((h>>8)*360)>>8, from_hue1, to_hue1, from_hue2, to_hue2, hue_offset );
-#endif
-
-					if( affected_radius >= 180 ||
-						(h >= (int)from_hue1 && h <= (int)to_hue1 ) ||
-						(h >= (int)from_hue2 && h <= (int)to_hue2 ) )
-
+			/* translating the whole line at once using lookup tables, then
+			 * adjusting it and testing hue ranges two pixels at a time : */
+			rgb2hsv_scanline( r, g, b, hue, saturation, value, width );
+			adjust_hsv_values( hue, saturation, value, affected, &adj, width );
+			if( do_greyscale )
+				for( x = 0 ; x < width ; ++x )
+					if( r[x] == g[x] && g[x] == b[x] )
 					{
-						s = rgb2saturation( r[x], g[x], b[x] ) + saturation_offset;
-						v = rgb2value( r[x], g[x], b[x] )+value_offset;
-						h += hue_offset ;
-						if( h > MAX_HUE16 )
-							h -= MAX_HUE16 ;
-						else if( h == 0 )
-							h =  MIN_HUE16 ;
-						else if( h < 0 )
-							h += MAX_HUE16 ;
-						if( v < 0 ) v = 0 ;
-						else if( v > 0x00FFFF ) v = 0x00FFFF ;
-
-						if( s < 0 ) s = 0 ;
-						else if( s > 0x00FFFF ) s = 0x00FFFF ;
-
-						hsv2rgb ( (CARD32)h, (CARD32)s, (CARD32)v, &r[x], &g[x], &b[x]);
-
-#ifdef DEBUG_HSV_ADJUSTMENT
-						fprintf( stderr, "OUT %d: rgb = #%4.4lX.%4.4lX.%4.4lX hue = %ld(%ld)     sat = %ld val = %ld\n", __LINE__, r[x], g[x], b[x], h, ((h>>8)*360)>>8, s, v );
-#endif
+						int tmp = (int)r[x] + adj.value_offset ; 
+						g[x] = b[x] = r[x] = (tmp < 0)?0:((tmp>0x00FFFF)?0x00FFff:tmp);
 					}
-				}else if( do_greyscale ) 
-				{
-					int tmp = (int)r[x] + value_offset ; 
-					g[x] = b[x] = r[x] = (tmp < 0)?0:((tmp>0x00FFFF)?0x00FFff:tmp);
-				}
-			}
+			hsv2rgb_scanline( hue, saturation, value, affected, r, g, b, width );
 			imdec->buffer.flags = 0xFFFFFFFF ;
 			imout->output_image_scanline( imout, &(imdec->buffer), 1);
 		}
+		free( hsv_buf );
 		stop_image_output( &imout );
 	}
 	stop_image_decoding( &imdec );
@@ -36,7 +36,8 @@ extern "C" {
  * SEE ALSO
  *  Transformations :
  *          scale_asimage(), tile_asimage(), merge_layers(), 
- * 			make_gradient(), flip_asimage(), mirror_asimage(), 
+ * 			make_gradient(), flip_asimage(), rotate_asimage(),
+ * 			mirror_asimage(), 
  * 			pad_asimage(), blur_asimage_gauss(), fill_asimage(), 
  * 			adjust_asimage_hsv()
  *
@@ -72,9 +73,35 @@ extern "C" {
  * If size has to be reduced - then several neighboring pixels will be 
  * averaged into single pixel. If size has to be increased then new 
  * pixels will be interpolated based on values of four neighboring pixels.
+ * If ASIM_MIPMAPPED flag is set on src, then downscaling starts from the 
+ * smallest mip level that is still at least twice the requested size. 
+ * See get_asimage_mip().
  * EXAMPLE
  * ASScale
  *********/
+/****f* libAfterImage/transform/get_asimage_mip()
+ * NAME
+ * get_asimage_mip() - returns smallest half resolution copy of the image
+ * that is still at least of requested size.
+ * SYNOPSIS
+ * ASImage *get_asimage_mip( ASImage *im, unsigned int min_width,
+ *                           unsigned int min_height );
+ * INPUTS
+ * im           - source ASImage with ASIM_MIPMAPPED flag set
+ * min_width,
+ * min_height   - smallest acceptable size of the returned level.
+ * RETURN VALUE
+ * Mip level of the image, or im itself if no level is small enough, or 
+ * if ASIM_MIPMAPPED is not set. Returned image is owned by im and must 
+ * not be destroyed.
+ * DESCRIPTION
+ * Each level is half of the size of previous one, and gets built on 
+ * demand from the previous level, using box filter, or Lanczos filter if
+ * ASIM_MIP_LANCZOS is set. Levels are kept until image is destroyed, and
+ * are rebuilt if image was modified since. That makes repeated 
+ * downscaling of the same large image to small sizes, as it happens with
+ * backgrounds and icons, touch only a fraction of the original pixels.
+ *********/
 /****f* libAfterImage/transform/tile_asimage()
  * NAME
  * tile_asimage() - tiles/crops ASImage to desired size, while optionaly 
@@ -145,6 +172,37 @@ extern "C" {
  * layer will be padded to fit width of the destination image with all 0
  * effectively making it transparent.
  *********/
+/****f* libAfterImage/transform/merge_layers_rects()
+ * NAME
+ * merge_layers_rects() - recomposes parts of the image previously 
+ * produced by merge_layers().
+ * SYNOPSIS
+ * Bool merge_layers_rects( struct ASVisual *asv, ASImage *dst,
+ *                          ASImageLayer *layers, int count,
+ *                          XRectangle *rects, int rects_count,
+ *                          int quality );
+ * INPUTS
+ * asv          - pointer to valid ASVisual structure
+ * dst          - result of earlier merge_layers() call, in ASA_ASImage 
+ *                format, or packed ( see create_packed_asimage() ).
+ * layers       - current list of layers, same as for merge_layers()
+ * rects        - areas of dst affected by changed layers.
+ * rects_count  - number of elements in rects.
+ * quality      - output quality
+ * RETURN VALUE
+ * True on success, False if dst has no usable data to update, or if
+ * any of the rectangles extends below the lowest layer, where
+ * merge_layers() tiles the image - full merge_layers() is needed then.
+ * DESCRIPTION
+ * Rectangles of dst get composed again from layers, and the rest of dst 
+ * is left as is. Only layers overlapping each rectangle get decoded, and
+ * only for the part that falls within it, so that changing single small
+ * layer, such as a text label or a button, costs only pixels it covers.
+ * Caller should pass both old and new location of the changed layer, 
+ * if it has moved. Since error diffusion restarts at the left edge of 
+ * each rectangle, result may differ from full merge_layers() by one 
+ * in the least significant bit.
+ *********/
 /****f* libAfterImage/transform/make_gradient()
  * NAME
  * make_gradient() - renders linear gradient into new ASImage
@@ -174,7 +232,18 @@ extern "C" {
  * make_gradient() will create new image of requested size and it will
  * fill it with gradient, described in structure pointed to by grad.
  * Different dithering techniques will be applied to produce nicer
- * looking gradients.
+ * looking gradients. Gradients rendered into ASImage format are kept
+ * in a small cache, and subsequent requests for the same gradient of
+ * the same size share the cached image data.
+ *********/
+/****f* libAfterImage/transform/flush_gradient_cache()
+ * NAME
+ * flush_gradient_cache() - releases gradients cached by make_gradient()
+ * SYNOPSIS
+ * void flush_gradient_cache();
+ * DESCRIPTION
+ * Destroys all the images kept in make_gradient()'s cache. Should be
+ * called before flush_default_asstorage() on shutdown.
  *********/
 /****f* libAfterImage/transform/flip_asimage()
  * NAME
@@ -207,6 +276,36 @@ extern "C" {
  * and it will rotate it then based on flip value. Three rotation angles
  * supported 90, 180 and 270 degrees.
  *********/
+/****f* libAfterImage/transform/rotate_asimage()
+ * NAME
+ * rotate_asimage() - rotates ASImage by arbitrary angle.
+ * SYNOPSIS
+ * ASImage *rotate_asimage( ASVisual *asv, ASImage *src,
+ *                          double angle,
+ *                          int to_width, int to_height,
+ *                          ASAltImFormats out_format,
+ *                          unsigned int compression_out, int quality );
+ * INPUTS
+ * asv          - pointer to valid ASVisual structure
+ * src          - source ASImage
+ * angle        - angle of rotation in degrees, counterclockwise.
+ * to_width     - desired width of the resulting image. If 0 - width of
+ *                the bounding box of the rotated image will be used.
+ * to_height    - desired height of the resulting image. If 0 - height
+ *                of the bounding box of the rotated image will be used.
+ * out_format 	- optionally describes alternative ASImage format that
+ *                should be produced as the result - XImage, ARGB32, etc.
+ * compression_out - compression level of resulting image in range 0-100.
+ * quality      - output quality
+ * RETURN VALUE
+ * returns newly created and encoded ASImage on success, NULL of failure.
+ * DESCRIPTION
+ * Rotated image is centered within the resulting image, and areas not
+ * covered by it are made fully transparent. Unless quality is
+ * ASIMAGE_QUALITY_POOR, pixels are bilinearly interpolated, producing
+ * antialiased alpha edge. Angles that are multiples of 90 degrees are
+ * passed on to flip_asimage() so there is no quality loss.
+ *********/
 /****f* libAfterImage/transform/mirror_asimage()
  * NAME
  * mirror_asimage()
@@ -369,6 +468,7 @@ ASImage *scale_asimage( struct ASVisual *asv, ASImage *src,
 						int to_width, int to_height,
 						ASAltImFormats out_format,
 						unsigned int compression_out, int quality );
+ASImage *get_asimage_mip( ASImage *im, unsigned int min_width, unsigned int min_height );
 ASImage *scale_asimage2( ASVisual *asv, ASImage *src, 
 		 				int clip_x, int clip_y, 
 						int clip_width, int clip_height, 
@@ -384,15 +484,24 @@ ASImage *merge_layers ( struct ASVisual *asv, ASImageLayer *layers, int count,
 			  		    int dst_width, int dst_height,
 			  		    ASAltImFormats out_format,
 						unsigned int compression_out, int quality );
+Bool merge_layers_rects( struct ASVisual *asv, ASImage *dst,
+						 ASImageLayer *layers, int count,
+						 XRectangle *rects, int rects_count, int quality );
 ASImage *make_gradient( struct ASVisual *asv, struct ASGradient *grad,
                			int width, int height, ASFlagType filter,
   			   			ASAltImFormats out_format,
 						unsigned int compression_out, int quality  );
+void flush_gradient_cache();
 ASImage *flip_asimage( struct ASVisual *asv, ASImage *src,
 		 		       int offset_x, int offset_y,
 			  		   int to_width, int to_height,
 					   int flip, ASAltImFormats out_format,
 					   unsigned int compression_out, int quality );
+ASImage *rotate_asimage( ASVisual *asv, ASImage *src,
+						 double angle,
+						 int to_width, int to_height,
+						 ASAltImFormats out_format,
+						 unsigned int compression_out, int quality );
 ASImage *mirror_asimage( ASVisual *asv, ASImage *src,
 				         int offset_x, int offset_y,
 						 int to_width,
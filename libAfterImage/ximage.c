@@ -25,6 +25,8 @@
 #undef LOCAL_DEBUG
 #define DO_CLOCKING 
 
+#include <string.h>
+
 #ifdef DO_CLOCKING
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
@@ -46,6 +48,12 @@
 # include <GL/glx.h>
 #endif
 
+#if defined(HAVE_XRENDER) && !defined(X_DISPLAY_MISSING)
+# include <X11/extensions/Xrender.h>
+#else
+# undef HAVE_XRENDER
+#endif
+
 
 #ifdef _WIN32
 # include "win32/afterbase.h"
@@ -299,6 +307,32 @@ LOCAL_DEBUG_OUT( "Failed to start ASImageOutput for ASImage %p and ASVisual %p",
 /*#ifdef DO_CLOCKING
 	started = clock ();
 #endif*/
+#ifndef X_DISPLAY_MISSING
+	if( get_flags( im->flags, ASIM_PACKED_ARGB32 ) && im->alt.argb32 &&
+		xim->depth == 24 && xim->bits_per_pixel == 32 &&
+		xim->red_mask == 0x00FF0000 && xim->green_mask == 0x0000FF00 && xim->blue_mask == 0x000000FF )
+	{
+#ifdef WORDS_BIGENDIAN
+		if( xim->byte_order == MSBFirst )
+#else
+		if( xim->byte_order == LSBFirst )
+#endif
+		{	/* XImage pixel layout is the same as ours - no conversion needed */
+			register ARGB32 *src = im->alt.argb32 ;
+			for (i = 0; i < (int)im->height; i++)
+			{
+				register CARD32 *dst = (CARD32*)(xim->data + i*xim->bytes_per_line);
+				register int x = im->width ;
+				while( --x >= 0 )
+					dst[x] = src[x]&0x00FFFFFF ;
+				src += im->width ;
+			}
+			stop_image_output(&imout);
+			clear_flags( im->flags, ASIM_XIMAGE_NOT_USEFUL);
+			return xim;
+		}
+	}
+#endif
 #if	1
 	if ((imdec = start_image_decoding(  asv, im, (xim->depth >= 24)?SCL_DO_ALL:SCL_DO_COLOR, 
 										0, 0, im->width, im->height, NULL)) != NULL )
@@ -644,6 +678,397 @@ asimage2drawable_gl(	ASVisual *asv, Drawable d, ASImage *im,
 	return False;
 }
 
+/* ***************************************************************************/
+/* XRender backend : images are kept on the server as ARGB32 Pictures, so	*/
+/* that tinting, tiling, scaling and alpha blending are done by the server.	*/
+/* ***************************************************************************/
+#ifdef HAVE_XRENDER
+typedef struct ASImagePicture
+{
+	Display *dpy ;
+	Pixmap   pixmap ;
+	Picture  picture ;
+	unsigned long revision ;	/* revision of the image when it was uploaded */
+	/* pictures are charged to the pixmap cache of the visual, so that they
+	 * can be dropped, least recently used first, once it is over budget : */
+	struct ASPixmapCache *cache ;
+	ASImage *im ;
+	size_t   size ;
+	struct ASImagePicture *prev, *next ;
+}ASImagePicture;
+
+static void charge_asimage_picture( ASVisual *asv, ASImagePicture *pic );
+static void uncharge_asimage_picture( ASImagePicture *pic );
+
+Bool
+check_xrender_support( ASVisual *asv )
+{
+	static Display *checked_dpy = NULL ;
+	static Bool 	available = False ;
+
+	if( asv == NULL || asv->dpy == NULL )
+		return False;
+	if( checked_dpy != asv->dpy )
+	{
+		int event_base, error_base, major = 0, minor = 0 ;
+		checked_dpy = asv->dpy ;
+		/* we need picture transforms and filters, which appeared in 0.6 */
+		available = ( XRenderQueryExtension( asv->dpy, &event_base, &error_base ) &&
+					  XRenderQueryVersion( asv->dpy, &major, &minor ) &&
+					  (major > 0 || minor >= 6) &&
+					  XRenderFindStandardFormat( asv->dpy, PictStandardARGB32 ) != NULL &&
+					  XRenderFindVisualFormat( asv->dpy, asv->visual_info.visual ) != NULL );
+	}
+	return available;
+}
+
+static Picture
+create_solid_mask( Display *dpy, Drawable d, CARD32 r, CARD32 g, CARD32 b, CARD32 a )
+{
+	XRenderPictFormat *fmt = XRenderFindStandardFormat( dpy, PictStandardARGB32 );
+	XRenderPictureAttributes pa ;
+	XRenderColor color ;
+	Pixmap p = XCreatePixmap( dpy, d, 1, 1, 32 );
+	Picture mask ;
+
+	pa.repeat = RepeatNormal ;
+	pa.component_alpha = True ;
+	mask = XRenderCreatePicture( dpy, p, fmt, CPRepeat|CPComponentAlpha, &pa );
+	XFreePixmap( dpy, p );                     /* picture holds a reference */
+	color.red   = r*0x0101 ;
+	color.green = g*0x0101 ;
+	color.blue  = b*0x0101 ;
+	color.alpha = a*0x0101 ;
+	XRenderFillRectangle( dpy, PictOpSrc, mask, &color, 0, 0, 1, 1 );
+	return mask;
+}
+
+/* Copies the area from src into dst multiplying channels by the tint the
+ * same way tile_asimage() does it - 0x7F leaves channel as is, so it has to
+ * map onto 255 in the mask. Values above 0x7F brighten, which we can't do
+ * with a single multiplicative mask, so the remainder gets added on top in
+ * a second pass. */
+static void
+xrender_copytint( Display *dpy, Drawable d, Picture src, Picture dst, ARGB32 tint,
+				  int src_x, int src_y, int dst_x, int dst_y, unsigned int width, unsigned int height )
+{
+	CARD32 chan[4], mul[4], add[4] ;
+	Picture mask ;
+	int i ;
+
+	if( tint == TINT_LEAVE_SAME || tint == 0 )
+	{
+		XRenderComposite( dpy, PictOpSrc, src, None, dst, src_x, src_y, 0, 0, dst_x, dst_y, width, height );
+		return;
+	}
+	chan[0] = (ARGB32_RED8(tint)*255)/127 ;
+	chan[1] = (ARGB32_GREEN8(tint)*255)/127 ;
+	chan[2] = (ARGB32_BLUE8(tint)*255)/127 ;
+	chan[3] = (ARGB32_ALPHA8(tint)*255)/127 ;
+	for( i = 0 ; i < 4 ; ++i )
+	{
+		mul[i] = MIN(chan[i],255);
+		add[i] = MIN(chan[i] - mul[i],255);
+	}
+	mask = create_solid_mask( dpy, d, mul[0], mul[1], mul[2], mul[3] );
+	XRenderComposite( dpy, PictOpSrc, src, mask, dst, src_x, src_y, 0, 0, dst_x, dst_y, width, height );
+	XRenderFreePicture( dpy, mask );
+	if( add[0] > 0 || add[1] > 0 || add[2] > 0 )
+	{
+		mask = create_solid_mask( dpy, d, add[0], add[1], add[2], 0 );
+		XRenderComposite( dpy, PictOpAdd, src, mask, dst, src_x, src_y, 0, 0, dst_x, dst_y, width, height );
+		XRenderFreePicture( dpy, mask );
+	}
+}
+
+static void
+set_picture_scale( Display *dpy, Picture pic, int src_x, int src_y,
+				   unsigned int width, unsigned int height,
+				   unsigned int to_width, unsigned int to_height )
+{
+	XTransform xform ;
+	memset( &xform, 0x00, sizeof(xform));
+	xform.matrix[0][0] = XDoubleToFixed( (double)width/(double)to_width );
+	xform.matrix[0][2] = XDoubleToFixed( src_x );
+	xform.matrix[1][1] = XDoubleToFixed( (double)height/(double)to_height );
+	xform.matrix[1][2] = XDoubleToFixed( src_y );
+	xform.matrix[2][2] = XDoubleToFixed( 1.0 );
+	XRenderSetPictureTransform( dpy, pic, &xform );
+	XRenderSetPictureFilter( dpy, pic, FilterBilinear, NULL, 0 );
+}
+
+static void
+reset_picture_scale( Display *dpy, Picture pic )
+{
+	XTransform xform ;
+	memset( &xform, 0x00, sizeof(xform));
+	xform.matrix[0][0] = xform.matrix[1][1] = xform.matrix[2][2] = XDoubleToFixed( 1.0 );
+	XRenderSetPictureTransform( dpy, pic, &xform );
+	XRenderSetPictureFilter( dpy, pic, FilterNearest, NULL, 0 );
+}
+
+static Picture
+asimage2picture( ASVisual *asv, Drawable d, ASImage *im, Bool use_cached )
+{
+	ASImagePicture *pic = im->alt.picture ;
+	XRenderPictFormat *fmt ;
+	ASImageDecoder *imdec ;
+	XImage *xim ;
+	CARD32 *data ;
+	GC gc ;
+	int y ;
+
+	if( pic && use_cached && pic->dpy == asv->dpy && pic->revision == im->revision )
+	{
+		charge_asimage_picture( asv, pic );
+		return pic->picture;
+	}
+	destroy_asimage_picture( im );
+
+	fmt = XRenderFindStandardFormat( asv->dpy, PictStandardARGB32 );
+	if( (imdec = start_image_decoding( asv, im, SCL_DO_ALL, 0, 0, im->width, im->height, NULL)) == NULL )
+		return None;
+	data = safemalloc( im->width*im->height*sizeof(CARD32) );
+	for( y = 0 ; y < (int)im->height ; ++y )
+	{
+		register CARD32 *row = data + y*im->width ;
+		register CARD32 *r = imdec->buffer.red, *g = imdec->buffer.green, *b = imdec->buffer.blue, *a = imdec->buffer.alpha ;
+		register int x ;
+		imdec->decode_image_scanline( imdec );
+		/* Render wants premultiplied alpha : */
+		for( x = 0 ; x < (int)im->width ; ++x )
+			row[x] = (a[x]<<24)|(((r[x]*a[x])/255)<<16)|(((g[x]*a[x])/255)<<8)|((b[x]*a[x])/255);
+	}
+	stop_image_decoding( &imdec );
+
+	xim = XCreateImage( asv->dpy, asv->visual_info.visual, 32, ZPixmap, 0, (char*)data,
+						im->width, im->height, 32, 0 );
+	if( xim == NULL )
+	{
+		free( data );
+		return None;
+	}
+#ifdef WORDS_BIGENDIAN
+	xim->byte_order = MSBFirst ;
+#else
+	xim->byte_order = LSBFirst ;
+#endif
+	pic = safecalloc( 1, sizeof(ASImagePicture));
+	pic->dpy = asv->dpy ;
+	pic->revision = im->revision ;
+	pic->pixmap = XCreatePixmap( asv->dpy, d, im->width, im->height, 32 );
+	gc = XCreateGC( asv->dpy, pic->pixmap, 0, NULL );
+	XPutImage( asv->dpy, pic->pixmap, gc, xim, 0, 0, 0, 0, im->width, im->height );
+	XFreeGC( asv->dpy, gc );
+	XDestroyImage( xim );                      /* frees data as well */
+	pic->picture = XRenderCreatePicture( asv->dpy, pic->pixmap, fmt, 0, NULL );
+	pic->im = im ;
+	im->alt.picture = pic ;
+	charge_asimage_picture( asv, pic );
+	return pic->picture;
+}
+#else
+Bool check_xrender_support( ASVisual *asv ) { return False; }
+#endif
+
+void
+destroy_asimage_picture( ASImage *im )
+{
+#ifdef HAVE_XRENDER
+	if( im && im->alt.picture )
+	{
+		ASImagePicture *pic = im->alt.picture ;
+		uncharge_asimage_picture( pic );
+		XRenderFreePicture( pic->dpy, pic->picture );
+		XFreePixmap( pic->dpy, pic->pixmap );
+		free( pic );
+		im->alt.picture = NULL ;
+	}
+#endif
+}
+
+Bool
+asimage2drawable_xrender( ASVisual *asv, Drawable d, ASImage *im,
+                          int src_x, int src_y, int dest_x, int dest_y,
+                          unsigned int width, unsigned int height,
+                          unsigned int to_width, unsigned int to_height,
+                          ARGB32 tint, Bool tile, Bool use_cached )
+{
+#ifdef HAVE_XRENDER
+	if( im != NULL && check_xrender_support( asv ) )
+	{
+		Display *dpy = asv->dpy ;
+		Picture src, dst ;
+		int sx = src_x, sy = src_y ;
+		Bool scaled = False ;
+
+		if( to_width == 0 )
+			to_width = width ;
+		if( to_height == 0 )
+			to_height = height ;
+		if( width == 0 || height == 0 || to_width == 0 || to_height == 0 )
+			return False;
+		if( (src = asimage2picture( asv, d, im, use_cached )) == None )
+			return False;
+		dst = XRenderCreatePicture( dpy, d, XRenderFindVisualFormat( dpy, asv->visual_info.visual ), 0, NULL );
+
+		if( tile )
+		{
+			XRenderPictureAttributes pa ;
+			pa.repeat = RepeatNormal ;
+			XRenderChangePicture( dpy, src, CPRepeat, &pa );
+			sx = src_x % (int)im->width ;
+			sy = src_y % (int)im->height ;
+			if( sx < 0 ) sx += im->width ;
+			if( sy < 0 ) sy += im->height ;
+		}else if( width != to_width || height != to_height )
+		{
+			set_picture_scale( dpy, src, src_x, src_y, width, height, to_width, to_height );
+			sx = sy = 0 ;
+			scaled = True ;
+		}
+
+		if( tint != TINT_LEAVE_SAME && tint != 0 )
+		{   /* tinted copy has to go through intermediate picture to keep alpha intact : */
+			Pixmap tmp = XCreatePixmap( dpy, d, to_width, to_height, 32 );
+			Picture tmp_pic = XRenderCreatePicture( dpy, tmp, XRenderFindStandardFormat( dpy, PictStandardARGB32 ), 0, NULL );
+			xrender_copytint( dpy, d, src, tmp_pic, tint, sx, sy, 0, 0, to_width, to_height );
+			XRenderComposite( dpy, PictOpOver, tmp_pic, None, dst, 0, 0, 0, 0, dest_x, dest_y, to_width, to_height );
+			XRenderFreePicture( dpy, tmp_pic );
+			XFreePixmap( dpy, tmp );
+		}else
+			XRenderComposite( dpy, PictOpOver, src, None, dst, sx, sy, 0, 0, dest_x, dest_y, to_width, to_height );
+
+		/* source picture is cached with the image - restore its defaults */
+		if( tile )
+		{
+			XRenderPictureAttributes pa ;
+			pa.repeat = RepeatNone ;
+			XRenderChangePicture( dpy, src, CPRepeat, &pa );
+		}else if( scaled )
+			reset_picture_scale( dpy, src );
+		XRenderFreePicture( dpy, dst );
+		return True;
+	}
+#endif
+	{
+		static Bool warning_shown = False ;
+		if( !warning_shown )
+		{
+			warning_shown = True ;
+			show_warning( "Support for XRender is unavailable.");
+		}
+	}
+	return False;
+}
+
+Bool
+copytint_drawable_xrender( ASVisual *asv, Drawable src, Drawable trg,
+						   int x, int y, unsigned int width, unsigned int height,
+						   unsigned int to_width, unsigned int to_height,
+						   int trg_x, int trg_y, ARGB32 tint )
+{
+#ifdef HAVE_XRENDER
+	if( check_xrender_support( asv ) && width > 0 && height > 0 )
+	{
+		Display *dpy = asv->dpy ;
+		XRenderPictFormat *fmt = XRenderFindVisualFormat( dpy, asv->visual_info.visual );
+		Picture src_pic = XRenderCreatePicture( dpy, src, fmt, 0, NULL );
+		Picture trg_pic = XRenderCreatePicture( dpy, trg, fmt, 0, NULL );
+
+		if( to_width == 0 )
+			to_width = width ;
+		if( to_height == 0 )
+			to_height = height ;
+		if( width != to_width || height != to_height )
+		{
+			set_picture_scale( dpy, src_pic, x, y, width, height, to_width, to_height );
+			x = y = 0 ;
+		}
+		xrender_copytint( dpy, trg, src_pic, trg_pic, tint, x, y, trg_x, trg_y, to_width, to_height );
+		XRenderFreePicture( dpy, src_pic );
+		XRenderFreePicture( dpy, trg_pic );
+		return True;
+	}
+#endif
+	return False;
+}
+
+/* Encodes the area straight into shared memory upload bands, so that the
+ * server copies one band while the next one is being encoded. Returns False
+ * without drawing anything if shared memory uploads are not available. */
+static Bool
+asimage2drawable_bands( ASVisual *asv, Drawable d, ASImage *im, GC gc,
+                        int src_x, int src_y, int dest_x, int dest_y,
+        		        unsigned int width, unsigned int height )
+{
+	ASImageDecoder *imdec ;
+	XImage *band ;
+	GC my_gc = gc ;
+	int y = 0 ;
+
+	if( (band = get_shm_upload_ximage( asv, width, height )) == NULL )
+		return False;
+	if( (imdec = start_image_decoding( asv, im, (band->depth >= 24)?SCL_DO_ALL:SCL_DO_COLOR,
+									   src_x, src_y, width, height, NULL)) == NULL )
+		return False;
+	if( my_gc == NULL )
+	{
+		XGCValues gcv ;
+		my_gc = XCreateGC( asv->dpy, d, 0, &gcv );
+	}
+
+	while( band != NULL )
+	{
+		ASImage *scratch_im = create_asimage( width, band->height, 0);
+		ASImageOutput *imout ;
+		int i ;
+
+		scratch_im->alt.ximage = band ;
+		if( (imout = start_image_output( asv, scratch_im, ASA_ScratchXImage, 0, ASIMAGE_QUALITY_DEFAULT )) != NULL )
+		{
+			for( i = 0 ; i < band->height ; ++i )
+			{
+				imdec->decode_image_scanline( imdec );
+				imout->output_image_scanline( imout, &(imdec->buffer), 1);
+			}
+			stop_image_output( &imout );
+		}
+		scratch_im->alt.ximage = NULL ;
+		destroy_asimage( &scratch_im );
+
+		put_shm_upload_ximage( asv, band, d, my_gc, dest_x, dest_y+y );
+		y += band->height ;
+		band = ( y < (int)height )? get_shm_upload_ximage( asv, width, height-y ) : NULL ;
+		if( band == NULL && y < (int)height )
+		{	/* could not get the next band - finish with regular XImage : */
+			XImage *xim = create_visual_ximage( asv, width, height-y, 0 );
+			if( xim )
+			{
+				scratch_im = create_asimage( width, height-y, 0);
+				scratch_im->alt.ximage = xim ;
+				if( (imout = start_image_output( asv, scratch_im, ASA_XImage, 0, ASIMAGE_QUALITY_DEFAULT )) != NULL )
+				{
+					for( i = y ; i < (int)height ; ++i )
+					{
+						imdec->decode_image_scanline( imdec );
+						imout->output_image_scanline( imout, &(imdec->buffer), 1);
+					}
+					stop_image_output( &imout );
+				}
+				scratch_im->alt.ximage = NULL ;
+				destroy_asimage( &scratch_im );
+				ASPutXImage( asv, d, my_gc, xim, 0, 0, dest_x, dest_y+y, width, height-y );
+				XDestroyImage( xim );
+			}
+		}
+	}
+	stop_image_decoding( &imdec );
+	if( my_gc != gc )
+		XFreeGC( asv->dpy, my_gc );
+	return True;
+}
+
 Bool
 asimage2drawable( ASVisual *asv, Drawable d, ASImage *im, GC gc,
                   int src_x, int src_y, int dest_x, int dest_y,
@@ -658,6 +1083,37 @@ asimage2drawable( ASVisual *asv, Drawable d, ASImage *im, GC gc,
 		Bool res = False;
 		if ( !use_cached || im->alt.ximage == NULL )
 		{
+			/* same clipping as put_ximage() would do : */
+			if( src_x < 0 )
+			{
+				width += src_x ;
+				src_x = 0;
+			}else if( src_x > (int)im->width )
+				return False;
+			if( (int)im->width  > src_x+(int)width )
+				width = im->width - src_x ;
+			if( src_y < 0 )
+			{
+				height+= src_y ;
+				src_y = 0;
+			}else if( src_y > (int)im->height )
+				return False;
+			if( (int)im->height  > src_y+(int)height )
+				height = im->height - src_y ;
+			/* opaque images can be kept on the server as Pictures, so that
+			 * repeated draws do not upload anything at all. Render ignores
+			 * GC function and clipping, so only do it without GC : */
+			if( use_cached && gc == NULL && check_xrender_support( asv ) &&
+				!get_flags( get_asimage_chanmask( im ), SCL_DO_ALPHA ) &&
+				ARGB32_ALPHA8(im->back_color) == 0x00FF )
+				if( asimage2drawable_xrender( asv, d, im, src_x, src_y, dest_x, dest_y,
+											  MIN(width,im->width-src_x), MIN(height,im->height-src_y),
+											  0, 0, TINT_LEAVE_SAME, False, True ) )
+					return True;
+			if( width*height*4 > ASSHM_UPLOAD_BAND_SIZE && check_shmem_images_enabled() )
+				if( asimage2drawable_bands( asv, d, im, gc, src_x, src_y, dest_x, dest_y,
+											MIN(width,im->width-src_x), MIN(height,im->height-src_y) ) )
+					return True;
             if( (xim = asimage2ximage_ext( asv, im, False )) == NULL )
 			{
 				show_error("cannot export image into XImage.");
@@ -781,6 +1237,355 @@ asimage2mask(ASVisual *asv, Window root, ASImage *im, GC gc, Bool use_cached)
 {
 	return asimage2alpha(asv, root, im, gc, use_cached, True);
 }
+
+/* ********************************************************************************/
+/* Server side pixmap cache : images that get drawn over and over again (icons,   */
+/* buttons shared through ASImageManager) are uploaded once per ASVisual and then */
+/* copied on the server. Entries are keyed by ASImage and validated by its       */
+/* revision, so any change to image data causes it to be uploaded again.         */
+/* ********************************************************************************/
+#ifndef X_DISPLAY_MISSING
+typedef struct ASPixmapCacheItem
+{
+	ASImage 	 *im ;                     /* NULL once image is gone while still referenced */
+	unsigned long revision ;
+	Pixmap 		  pixmap, mask ;
+	size_t 		  size ;
+	int 		  ref_count ;
+	struct ASPixmapCacheItem *prev, *next ; /* most recently used first */
+}ASPixmapCacheItem;
+
+typedef struct ASPixmapCache
+{
+	ASVisual 	 *asv ;
+	ASHashTable  *items ;
+	ASPixmapCacheItem *head, *tail ;
+	struct ASImagePicture *pictures, *pictures_tail ; /* XRender pictures charged to us */
+	size_t 		  used, max_size ;
+	struct ASPixmapCache *next ;
+}ASPixmapCache;
+
+/* we need to find all the caches when image gets destroyed : */
+static ASPixmapCache *pixmap_caches = NULL ;
+
+static ASPixmapCache *
+get_pixmap_cache( ASVisual *asv, Bool create )
+{
+	if( asv->pixmap_cache == NULL && create )
+	{
+		ASPixmapCache *cache = safecalloc( 1, sizeof(ASPixmapCache));
+		cache->asv = asv ;
+		cache->items = create_ashash( 0, pointer_hash_value, NULL, NULL );
+		cache->max_size = ASVISUAL_PIXMAP_CACHE_SIZE ;
+		cache->next = pixmap_caches ;
+		pixmap_caches = cache ;
+		asv->pixmap_cache = cache ;
+	}
+	return asv->pixmap_cache;
+}
+
+static void
+unlink_pixmap_cache_item( ASPixmapCache *cache, ASPixmapCacheItem *item )
+{
+	if( item->prev )
+		item->prev->next = item->next ;
+	else
+		cache->head = item->next ;
+	if( item->next )
+		item->next->prev = item->prev ;
+	else
+		cache->tail = item->prev ;
+	item->prev = item->next = NULL ;
+}
+
+static void
+free_pixmap_cache_item( ASPixmapCache *cache, ASPixmapCacheItem *item )
+{
+	if( item->im )
+		remove_hash_item( cache->items, AS_HASHABLE(item->im), NULL, False );
+	unlink_pixmap_cache_item( cache, item );
+	if( item->pixmap )
+		XFreePixmap( cache->asv->dpy, item->pixmap );
+	if( item->mask )
+		XFreePixmap( cache->asv->dpy, item->mask );
+	cache->used -= item->size ;
+	free( item );
+}
+
+/* image changed or went away - pixmap can only live on while referenced : */
+static void
+orphan_pixmap_cache_item( ASPixmapCache *cache, ASPixmapCacheItem *item )
+{
+	if( item->ref_count > 0 )
+	{
+		remove_hash_item( cache->items, AS_HASHABLE(item->im), NULL, False );
+		item->im = NULL ;
+	}else
+		free_pixmap_cache_item( cache, item );
+}
+
+static void
+trim_pixmap_cache( ASPixmapCache *cache, size_t max_size )
+{
+	ASPixmapCacheItem *item = cache->tail ;
+	while( item && cache->used > max_size )
+	{
+		ASPixmapCacheItem *prev = item->prev ;
+		if( item->ref_count <= 0 )
+			free_pixmap_cache_item( cache, item );
+		item = prev ;
+	}
+#ifdef HAVE_XRENDER
+	/* pictures are only used for the duration of a single call : */
+	while( cache->pictures_tail && cache->used > max_size )
+		destroy_asimage_picture( cache->pictures_tail->im );
+#endif
+}
+
+#ifdef HAVE_XRENDER
+static void
+unlink_asimage_picture( ASPixmapCache *cache, ASImagePicture *pic )
+{
+	if( pic->prev )
+		pic->prev->next = pic->next ;
+	else
+		cache->pictures = pic->next ;
+	if( pic->next )
+		pic->next->prev = pic->prev ;
+	else
+		cache->pictures_tail = pic->prev ;
+	pic->prev = pic->next = NULL ;
+}
+
+/* new picture gets charged to the cache, making room for it first,
+ * and already charged one simply becomes most recently used : */
+static void
+charge_asimage_picture( ASVisual *asv, ASImagePicture *pic )
+{
+	ASPixmapCache *cache = get_pixmap_cache( asv, True );
+
+	if( pic->cache == cache )
+		unlink_asimage_picture( cache, pic );
+	else
+	{
+		uncharge_asimage_picture( pic );
+		pic->size = pic->im->width*pic->im->height*sizeof(CARD32) ;
+		trim_pixmap_cache( cache, (pic->size < cache->max_size)? cache->max_size - pic->size : 0 );
+		pic->cache = cache ;
+		cache->used += pic->size ;
+	}
+	pic->next = cache->pictures ;
+	if( cache->pictures )
+		cache->pictures->prev = pic ;
+	cache->pictures = pic ;
+	if( cache->pictures_tail == NULL )
+		cache->pictures_tail = pic ;
+}
+
+static void
+uncharge_asimage_picture( ASImagePicture *pic )
+{
+	if( pic->cache )
+	{
+		unlink_asimage_picture( pic->cache, pic );
+		pic->cache->used -= pic->size ;
+		pic->cache = NULL ;
+	}
+}
+#endif
+
+static ASPixmapCacheItem *
+fetch_cached_pixmap( ASVisual *asv, Drawable root, ASImage *im, Bool want_mask )
+{
+	ASPixmapCache *cache = get_pixmap_cache( asv, True );
+	ASPixmapCacheItem *item = NULL ;
+	ASHashData hdata ;
+
+	if( get_hash_item( cache->items, AS_HASHABLE(im), &hdata.vptr ) == ASH_Success )
+	{
+		item = hdata.vptr ;
+		if( item->revision != im->revision )
+		{
+			LOCAL_DEBUG_OUT( "image %p changed - dropping pixmap %lX", im, item->pixmap );
+			orphan_pixmap_cache_item( cache, item );
+			item = NULL ;
+		}
+	}
+
+	if( item == NULL )
+	{
+		int bpp = (asv->true_depth > 16)?4:((asv->true_depth > 8)?2:1) ;
+		size_t size = im->width*im->height*bpp ;
+		Pixmap p ;
+
+		if( size > cache->max_size )
+			return NULL;
+		if( (p = asimage2pixmap( asv, root, im, NULL, False )) == None )
+			return NULL;
+		item = safecalloc( 1, sizeof(ASPixmapCacheItem));
+		item->im = im ;
+		item->revision = im->revision ;
+		item->pixmap = p ;
+		item->size = size ;
+		add_hash_item( cache->items, AS_HASHABLE(im), item );
+		cache->used += size ;
+	}else
+		unlink_pixmap_cache_item( cache, item );
+
+	/* most recently used goes to the head : */
+	item->next = cache->head ;
+	if( cache->head )
+		cache->head->prev = item ;
+	cache->head = item ;
+	if( cache->tail == NULL )
+		cache->tail = item ;
+
+	if( want_mask && item->mask == None && check_asimage_alpha( asv, im ) > 0 )
+	{
+		item->mask = asimage2mask( asv, root, im, NULL, False );
+		item->size += ((im->width+7)/8)*im->height ;
+		cache->used += ((im->width+7)/8)*im->height ;
+	}
+	/* keep the one we just fetched alive while trimming : */
+	++(item->ref_count);
+	trim_pixmap_cache( cache, cache->max_size );
+	--(item->ref_count);
+	return item;
+}
+#endif
+
+Pixmap
+get_cached_asimage_pixmap( ASVisual *asv, Window root, ASImage *im, Pixmap *mask_ret )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCacheItem *item ;
+	if( asv == NULL || im == NULL )
+		return None;
+	if( (item = fetch_cached_pixmap( asv, root, im, (mask_ret != NULL) )) == NULL )
+		return None;
+	++(item->ref_count);
+	if( mask_ret )
+		*mask_ret = item->mask ;
+	return item->pixmap;
+#else
+	return None ;
+#endif
+}
+
+void
+release_cached_asimage_pixmap( ASVisual *asv, Pixmap p )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCache *cache ;
+	ASPixmapCacheItem *item ;
+	if( asv == NULL || p == None || (cache = get_pixmap_cache( asv, False )) == NULL )
+		return;
+	for( item = cache->head ; item ; item = item->next )
+		if( item->pixmap == p )
+		{
+			if( --(item->ref_count) <= 0 )
+			{
+				item->ref_count = 0 ;
+				if( item->im == NULL )
+					free_pixmap_cache_item( cache, item );
+				else
+					trim_pixmap_cache( cache, cache->max_size );
+			}
+			break;
+		}
+#endif
+}
+
+Bool
+asimage2drawable_cached( ASVisual *asv, Drawable d, ASImage *im, GC gc,
+                         int src_x, int src_y, int dest_x, int dest_y,
+        		         unsigned int width, unsigned int height )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCacheItem *item ;
+	if( asv == NULL || im == NULL )
+		return False;
+	if( (item = fetch_cached_pixmap( asv, d, im, False )) != NULL )
+	{
+		GC my_gc = gc ;
+		if( my_gc == NULL )
+		{
+			XGCValues gcv ;
+			my_gc = XCreateGC( asv->dpy, d, 0, &gcv );
+		}
+		XCopyArea( asv->dpy, item->pixmap, d, my_gc, src_x, src_y, width, height, dest_x, dest_y );
+		if( my_gc != gc )
+			XFreeGC( asv->dpy, my_gc );
+		return True;
+	}
+	return asimage2drawable( asv, d, im, gc, src_x, src_y, dest_x, dest_y, width, height, True );
+#else
+	return False ;
+#endif
+}
+
+void
+set_asvisual_pixmap_cache_size( ASVisual *asv, size_t max_size )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCache *cache ;
+	if( asv && (cache = get_pixmap_cache( asv, True )) != NULL )
+	{
+		cache->max_size = max_size ;
+		trim_pixmap_cache( cache, max_size );
+	}
+#endif
+}
+
+void
+flush_asvisual_pixmap_cache( ASVisual *asv )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCache *cache ;
+	if( asv && (cache = get_pixmap_cache( asv, False )) != NULL )
+		trim_pixmap_cache( cache, 0 );
+#endif
+}
+
+void
+destroy_asvisual_pixmap_cache( ASVisual *asv )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCache *cache, **pcurr ;
+	if( asv == NULL || (cache = get_pixmap_cache( asv, False )) == NULL )
+		return;
+	while( cache->head )
+		free_pixmap_cache_item( cache, cache->head );
+#ifdef HAVE_XRENDER
+	while( cache->pictures )
+		destroy_asimage_picture( cache->pictures->im );
+#endif
+	destroy_ashash( &(cache->items) );
+	for( pcurr = &pixmap_caches ; *pcurr ; pcurr = &((*pcurr)->next) )
+		if( *pcurr == cache )
+		{
+			*pcurr = cache->next ;
+			break;
+		}
+	free( cache );
+	asv->pixmap_cache = NULL ;
+#endif
+}
+
+void
+forget_asimage_pixmaps( ASImage *im )
+{
+#ifndef X_DISPLAY_MISSING
+	ASPixmapCache *cache ;
+	for( cache = pixmap_caches ; cache ; cache = cache->next )
+	{
+		ASHashData hdata ;
+		if( get_hash_item( cache->items, AS_HASHABLE(im), &hdata.vptr ) == ASH_Success )
+			orphan_pixmap_cache_item( cache, (ASPixmapCacheItem*)hdata.vptr );
+	}
+#endif
+}
+
 /* ********************************************************************************/
 /* The end !!!! 																 */
 /* ********************************************************************************/
@@ -270,6 +270,9 @@ ASImage *pixmap2asimage (struct ASVisual *asv, Pixmap p, int x, int y,
  * It then supplied gc or DefaultGC of the screen to transfer
  * XImage to the server.
  * Missing scanlines get filled with black color.
+ * If use_cached is True, gc is NULL, image is opaque and has no XImage
+ * attached, then it gets drawn with asimage2drawable_xrender() instead,
+ * when XRender is available, so that image data stays on the server.
  * SEE ALSO
  * asimage2ximage()
  * asimage2pixmap()
@@ -331,6 +334,86 @@ ASImage *pixmap2asimage (struct ASVisual *asv, Pixmap p, int x, int y,
  * SEE ALSO
  * asimage2mask_ximage()
  **********/
+/****f* libAfterImage/asimage2drawable_xrender()
+ * NAME
+ * asimage2drawable_xrender()
+ * SYNOPSIS
+ * Bool asimage2drawable_xrender( ASVisual *asv, Drawable d, ASImage *im,
+ *                                int src_x, int src_y,
+ *                                int dest_x, int dest_y,
+ *                                unsigned int width, unsigned int height,
+ *                                unsigned int to_width,
+ *                                unsigned int to_height,
+ *                                ARGB32 tint, Bool tile, Bool use_cached );
+ * INPUTS
+ * asv          - pointer to valid ASVisual structure
+ * d            - destination drawable of the visual's depth
+ * im           - source ASImage
+ * src_x, src_y - origin of the source area, or of the tiling if tile
+ *                is True.
+ * dest_x,dest_y- position in the drawable
+ * width,height - size of the source area
+ * to_width,
+ * to_height    - size of the destination area. Source area is scaled
+ *                to this size, unless tile is True. 0 means same as
+ *                source.
+ * tint         - tint to apply - see tile_asimage().
+ * tile         - if True the image gets tiled over destination area.
+ * use_cached   - if True, ARGB32 picture kept on the server from the
+ *                previous call will be reused.
+ * RETURN VALUE
+ * True on success. False if XRender is not available - caller should
+ * then fall back to client side compositing.
+ * DESCRIPTION
+ * asimage2drawable_xrender() uploads ASImage to the server once, as
+ * premultiplied ARGB32 XRender Picture stored in im->alt.picture, and
+ * then alpha blends it onto the drawable, tinting, tiling and scaling
+ * it on the server side. That makes redrawing of translucent
+ * elements a matter of a few X requests. Pictures count against the
+ * budget of the visual's pixmap cache (see asimage2drawable_cached())
+ * and get dropped, least recently used first, once it is exceeded.
+ * Library has to be built with
+ * HAVE_XRENDER defined and linked with libXrender for this to work.
+ * copytint_drawable_xrender() does the same tinting and scaling for
+ * area of a drawable of the visual's format.
+ *********/
+/****f* libAfterImage/asimage2drawable_cached()
+ * NAME
+ * asimage2drawable_cached()
+ * get_cached_asimage_pixmap()
+ * release_cached_asimage_pixmap()
+ * SYNOPSIS
+ * Bool   asimage2drawable_cached( ASVisual *asv, Drawable d, ASImage *im,
+ *                                 GC gc, int src_x, int src_y,
+ *                                 int dest_x, int dest_y,
+ *                                 unsigned int width, unsigned int height );
+ * Pixmap get_cached_asimage_pixmap( ASVisual *asv, Window root,
+ *                                   ASImage *im, Pixmap *mask_ret );
+ * void   release_cached_asimage_pixmap( ASVisual *asv, Pixmap p );
+ * void   set_asvisual_pixmap_cache_size( ASVisual *asv, size_t max_size );
+ * INPUTS
+ * asv          - pointer to valid ASVisual structure
+ * d            - destination drawable of the visual's depth
+ * im           - source ASImage
+ * gc           - GC to use for copying, if NULL temporary one is created
+ * mask_ret     - if not NULL, will receive 1 bit mask Pixmap for the
+ *                image, or None if image has no alpha.
+ * RETURN VALUE
+ * get_cached_asimage_pixmap() returns Pixmap owned by the cache, that
+ * must be returned with release_cached_asimage_pixmap() and never
+ * freed directly.
+ * DESCRIPTION
+ * Each ASVisual keeps a cache of server side Pixmaps of the images
+ * drawn through these functions, so that drawing the same image many
+ * times only uploads it once and then uses XCopyArea. Cached Pixmap is
+ * validated against image's revision, which changes every time image
+ * data is modified, and is dropped when image is destroyed.
+ * Unreferenced pixmaps are freed, least recently used first, once
+ * total size exceeds the cache budget - ASVISUAL_PIXMAP_CACHE_SIZE by
+ * default, changeable with set_asvisual_pixmap_cache_size().
+ * asimage2drawable_cached() falls back to asimage2drawable() if image
+ * does not fit into the cache.
+ *********/
 XImage  *asimage2ximage  (struct ASVisual *asv, ASImage *im);
 Bool     subimage2ximage (struct ASVisual *asv, ASImage *im, int x, int y, XImage* xim);
 Bool     put_ximage( ASVisual *asv, XImage *xim, Drawable d, GC gc,
@@ -350,6 +433,19 @@ Bool asimage2drawable_gl(	ASVisual *asv, Drawable d, ASImage *im,
         		  		int width, int height, int d_width, int d_height, 
 						Bool force_direct );
 
+/* server side compositing through XRender, where available : */
+Bool check_xrender_support( ASVisual *asv );
+Bool asimage2drawable_xrender( ASVisual *asv, Drawable d, ASImage *im,
+                               int src_x, int src_y, int dest_x, int dest_y,
+                               unsigned int width, unsigned int height,
+                               unsigned int to_width, unsigned int to_height,
+                               ARGB32 tint, Bool tile, Bool use_cached );
+Bool copytint_drawable_xrender( ASVisual *asv, Drawable src, Drawable trg,
+                                int x, int y, unsigned int width, unsigned int height,
+                                unsigned int to_width, unsigned int to_height,
+                                int trg_x, int trg_y, ARGB32 tint );
+void destroy_asimage_picture( ASImage *im );
+
 Bool	 asimage2alpha_drawable( ASVisual *asv, Drawable d, ASImage *im, GC gc,
       	    		  	   int src_x, int src_y, int dest_x, int dest_y,
         				   unsigned int width, unsigned int height,
@@ -358,6 +454,16 @@ Pixmap   asimage2pixmap  (struct ASVisual *asv, Window root, ASImage *im, GC gc,
 Pixmap	 asimage2alpha   (struct ASVisual *asv, Window root, ASImage *im, GC gc, Bool use_cached, Bool bitmap);
 Pixmap   asimage2mask    (struct ASVisual *asv, Window root, ASImage *im, GC gc, Bool use_cached);
 
+Pixmap get_cached_asimage_pixmap( ASVisual *asv, Window root, ASImage *im, Pixmap *mask_ret );
+void   release_cached_asimage_pixmap( ASVisual *asv, Pixmap p );
+Bool   asimage2drawable_cached( ASVisual *asv, Drawable d, ASImage *im, GC gc,
+                                int src_x, int src_y, int dest_x, int dest_y,
+                                unsigned int width, unsigned int height );
+void   set_asvisual_pixmap_cache_size( ASVisual *asv, size_t max_size );
+void   flush_asvisual_pixmap_cache( ASVisual *asv );
+void   destroy_asvisual_pixmap_cache( ASVisual *asv );
+void   forget_asimage_pixmaps( ASImage *im );
+
 #ifdef __cplusplus
 }
 #endif
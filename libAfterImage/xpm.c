@@ -57,6 +57,11 @@
 #endif
 #include <fcntl.h>
 #include <string.h>
+/* whole file gets mapped and parsed in place : */
+#if !defined(_WIN32) && !defined(HAVE_LIBXPM)
+#define HAVE_XPM_MMAP
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_LIBXPM      /* XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM XPM */
 #ifdef HAVE_LIBXPM_X11
@@ -338,6 +343,11 @@ get_xpm_char( ASXpmFile *xpm_file )
 	char c;
 	if( xpm_file->curr_byte >= xpm_file->bytes_in )
 	{
+		if( xpm_file->mapped_size > 0 )
+		{
+			xpm_file->parse_state = XPM_Outside ;
+			return '\0';
+		}
 		if( xpm_file->bytes_in > AS_XPM_BUFFER_UNDO )
 		{
 			register char* src = &(xpm_file->buffer[xpm_file->bytes_in-AS_XPM_BUFFER_UNDO]);
@@ -371,7 +381,9 @@ unget_xpm_char( ASXpmFile *xpm_file, char c )
 	if( xpm_file->curr_byte > 0 )
 	{
 		xpm_file->curr_byte--;
-		xpm_file->buffer[xpm_file->curr_byte] = c;
+		/* don't touch mapped pages needlessly - it is nearly always the same char */
+		if( xpm_file->buffer[xpm_file->curr_byte] != c )
+			xpm_file->buffer[xpm_file->curr_byte] = c;
 	}
 #endif
 }
@@ -425,6 +437,19 @@ seek_next_xpm_image( ASXpmFile *xpm_file )
 	return (xpm_file->parse_state >= XPM_InImage);
 }
 
+static inline void
+grow_xpm_str_buf( ASXpmFile *xpm_file, size_t size )
+{
+	if( size > xpm_file->str_buf_size )
+	{
+		size_t new_size = xpm_file->str_buf_size+16+(xpm_file->str_buf_size>>2) ;
+		if( new_size < size )
+			new_size = size ;
+		xpm_file->str_buf = realloc( xpm_file->str_buf, new_size );
+		xpm_file->str_buf_size = new_size ;
+	}
+}
+
 static Bool
 read_next_xpm_string( ASXpmFile *xpm_file )
 {
@@ -432,6 +457,25 @@ read_next_xpm_string( ASXpmFile *xpm_file )
 	int i = 0;
 	while( xpm_file->parse_state == XPM_InString )
 	{
+		if( xpm_file->curr_byte < xpm_file->bytes_in )
+		{	/* copying whatever is in the buffer up to the closing quote at once : */
+			char *start = &(xpm_file->buffer[xpm_file->curr_byte]) ;
+			size_t avail = xpm_file->bytes_in - xpm_file->curr_byte ;
+			char *end = memchr( start, '"', avail );
+			size_t len = end ? (size_t)(end - start) : avail ;
+
+			grow_xpm_str_buf( xpm_file, i+len+1 );
+			memcpy( &(xpm_file->str_buf[i]), start, len );
+			i += len ;
+			xpm_file->curr_byte += len ;
+			if( end )
+			{
+				xpm_file->curr_byte++;
+				xpm_file->parse_state = XPM_InImage ;
+				xpm_file->str_buf[i++] = '\0';
+			}
+			continue;
+		}
 		c=get_xpm_char(xpm_file);
 		if( c == '"' )
 		{
@@ -439,11 +483,7 @@ read_next_xpm_string( ASXpmFile *xpm_file )
 			c = '\0';
 		}
 
-		if( i >= (int)xpm_file->str_buf_size )
-		{
-			xpm_file->str_buf = realloc( xpm_file->str_buf, xpm_file->str_buf_size+16+(xpm_file->str_buf_size>>2));
-			xpm_file->str_buf_size += 16+(xpm_file->str_buf_size>>2) ;
-		}
+		grow_xpm_str_buf( xpm_file, i+1 );
 		xpm_file->str_buf[i++] = c;
 	}
    xpm_file->curr_img_line++;
@@ -514,6 +554,11 @@ close_xpm_file( ASXpmFile **xpm_file )
 #ifdef HAVE_LIBXPM
 			XpmFreeXpmImage (&((*xpm_file)->xpmImage));
 #else
+#ifdef HAVE_XPM_MMAP
+			if( (*xpm_file)->mapped_size > 0 )
+				munmap( (*xpm_file)->buffer, (*xpm_file)->mapped_size );
+			else
+#endif
 			if( (*xpm_file)->buffer && !(*xpm_file)->data)
 				free( (*xpm_file)->buffer );
 #endif
@@ -528,8 +573,12 @@ close_xpm_file( ASXpmFile **xpm_file )
 						free( (*xpm_file)->cmap2[i] );
 				free( (*xpm_file)->cmap2 );
 			}
-			if( (*xpm_file)->cmap_name_xref )
-				destroy_ashash( &((*xpm_file)->cmap_name_xref) );
+			if( (*xpm_file)->codes )
+				free( (*xpm_file)->codes );
+			if( (*xpm_file)->code_colors )
+				free( (*xpm_file)->code_colors );
+			if( (*xpm_file)->code_slots )
+				free( (*xpm_file)->code_slots );
 			free( *xpm_file );
 			*xpm_file = NULL ;
 		}
@@ -548,12 +597,32 @@ open_xpm_file( const char *realfilename )
 		fd = open( realfilename, O_RDONLY );
 		if( fd >= 0 )
 		{
+#ifdef HAVE_XPM_MMAP
+			struct stat st ;
+#endif
 			xpm_file->fd = fd;
 			xpm_file->parse_state = XPM_InFile ;
-			xpm_file->buffer = safemalloc(AS_XPM_BUFFER_UNDO+AS_XPM_BUFFER_SIZE+1);
 			xpm_file->data = 0;
-			xpm_file->bytes_in = AS_XPM_BUFFER_UNDO+read( fd, &(xpm_file->buffer[AS_XPM_BUFFER_UNDO]),  AS_XPM_BUFFER_SIZE );
-			xpm_file->curr_byte = AS_XPM_BUFFER_UNDO ;
+#ifdef HAVE_XPM_MMAP
+			/* private mapping, so that unget_xpm_char() may still write into it */
+			if( fstat( fd, &st ) == 0 && st.st_size > 0 )
+			{
+				void *map = mmap( NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0 );
+				if( map != MAP_FAILED )
+				{
+					xpm_file->buffer = map ;
+					xpm_file->mapped_size = st.st_size ;
+					xpm_file->bytes_in = st.st_size ;
+					xpm_file->curr_byte = 0 ;
+				}
+			}
+			if( xpm_file->mapped_size == 0 )
+#endif
+			{
+				xpm_file->buffer = safemalloc(AS_XPM_BUFFER_UNDO+AS_XPM_BUFFER_SIZE+1);
+				xpm_file->bytes_in = AS_XPM_BUFFER_UNDO+read( fd, &(xpm_file->buffer[AS_XPM_BUFFER_UNDO]),  AS_XPM_BUFFER_SIZE );
+				xpm_file->curr_byte = AS_XPM_BUFFER_UNDO ;
+			}
 			if (get_xpm_string( xpm_file ) == XPM_Success)
 				success = parse_xpm_header( xpm_file );
 		}
@@ -762,13 +831,61 @@ lookup_xpm_color( char **colornames, ASHashTable *xpm_color_names )
 	return color;
 }
 
-void
-string_value_destroy (ASHashableValue value, void *data)
+#ifndef HAVE_LIBXPM
+/* pixel codes of 3 and more chars get looked up in open addressing table,
+ * hashed straight from the image data, without copying : */
+static inline unsigned int
+hash_xpm_code( const unsigned char *code, int bpp )
 {
-	if ((char*)value != NULL)
-		free ((char*)value);
+	register unsigned int h = 0 ;
+	while( --bpp >= 0 )
+		h = (h<<5) + h + *(code++) ;
+	return h^(h>>11) ;
+}
+
+static inline int
+find_xpm_code( ASXpmFile *xpm_file, const unsigned char *code )
+{
+	unsigned int mask = xpm_file->code_slots_num-1 ;
+	unsigned int slot = hash_xpm_code( code, xpm_file->bpp )&mask ;
+	int idx ;
+	while( (idx = xpm_file->code_slots[slot]) >= 0 )
+	{
+		if( memcmp( &(xpm_file->codes[idx*xpm_file->bpp]), code, xpm_file->bpp ) == 0 )
+			break;
+		slot = (slot+1)&mask ;
+	}
+	return slot;
 }
 
+static void
+add_xpm_code( ASXpmFile *xpm_file, const char *code, ARGB32 color )
+{
+	int bpp = xpm_file->bpp ;
+	int slot ;
+
+	if( (xpm_file->codes_num+1)*2 > xpm_file->code_slots_num )
+	{	/* keeping table at most half full : */
+		unsigned int i ;
+		xpm_file->code_slots_num = xpm_file->code_slots_num ? xpm_file->code_slots_num*2 : 256 ;
+		xpm_file->code_slots = realloc( xpm_file->code_slots, xpm_file->code_slots_num*sizeof(int) );
+		for( i = 0 ; i < xpm_file->code_slots_num ; ++i )
+			xpm_file->code_slots[i] = -1 ;
+		for( i = 0 ; i < xpm_file->codes_num ; ++i )
+			xpm_file->code_slots[find_xpm_code( xpm_file, (unsigned char*)&(xpm_file->codes[i*bpp]) )] = i ;
+		xpm_file->codes = realloc( xpm_file->codes, (xpm_file->code_slots_num/2)*bpp );
+		xpm_file->code_colors = realloc( xpm_file->code_colors, (xpm_file->code_slots_num/2)*sizeof(ARGB32) );
+	}
+	slot = find_xpm_code( xpm_file, (const unsigned char*)code );
+	if( xpm_file->code_slots[slot] < 0 ) /* first definition wins */
+	{
+		memcpy( &(xpm_file->codes[xpm_file->codes_num*bpp]), code, bpp );
+		xpm_file->code_colors[xpm_file->codes_num] = color ;
+		xpm_file->code_slots[slot] = xpm_file->codes_num++ ;
+	}
+}
+#endif
+
 Bool
 build_xpm_colormap( ASXpmFile *xpm_file )
 {
@@ -785,8 +902,12 @@ build_xpm_colormap( ASXpmFile *xpm_file )
 		return False;
 	}
 
-	if( xpm_file->cmap_name_xref )
-		destroy_ashash( &(xpm_file->cmap_name_xref) );
+	if( xpm_file->code_slots )
+	{
+		free( xpm_file->code_slots );
+		xpm_file->code_slots = NULL ;
+		xpm_file->code_slots_num = xpm_file->codes_num = 0 ;
+	}
 	if( xpm_file->cmap )
 	{
 		free( xpm_file->cmap );
@@ -809,10 +930,7 @@ build_xpm_colormap( ASXpmFile *xpm_file )
 	}else if( xpm_file->bpp == 2 )
 	{
 		xpm_file->cmap2 = safecalloc( 256, sizeof(ARGB32*));
-	}else
-		xpm_file->cmap_name_xref = create_ashash( 0, string_hash_value,
-													 string_compare,
-													 string_value_destroy );
+	}
 #endif
 	if( xpm_color_names == NULL )
 	{
@@ -857,12 +975,8 @@ LOCAL_DEBUG_OUT( "\t\tcolor = 0x%8.8lX\n",  color );
 				*slot = safecalloc( 256, sizeof(ARGB32));
 			(*slot)[(unsigned int)(xpm_file->str_buf[1])] = color ;
 		}
-		else if( i < real_cmap_size )
-		{
-			char *name = mystrndup(xpm_file->str_buf, xpm_file->bpp);
-LOCAL_DEBUG_OUT( "\t\tname = \"%s\"\n", name );
-			add_hash_item( xpm_file->cmap_name_xref, (ASHashableValue)name, (void*)((long)color) );
-		}
+		else if( i < real_cmap_size && strlen(xpm_file->str_buf) >= xpm_file->bpp )
+			add_xpm_code( xpm_file, xpm_file->str_buf, color );
 #endif
 	}
 	xpm_file->cmap_size = real_cmap_size ;
@@ -912,31 +1026,37 @@ convert_xpm_scanline( ASXpmFile *xpm_file, unsigned int line )
 					a[k]  = ARGB32_ALPHA8(c);
 			}
 		}
-	}else if( xpm_file->cmap_name_xref )
+	}
+#ifndef HAVE_LIBXPM
+	else if( xpm_file->bpp > 2 )
 	{
-		char *pixel ;
-		pixel = safemalloc( xpm_file->bpp+1);
-		pixel[xpm_file->bpp] = '\0' ;
-		data += (k-1)*xpm_file->bpp ;
+		int bpp = xpm_file->bpp ;
+		const unsigned char *last = NULL ;
+		CARD32 c = 0;
+		/* line may be cut short in broken images - missing pixels are transparent */
+		int len = strlen( (char*)data );
+		data += (k-1)*bpp ;
 		while( --k >= 0 )
 		{
-			register int i = xpm_file->bpp;
-            ASHashData hdata = {0} ;
-            CARD32 c = 0;
-			while( --i >= 0 )
-				pixel[i] = data[i] ;
-			data -= xpm_file->bpp ;
-            get_hash_item( xpm_file->cmap_name_xref, AS_HASHABLE(pixel), &hdata.vptr );
-            /* on 64 bit system we must do that since pointers are 64 bit */
-            c = hdata.c32;
+			if( (k+1)*bpp > len )
+			{
+				c = 0 ;
+				last = NULL ;
+			}else if( last == NULL || memcmp( data, last, bpp ) != 0 )
+			{	/* runs of the same pixel are common - only look up when code changes */
+				int idx = xpm_file->code_slots ? xpm_file->code_slots[find_xpm_code( xpm_file, data )] : -1 ;
+				c = (idx >= 0)? xpm_file->code_colors[idx] : 0 ;
+				last = data ;
+			}
+			data -= bpp ;
 			r[k] = ARGB32_RED8(c);
 			g[k] = ARGB32_GREEN8(c);
 			b[k] = ARGB32_BLUE8(c);
 			if( a )
 				a[k]  = ARGB32_ALPHA8(c);
 		}
-		free( pixel );
 	}
+#endif
 	return True;
 }
 
@@ -36,6 +36,7 @@ typedef struct ASXpmFile
 	char 	 *buffer;
 	size_t   bytes_in;
 	size_t   curr_byte;
+	size_t   mapped_size;                      /* buffer is mmap()-ed file */
 #endif
 
 	int 	 curr_img;
@@ -51,7 +52,11 @@ typedef struct ASXpmFile
 	ASScanline scl ;
 
 	ARGB32		*cmap, **cmap2;
-	ASHashTable *cmap_name_xref;
+	/* 3 and more chars per pixel - open addressing table of pixel codes : */
+	char 		*codes ;
+	ARGB32		*code_colors ;
+	int 		*code_slots ;
+	unsigned int codes_num, code_slots_num ;
 
 	Bool do_alpha, full_alpha ;
 }ASXpmFile;
@@ -1217,6 +1217,8 @@ void FreeMyAppResources ()
 	flush_shm_cache ();
 #endif
 	free (ASDefaultScr);
+	flush_gradient_cache ();
+	flush_image_codec_pool ();
 	flush_default_asstorage ();
 	flush_asbidirlist_memory_pool ();
 	flush_ashash_memory_pool ();
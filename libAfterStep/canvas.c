@@ -347,6 +347,12 @@ Bool draw_canvas_image (ASCanvas * pc, ASImage * im, int x, int y)
 																real_x - x, real_y - y, real_x, real_y,
 																width, height, pc->width, pc->height,
 																False);
+	/* shared images get drawn many times over - keep them on the server : */
+	if (!done && im->imageman != NULL)
+		done =
+				asimage2drawable_cached (ASDefaultVisual, p, im, ASDefaultDrawGC,
+																 real_x - x, real_y - y, real_x, real_y,
+																 width, height);
 	if (!done)
 		done =
 				asimage2drawable (ASDefaultVisual, p, im, ASDefaultDrawGC,
@@ -582,6 +582,64 @@ ASTBarData *create_astbar ()
 	return tbar;
 }
 
+typedef struct ASTBarComposition {
+	/* all compositions are kept in most-recently-used order, so that
+	 * their total size can be kept under ASTBAR_COMPOSITIONS_BUDGET : */
+	struct ASTBarComposition *prev, *next;
+	ASTBarData *tbar;
+	size_t size;
+	ASImage *im;									/* packed ARGB32 result of the merge */
+	int state;
+	unsigned short width, height;
+	ASImageBevel bevel;
+	ASImageLayer *layers;
+	unsigned long *revisions;
+	int layers_num;
+} ASTBarComposition;
+
+#define ASTBAR_COMPOSITIONS_BUDGET	(4*1024*1024)
+
+static ASTBarComposition *astbar_compositions = NULL;
+static size_t astbar_compositions_size = 0;
+
+static void unlink_astbar_composition (ASTBarComposition * c)
+{
+	if (c->prev)
+		c->prev->next = c->next;
+	else if (astbar_compositions == c)
+		astbar_compositions = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	c->prev = c->next = NULL;
+}
+
+static void touch_astbar_composition (ASTBarComposition * c)
+{
+	unlink_astbar_composition (c);
+	c->next = astbar_compositions;
+	if (c->next)
+		c->next->prev = c;
+	astbar_compositions = c;
+}
+
+static void destroy_astbar_composition (ASTBarData * tbar)
+{
+	ASTBarComposition *c = tbar->composition;
+
+	if (c) {
+		unlink_astbar_composition (c);
+		astbar_compositions_size -= c->size;
+		if (c->im)
+			destroy_asimage (&(c->im));
+		if (c->layers)
+			free (c->layers);
+		if (c->revisions)
+			free (c->revisions);
+		free (c);
+		tbar->composition = NULL;
+	}
+}
+
 static inline void flush_tbar_backs (ASTBarData * tbar)
 {
 	register int i;
@@ -628,6 +686,7 @@ void destroy_astbar (ASTBarData ** ptbar)
 
 			LOCAL_DEBUG_CALLER_OUT ("<<#########>>flashing tbar %p backs", tbar);
 			flush_tbar_backs (tbar);
+			destroy_astbar_composition (tbar);
 
 			if (tbar == FocusedBar) {
 				LOCAL_DEBUG_CALLER_OUT
@@ -1388,6 +1447,117 @@ trim_astbar_grid_dim (short *dim, int size, int space_left)
 }
 
 
+static Bool
+same_astbar_layer (ASImageLayer * old, unsigned long old_revision,
+									 ASImageLayer * l)
+{
+	/* images may be scrap images destroyed after previous merge, so we only
+	 * ever compare pointers and revisions - new image gets new revision */
+	return (old->im == l->im
+					&& (l->im == NULL || l->im->revision == old_revision)
+					&& old->dst_x == l->dst_x && old->dst_y == l->dst_y
+					&& old->clip_x == l->clip_x && old->clip_y == l->clip_y
+					&& old->clip_width == l->clip_width
+					&& old->clip_height == l->clip_height
+					&& old->tint == l->tint && old->solid_color == l->solid_color
+					&& old->merge_scanlines == l->merge_scanlines
+					&& old->bevel_x == l->bevel_x && old->bevel_y == l->bevel_y
+					&& old->bevel_width == l->bevel_width
+					&& old->bevel_height == l->bevel_height);
+}
+
+static int
+set_astbar_layer_rect (XRectangle * rect, ASImageLayer * l)
+{
+	rect->x = l->dst_x;
+	rect->y = l->dst_y;
+	rect->width = l->clip_width;
+	rect->height = l->clip_height;
+	return (int)l->clip_width * (int)l->clip_height;
+}
+
+/* Merges layers of the bar, reusing result of the previous merge when
+ * only some of the layers changed, such as label text or button state.
+ * Returned image belongs to the bar and must not be destroyed : */
+static ASImage *compose_astbar_layers (ASTBarData * tbar, int state,
+																			 ASImageBevel * bevel,
+																			 ASImageLayer * layers,
+																			 int layers_num)
+{
+	ASTBarComposition *c = tbar->composition;
+	int l;
+
+	if (c && c->im && c->state == state && c->width == tbar->width
+			&& c->height == tbar->height && c->layers_num == layers_num
+			&& memcmp (&(c->bevel), bevel, sizeof (ASImageBevel)) == 0
+			&& same_astbar_layer (&(c->layers[0]), c->revisions[0], &layers[0])) {
+		XRectangle *rects = safecalloc (layers_num * 2, sizeof (XRectangle));
+		int rects_count = 0;
+		int dirty_area = 0;
+
+		for (l = 1; l < layers_num; ++l)
+			if (!same_astbar_layer (&(c->layers[l]), c->revisions[l], &layers[l])) {
+				/* bevelled layers spill outside of their clip rectangle : */
+				if (c->layers[l].bevel != NULL || layers[l].bevel != NULL)
+					break;
+				dirty_area += set_astbar_layer_rect (&rects[rects_count++], &(c->layers[l]));
+				dirty_area += set_astbar_layer_rect (&rects[rects_count++], &layers[l]);
+			}
+		LOCAL_DEBUG_OUT ("tbar %p: %d dirty rects, area %d", tbar, rects_count,
+										 dirty_area);
+		if (l == layers_num
+				&& (rects_count == 0
+						|| (dirty_area * 2 < (int)tbar->width * (int)tbar->height
+								&& merge_layers_rects (ASDefaultVisual, c->im, layers,
+																			 layers_num, rects, rects_count,
+																			 ASIMAGE_QUALITY_DEFAULT)))) {
+			free (rects);
+			for (l = 1; l < layers_num; ++l) {
+				c->layers[l] = layers[l];
+				c->revisions[l] = layers[l].im ? layers[l].im->revision : 0;
+			}
+			touch_astbar_composition (c);
+			return c->im;
+		}
+		free (rects);
+	}
+
+	destroy_astbar_composition (tbar);
+	c = safecalloc (1, sizeof (ASTBarComposition));
+	c->im = merge_layers (ASDefaultVisual, layers, layers_num, tbar->width,
+												tbar->height, ASA_ARGB32, 0, ASIMAGE_QUALITY_DEFAULT);
+	if (c->im == NULL) {
+		free (c);
+		return NULL;
+	}
+	c->state = state;
+	c->width = tbar->width;
+	c->height = tbar->height;
+	c->bevel = *bevel;
+	c->layers_num = layers_num;
+	c->layers = safemalloc (layers_num * sizeof (ASImageLayer));
+	c->revisions = safemalloc (layers_num * sizeof (unsigned long));
+	for (l = 0; l < layers_num; ++l) {
+		c->layers[l] = layers[l];
+		c->revisions[l] = layers[l].im ? layers[l].im->revision : 0;
+	}
+	c->tbar = tbar;
+	c->size = (size_t)c->width * c->height * sizeof (ARGB32);
+	tbar->composition = c;
+	touch_astbar_composition (c);
+	astbar_compositions_size += c->size;
+	/* bars that were not drawn for the longest time give up theirs first : */
+	while (astbar_compositions_size > ASTBAR_COMPOSITIONS_BUDGET
+				 && astbar_compositions->next != NULL) {
+		ASTBarComposition *lru = astbar_compositions;
+
+		while (lru->next)
+			lru = lru->next;
+		destroy_astbar_composition (lru->tbar);
+	}
+	return c->im;
+}
+
 static inline Bool
 render_astbar_int (ASTBarData * tbar, ASCanvas * pc, ASImage ** pcache,
 									 ASCanvas * origin_canvas)
@@ -1414,6 +1584,7 @@ render_astbar_int (ASTBarData * tbar, ASCanvas * pc, ASImage ** pcache,
 	int good_layers = 0;
 	Bool res = False;
 	Bool render_mask = False;
+	Bool keep_merged = False;
 	merge_scanlines_func merge_func = alphablend_scanlines;
 	int h_bevel_size = 0, v_bevel_size = 0;
 
@@ -1768,6 +1939,11 @@ render_astbar_int (ASTBarData * tbar, ASCanvas * pc, ASImage ** pcache,
 																			ASIMAGE_QUALITY_DEFAULT);
 			destroy_asimage (&tmp_im);
 		}
+		destroy_astbar_composition (tbar);
+	} else if (fmt == ASA_ScratchXImageAndAlpha) {
+		merged_im =
+				compose_astbar_layers (tbar, state, &bevel, &layers[0], good_layers);
+		keep_merged = (merged_im != NULL);
 	} else
 		merged_im =
 				merge_layers (ASDefaultVisual, &layers[0], good_layers,
@@ -1786,7 +1962,8 @@ render_astbar_int (ASTBarData * tbar, ASCanvas * pc, ASImage ** pcache,
 		if (render_mask)
 			draw_canvas_mask (pc, merged_im, tbar->win_x, tbar->win_y);
 #endif
-		destroy_asimage (&merged_im);
+		if (!keep_merged)
+			destroy_asimage (&merged_im);
 		if (res)
 			clear_flags (tbar->state, BAR_FLAGS_REND_PENDING);
 	}
@@ -189,6 +189,9 @@ typedef struct ASTBarData {
 	/* 62 bytes */
 	short hue[2], sat[2] ;
 	/* 70 bytes */
+	/* last composed image and layers it was made of, so that we only
+	 * recompose what has changed : */
+	struct ASTBarComposition *composition ;
 }ASTBarData ;
 
 ASTBtnData *create_astbtn();
@@ -1,6 +1,7 @@
 #include "../configure.h"
 #include "asapp.h"
 #include "screen.h"
+#include "session.h"
 #include "../libAfterImage/afterimage.h"
 
 const char *default_font = "fixed";
@@ -37,6 +38,15 @@ Bool load_font (const char *name_in, MyFont * font)
 		if (path == NULL)
 			path = getenv ("PATH");
 		ASDefaultScr->font_manager = create_font_manager (dpy, path, NULL);
+		/* unless user wants it elsewhere - all our modules share glyphs
+		   rendered by any of them through the cache in user's home dir */
+		if (getenv (ASFONT_GLYPH_CACHE_ENVVAR) == NULL && Session != NULL) {
+			char *cache_file =
+					make_session_data_file (Session, False, 0, GLYPH_CACHE_FILE, NULL);
+
+			set_font_manager_glyph_cache (ASDefaultScr->font_manager, cache_file, 0);
+			free (cache_file);
+		}
 	}
 
 	name = name_in ? (char *)name_in : font->name;
@@ -131,13 +131,23 @@ load_icon (icon_t * icon, const char *filename, ASImageManager * imman)
 	return False;
 }
 
+/* icons up to that many pixels are kept packed - they get redrawn far more
+ * often than they are created, and are too small for compression to matter */
+#define PACKED_ICON_MAX_PIXELS	(64*64)
+
 Bool scale_icon (icon_t * icon, int width, int height, ASVisual * asv)
 {
 	if (icon && icon->image && width > 0 && height > 0
 			&& (icon->image->width != width || icon->image->height != height)) {
-		ASImage *tmp =
-				scale_asimage (asv, icon->image, width, height, ASA_ASImage, 100,
-											 ASIMAGE_QUALITY_DEFAULT);
+		ASAltImFormats fmt =
+				(width * height <= PACKED_ICON_MAX_PIXELS) ? ASA_ARGB32 : ASA_ASImage;
+		ASImage *tmp;
+
+		/* shared icons get scaled to many sizes - let them keep mip levels */
+		if (icon->image->imageman != NULL)
+			set_flags (icon->image->flags, ASIM_MIPMAPPED);
+		tmp = scale_asimage (asv, icon->image, width, height, fmt, 100,
+												 ASIMAGE_QUALITY_DEFAULT);
 
 		if (tmp) {
 			safe_asimage_destroy (icon->image);
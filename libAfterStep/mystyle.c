@@ -562,10 +562,13 @@ static ASImage *mystyle_make_image_int (MyStyle * style, int root_x,
 													 style->slice_y_start, style->slice_y_end,
 													 preflip_width, preflip_height, True,
 													 ASA_ASImage, 0, ASIMAGE_QUALITY_DEFAULT);
-		} else
+		} else {
+			if (style->back_icon.image->imageman != NULL)
+				set_flags (style->back_icon.image->flags, ASIM_MIPMAPPED);
 			im = scale_asimage (ASDefaultVisual, style->back_icon.image,
 													preflip_width, preflip_height, ASA_ASImage, 0,
 													ASIMAGE_QUALITY_DEFAULT);
+		}
 		if (flip != 0)
 			im = mystyle_flip_image (im, width, height, flip);
 		break;
@@ -685,6 +688,8 @@ static ASImage *mystyle_make_image_int (MyStyle * style, int root_x,
 																			ASIMAGE_QUALITY_DEFAULT);
 					LOCAL_DEBUG_OUT ("image scliced to %p", scaled_im);
 				} else if (do_scale) {
+					if (layers[1].im->imageman != NULL)
+						set_flags (layers[1].im->flags, ASIM_MIPMAPPED);
 					scaled_im = scale_asimage (ASDefaultVisual, layers[1].im,
 																		 preflip_width, preflip_height,
 																		 ASA_ASImage, 0,
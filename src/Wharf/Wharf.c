@@ -1074,7 +1074,10 @@ ASTBarData *build_wharf_button_tbar (ASWharfButton * aswb,
 							 icon[i], im->width, im->height, aswb->desired_width,
 							 aswb->desired_height, scale_to_width, scale_to_height);
 					if ( scale_to_width < im->width || scale_to_height < im->height) {
-						ASImage *tmp =
+						ASImage *tmp;
+						if (im->imageman != NULL)
+							set_flags (im->flags, ASIM_MIPMAPPED);
+						tmp =
 								scale_asimage (Scr.asv, im, min(scale_to_width,im->width),
 															 min(scale_to_height,im->height), ASA_ASImage, 100,
 															 ASIMAGE_QUALITY_DEFAULT);
@@ -1306,7 +1306,10 @@ void configure_tbar_icon( ASTBarData *tbar, ASWindowData *wd )
         }
         if( width != icon_im->width || height != icon_im->height ) 
         {
-            ASImage *scaled_im = scale_asimage( Scr.asv, icon_im, width, height, ASA_ASImage, 100, ASIMAGE_QUALITY_DEFAULT );
+            ASImage *scaled_im ;
+            if( icon_im->imageman != NULL )
+                set_flags( icon_im->flags, ASIM_MIPMAPPED );
+            scaled_im = scale_asimage( Scr.asv, icon_im, width, height, ASA_ASImage, 100, ASIMAGE_QUALITY_DEFAULT );
             if( scaled_im != NULL ) 
             {
                 safe_asimage_destroy( icon_im );
@@ -966,6 +966,8 @@ void Done (Bool restart, char *command)
 		free_as_app_args ();
 		free (ASDefaultScr);
 
+		flush_gradient_cache ();
+		flush_image_codec_pool ();
 		flush_default_asstorage ();
 		flush_asbidirlist_memory_pool ();
 		flush_ashash_memory_pool ();